@@ -4,6 +4,18 @@
 #ifndef _LPC17XX_HARDWARE_H_
 #define _LPC17XX_HARDWARE_H_
 
+//
+// The type of a 32-bit peripheral register. The host build replaces the
+// registers with objects that forward each access to simulated peripherals
+// (see host/mock/lpc17xx.h), so code that takes the address of a register
+// must use this type rather than volatile uint32_t.
+//
+#if LLDT_HOST
+typedef HostRegister PeripheralRegister;
+#else // LLDT_HOST
+typedef volatile uint32_t PeripheralRegister;
+#endif // LLDT_HOST
+
 //
 // Clock and Power
 //
@@ -221,15 +233,122 @@ enum TIM_CTCR : uint32_t {
     TIM_CTCR_INPUT_MASK     = 0xC,
     TIM_CTCR_MASKBIT        = 0xF,
     TIM_CTCR_COUNTER_MODE   = 1,
+    TIM_CTCR_COUNTER_MODE_BOTH_EDGES = 3,
+};
+
+//
+// The DWT cycle counter counts CCLK cycles, and wraps after 2^32 cycles
+// (about 44 seconds at 96MHz)
+//
+void CycleCounterInit ();
+
+inline uint32_t CycleCount ()
+{
+    return DWT->CYCCNT;
+}
+
+//
+// The timebase is a monotonic 64-bit count of CCLK cycles since the cycle
+// counter was initialized, shared by the I2C and SPI testers. The cycle
+// counter stops while the core sleeps, so the timebase counts the cycles
+// spent asleep separately, as measured on the default timer, and is
+// otherwise as precise as the cycle counter. The high word is updated from
+// an alarm on TIMEBASE_ALARM_CHANNEL well within each wrap of the low word,
+// which is always ElapsedCycles().
+//
+struct Timebase {
+    volatile uint32_t sequence;     // incremented by each update
+    volatile uint32_t high;
+    volatile uint32_t low;          // ElapsedCycles() at the last update
+    volatile uint32_t asleep;       // cycles spent asleep, modulo 2^32
 };
 
+extern Timebase _timebase;
+
+//
+// CycleCount() plus the cycles the core has spent asleep, modulo 2^32.
+// Unlike a difference of CycleCount() values, a difference of
+// ElapsedCycles() values includes the time the core spent asleep.
+//
+inline uint32_t ElapsedCycles ()
+{
+    return CycleCount() + _timebase.asleep;
+}
+
+const TIM_MATCH_CHANNEL TIMEBASE_ALARM_CHANNEL = TIM_MATCH_CHANNEL_3;
+
+//
+// Starts updating the timebase. Must be called after SetDefaultTimer and
+// CycleCounterInit.
+//
+void TimebaseInit ();
+
+//
+// Returns the timebase. Safe to call from any context. An update cannot be
+// preempted by a reader, so a reader only has to retry if it was preempted
+// by an update.
+//
+inline uint64_t Now ()
+{
+    uint32_t sequence;
+    uint32_t high;
+    uint32_t low;
+    uint32_t now;
+    do {
+        sequence = _timebase.sequence;
+        high = _timebase.high;
+        low = _timebase.low;
+        now = ElapsedCycles();
+    } while (sequence != _timebase.sequence);
+
+    return ((uint64_t(high) << 32) | low) + (now - low);
+}
+
+//
+// Sleeps until an interrupt is pending. Must be called with interrupts
+// disabled, and returns with them disabled so the caller can check for work
+// before the interrupt runs. The cycle counter stops while the core sleeps,
+// so the time asleep is measured on the default timer and added to the
+// timebase. The cycle counter itself is left alone.
+//
+void SleepUntilInterrupt ();
+
+//
+// Converts an ElapsedCycles() value from the last 2^32 cycles to the
+// timebase.
+//
+inline uint64_t ElapsedCyclesToTime (uint32_t Cycles)
+{
+    const uint64_t now = Now();
+    return now - (uint32_t(now) - Cycles);
+}
+
 void SetDefaultTimer (LPC_TIM_TypeDef* Timer);
+IRQn_Type DefaultTimerIrq ();
 uint32_t Micros ();
 void DelayMicros (uint32_t Micros);
 
+//
+// Alarms use the match channels of the default timer to invoke a callback
+// from the default timer's interrupt after the specified number of
+// microseconds. Alarms must only be set and cancelled from code running at
+// the default timer's interrupt priority or with that interrupt masked.
+//
+typedef void (*AlarmCallback) ();
+void SetAlarm (
+    TIM_MATCH_CHANNEL Channel,
+    uint32_t Micros,
+    AlarmCallback Callback
+    );
+void CancelAlarm (TIM_MATCH_CHANNEL Channel);
+
+//
+// Unlike Micros(), which wraps after about 71 minutes, Millis() follows the
+// timebase and wraps after about 49 days.
+//
 inline uint32_t Millis ()
 {
-    return Micros() / 1000;
+    return uint32_t(Now() / (SystemCoreClock / 1000));
 }
 
 inline void DelayMillis (uint32_t Millis)
@@ -238,6 +357,54 @@ inline void DelayMillis (uint32_t Millis)
 }
 
 
+//
+// PWM Related Definitions
+//
+
+//
+// PWM TCR Register Bit Definitions
+//
+enum PWM_TCR : uint32_t {
+    PWM_TCR_COUNTER_ENABLE  = 1<<0,
+    PWM_TCR_COUNTER_RESET   = 1<<1,
+    PWM_TCR_PWM_ENABLE      = 1<<3,
+};
+
+//
+// PWM match channels 0-3 use the same MCR layout as the timers
+//
+constexpr inline uint32_t PWM_PCR_PWMENA (uint32_t Channel)
+{
+    return 1U << (8 + Channel);
+}
+
+constexpr inline uint32_t PWM_LER_EN (uint32_t Channel)
+{
+    return 1U << Channel;
+}
+
+//
+// UART Related Definitions
+//
+
+//
+// UART FCR Register Bit Definitions
+//
+enum UART_FCR : uint32_t {
+    UART_FCR_FIFO_EN        = 1<<0,
+    UART_FCR_RX_RS          = 1<<1,
+    UART_FCR_TX_RS          = 1<<2,
+    UART_FCR_DMAMODE_SEL    = 1<<3,
+};
+
+//
+// UART LCR Register Bit Definitions
+//
+enum UART_LCR : uint32_t {
+    UART_LCR_WLEN8          = 3<<0,
+    UART_LCR_DLAB_EN        = 1<<7,
+};
+
 //
 // I2C Related Definitions
 //
@@ -408,4 +575,189 @@ constexpr inline uint32_t SSP_CR0_SCR (uint32_t Value)
     return (Value & 0xFF) << 8;
 }
 
+//
+// GPDMA Related Definitions
+//
+
+//
+// DMACConfig Register Bit Definitions
+//
+enum GPDMA_CONFIG : uint32_t {
+    GPDMA_CONFIG_ENABLE     = 1<<0,
+    GPDMA_CONFIG_BIG_ENDIAN = 1<<1,
+};
+
+//
+// DMA request lines (DMACCxConfig SrcPeripheral/DestPeripheral). Lines 8-15
+// are shared between the UARTs and the timer match outputs and are selected
+// with DMAREQSEL.
+//
+enum GPDMA_CONN : uint32_t {
+    GPDMA_CONN_SSP0_TX      = 0,
+    GPDMA_CONN_SSP0_RX      = 1,
+    GPDMA_CONN_SSP1_TX      = 2,
+    GPDMA_CONN_SSP1_RX      = 3,
+    GPDMA_CONN_ADC          = 4,
+    GPDMA_CONN_I2S_CHANNEL0 = 5,
+    GPDMA_CONN_I2S_CHANNEL1 = 6,
+    GPDMA_CONN_DAC          = 7,
+    GPDMA_CONN_UART0_TX     = 8,
+    GPDMA_CONN_UART0_RX     = 9,
+    GPDMA_CONN_UART1_TX     = 10,
+    GPDMA_CONN_UART1_RX     = 11,
+    GPDMA_CONN_UART2_TX     = 12,
+    GPDMA_CONN_UART2_RX     = 13,
+    GPDMA_CONN_UART3_TX     = 14,
+    GPDMA_CONN_UART3_RX     = 15,
+    GPDMA_CONN_MAT0_0       = 8,
+    GPDMA_CONN_MAT0_1       = 9,
+    GPDMA_CONN_MAT1_0       = 10,
+    GPDMA_CONN_MAT1_1       = 11,
+    GPDMA_CONN_MAT2_0       = 12,
+    GPDMA_CONN_MAT2_1       = 13,
+    GPDMA_CONN_MAT3_0       = 14,
+    GPDMA_CONN_MAT3_1       = 15,
+};
+
+//
+// Returns the DMAREQSEL bit that selects the timer match output for one of
+// the shared request lines GPDMA_CONN_MAT0_0 - GPDMA_CONN_MAT3_1
+//
+constexpr inline uint32_t DMAREQSEL_TIMER_MATCH (GPDMA_CONN Conn)
+{
+    return 1U << (Conn - GPDMA_CONN_MAT0_0);
+}
+
+//
+// DMACCxControl Register Bit Definitions
+//
+enum GPDMA_CTRL : uint32_t {
+    GPDMA_CTRL_SI           = 1U<<26,
+    GPDMA_CTRL_DI           = 1U<<27,
+    GPDMA_CTRL_I            = 1U<<31,
+};
+
+enum GPDMA_BSIZE : uint32_t {
+    GPDMA_BSIZE_1           = 0,
+    GPDMA_BSIZE_4           = 1,
+    GPDMA_BSIZE_8           = 2,
+    GPDMA_BSIZE_16          = 3,
+    GPDMA_BSIZE_32          = 4,
+    GPDMA_BSIZE_64          = 5,
+    GPDMA_BSIZE_128         = 6,
+    GPDMA_BSIZE_256         = 7,
+};
+
+enum GPDMA_WIDTH : uint32_t {
+    GPDMA_WIDTH_BYTE        = 0,
+    GPDMA_WIDTH_HALFWORD    = 1,
+    GPDMA_WIDTH_WORD        = 2,
+};
+
+//
+// The largest number of transfers a single DMACCxControl can describe.
+// Longer transfers must be split across linked list items.
+//
+enum : uint32_t { GPDMA_MAX_TRANSFER_SIZE = 0xFFF };
+
+constexpr inline uint32_t GPDMA_CTRL_TRANSFER_SIZE (uint32_t Size)
+{
+    return Size & GPDMA_MAX_TRANSFER_SIZE;
+}
+
+constexpr inline uint32_t GPDMA_CTRL_SBSIZE (GPDMA_BSIZE Size)
+{
+    return Size << 12;
+}
+
+constexpr inline uint32_t GPDMA_CTRL_DBSIZE (GPDMA_BSIZE Size)
+{
+    return Size << 15;
+}
+
+constexpr inline uint32_t GPDMA_CTRL_SWIDTH (GPDMA_WIDTH Width)
+{
+    return Width << 18;
+}
+
+constexpr inline uint32_t GPDMA_CTRL_DWIDTH (GPDMA_WIDTH Width)
+{
+    return Width << 21;
+}
+
+//
+// DMACCxConfig Register Bit Definitions
+//
+enum GPDMA_CFG : uint32_t {
+    GPDMA_CFG_E             = 1<<0,
+    GPDMA_CFG_IE            = 1<<14,
+    GPDMA_CFG_ITC           = 1<<15,
+    GPDMA_CFG_L             = 1<<16,
+    GPDMA_CFG_A             = 1<<17,
+    GPDMA_CFG_H             = 1<<18,
+};
+
+enum GPDMA_TRANSFER_TYPE : uint32_t {
+    GPDMA_TRANSFER_TYPE_M2M = 0,
+    GPDMA_TRANSFER_TYPE_M2P = 1,
+    GPDMA_TRANSFER_TYPE_P2M = 2,
+    GPDMA_TRANSFER_TYPE_P2P = 3,
+};
+
+constexpr inline uint32_t GPDMA_CFG_SRC_PERIPHERAL (GPDMA_CONN Conn)
+{
+    return Conn << 1;
+}
+
+constexpr inline uint32_t GPDMA_CFG_DEST_PERIPHERAL (GPDMA_CONN Conn)
+{
+    return Conn << 6;
+}
+
+constexpr inline uint32_t GPDMA_CFG_TRANSFER_TYPE (GPDMA_TRANSFER_TYPE Type)
+{
+    return Type << 11;
+}
+
+//
+// GPDMA linked list item. Must be word aligned and reside in memory that is
+// accessible to the GPDMA (that is, AHB SRAM and not the CPU's local SRAM).
+//
+struct GPDMA_LLI {
+    uint32_t SrcAddr;
+    uint32_t DestAddr;
+    uint32_t NextLli;
+    uint32_t Control;
+};
+
+//
+// Returns the bus address of Ptr for programming into GPDMA registers.
+// Host pointers do not fit in 32 bits, so the host build maps them to the
+// addresses of the simulated GPDMA.
+//
+#if LLDT_HOST
+inline uint32_t DmaAddress (const volatile void* Ptr)
+{
+    return HostDmaAddress(Ptr);
+}
+#else // LLDT_HOST
+inline uint32_t DmaAddress (const volatile void* Ptr)
+{
+    return uint32_t(uintptr_t(Ptr));
+}
+#endif // LLDT_HOST
+
+void GpdmaInit ();
+LPC_GPDMACH_TypeDef* GpdmaChannel (uint32_t Channel);
+void GpdmaStopChannel (uint32_t Channel);
+void GpdmaProgramChannel (
+    uint32_t Channel,
+    GPDMA_LLI* Lli,
+    uint32_t SrcAddr,
+    uint32_t DestAddr,
+    uint32_t Count,
+    uint32_t Control,
+    uint32_t Config
+    );
+
 #endif // _LPC17XX_HARDWARE_H_
\ No newline at end of file
@@ -0,0 +1,403 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Host client library for the SPI tester interface
+//
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "lldtester.h"
+#include "lldtclient.h"
+
+using namespace Lldt::Spi;
+using namespace Lldt::Client;
+
+namespace { // static
+
+//
+// CRC16-CCITT, as used by TransferHeader
+//
+class CrcTable {
+public:
+    CrcTable ()
+    {
+        for (uint32_t i = 0; i != 256; ++i) {
+            uint32_t crc = i << 8;
+            for (uint32_t bit = 0; bit != 8; ++bit) {
+                crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+            }
+            this->table[i] = uint16_t(crc);
+        }
+    }
+
+    uint32_t Update (uint32_t Crc, uint8_t Data) const
+    {
+        return ((Crc << 8) ^ this->table[((Crc >> 8) ^ Data) & 0xff]) & 0xffff;
+    }
+
+private:
+    uint16_t table[256];
+};
+
+const CrcTable crcTable;
+
+} // namespace "static"
+
+TesterClient::TesterClient (SpiPort& Port) :
+    port(Port),
+    controlConfigured(false),
+    statistics(),
+    lastCaptureNanos(0),
+    batchCount(0),
+    batchResponseLength(0)
+{
+    memset(this->batchValid, 0, sizeof(this->batchValid));
+    memset(this->batchOffsets, 0, sizeof(this->batchOffsets));
+    memset(this->idleBuffer, 0, sizeof(this->idleBuffer));
+
+    // every byte of the write portion is the command code. The tester
+    // ignores the bytes clocked out while it sends the response.
+    memset(
+        this->acknowledgeWrite,
+        SpiTesterCommand::AcknowledgeInterrupt,
+        sizeof(this->acknowledgeWrite));
+}
+
+bool TesterClient::ValidResponse (const void* Response, uint32_t Length)
+{
+    if (Length < sizeof(TransferHeader)) return false;
+
+    const TransferHeader* const header =
+        static_cast<const TransferHeader*>(Response);
+    if (header->Header.Length != Length) return false;
+
+    // the checksum is computed with the checksum field zeroed
+    const uint8_t* const bytes = static_cast<const uint8_t*>(Response);
+    uint32_t crc = crcTable.Update(crcTable.Update(0, 0), 0);
+    for (uint32_t i = sizeof(header->Header.Checksum); i != Length; ++i) {
+        crc = crcTable.Update(crc, bytes[i]);
+    }
+    return crc == header->Header.Checksum;
+}
+
+uint32_t TesterClient::ResponseLength (const CommandBlock& Command)
+{
+    switch (Command.Command) {
+    case SpiTesterCommand::GetDeviceInfo:
+        return (Command.u.GetDeviceInfo.InfoVersion >= DEVICE_INFO_VERSION) ?
+            sizeof(TesterInfo2) : sizeof(TesterInfo);
+    case SpiTesterCommand::GetTransferInfo:
+        return (Command.u.GetTransferInfo.InfoVersion >= TRANSFER_INFO_VERSION) ?
+            sizeof(TransferInfo2) : sizeof(TransferInfo);
+    case SpiTesterCommand::GetPeriodicInterruptInfo:
+        return sizeof(PeriodicInterruptInfo);
+    case SpiTesterCommand::GetCapturedData:
+        return sizeof(CapturedData);
+    case SpiTesterCommand::GetInterruptLatencyHistogram:
+        return sizeof(InterruptLatencyHistogram);
+    case SpiTesterCommand::GetInterruptSweepInfo:
+        return sizeof(InterruptSweepInfo);
+    case SpiTesterCommand::GetEdgeTraceInfo:
+        return sizeof(EdgeTraceInfo);
+    case SpiTesterCommand::GetProfilingInfo:
+        return sizeof(ProfilingInfo);
+    case SpiTesterCommand::GetStreamingInfo:
+        return sizeof(StreamingInfo);
+    default:
+        return 0;
+    }
+}
+
+void TesterClient::ResetStatistics ()
+{
+    this->statistics = ClientStatistics();
+}
+
+bool TesterClient::UseControlInterface ()
+{
+    if (this->controlConfigured) return true;
+
+    this->controlConfigured = this->port.Configure(
+        SPI_CONTROL_INTERFACE_MODE,
+        SPI_CONTROL_INTERFACE_FREQUENCY,
+        SPI_CONTROL_INTERFACE_DATABITLENGTH);
+    return this->controlConfigured;
+}
+
+bool TesterClient::Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length)
+{
+    ++this->statistics.Transfers;
+    if (!this->port.Transfer(Write, Read, Length)) {
+        ++this->statistics.TransferErrors;
+        return false;
+    }
+    return true;
+}
+
+bool TesterClient::Send (
+    const CommandBlock& Command,
+    const void* Extra,
+    uint32_t ExtraLength
+    )
+{
+    if ((sizeof(Command) + ExtraLength) > sizeof(this->commandBuffer)) {
+        return false;
+    }
+    if (!UseControlInterface()) return false;
+
+    memcpy(this->commandBuffer, &Command, sizeof(Command));
+    if (ExtraLength != 0) {
+        memcpy(this->commandBuffer + sizeof(Command), Extra, ExtraLength);
+    }
+
+    return Transfer(this->commandBuffer, nullptr, sizeof(Command) + ExtraLength);
+}
+
+bool TesterClient::ReadResponse (uint32_t Length)
+{
+    return (Length <= sizeof(this->responseBuffer)) &&
+        UseControlInterface() &&
+        Transfer(this->idleBuffer, this->responseBuffer, Length);
+}
+
+const void* TesterClient::QueryResponse (
+    const CommandBlock& Command,
+    uint32_t Length
+    )
+{
+    if (!Send(Command) || !ReadResponse(Length)) return nullptr;
+
+    if (!ValidResponse(this->responseBuffer, Length)) {
+        ++this->statistics.InvalidResponses;
+        return nullptr;
+    }
+    return this->responseBuffer;
+}
+
+const TesterInfo* TesterClient::GetDeviceInfo (
+    CaptureMode Engine,
+    uint32_t DataBitLength
+    )
+{
+    CommandBlock command(SpiTesterCommand::GetDeviceInfo);
+    command.u.GetDeviceInfo.CaptureMode = uint8_t(Engine);
+    command.u.GetDeviceInfo.DataBitLength = uint8_t(DataBitLength);
+    return Query<TesterInfo>(command);
+}
+
+const TesterInfo2* TesterClient::GetDeviceInfo2 (
+    CaptureMode Engine,
+    uint32_t DataBitLength
+    )
+{
+    CommandBlock command(SpiTesterCommand::GetDeviceInfo);
+    command.u.GetDeviceInfo.CaptureMode = uint8_t(Engine);
+    command.u.GetDeviceInfo.DataBitLength = uint8_t(DataBitLength);
+    command.u.GetDeviceInfo.InfoVersion = DEVICE_INFO_VERSION;
+    return Query<TesterInfo2>(command);
+}
+
+const TransferInfo2* TesterClient::GetTransferInfo ()
+{
+    CommandBlock command(SpiTesterCommand::GetTransferInfo);
+    command.u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+    return Query<TransferInfo2>(command);
+}
+
+void TesterClient::BeginBatch ()
+{
+    this->batchCount = 0;
+    this->batchResponseLength = 0;
+    memset(this->batchValid, 0, sizeof(this->batchValid));
+}
+
+bool TesterClient::AddToBatch (const CommandBlock& Command)
+{
+    if (this->batchCount == BATCH_MAX_COMMANDS) return false;
+
+    // a command that is not a query ends the batch
+    if ((this->batchCount != 0) &&
+        (ResponseLength(this->batch[this->batchCount - 1]) == 0)) {
+
+        return false;
+    }
+
+    // the tester does not receive payloads within a batch
+    if ((Command.Command == SpiTesterCommand::LoadPattern) &&
+        (Command.u.LoadPattern.Pattern == CapturePattern::User)) {
+
+        return false;
+    }
+
+    // the tester drops responses that do not fit its buffer
+    const uint32_t length = ResponseLength(Command);
+    if ((this->batchResponseLength + length) > BATCH_RESPONSE_BUFFER_SIZE) {
+        return false;
+    }
+
+    this->batchOffsets[this->batchCount] = this->batchResponseLength;
+    this->batch[this->batchCount] = Command;
+    ++this->batchCount;
+    this->batchResponseLength += length;
+    return true;
+}
+
+bool TesterClient::ExecuteBatch ()
+{
+    CommandBlock command(SpiTesterCommand::ExecuteBatch);
+    command.u.ExecuteBatch.CommandCount = uint8_t(this->batchCount);
+    if (!Send(command, this->batch, this->batchCount * sizeof(CommandBlock))) {
+        return false;
+    }
+
+    // a batch that only runs a command has no responses
+    if (this->batchResponseLength == 0) return true;
+    if (!ReadResponse(this->batchResponseLength)) return false;
+
+    bool valid = true;
+    for (uint32_t i = 0; i != this->batchCount; ++i) {
+        const uint32_t length = ResponseLength(this->batch[i]);
+        if (length == 0) break;
+
+        this->batchValid[i] = ValidResponse(
+            this->responseBuffer + this->batchOffsets[i],
+            length);
+        if (!this->batchValid[i]) {
+            ++this->statistics.InvalidResponses;
+            valid = false;
+        }
+    }
+    return valid;
+}
+
+const void* TesterClient::BatchResponse (uint32_t Index, uint32_t Length) const
+{
+    if ((Index >= this->batchCount) || !this->batchValid[Index] ||
+        (ResponseLength(this->batch[Index]) != Length)) {
+
+        return nullptr;
+    }
+    return this->responseBuffer + this->batchOffsets[Index];
+}
+
+bool TesterClient::LoadPattern (
+    CapturePattern Pattern,
+    uint32_t DataBitLength,
+    const uint16_t* Elements,
+    uint32_t Count
+    )
+{
+    if (Count > PATTERN_TABLE_LENGTH) return false;
+
+    CommandBlock command(SpiTesterCommand::LoadPattern);
+    command.u.LoadPattern.Pattern = uint8_t(Pattern);
+    command.u.LoadPattern.DataBitLength = uint8_t(DataBitLength);
+    if (Pattern != CapturePattern::User) {
+        return Send(command);
+    }
+
+    command.u.LoadPattern.ElementOffset = 0;
+    command.u.LoadPattern.ElementCount = uint16_t(Count);
+    return Send(command, Elements, Count * sizeof(uint16_t));
+}
+
+const TransferInfo2* TesterClient::Capture (
+    const CaptureParameters& Parameters,
+    const uint8_t* Mosi,
+    uint8_t* Miso,
+    uint32_t Length
+    )
+{
+    CommandBlock command(SpiTesterCommand::CaptureNextTransfer);
+    command.u.CaptureNextTransfer.Mode = uint8_t(Parameters.Mode);
+    command.u.CaptureNextTransfer.DataBitLength =
+        uint8_t(Parameters.DataBitLength);
+    command.u.CaptureNextTransfer.SendValue = Parameters.SendValue;
+    command.u.CaptureNextTransfer.ReceiveValue = Parameters.ReceiveValue;
+    command.u.CaptureNextTransfer.CaptureMode = uint8_t(Parameters.Engine);
+    if (!Send(command)) return nullptr;
+
+    this->controlConfigured = false;
+    if (!this->port.Configure(
+            Parameters.Mode,
+            Parameters.Frequency,
+            Parameters.DataBitLength)) {
+
+        return nullptr;
+    }
+
+    if (!Transfer(Mosi, Miso, Length)) return nullptr;
+    this->lastCaptureNanos = this->port.LastTransferNanos();
+
+    return GetTransferInfo();
+}
+
+const AcknowledgeInterruptInfo* TesterClient::AcknowledgeInterrupt ()
+{
+    if (!UseControlInterface() ||
+        !Transfer(
+            this->acknowledgeWrite,
+            this->acknowledgeRead,
+            sizeof(this->acknowledgeWrite))) {
+
+        return nullptr;
+    }
+
+    // the response follows the command in the same transfer
+    const AcknowledgeInterruptInfo* const info =
+        reinterpret_cast<const AcknowledgeInterruptInfo*>(
+            this->acknowledgeRead + sizeof(CommandBlock));
+    if (!info->ChecksumValid()) {
+        ++this->statistics.InvalidAcknowledges;
+        return nullptr;
+    }
+    return info;
+}
+
+const PeriodicInterruptInfo* TesterClient::RunPeriodicInterrupts (
+    uint32_t Frequency,
+    uint16_t DurationInSeconds,
+    std::vector<uint32_t>& Latencies
+    )
+{
+    if (!this->port.HasInterruptLine()) return nullptr;
+
+    CommandBlock command(SpiTesterCommand::StartPeriodicInterrupts);
+    command.u.StartPeriodicInterrupts.InterruptFrequency = Frequency;
+    command.u.StartPeriodicInterrupts.DurationInSeconds = DurationInSeconds;
+
+    uint32_t interruptCount;
+    if (!command.u.StartPeriodicInterrupts.ComputeInterruptCount(interruptCount) ||
+        !Send(command)) {
+
+        return nullptr;
+    }
+
+    Latencies.reserve(Latencies.size() + interruptCount);
+
+    // The session is over once no interrupt arrives for a few periods after
+    // the last one is due. The tester leaves interrupt mode at the next
+    // command that is not an acknowledge.
+    const uint64_t end = this->port.NowNanos() +
+        (uint64_t(DurationInSeconds) * 1000000000);
+    const uint32_t timeoutMicros = std::max<uint32_t>(
+        10000,
+        uint32_t((uint64_t(4) * 1000000) / std::max<uint32_t>(Frequency, 1)));
+
+    for (;;) {
+        if (!this->port.WaitForInterrupt(timeoutMicros)) {
+            if (this->port.NowNanos() >= end) break;
+            continue;
+        }
+
+        const AcknowledgeInterruptInfo* const info = AcknowledgeInterrupt();
+        if ((info != nullptr) && !info->AlreadyAcknowledged()) {
+            Latencies.push_back(info->TimeSinceFallingEdge);
+        }
+    }
+
+    return Query<PeriodicInterruptInfo>(
+        CommandBlock(SpiTesterCommand::GetPeriodicInterruptInfo));
+}
@@ -0,0 +1,264 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Host client library for the SPI tester interface of lldtester.h.
+//
+// TesterClient owns every buffer it needs, so commands do not allocate.
+// Queries return a pointer to the response in the client's receive buffer
+// once its length and checksum have been verified, rather than a copy. The
+// pointer stays valid until the next call on the client.
+//
+// Include lldtester.h first.
+//
+#ifndef _LLDT_CLIENT_H_
+#define _LLDT_CLIENT_H_
+
+#include <stdint.h>
+#include <vector>
+
+namespace Lldt {
+namespace Client {
+
+//
+// A connection to the tester's SPI interface, and optionally to its
+// interrupt pin. See spidevport.h and simport.h.
+//
+class SpiPort {
+public:
+    virtual ~SpiPort () { }
+
+    //
+    // Sets the mode, clock frequency and frame width of subsequent
+    // transfers
+    //
+    virtual bool Configure (
+        Spi::SpiDataMode Mode,
+        uint32_t Frequency,
+        uint32_t DataBitLength
+        ) = 0;
+
+    //
+    // Runs one full duplex transfer of Length bytes, with chip select
+    // asserted throughout. Frames wider than 8 bits occupy two bytes, least
+    // significant byte first. Read may be nullptr.
+    //
+    virtual bool Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length) = 0;
+
+    //
+    // The duration of the last transfer, from chip select asserting to chip
+    // select deasserting or as near to that as the port can measure
+    //
+    virtual uint64_t LastTransferNanos () const = 0;
+
+    //
+    // A monotonic clock in nanoseconds. The simulator's clock is the
+    // simulated time.
+    //
+    virtual uint64_t NowNanos () = 0;
+
+    //
+    // Waits up to TimeoutMicros for a falling edge on the interrupt pin.
+    // Returns false on timeout, or if the port has no interrupt line.
+    //
+    virtual bool WaitForInterrupt (uint32_t /*TimeoutMicros*/) { return false; }
+    virtual bool HasInterruptLine () const { return false; }
+};
+
+struct CaptureParameters {
+    CaptureParameters () :
+        Mode(Spi::Mode3),
+        Frequency(Spi::SPI_CONTROL_INTERFACE_FREQUENCY),
+        DataBitLength(8),
+        SendValue(0),
+        ReceiveValue(0),
+        Engine(Spi::CaptureMode::Polled)
+    { }
+
+    Spi::SpiDataMode Mode;
+    uint32_t Frequency;
+    uint32_t DataBitLength;
+    uint16_t SendValue;         // first element the master sends
+    uint16_t ReceiveValue;      // first element the tester sends
+    Spi::CaptureMode Engine;
+};
+
+struct ClientStatistics {
+    uint64_t Transfers;
+
+    // transfers that the port failed
+    uint64_t TransferErrors;
+
+    // responses with the wrong length or checksum
+    uint64_t InvalidResponses;
+
+    // acknowledges whose checksum was wrong
+    uint64_t InvalidAcknowledges;
+};
+
+class TesterClient {
+public:
+    explicit TesterClient (SpiPort& Port);
+
+    //
+    // Returns true if Response starts with a TransferHeader whose Length is
+    // Length and whose Checksum is correct
+    //
+    static bool ValidResponse (const void* Response, uint32_t Length);
+
+    //
+    // The length of the response to Command, or 0 if Command is not a query
+    //
+    static uint32_t ResponseLength (const Spi::CommandBlock& Command);
+
+    //
+    // Sends Command, followed in the same transfer by ExtraLength bytes of
+    // Extra
+    //
+    bool Send (
+        const Spi::CommandBlock& Command,
+        const void* Extra = nullptr,
+        uint32_t ExtraLength = 0
+        );
+
+    //
+    // Sends a query and returns its response, or nullptr if the transfers
+    // failed or the response is invalid. Ty must be the response type of
+    // Command.
+    //
+    template <typename Ty>
+    const Ty* Query (const Spi::CommandBlock& Command)
+    {
+        return static_cast<const Ty*>(QueryResponse(Command, sizeof(Ty)));
+    }
+
+    const Spi::TesterInfo* GetDeviceInfo (
+        Spi::CaptureMode Engine = Spi::CaptureMode::Polled,
+        uint32_t DataBitLength = 0
+        );
+
+    //
+    // Queries the tester's TesterInfo2. A tester that predates TesterInfo2
+    // returns a TesterInfo instead, which fails validation, so callers that
+    // get nullptr can fall back to GetDeviceInfo.
+    //
+    const Spi::TesterInfo2* GetDeviceInfo2 (
+        Spi::CaptureMode Engine = Spi::CaptureMode::Polled,
+        uint32_t DataBitLength = 0
+        );
+
+    const Spi::TransferInfo2* GetTransferInfo ();
+
+    //
+    // Batches of queries. The responses of a batch are read in a single
+    // transfer. A command that is not a query may be added last; it runs
+    // after the responses have been read.
+    //
+    void BeginBatch ();
+
+    // Returns false if the batch is full, or if Command uploads a pattern,
+    // which the tester rejects within a batch
+    bool AddToBatch (const Spi::CommandBlock& Command);
+
+    bool ExecuteBatch ();
+
+    //
+    // The response of the query at Index in the last batch executed, or
+    // nullptr if it was invalid
+    //
+    template <typename Ty>
+    const Ty* BatchResponse (uint32_t Index) const
+    {
+        return static_cast<const Ty*>(BatchResponse(Index, sizeof(Ty)));
+    }
+
+    //
+    // Selects the pattern of subsequent captures. Elements and Count are
+    // the table of a User pattern, which is loaded from index 0.
+    //
+    bool LoadPattern (
+        Spi::CapturePattern Pattern,
+        uint32_t DataBitLength,
+        const uint16_t* Elements = nullptr,
+        uint32_t Count = 0
+        );
+
+    //
+    // Captures one transfer: sends CaptureNextTransfer, clocks Length bytes
+    // of Mosi through with Parameters, and reads the TransferInfo2. Miso
+    // receives the elements sent by the tester, and may be nullptr.
+    //
+    const Spi::TransferInfo2* Capture (
+        const CaptureParameters& Parameters,
+        const uint8_t* Mosi,
+        uint8_t* Miso,
+        uint32_t Length
+        );
+
+    //
+    // The duration the port measured for the transfer of the last capture
+    //
+    uint64_t LastCaptureNanos () const { return this->lastCaptureNanos; }
+
+    //
+    // Acknowledges the interrupt that is asserted. Returns nullptr if the
+    // transfer failed or the checksum is wrong.
+    //
+    const Spi::AcknowledgeInterruptInfo* AcknowledgeInterrupt ();
+
+    //
+    // Runs a periodic interrupt session, acknowledging each interrupt as
+    // soon as the port reports it. The TimeSinceFallingEdge of each
+    // acknowledge that was not already acknowledged is appended to
+    // Latencies. Returns the session's PeriodicInterruptInfo.
+    //
+    const Spi::PeriodicInterruptInfo* RunPeriodicInterrupts (
+        uint32_t Frequency,
+        uint16_t DurationInSeconds,
+        std::vector<uint32_t>& Latencies
+        );
+
+    const ClientStatistics& Statistics () const { return this->statistics; }
+    void ResetStatistics ();
+
+private:
+    enum : uint32_t {
+        // a LoadPattern command and a full table is the longest write
+        COMMAND_BUFFER_SIZE = sizeof(Spi::CommandBlock) +
+            (Spi::PATTERN_TABLE_LENGTH * sizeof(uint16_t)),
+    };
+
+    bool UseControlInterface ();
+    bool Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length);
+    bool ReadResponse (uint32_t Length);
+    const void* QueryResponse (const Spi::CommandBlock& Command, uint32_t Length);
+    const void* BatchResponse (uint32_t Index, uint32_t Length) const;
+
+    SpiPort& port;
+    bool controlConfigured;
+    ClientStatistics statistics;
+    uint64_t lastCaptureNanos;
+
+    Spi::CommandBlock batch[Spi::BATCH_MAX_COMMANDS];
+    uint32_t batchCount;
+    uint32_t batchResponseLength;
+    bool batchValid[Spi::BATCH_MAX_COMMANDS];
+    uint32_t batchOffsets[Spi::BATCH_MAX_COMMANDS];
+
+    uint8_t commandBuffer[COMMAND_BUFFER_SIZE];
+
+    // clocked out while a response is read
+    uint8_t idleBuffer[Spi::BATCH_RESPONSE_BUFFER_SIZE];
+
+    // the write-read transfer of AcknowledgeInterrupt
+    uint8_t acknowledgeWrite[sizeof(Spi::CommandBlock) +
+        sizeof(Spi::AcknowledgeInterruptInfo)];
+    uint8_t acknowledgeRead[sizeof(acknowledgeWrite)];
+
+    // responses are parsed in place, so the buffer is aligned for them
+    alignas(8) uint8_t responseBuffer[Spi::BATCH_RESPONSE_BUFFER_SIZE];
+};
+
+} // namespace Client
+} // namespace Lldt
+
+#endif // _LLDT_CLIENT_H_
@@ -0,0 +1,91 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// SpiPort over the simulated SPI master
+//
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "simulator.h"
+#include "lldtester.h"
+#include "testerbus.h"
+#include "lldtclient.h"
+#include "simport.h"
+
+using namespace Lldt::Client;
+
+namespace { // static
+
+uint64_t CyclesToNanos (Sim::Cycles Duration)
+{
+    return (Duration * 1000) / (Sim::CCLK_FREQUENCY / 1000000);
+}
+
+} // namespace "static"
+
+SimPort::SimPort () :
+    mode(Spi::SPI_CONTROL_INTERFACE_MODE),
+    frequency(Spi::SPI_CONTROL_INTERFACE_FREQUENCY),
+    dataBitLength(Spi::SPI_CONTROL_INTERFACE_DATABITLENGTH),
+    lastTransferNanos(0)
+{
+    Sim::Boot();
+}
+
+bool SimPort::Configure (
+    Spi::SpiDataMode Mode,
+    uint32_t Frequency,
+    uint32_t DataBitLength
+    )
+{
+    if ((Frequency == 0) || (DataBitLength == 0) || (DataBitLength > 16)) {
+        return false;
+    }
+
+    this->mode = uint32_t(Mode);
+    this->frequency = Frequency;
+    this->dataBitLength = DataBitLength;
+    return true;
+}
+
+bool SimPort::Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length)
+{
+    const uint32_t elementSize = (this->dataBitLength > 8) ? 2 : 1;
+    if ((Length % elementSize) != 0) return false;
+
+    std::vector<uint16_t> mosi(Length / elementSize);
+    for (uint32_t i = 0; i != mosi.size(); ++i) {
+        mosi[i] = (elementSize == 2) ?
+            uint16_t(Write[2 * i] | (Write[2 * i + 1] << 8)) :
+            Write[i];
+    }
+
+    Sim::SpiSettings settings;
+    settings.Mode = this->mode;
+    settings.Frequency = this->frequency;
+    settings.DataBitLength = this->dataBitLength;
+
+    auto transfer = Sim::SpiRunTransfer(settings, mosi);
+    if (transfer == nullptr) return false;
+
+    this->lastTransferNanos = CyclesToNanos(
+        transfer->ChipSelectDeassertTime - transfer->ChipSelectAssertTime);
+
+    if (Read != nullptr) {
+        for (uint32_t i = 0; i != transfer->Miso.size(); ++i) {
+            if (elementSize == 2) {
+                Read[2 * i] = uint8_t(transfer->Miso[i]);
+                Read[2 * i + 1] = uint8_t(transfer->Miso[i] >> 8);
+            } else {
+                Read[i] = uint8_t(transfer->Miso[i]);
+            }
+        }
+    }
+    return true;
+}
+
+uint64_t SimPort::NowNanos ()
+{
+    return CyclesToNanos(Sim::Now());
+}
@@ -0,0 +1,43 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// SpiPort over the simulated SPI master of sim/simulator.h. Constructing a
+// SimPort boots the simulated firmware, so there may only be one.
+//
+// The simulator does not model the tester's interrupt pin, so periodic
+// interrupt sessions cannot be run against it.
+//
+// Include lldtester.h and lldtclient.h first.
+//
+#ifndef _LLDT_SIMPORT_H_
+#define _LLDT_SIMPORT_H_
+
+namespace Lldt {
+namespace Client {
+
+class SimPort : public SpiPort {
+public:
+    SimPort ();
+
+    bool Configure (
+        Spi::SpiDataMode Mode,
+        uint32_t Frequency,
+        uint32_t DataBitLength
+        ) override;
+
+    bool Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length) override;
+
+    uint64_t LastTransferNanos () const override { return this->lastTransferNanos; }
+    uint64_t NowNanos () override;
+
+private:
+    uint32_t mode;
+    uint32_t frequency;
+    uint32_t dataBitLength;
+    uint64_t lastTransferNanos;
+};
+
+} // namespace Client
+} // namespace Lldt
+
+#endif // _LLDT_SIMPORT_H_
@@ -0,0 +1,185 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// SpiPort over Linux spidev and the GPIO character device
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+#include <vector>
+
+#include "lldtester.h"
+#include "lldtclient.h"
+#include "spidevport.h"
+
+using namespace Lldt::Client;
+
+namespace { // static
+
+enum : uint32_t { DEFAULT_SPIDEV_BUFSIZ = 4096 };
+
+uint32_t ReadSpidevBufsiz ()
+{
+    FILE* const file = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+    if (file == nullptr) return DEFAULT_SPIDEV_BUFSIZ;
+
+    unsigned long bufsiz;
+    const bool read = fscanf(file, "%lu", &bufsiz) == 1;
+    fclose(file);
+    return (read && (bufsiz != 0)) ? uint32_t(bufsiz) : DEFAULT_SPIDEV_BUFSIZ;
+}
+
+uint64_t Monotonic ()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t(now.tv_sec) * 1000000000) + uint64_t(now.tv_nsec);
+}
+
+} // namespace "static"
+
+SpidevPort::SpidevPort () :
+    spiFd(-1),
+    eventFd(-1),
+    frequency(Spi::SPI_CONTROL_INTERFACE_FREQUENCY),
+    dataBitLength(Spi::SPI_CONTROL_INTERFACE_DATABITLENGTH),
+    maxTransferLength(DEFAULT_SPIDEV_BUFSIZ),
+    lastTransferNanos(0)
+{ }
+
+SpidevPort::~SpidevPort ()
+{
+    if (this->eventFd >= 0) close(this->eventFd);
+    if (this->spiFd >= 0) close(this->spiFd);
+}
+
+bool SpidevPort::Open (const char* Device, const char* GpioChip, uint32_t Line)
+{
+    this->spiFd = open(Device, O_RDWR);
+    if (this->spiFd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", Device, strerror(errno));
+        return false;
+    }
+    this->maxTransferLength = ReadSpidevBufsiz();
+
+    if (GpioChip == nullptr) return true;
+
+    const int chipFd = open(GpioChip, O_RDWR);
+    if (chipFd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", GpioChip, strerror(errno));
+        return false;
+    }
+
+    struct gpioevent_request request;
+    memset(&request, 0, sizeof(request));
+    request.lineoffset = Line;
+    request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    request.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+    strncpy(request.consumer_label, "lldt-interrupt", sizeof(request.consumer_label) - 1);
+
+    const int result = ioctl(chipFd, GPIO_GET_LINEEVENT_IOCTL, &request);
+    const int error = errno;
+    close(chipFd);
+    if (result < 0) {
+        fprintf(
+            stderr,
+            "Failed to request events on %s line %u: %s\n",
+            GpioChip,
+            Line,
+            strerror(error));
+        return false;
+    }
+
+    this->eventFd = request.fd;
+    return true;
+}
+
+bool SpidevPort::Configure (
+    Spi::SpiDataMode Mode,
+    uint32_t Frequency,
+    uint32_t DataBitLength
+    )
+{
+    static const uint8_t modes[] = { SPI_MODE_0, SPI_MODE_1, SPI_MODE_2, SPI_MODE_3 };
+    if (uint32_t(Mode) >= (sizeof(modes) / sizeof(modes[0]))) return false;
+
+    const uint8_t mode = modes[Mode];
+    const uint8_t bits = uint8_t(DataBitLength);
+    if ((ioctl(this->spiFd, SPI_IOC_WR_MODE, &mode) < 0) ||
+        (ioctl(this->spiFd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) ||
+        (ioctl(this->spiFd, SPI_IOC_WR_MAX_SPEED_HZ, &Frequency) < 0)) {
+
+        fprintf(
+            stderr,
+            "Failed to configure mode %u, %u Hz, %u bits: %s\n",
+            uint32_t(Mode),
+            Frequency,
+            DataBitLength,
+            strerror(errno));
+        return false;
+    }
+
+    this->frequency = Frequency;
+    this->dataBitLength = DataBitLength;
+    return true;
+}
+
+bool SpidevPort::Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length)
+{
+    if (Length > this->maxTransferLength) {
+        fprintf(
+            stderr,
+            "Transfer of %u bytes exceeds spidev bufsiz of %u\n",
+            Length,
+            this->maxTransferLength);
+        return false;
+    }
+
+    // spidev carries frames wider than 8 bits in 16-bit words in host byte
+    // order, which is the least significant byte first of SpiPort on the
+    // little endian hosts this runs on
+    struct spi_ioc_transfer transfer;
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.tx_buf = uintptr_t(Write);
+    transfer.rx_buf = uintptr_t(Read);
+    transfer.len = Length;
+    transfer.speed_hz = this->frequency;
+    transfer.bits_per_word = uint8_t(this->dataBitLength);
+
+    const uint64_t start = Monotonic();
+    if (ioctl(this->spiFd, SPI_IOC_MESSAGE(1), &transfer) < 0) {
+        fprintf(stderr, "SPI transfer failed: %s\n", strerror(errno));
+        return false;
+    }
+    this->lastTransferNanos = Monotonic() - start;
+    return true;
+}
+
+uint64_t SpidevPort::NowNanos ()
+{
+    return Monotonic();
+}
+
+bool SpidevPort::WaitForInterrupt (uint32_t TimeoutMicros)
+{
+    if (this->eventFd < 0) return false;
+
+    struct pollfd fd;
+    fd.fd = this->eventFd;
+    fd.events = POLLIN | POLLPRI;
+    fd.revents = 0;
+
+    const int timeoutMillis = int((TimeoutMicros + 999) / 1000);
+    if (poll(&fd, 1, timeoutMillis) <= 0) return false;
+
+    struct gpioevent_data event;
+    return read(this->eventFd, &event, sizeof(event)) == ssize_t(sizeof(event));
+}
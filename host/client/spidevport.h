@@ -0,0 +1,60 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// SpiPort over a Linux spidev device, with the tester's interrupt pin
+// optionally connected to a GPIO line of a gpiochip character device.
+//
+// spidev limits a transfer to its bufsiz module parameter (4096 bytes by
+// default). Longer transfers fail, since a transfer must hold chip select
+// throughout; raise the limit with spidev.bufsiz=N to capture more.
+//
+// Include lldtester.h and lldtclient.h first.
+//
+#ifndef _LLDT_SPIDEVPORT_H_
+#define _LLDT_SPIDEVPORT_H_
+
+namespace Lldt {
+namespace Client {
+
+class SpidevPort : public SpiPort {
+public:
+    SpidevPort ();
+    ~SpidevPort () override;
+
+    //
+    // Opens Device, e.g. /dev/spidev0.0, and if GpioChip is not nullptr,
+    // requests falling edge events on Line of GpioChip, e.g. /dev/gpiochip0.
+    // Prints the reason to stderr on failure.
+    //
+    bool Open (const char* Device, const char* GpioChip = nullptr, uint32_t Line = 0);
+
+    bool Configure (
+        Spi::SpiDataMode Mode,
+        uint32_t Frequency,
+        uint32_t DataBitLength
+        ) override;
+
+    bool Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length) override;
+
+    uint64_t LastTransferNanos () const override { return this->lastTransferNanos; }
+    uint64_t NowNanos () override;
+
+    bool WaitForInterrupt (uint32_t TimeoutMicros) override;
+    bool HasInterruptLine () const override { return this->eventFd >= 0; }
+
+private:
+    SpidevPort (const SpidevPort&) = delete;
+    SpidevPort& operator= (const SpidevPort&) = delete;
+
+    int spiFd;
+    int eventFd;
+    uint32_t frequency;
+    uint32_t dataBitLength;
+    uint32_t maxTransferLength;
+    uint64_t lastTransferNanos;
+};
+
+} // namespace Client
+} // namespace Lldt
+
+#endif // _LLDT_SPIDEVPORT_H_
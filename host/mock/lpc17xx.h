@@ -0,0 +1,444 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Replaces the CMSIS device header in the host build. The peripheral
+// structures have the same layout as on the LPC1768, but each register is a
+// HostRegister, which forwards reads and writes to the simulated peripherals
+// in host/sim. Each access also advances the simulated clock, and runs any
+// interrupt that has become pending, so the firmware's polling loops and
+// interrupt handlers run unmodified.
+//
+// Only the peripherals and intrinsics used by the firmware are provided.
+//
+#ifndef _HOST_LPC17XX_H_
+#define _HOST_LPC17XX_H_
+
+#include <stdint.h>
+
+class HostRegister;
+
+uint32_t HostRegisterRead (const HostRegister* Register);
+void HostRegisterWrite (HostRegister* Register, uint32_t Value);
+
+class HostRegister
+{
+public:
+
+    operator uint32_t ( ) const { return HostRegisterRead(this); }
+
+    HostRegister& operator= (uint32_t Value)
+    {
+        HostRegisterWrite(this, Value);
+        return *this;
+    }
+
+    HostRegister& operator= (const HostRegister& Other)
+    {
+        return *this = uint32_t(Other);
+    }
+
+    HostRegister& operator|= (uint32_t Value)
+    {
+        return *this = uint32_t(*this) | Value;
+    }
+
+    HostRegister& operator&= (uint32_t Value)
+    {
+        return *this = uint32_t(*this) & Value;
+    }
+
+    HostRegister& operator+= (uint32_t Value)
+    {
+        return *this = uint32_t(*this) + Value;
+    }
+
+    //
+    // The contents of the register as the simulated peripheral last left
+    // them. Registers with side effects compute their value when read.
+    //
+    uint32_t value;
+};
+
+static_assert(
+    sizeof(HostRegister) == sizeof(uint32_t),
+    "Registers must be laid out as on the target");
+
+//
+// Interrupt numbers
+//
+typedef enum IRQn {
+    NonMaskableInt_IRQn = -14,
+    MemoryManagement_IRQn = -12,
+    BusFault_IRQn = -11,
+    UsageFault_IRQn = -10,
+    SVCall_IRQn = -5,
+    DebugMonitor_IRQn = -4,
+    PendSV_IRQn = -2,
+    SysTick_IRQn = -1,
+    WDT_IRQn = 0,
+    TIMER0_IRQn = 1,
+    TIMER1_IRQn = 2,
+    TIMER2_IRQn = 3,
+    TIMER3_IRQn = 4,
+    UART0_IRQn = 5,
+    UART1_IRQn = 6,
+    UART2_IRQn = 7,
+    UART3_IRQn = 8,
+    PWM1_IRQn = 9,
+    I2C0_IRQn = 10,
+    I2C1_IRQn = 11,
+    I2C2_IRQn = 12,
+    SPI_IRQn = 13,
+    SSP0_IRQn = 14,
+    SSP1_IRQn = 15,
+    PLL0_IRQn = 16,
+    RTC_IRQn = 17,
+    EINT0_IRQn = 18,
+    EINT1_IRQn = 19,
+    EINT2_IRQn = 20,
+    EINT3_IRQn = 21,
+    ADC_IRQn = 22,
+    BOD_IRQn = 23,
+    USB_IRQn = 24,
+    CAN_IRQn = 25,
+    DMA_IRQn = 26,
+    I2S_IRQn = 27,
+    ENET_IRQn = 28,
+    RIT_IRQn = 29,
+    MCPWM_IRQn = 30,
+    QEI_IRQn = 31,
+    PLL1_IRQn = 32,
+    USBActivity_IRQn = 33,
+    CANActivity_IRQn = 34,
+    HOST_IRQ_COUNT,
+} IRQn_Type;
+
+#define __NVIC_PRIO_BITS 5
+
+//
+// Peripheral register layouts
+//
+typedef struct {
+    HostRegister FLASHCFG;
+    uint32_t RESERVED0[31];
+    HostRegister PLL0CON;
+    HostRegister PLL0CFG;
+    HostRegister PLL0STAT;
+    HostRegister PLL0FEED;
+    uint32_t RESERVED1[4];
+    HostRegister PLL1CON;
+    HostRegister PLL1CFG;
+    HostRegister PLL1STAT;
+    HostRegister PLL1FEED;
+    uint32_t RESERVED2[4];
+    HostRegister PCON;
+    HostRegister PCONP;
+    uint32_t RESERVED3[15];
+    HostRegister CCLKCFG;
+    HostRegister USBCLKCFG;
+    HostRegister CLKSRCSEL;
+    uint32_t RESERVED4[12];
+    HostRegister EXTINT;
+    uint32_t RESERVED5;
+    HostRegister EXTMODE;
+    HostRegister EXTPOLAR;
+    uint32_t RESERVED6[12];
+    HostRegister RSID;
+    uint32_t RESERVED7[7];
+    HostRegister SCS;
+    HostRegister IRCTRIM;
+    HostRegister PCLKSEL0;
+    HostRegister PCLKSEL1;
+    uint32_t RESERVED8[4];
+    HostRegister USBIntSt;
+    HostRegister DMAREQSEL;
+    HostRegister CLKOUTCFG;
+} LPC_SC_TypeDef;
+
+typedef struct {
+    HostRegister PINSEL0;
+    HostRegister PINSEL1;
+    HostRegister PINSEL2;
+    HostRegister PINSEL3;
+    HostRegister PINSEL4;
+    HostRegister PINSEL5;
+    HostRegister PINSEL6;
+    HostRegister PINSEL7;
+    HostRegister PINSEL8;
+    HostRegister PINSEL9;
+    HostRegister PINSEL10;
+    uint32_t RESERVED0[5];
+    HostRegister PINMODE0;
+    HostRegister PINMODE1;
+    HostRegister PINMODE2;
+    HostRegister PINMODE3;
+    HostRegister PINMODE4;
+    HostRegister PINMODE5;
+    HostRegister PINMODE6;
+    HostRegister PINMODE7;
+    HostRegister PINMODE8;
+    HostRegister PINMODE9;
+    HostRegister PINMODE_OD0;
+    HostRegister PINMODE_OD1;
+    HostRegister PINMODE_OD2;
+    HostRegister PINMODE_OD3;
+    HostRegister PINMODE_OD4;
+    HostRegister I2CPADCFG;
+} LPC_PINCON_TypeDef;
+
+typedef struct {
+    HostRegister FIODIR;
+    uint32_t RESERVED0[3];
+    HostRegister FIOMASK;
+    HostRegister FIOPIN;
+    HostRegister FIOSET;
+    HostRegister FIOCLR;
+} LPC_GPIO_TypeDef;
+
+typedef struct {
+    HostRegister IntStatus;
+    HostRegister IO0IntStatR;
+    HostRegister IO0IntStatF;
+    HostRegister IO0IntClr;
+    HostRegister IO0IntEnR;
+    HostRegister IO0IntEnF;
+    uint32_t RESERVED0[3];
+    HostRegister IO2IntStatR;
+    HostRegister IO2IntStatF;
+    HostRegister IO2IntClr;
+    HostRegister IO2IntEnR;
+    HostRegister IO2IntEnF;
+} LPC_GPIOINT_TypeDef;
+
+typedef struct {
+    HostRegister IR;
+    HostRegister TCR;
+    HostRegister TC;
+    HostRegister PR;
+    HostRegister PC;
+    HostRegister MCR;
+    HostRegister MR0;
+    HostRegister MR1;
+    HostRegister MR2;
+    HostRegister MR3;
+    HostRegister CCR;
+    HostRegister CR0;
+    HostRegister CR1;
+    uint32_t RESERVED0[2];
+    HostRegister EMR;
+    uint32_t RESERVED1[12];
+    HostRegister CTCR;
+} LPC_TIM_TypeDef;
+
+typedef struct {
+    HostRegister IR;
+    HostRegister TCR;
+    HostRegister TC;
+    HostRegister PR;
+    HostRegister PC;
+    HostRegister MCR;
+    HostRegister MR0;
+    HostRegister MR1;
+    HostRegister MR2;
+    HostRegister MR3;
+    HostRegister CCR;
+    HostRegister CR0;
+    HostRegister CR1;
+    HostRegister CR2;
+    HostRegister CR3;
+    uint32_t RESERVED0;
+    HostRegister MR4;
+    HostRegister MR5;
+    HostRegister MR6;
+    HostRegister PCR;
+    HostRegister LER;
+    uint32_t RESERVED1[7];
+    HostRegister CTCR;
+} LPC_PWM_TypeDef;
+
+typedef struct {
+    HostRegister CR0;
+    HostRegister CR1;
+    HostRegister DR;
+    HostRegister SR;
+    HostRegister CPSR;
+    HostRegister IMSC;
+    HostRegister RIS;
+    HostRegister MIS;
+    HostRegister ICR;
+    HostRegister DMACR;
+} LPC_SSP_TypeDef;
+
+typedef struct {
+    HostRegister I2CONSET;
+    HostRegister I2STAT;
+    HostRegister I2DAT;
+    HostRegister I2ADR0;
+    HostRegister I2SCLH;
+    HostRegister I2SCLL;
+    HostRegister I2CONCLR;
+    HostRegister MMCTRL;
+    HostRegister I2ADR1;
+    HostRegister I2ADR2;
+    HostRegister I2ADR3;
+    HostRegister I2DATA_BUFFER;
+    HostRegister I2MASK0;
+    HostRegister I2MASK1;
+    HostRegister I2MASK2;
+    HostRegister I2MASK3;
+} LPC_I2C_TypeDef;
+
+typedef struct {
+    HostRegister DMACIntStat;
+    HostRegister DMACIntTCStat;
+    HostRegister DMACIntTCClear;
+    HostRegister DMACIntErrStat;
+    HostRegister DMACIntErrClr;
+    HostRegister DMACRawIntTCStat;
+    HostRegister DMACRawIntErrStat;
+    HostRegister DMACEnbldChns;
+    HostRegister DMACSoftBReq;
+    HostRegister DMACSoftSReq;
+    HostRegister DMACSoftLBReq;
+    HostRegister DMACSoftLSReq;
+    HostRegister DMACConfig;
+    HostRegister DMACSync;
+} LPC_GPDMA_TypeDef;
+
+typedef struct {
+    HostRegister DMACCSrcAddr;
+    HostRegister DMACCDestAddr;
+    HostRegister DMACCLLI;
+    HostRegister DMACCControl;
+    HostRegister DMACCConfig;
+    uint32_t RESERVED0[3];
+} LPC_GPDMACH_TypeDef;
+
+typedef struct {
+    HostRegister CTRL;
+    HostRegister CYCCNT;
+    HostRegister CPICNT;
+    HostRegister EXCCNT;
+    HostRegister SLEEPCNT;
+    HostRegister LSUCNT;
+    HostRegister FOLDCNT;
+    HostRegister PCSR;
+} DWT_Type;
+
+typedef struct {
+    HostRegister DHCSR;
+    HostRegister DCRSR;
+    HostRegister DCRDR;
+    HostRegister DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    HostRegister CPUID;
+    HostRegister ICSR;
+    HostRegister VTOR;
+    HostRegister AIRCR;
+    HostRegister SCR;
+    HostRegister CCR;
+} SCB_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define SCB_SCR_SLEEPDEEP_Msk (1UL << 2)
+#define SCB_SCR_SEVONPEND_Msk (1UL << 4)
+
+//
+// All simulated registers live in one object, so that an access can be
+// routed to its peripheral by its offset
+//
+struct HostPeripherals {
+    LPC_SC_TypeDef sc;
+    LPC_PINCON_TypeDef pincon;
+    LPC_GPIO_TypeDef gpio[5];
+    LPC_GPIOINT_TypeDef gpioint;
+    LPC_TIM_TypeDef tim[4];
+    LPC_PWM_TypeDef pwm1;
+    LPC_SSP_TypeDef ssp[2];
+    LPC_I2C_TypeDef i2c[3];
+    LPC_GPDMA_TypeDef gpdma;
+    LPC_GPDMACH_TypeDef gpdmach[8];
+    DWT_Type dwt;
+    CoreDebug_Type coreDebug;
+    SCB_Type scb;
+};
+
+extern HostPeripherals hostPeripherals;
+
+#define LPC_SC (&hostPeripherals.sc)
+#define LPC_PINCON (&hostPeripherals.pincon)
+#define LPC_GPIO0 (&hostPeripherals.gpio[0])
+#define LPC_GPIO1 (&hostPeripherals.gpio[1])
+#define LPC_GPIO2 (&hostPeripherals.gpio[2])
+#define LPC_GPIO3 (&hostPeripherals.gpio[3])
+#define LPC_GPIO4 (&hostPeripherals.gpio[4])
+#define LPC_GPIOINT (&hostPeripherals.gpioint)
+#define LPC_TIM0 (&hostPeripherals.tim[0])
+#define LPC_TIM1 (&hostPeripherals.tim[1])
+#define LPC_TIM2 (&hostPeripherals.tim[2])
+#define LPC_TIM3 (&hostPeripherals.tim[3])
+#define LPC_PWM1 (&hostPeripherals.pwm1)
+#define LPC_SSP0 (&hostPeripherals.ssp[0])
+#define LPC_SSP1 (&hostPeripherals.ssp[1])
+#define LPC_I2C0 (&hostPeripherals.i2c[0])
+#define LPC_I2C1 (&hostPeripherals.i2c[1])
+#define LPC_I2C2 (&hostPeripherals.i2c[2])
+#define LPC_GPDMA (&hostPeripherals.gpdma)
+#define LPC_GPDMACH0 (&hostPeripherals.gpdmach[0])
+#define LPC_GPDMACH1 (&hostPeripherals.gpdmach[1])
+#define LPC_GPDMACH2 (&hostPeripherals.gpdmach[2])
+#define LPC_GPDMACH3 (&hostPeripherals.gpdmach[3])
+#define LPC_GPDMACH4 (&hostPeripherals.gpdmach[4])
+#define LPC_GPDMACH5 (&hostPeripherals.gpdmach[5])
+#define LPC_GPDMACH6 (&hostPeripherals.gpdmach[6])
+#define LPC_GPDMACH7 (&hostPeripherals.gpdmach[7])
+#define DWT (&hostPeripherals.dwt)
+#define CoreDebug (&hostPeripherals.coreDebug)
+#define SCB (&hostPeripherals.scb)
+
+extern uint32_t SystemCoreClock;
+
+//
+// Returns the simulated GPDMA's address of Ptr, which must be in the
+// firmware's static data
+//
+uint32_t HostDmaAddress (const volatile void* Ptr);
+
+//
+// Core intrinsics and NVIC functions, implemented by the simulated core
+//
+void __disable_irq ();
+void __enable_irq ();
+uint32_t __get_PRIMASK ();
+void __set_PRIMASK (uint32_t PriMask);
+uint32_t __get_BASEPRI ();
+void __set_BASEPRI (uint32_t BasePri);
+uint32_t __get_IPSR ();
+void __WFI ();
+
+inline void __DMB () { }
+inline void __DSB () { }
+inline void __ISB () { }
+inline void __NOP () { }
+
+inline uint8_t __CLZ (uint32_t Value)
+{
+    uint8_t count = 0;
+    for (uint32_t bit = 0x80000000; (bit != 0) && !(Value & bit); bit >>= 1) {
+        ++count;
+    }
+    return count;
+}
+
+void NVIC_EnableIRQ (IRQn_Type IRQn);
+void NVIC_DisableIRQ (IRQn_Type IRQn);
+void NVIC_SetPendingIRQ (IRQn_Type IRQn);
+void NVIC_ClearPendingIRQ (IRQn_Type IRQn);
+uint32_t NVIC_GetPendingIRQ (IRQn_Type IRQn);
+void NVIC_SetPriority (IRQn_Type IRQn, uint32_t Priority);
+uint32_t NVIC_GetPriority (IRQn_Type IRQn);
+
+#endif // _HOST_LPC17XX_H_
@@ -0,0 +1,570 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// The simulated core: the clock, the NVIC, the register access dispatch,
+// and the thread that runs the firmware in lock step with the harness.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <lpc17xx.h>
+
+#include "simulator.h"
+#include "core.h"
+#include "peripherals.h"
+
+HostPeripherals hostPeripherals;
+
+uint32_t SystemCoreClock = Sim::CCLK_FREQUENCY;
+
+// the firmware's main(), renamed by the build
+int FirmwareMain ();
+
+extern "C" void TIMER1_IRQHandler ();
+extern "C" void I2C1_IRQHandler ();
+extern "C" void SSP0_IRQHandler ();
+#if SPI_TESTER_SSP1
+extern "C" void SSP1_IRQHandler ();
+#endif // SPI_TESTER_SSP1
+
+using namespace Sim;
+
+namespace { // static
+
+enum : uint32_t {
+    REGISTER_COUNT = sizeof(HostPeripherals) / sizeof(HostRegister),
+
+    // GPDMA address of the start of hostPeripherals
+    DMA_ADDRESS_BASE = 0x20000000,
+};
+
+struct Interrupt {
+    Peripheral* source;
+    void (*handler) ();
+    bool enabled;
+    bool pending;
+    uint8_t priority;
+};
+
+enum class RunMode { Stopped, UntilIdle, For };
+
+struct Core {
+    Peripheral* registerOwners[REGISTER_COUNT];
+    std::vector<Peripheral*> eventSources;
+    Interrupt interrupts[HOST_IRQ_COUNT];
+
+    Cycles now;
+    uint32_t accessCycles;
+    Cycles settleCycles;
+    Statistics statistics;
+
+    uint32_t primask;
+    uint32_t basepri;
+    // priorities and numbers of the active interrupts, innermost last
+    std::vector<uint32_t> activePriorities;
+    std::vector<int> activeIrqs;
+
+    RunMode mode;
+    Cycles deadline;
+    Cycles idleSince;
+    bool runResult;
+};
+
+Core core;
+Peripheral plainRegisters;
+
+//
+// Hand off between the harness and the firmware thread. They are never
+// destroyed, since the firmware thread is still waiting on them at exit.
+//
+std::mutex* handoffLock;
+std::condition_variable* handoffSignal;
+bool firmwareTurn;
+
+void Fail (const char* Message)
+{
+    fprintf(stderr, "simulator: %s\n", Message);
+    abort();
+}
+
+//
+// Called on the firmware thread to return control to the harness
+//
+void Yield (bool Result)
+{
+    core.runResult = Result;
+    core.mode = RunMode::Stopped;
+
+    std::unique_lock<std::mutex> lock(*handoffLock);
+    firmwareTurn = false;
+    handoffSignal->notify_all();
+    handoffSignal->wait(lock, [] { return firmwareTurn; });
+}
+
+//
+// Called on the harness thread to run the firmware until it yields
+//
+void Resume ()
+{
+    std::unique_lock<std::mutex> lock(*handoffLock);
+    firmwareTurn = true;
+    handoffSignal->notify_all();
+    handoffSignal->wait(lock, [] { return !firmwareTurn; });
+}
+
+void FirmwareThread ()
+{
+    {
+        std::unique_lock<std::mutex> lock(*handoffLock);
+        handoffSignal->wait(lock, [] { return firmwareTurn; });
+    }
+
+    FirmwareMain();
+    Fail("main() returned");
+}
+
+bool BusesBusy ()
+{
+    for (Peripheral* source : core.eventSources) {
+        if (source->Busy()) return true;
+    }
+    return false;
+}
+
+//
+// Returns control to the harness if the current run is complete. Sleeping
+// is true if the core is waiting for an interrupt with none pending.
+//
+void CheckYield (bool Sleeping)
+{
+    switch (core.mode) {
+    case RunMode::UntilIdle:
+        if (BusesBusy()) {
+            core.idleSince = NEVER;
+        } else {
+            if (core.idleSince == NEVER) {
+                core.idleSince = core.now;
+            }
+
+            if (Sleeping || ((core.now - core.idleSince) >= core.settleCycles)) {
+                Yield(true);
+                return;
+            }
+        }
+
+        if (core.now >= core.deadline) {
+            Yield(false);
+        }
+        break;
+    case RunMode::For:
+        if (core.now >= core.deadline) {
+            Yield(true);
+        }
+        break;
+    case RunMode::Stopped:
+        break;
+    }
+}
+
+Cycles NextEventTime ()
+{
+    Cycles next = NEVER;
+    for (Peripheral* source : core.eventSources) {
+        next = std::min(next, source->NextEventTime());
+    }
+    return next;
+}
+
+//
+// Runs the peripheral events that are due, in time order
+//
+void RunDueEvents ()
+{
+    for (;;) {
+        Peripheral* next = nullptr;
+        Cycles time = core.now + 1;
+        for (Peripheral* source : core.eventSources) {
+            const Cycles sourceTime = source->NextEventTime();
+            if (sourceTime < time) {
+                time = sourceTime;
+                next = source;
+            }
+        }
+
+        if (next == nullptr) break;
+        next->RunEvents(time);
+    }
+}
+
+bool InterruptRequested (const Interrupt& I)
+{
+    return I.enabled &&
+        (I.pending || ((I.source != nullptr) && I.source->InterruptAsserted()));
+}
+
+//
+// Returns the highest priority interrupt that is requested and has a
+// priority lower than Threshold, or -1
+//
+int HighestRequest (uint32_t Threshold)
+{
+    int best = -1;
+    for (int irq = 0; irq != HOST_IRQ_COUNT; ++irq) {
+        const Interrupt& i = core.interrupts[irq];
+        if ((i.priority < Threshold) &&
+            ((best < 0) || (i.priority < core.interrupts[best].priority)) &&
+            InterruptRequested(i)) {
+
+            best = irq;
+        }
+    }
+    return best;
+}
+
+uint32_t PreemptionThreshold ()
+{
+    uint32_t threshold = core.activePriorities.empty() ?
+        0x100 : core.activePriorities.back();
+    if ((core.basepri != 0) && (core.basepri < threshold)) {
+        threshold = core.basepri;
+    }
+    return threshold;
+}
+
+void Tick (Cycles Count);
+
+//
+// Takes each interrupt that can preempt the current context
+//
+void TakeInterrupts ()
+{
+    while (core.primask == 0) {
+        const int irq = HighestRequest(PreemptionThreshold());
+        if (irq < 0) break;
+
+        Interrupt& i = core.interrupts[irq];
+        if (i.handler == nullptr) {
+            fprintf(stderr, "simulator: IRQ %d has no handler\n", irq);
+            abort();
+        }
+
+        i.pending = false;
+        ++core.statistics.Interrupts[irq];
+        core.activePriorities.push_back(i.priority);
+        core.activeIrqs.push_back(irq);
+
+        Tick(INTERRUPT_ENTRY_CYCLES);
+        i.handler();
+
+        core.activePriorities.pop_back();
+        core.activeIrqs.pop_back();
+    }
+}
+
+//
+// Advances the clock for work done by the CPU
+//
+void Tick (Cycles Count)
+{
+    core.now += Count;
+    RunDueEvents();
+    TakeInterrupts();
+    CheckYield(false);
+}
+
+void Access ()
+{
+    ++core.statistics.RegisterAccesses;
+    Tick(core.accessCycles);
+}
+
+Interrupt& CheckedInterrupt (IRQn_Type IRQn)
+{
+    if ((IRQn < 0) || (IRQn >= HOST_IRQ_COUNT)) {
+        Fail("system exceptions are not simulated");
+    }
+    return core.interrupts[IRQn];
+}
+
+} // namespace "static"
+
+//
+// Firmware interface
+//
+uint32_t HostRegisterRead (const HostRegister* Register)
+{
+    const uint32_t value = RegisterOwner(Register)->Read(*Register);
+    Access();
+    return value;
+}
+
+void HostRegisterWrite (HostRegister* Register, uint32_t Value)
+{
+    RegisterOwner(Register)->Write(*Register, Value);
+    Access();
+}
+
+uint32_t HostDmaAddress (const volatile void* Ptr)
+{
+    const intptr_t offset = reinterpret_cast<const volatile char*>(Ptr) -
+        reinterpret_cast<const char*>(&hostPeripherals);
+    const uint32_t address = DMA_ADDRESS_BASE + uint32_t(offset);
+
+    if (HostPointer(address) != Ptr) {
+        Fail("address is not reachable by the GPDMA");
+    }
+    return address;
+}
+
+void __disable_irq ()
+{
+    core.primask = 1;
+}
+
+void __enable_irq ()
+{
+    core.primask = 0;
+    TakeInterrupts();
+}
+
+uint32_t __get_PRIMASK ()
+{
+    return core.primask;
+}
+
+void __set_PRIMASK (uint32_t PriMask)
+{
+    core.primask = PriMask & 1;
+    TakeInterrupts();
+}
+
+uint32_t __get_BASEPRI ()
+{
+    return core.basepri;
+}
+
+void __set_BASEPRI (uint32_t BasePri)
+{
+    core.basepri = BasePri & 0xff;
+    TakeInterrupts();
+}
+
+uint32_t __get_IPSR ()
+{
+    return core.activeIrqs.empty() ? 0 : (16 + core.activeIrqs.back());
+}
+
+//
+// Sleeps until an interrupt that could preempt the thread is pending,
+// skipping ahead to the next peripheral event. WFI wakes regardless of
+// PRIMASK, so the scheduler takes the interrupt once it enables interrupts.
+//
+void __WFI ()
+{
+    Access();
+
+    for (;;) {
+        if (HighestRequest(PreemptionThreshold()) >= 0) return;
+
+        CheckYield(true);
+        if (HighestRequest(PreemptionThreshold()) >= 0) return;
+
+        Cycles next = NextEventTime();
+        if (core.mode != RunMode::Stopped) {
+            next = std::min(next, core.deadline);
+        }
+        if (next == NEVER) {
+            Fail("the core is asleep with nothing to wake it");
+        }
+
+        if (next > core.now) {
+            core.statistics.SleepCycles += next - core.now;
+            Dwt().Sleep(next - core.now);
+            core.now = next;
+        }
+        RunDueEvents();
+    }
+}
+
+void NVIC_EnableIRQ (IRQn_Type IRQn)
+{
+    CheckedInterrupt(IRQn).enabled = true;
+    Access();
+}
+
+void NVIC_DisableIRQ (IRQn_Type IRQn)
+{
+    CheckedInterrupt(IRQn).enabled = false;
+    Access();
+}
+
+void NVIC_SetPendingIRQ (IRQn_Type IRQn)
+{
+    CheckedInterrupt(IRQn).pending = true;
+    Access();
+}
+
+void NVIC_ClearPendingIRQ (IRQn_Type IRQn)
+{
+    CheckedInterrupt(IRQn).pending = false;
+    Access();
+}
+
+uint32_t NVIC_GetPendingIRQ (IRQn_Type IRQn)
+{
+    const Interrupt& i = CheckedInterrupt(IRQn);
+    Access();
+    return (i.pending ||
+            ((i.source != nullptr) && i.source->InterruptAsserted())) ? 1 : 0;
+}
+
+void NVIC_SetPriority (IRQn_Type IRQn, uint32_t Priority)
+{
+    CheckedInterrupt(IRQn).priority =
+        uint8_t(Priority << (8 - __NVIC_PRIO_BITS));
+    Access();
+}
+
+uint32_t NVIC_GetPriority (IRQn_Type IRQn)
+{
+    const uint32_t priority = CheckedInterrupt(IRQn).priority;
+    Access();
+    return priority >> (8 - __NVIC_PRIO_BITS);
+}
+
+//
+// Peripheral model interface
+//
+void Sim::AttachPeripheral (
+    Peripheral* P,
+    const void* Begin,
+    size_t Size,
+    int Irq,
+    bool HasEvents
+    )
+{
+    if (Size != 0) {
+        const size_t first = (static_cast<const char*>(Begin) -
+            reinterpret_cast<const char*>(&hostPeripherals)) /
+            sizeof(HostRegister);
+
+        for (size_t i = 0; i != Size / sizeof(HostRegister); ++i) {
+            core.registerOwners[first + i] = P;
+        }
+    }
+
+    if (Irq >= 0) {
+        core.interrupts[Irq].source = P;
+    }
+
+    if (HasEvents) {
+        core.eventSources.push_back(P);
+    }
+}
+
+void* Sim::HostPointer (uint32_t DmaAddress)
+{
+    return reinterpret_cast<char*>(&hostPeripherals) +
+        int32_t(DmaAddress - DMA_ADDRESS_BASE);
+}
+
+Peripheral* Sim::RegisterOwner (const void* Ptr)
+{
+    const char* const begin = reinterpret_cast<const char*>(&hostPeripherals);
+    const char* const p = static_cast<const char*>(Ptr);
+    if ((p < begin) || (p >= (begin + sizeof(hostPeripherals)))) {
+        return nullptr;
+    }
+
+    return core.registerOwners[(p - begin) / sizeof(HostRegister)];
+}
+
+Statistics& Sim::MutableStatistics ()
+{
+    return core.statistics;
+}
+
+//
+// Harness interface
+//
+void Sim::Boot ()
+{
+    static bool booted;
+    if (booted) {
+        Fail("Boot may only be called once");
+    }
+    booted = true;
+
+    for (Peripheral*& owner : core.registerOwners) {
+        owner = &plainRegisters;
+    }
+
+    core.accessCycles = DEFAULT_ACCESS_CYCLES;
+    core.settleCycles = MicrosToCycles(100);
+    core.mode = RunMode::Stopped;
+
+    core.interrupts[TIMER1_IRQn].handler = &TIMER1_IRQHandler;
+    core.interrupts[I2C1_IRQn].handler = &I2C1_IRQHandler;
+    core.interrupts[SSP0_IRQn].handler = &SSP0_IRQHandler;
+#if SPI_TESTER_SSP1
+    core.interrupts[SSP1_IRQn].handler = &SSP1_IRQHandler;
+#endif // SPI_TESTER_SSP1
+
+    CreatePeripherals();
+
+    handoffLock = new std::mutex;
+    handoffSignal = new std::condition_variable;
+    std::thread(&FirmwareThread).detach();
+
+    if (!Run()) {
+        Fail("the firmware did not become idle after reset");
+    }
+}
+
+bool Sim::Run (Cycles Timeout)
+{
+    core.mode = RunMode::UntilIdle;
+    core.deadline = core.now + Timeout;
+    core.idleSince = NEVER;
+    Resume();
+    return core.runResult;
+}
+
+void Sim::RunFor (Cycles Duration)
+{
+    core.mode = RunMode::For;
+    core.deadline = core.now + Duration;
+    Resume();
+}
+
+Cycles Sim::Now ()
+{
+    return core.now;
+}
+
+void Sim::SetAccessCycles (uint32_t AccessCycles)
+{
+    core.accessCycles = AccessCycles;
+}
+
+void Sim::SetSettleCycles (Cycles SettleCycles)
+{
+    core.settleCycles = SettleCycles;
+}
+
+const Statistics& Sim::GetStatistics ()
+{
+    return core.statistics;
+}
+
+void Sim::ResetStatistics ()
+{
+    memset(&core.statistics, 0, sizeof(core.statistics));
+}
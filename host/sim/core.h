@@ -0,0 +1,79 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Interface between the simulated core and the peripheral models.
+//
+#ifndef _SIM_CORE_H_
+#define _SIM_CORE_H_
+
+namespace Sim {
+
+//
+// A simulated peripheral. Registers that a model does not handle behave as
+// plain memory.
+//
+class Peripheral {
+public:
+    virtual ~Peripheral () { }
+
+    //
+    // Register accesses by the CPU or the GPDMA. Register identifies the
+    // register within hostPeripherals.
+    //
+    virtual uint32_t Read (const HostRegister& Register)
+    {
+        return Register.value;
+    }
+
+    virtual void Write (HostRegister& Register, uint32_t Value)
+    {
+        Register.value = Value;
+    }
+
+    //
+    // The time of the earliest event the model has scheduled, or NEVER.
+    // RunEvents runs the events scheduled at Time, after which NextEventTime
+    // must return a later time.
+    //
+    virtual Cycles NextEventTime () const { return NEVER; }
+    virtual void RunEvents (Cycles /*Time*/) { }
+
+    // level of the model's interrupt request line
+    virtual bool InterruptAsserted () const { return false; }
+
+    // whether the model has bus traffic in progress or queued
+    virtual bool Busy () const { return false; }
+};
+
+//
+// Routes accesses to Size bytes of registers starting at Begin to P. If Irq
+// is not negative, P drives that interrupt line, and if P schedules events
+// it must be registered with HasEvents.
+//
+void AttachPeripheral (
+    Peripheral* P,
+    const void* Begin,
+    size_t Size,
+    int Irq = -1,
+    bool HasEvents = false
+    );
+
+// Registers the peripheral models. Implemented in peripherals.cpp.
+void CreatePeripherals ();
+
+//
+// Translates between host pointers and the addresses seen by the GPDMA
+//
+void* HostPointer (uint32_t DmaAddress);
+
+//
+// Returns the peripheral that owns the register at Ptr, or nullptr if Ptr
+// is not a register
+//
+Peripheral* RegisterOwner (const void* Ptr);
+
+Statistics& MutableStatistics ();
+
+} // namespace Sim
+
+#endif // _SIM_CORE_H_
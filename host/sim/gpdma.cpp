@@ -0,0 +1,240 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// GPDMA model
+//
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include <lpc17xx.h>
+
+#include "simulator.h"
+#include "core.h"
+#include "peripherals.h"
+
+using namespace Sim;
+
+namespace { // static
+
+enum : uint32_t {
+    CHANNEL_COUNT = 8,
+
+    CONTROL_TRANSFER_SIZE = 0xfff,
+    CONTROL_SI = 1U << 26,
+    CONTROL_DI = 1U << 27,
+    CONTROL_I = 1U << 31,
+
+    CONFIG_E = 1U << 0,
+    CONFIG_A = 1U << 17,
+    CONFIG_H = 1U << 18,
+
+    TRANSFER_TYPE_M2M = 0,
+    TRANSFER_TYPE_M2P = 1,
+    TRANSFER_TYPE_P2M = 2,
+
+    CONN_SSP0_TX = 0,
+    CONN_SSP0_RX = 1,
+    CONN_SSP1_TX = 2,
+    CONN_SSP1_RX = 3,
+};
+
+LPC_GPDMACH_TypeDef& Channel (uint32_t Index)
+{
+    return hostPeripherals.gpdmach[Index];
+}
+
+bool PeripheralRequest (uint32_t Conn)
+{
+    switch (Conn) {
+    case CONN_SSP0_TX: return Ssp(0).TxDmaRequest();
+    case CONN_SSP0_RX: return Ssp(0).RxDmaRequest();
+    case CONN_SSP1_TX: return Ssp(1).TxDmaRequest();
+    case CONN_SSP1_RX: return Ssp(1).RxDmaRequest();
+    default:
+        // timer match and UART requests are not simulated
+        return false;
+    }
+}
+
+//
+// Accesses Width bytes at Address, which may be a register or memory
+//
+uint32_t BusRead (uint32_t Address, uint32_t Width)
+{
+    void* const ptr = HostPointer(Address);
+    if (Peripheral* owner = RegisterOwner(ptr)) {
+        const HostRegister& reg = *reinterpret_cast<const HostRegister*>(
+            uintptr_t(ptr) & ~uintptr_t(sizeof(HostRegister) - 1));
+        return owner->Read(reg);
+    }
+
+    uint32_t value = 0;
+    memcpy(&value, ptr, Width);
+    return value;
+}
+
+void BusWrite (uint32_t Address, uint32_t Width, uint32_t Value)
+{
+    void* const ptr = HostPointer(Address);
+    if (Peripheral* owner = RegisterOwner(ptr)) {
+        HostRegister& reg = *reinterpret_cast<HostRegister*>(
+            uintptr_t(ptr) & ~uintptr_t(sizeof(HostRegister) - 1));
+        owner->Write(reg, Value);
+        return;
+    }
+
+    memcpy(ptr, &Value, Width);
+}
+
+} // namespace "static"
+
+uint32_t GpdmaModel::Read (const HostRegister& Register)
+{
+    LPC_GPDMA_TypeDef& gpdma = hostPeripherals.gpdma;
+
+    if (&Register == &gpdma.DMACIntStat) {
+        return gpdma.DMACIntTCStat.value | gpdma.DMACIntErrStat.value;
+    } else if (&Register == &gpdma.DMACEnbldChns) {
+        uint32_t enabled = 0;
+        for (uint32_t i = 0; i != CHANNEL_COUNT; ++i) {
+            if (Channel(i).DMACCConfig.value & CONFIG_E) {
+                enabled |= 1U << i;
+            }
+        }
+        return enabled;
+    } else if ((&Register == &gpdma.DMACIntTCClear) ||
+               (&Register == &gpdma.DMACIntErrClr)) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i != CHANNEL_COUNT; ++i) {
+        // channels are idle as soon as they are halted, since transfers
+        // complete immediately
+        if (&Register == &Channel(i).DMACCConfig) {
+            return Register.value & ~CONFIG_A;
+        }
+    }
+
+    return Register.value;
+}
+
+void GpdmaModel::Write (HostRegister& Register, uint32_t Value)
+{
+    LPC_GPDMA_TypeDef& gpdma = hostPeripherals.gpdma;
+
+    if (&Register == &gpdma.DMACIntTCClear) {
+        gpdma.DMACIntTCStat.value &= ~Value;
+        gpdma.DMACRawIntTCStat.value &= ~Value;
+        return;
+    } else if (&Register == &gpdma.DMACIntErrClr) {
+        gpdma.DMACIntErrStat.value &= ~Value;
+        gpdma.DMACRawIntErrStat.value &= ~Value;
+        return;
+    } else if ((&Register == &gpdma.DMACIntStat) ||
+               (&Register == &gpdma.DMACIntTCStat) ||
+               (&Register == &gpdma.DMACIntErrStat) ||
+               (&Register == &gpdma.DMACRawIntTCStat) ||
+               (&Register == &gpdma.DMACRawIntErrStat) ||
+               (&Register == &gpdma.DMACEnbldChns)) {
+
+        // read only
+        return;
+    }
+
+    Register.value = Value;
+    Service();
+}
+
+bool GpdmaModel::InterruptAsserted () const
+{
+    LPC_GPDMA_TypeDef& gpdma = hostPeripherals.gpdma;
+    return (gpdma.DMACIntTCStat.value | gpdma.DMACIntErrStat.value) != 0;
+}
+
+bool GpdmaModel::RequestAsserted (uint32_t Index) const
+{
+    const uint32_t config = Channel(Index).DMACCConfig.value;
+    if (!(config & CONFIG_E) || (config & CONFIG_H) ||
+        !(hostPeripherals.gpdma.DMACConfig.value & 0x1)) {
+
+        return false;
+    }
+
+    switch ((config >> 11) & 0x7) {
+    case TRANSFER_TYPE_M2M:
+        return true;
+    case TRANSFER_TYPE_M2P:
+        return PeripheralRequest((config >> 6) & 0x1f);
+    case TRANSFER_TYPE_P2M:
+        return PeripheralRequest((config >> 1) & 0x1f);
+    default:
+        return false;
+    }
+}
+
+//
+// Moves one element, following the linked list when the transfer is
+// complete
+//
+void GpdmaModel::TransferElement (uint32_t Index)
+{
+    LPC_GPDMACH_TypeDef& channel = Channel(Index);
+    const uint32_t control = channel.DMACCControl.value;
+    const uint32_t srcWidth = 1U << ((control >> 18) & 0x7);
+    const uint32_t destWidth = 1U << ((control >> 21) & 0x7);
+
+    if ((control & CONTROL_TRANSFER_SIZE) != 0) {
+        const uint32_t value = BusRead(channel.DMACCSrcAddr.value, srcWidth);
+        BusWrite(channel.DMACCDestAddr.value, destWidth, value);
+
+        if (control & CONTROL_SI) {
+            channel.DMACCSrcAddr.value += srcWidth;
+        }
+        if (control & CONTROL_DI) {
+            channel.DMACCDestAddr.value += destWidth;
+        }
+        channel.DMACCControl.value = control - 1;
+    }
+
+    if ((channel.DMACCControl.value & CONTROL_TRANSFER_SIZE) != 0) return;
+
+    if (channel.DMACCLLI.value != 0) {
+        const uint32_t* const lli =
+            static_cast<const uint32_t*>(HostPointer(channel.DMACCLLI.value));
+        channel.DMACCSrcAddr.value = lli[0];
+        channel.DMACCDestAddr.value = lli[1];
+        channel.DMACCLLI.value = lli[2];
+        channel.DMACCControl.value = lli[3];
+        return;
+    }
+
+    channel.DMACCConfig.value &= ~CONFIG_E;
+    if (control & CONTROL_I) {
+        hostPeripherals.gpdma.DMACRawIntTCStat.value |= 1U << Index;
+        hostPeripherals.gpdma.DMACIntTCStat.value |= 1U << Index;
+    }
+}
+
+void GpdmaModel::Service ()
+{
+    // transfers change the requests, which calls back into Service
+    if (this->servicing) return;
+    this->servicing = true;
+
+    bool progress;
+    do {
+        progress = false;
+
+        // lower numbered channels have higher priority
+        for (uint32_t i = 0; i != CHANNEL_COUNT; ++i) {
+            if (RequestAsserted(i)) {
+                TransferElement(i);
+                progress = true;
+                break;
+            }
+        }
+    } while (progress);
+
+    this->servicing = false;
+}
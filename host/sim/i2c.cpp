@@ -0,0 +1,396 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// I2C slave and I2C master models. The master works a byte at a time: each
+// step of a transaction (start, address, data byte, stop) begins once the
+// slave has released SCL by clearing SI, and the slave's response is
+// latched when the step begins, as the LPC1768 latches AA and I2DAT.
+//
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <lpc17xx.h>
+
+#include "simulator.h"
+#include "core.h"
+#include "peripherals.h"
+
+using namespace Sim;
+
+namespace { // static
+
+enum : uint32_t {
+    CON_AA = 1 << 2,
+    CON_SI = 1 << 3,
+    CON_STO = 1 << 4,
+    CON_STA = 1 << 5,
+    CON_I2EN = 1 << 6,
+
+    STAT_SLAW_ACK = 0x60,
+    STAT_DATA_ACK = 0x80,
+    STAT_DATA_NACK = 0x88,
+    STAT_STOP_OR_RESTART = 0xa0,
+    STAT_SLAR_ACK = 0xa8,
+    STAT_TX_DATA_ACK = 0xb8,
+    STAT_TX_DATA_NACK = 0xc0,
+    STAT_TX_LAST_DATA_ACK = 0xc8,
+    STAT_NO_INFO = 0xf8,
+
+    // an address or data byte and its acknowledge
+    BYTE_BITS = 9,
+};
+
+I2cModel i2c;
+
+LPC_I2C_TypeDef& Registers ()
+{
+    return hostPeripherals.i2c[1];
+}
+
+} // namespace "static"
+
+I2cModel& Sim::I2c () { return i2c; }
+
+uint32_t I2cModel::Read (const HostRegister& Register)
+{
+    if (&Register == &Registers().I2CONCLR) {
+        return 0;
+    }
+
+    return Register.value;
+}
+
+void I2cModel::Write (HostRegister& Register, uint32_t Value)
+{
+    LPC_I2C_TypeDef& regs = Registers();
+    uint32_t& con = regs.I2CONSET.value;
+
+    if (&Register == &regs.I2CONSET) {
+        // STO in slave mode recovers from an error as if a stop had been
+        // received, so the slave does not respond until the next stop
+        if ((Value & CON_STO) && (this->step != Step::Idle || this->busClaimed)) {
+            this->slave = Slave::NotAddressed;
+            this->ignoreUntilStop = true;
+        }
+
+        // master mode is not simulated, so STA is ignored
+        con |= Value & (CON_AA | CON_SI | CON_I2EN);
+        return;
+    } else if (&Register == &regs.I2CONCLR) {
+        const bool releasedScl = (con & CON_SI) && (Value & CON_SI);
+        con &= ~(Value & (CON_AA | CON_SI | CON_STA | CON_I2EN));
+
+        if (!(con & CON_I2EN)) {
+            this->slave = Slave::NotAddressed;
+        }
+
+        if (releasedScl) {
+            regs.I2STAT.value = STAT_NO_INFO;
+
+            // the master resumes a step that was waiting for SCL
+            if (this->current && !this->stepBegun &&
+                (this->nextEventTime == NEVER)) {
+
+                this->nextEventTime = std::max(Now(), this->stepTime);
+            }
+        }
+        return;
+    } else if (&Register == &regs.I2STAT) {
+        // read only
+        return;
+    }
+
+    Register.value = Value;
+}
+
+bool I2cModel::InterruptAsserted () const
+{
+    const uint32_t con = hostPeripherals.i2c[1].I2CONSET.value;
+    return (con & CON_SI) && (con & CON_I2EN);
+}
+
+bool I2cModel::Busy () const
+{
+    return this->current || !this->queue.empty();
+}
+
+void I2cModel::Interrupt (uint32_t Status)
+{
+    Registers().I2STAT.value = Status;
+    Registers().I2CONSET.value |= CON_SI;
+}
+
+bool I2cModel::AddressMatches (uint8_t Address) const
+{
+    const LPC_I2C_TypeDef& regs = Registers();
+    const uint32_t addresses[] = {
+        regs.I2ADR0.value,
+        regs.I2ADR1.value,
+        regs.I2ADR2.value,
+        regs.I2ADR3.value,
+    };
+    const uint32_t masks[] = {
+        regs.I2MASK0.value,
+        regs.I2MASK1.value,
+        regs.I2MASK2.value,
+        regs.I2MASK3.value,
+    };
+
+    for (uint32_t i = 0; i != 4; ++i) {
+        if (((uint32_t(Address << 1) ^ addresses[i]) & ~masks[i] & 0xfe) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void I2cModel::Queue (const std::shared_ptr<I2cTransaction>& Transaction)
+{
+    this->queue.push_back(Transaction);
+    if (!this->current) {
+        StartNext(Now());
+    }
+}
+
+//
+// Makes the next queued transaction current. Time is the end of the
+// previous transaction, or the time the transaction was queued if the bus
+// was idle.
+//
+void I2cModel::StartNext (Cycles Time)
+{
+    this->current.reset();
+    this->step = Step::Idle;
+    this->nextEventTime = NEVER;
+    if (this->queue.empty()) return;
+
+    this->current = this->queue.front();
+    this->queue.erase(this->queue.begin());
+
+    this->bitCycles = CCLK_FREQUENCY / this->current->Settings.Frequency;
+
+    // a repeated start follows the previous transaction immediately
+    Schedule(
+        Step::Start,
+        this->busClaimed ?
+            (Time + (this->bitCycles / 2)) :
+            (Time + this->current->Settings.GapCycles));
+}
+
+void I2cModel::Schedule (Step Next, Cycles Time)
+{
+    this->step = Next;
+    this->stepBegun = false;
+    this->stepTime = Time;
+    this->nextEventTime = Time;
+}
+
+void I2cModel::RunEvents (Cycles Time)
+{
+    if (this->stepBegun) {
+        CompleteStep(Time);
+        return;
+    }
+
+    // the slave holds SCL low while SI is set
+    const uint32_t con = Registers().I2CONSET.value;
+    if ((con & CON_SI) && (con & CON_I2EN)) {
+        this->nextEventTime = NEVER;
+        return;
+    }
+
+    BeginStep(Time);
+}
+
+void I2cModel::BeginStep (Cycles Time)
+{
+    I2cTransaction& transaction = *this->current;
+    const uint32_t con = Registers().I2CONSET.value;
+
+    this->stepBegun = true;
+    transaction.StretchCycles += Time - this->stepTime;
+    this->slaveAck = (con & CON_AA) && (con & CON_I2EN);
+
+    Cycles duration = BYTE_BITS * this->bitCycles;
+    switch (this->step) {
+    case Step::Start:
+        duration = this->bitCycles / 2;
+        break;
+    case Step::Data:
+        if (transaction.Read) {
+            this->shiftOut = (this->slave == Slave::Transmitter) ?
+                uint8_t(Registers().I2DAT.value) : 0xff;
+        }
+        break;
+    case Step::Stop:
+        duration = this->bitCycles;
+        break;
+    case Step::Address:
+    case Step::Idle:
+        break;
+    }
+
+    this->nextEventTime = Time + duration;
+}
+
+void I2cModel::CompleteStep (Cycles Time)
+{
+    I2cTransaction& transaction = *this->current;
+    const uint32_t length = transaction.Read ?
+        transaction.ReadLength : uint32_t(transaction.Data.size());
+
+    // the step after a byte: the next byte, or the end of the transaction
+    auto next = [&] (bool Continue) {
+        if (Continue && (this->byteIndex < length)) {
+            Schedule(Step::Data, Time);
+        } else if (transaction.Stop) {
+            Schedule(Step::Stop, Time);
+        } else {
+            transaction.EndTime = Time;
+            transaction.Complete = true;
+            StartNext(Time);
+        }
+    };
+
+    switch (this->step) {
+    case Step::Start:
+        if (this->slave != Slave::NotAddressed) {
+            this->slave = Slave::NotAddressed;
+            Interrupt(STAT_STOP_OR_RESTART);
+        }
+
+        this->busClaimed = true;
+        transaction.StartTime = Time;
+        Schedule(Step::Address, Time);
+        break;
+
+    case Step::Address:
+        transaction.AddressAcked = this->slaveAck && !this->ignoreUntilStop &&
+            AddressMatches(transaction.Address);
+        this->byteIndex = 0;
+
+        if (transaction.AddressAcked) {
+            Registers().I2DAT.value =
+                uint32_t(transaction.Address << 1) | (transaction.Read ? 1 : 0);
+            if (transaction.Read) {
+                this->slave = Slave::Transmitter;
+                Interrupt(STAT_SLAR_ACK);
+            } else {
+                this->slave = Slave::Receiver;
+                Interrupt(STAT_SLAW_ACK);
+            }
+        }
+        next(transaction.AddressAcked);
+        break;
+
+    case Step::Data:
+        if (transaction.Read) {
+            transaction.Data.push_back(this->shiftOut);
+            ++this->byteIndex;
+
+            const bool masterAck = this->byteIndex < length;
+            if (this->slave == Slave::Transmitter) {
+                uint32_t status;
+                if (!masterAck) {
+                    status = STAT_TX_DATA_NACK;
+                } else if (this->slaveAck) {
+                    status = STAT_TX_DATA_ACK;
+                } else {
+                    status = STAT_TX_LAST_DATA_ACK;
+                }
+
+                if (status != STAT_TX_DATA_ACK) {
+                    this->slave = Slave::NotAddressed;
+                }
+                Interrupt(status);
+            }
+            next(masterAck);
+        } else {
+            bool ack = false;
+            if (this->slave == Slave::Receiver) {
+                ack = this->slaveAck;
+                Registers().I2DAT.value = transaction.Data[this->byteIndex];
+                if (!ack) {
+                    this->slave = Slave::NotAddressed;
+                }
+                Interrupt(ack ? STAT_DATA_ACK : STAT_DATA_NACK);
+            }
+
+            if (ack) {
+                ++transaction.BytesAcked;
+            }
+            ++this->byteIndex;
+            next(ack);
+        }
+        break;
+
+    case Step::Stop:
+        if (this->slave != Slave::NotAddressed) {
+            this->slave = Slave::NotAddressed;
+            Interrupt(STAT_STOP_OR_RESTART);
+        }
+
+        this->ignoreUntilStop = false;
+        this->busClaimed = false;
+        transaction.EndTime = Time;
+        transaction.Complete = true;
+        StartNext(Time);
+        break;
+
+    case Step::Idle:
+        break;
+    }
+}
+
+namespace { // static
+
+std::shared_ptr<I2cTransaction> NewTransaction (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    bool Read,
+    bool Stop
+    )
+{
+    auto transaction = std::make_shared<I2cTransaction>();
+    transaction->Settings = Settings;
+    transaction->Address = Address;
+    transaction->Read = Read;
+    transaction->ReadLength = 0;
+    transaction->Stop = Stop;
+    transaction->AddressAcked = false;
+    transaction->BytesAcked = 0;
+    transaction->StartTime = 0;
+    transaction->EndTime = 0;
+    transaction->StretchCycles = 0;
+    transaction->Complete = false;
+    return transaction;
+}
+
+} // namespace "static"
+
+std::shared_ptr<I2cTransaction> Sim::QueueI2cWrite (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    const std::vector<uint8_t>& Data,
+    bool Stop
+    )
+{
+    auto transaction = NewTransaction(Settings, Address, false, Stop);
+    transaction->Data = Data;
+    i2c.Queue(transaction);
+    return transaction;
+}
+
+std::shared_ptr<I2cTransaction> Sim::QueueI2cRead (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    uint32_t Length,
+    bool Stop
+    )
+{
+    auto transaction = NewTransaction(Settings, Address, true, Stop);
+    transaction->ReadLength = Length;
+    i2c.Queue(transaction);
+    return transaction;
+}
@@ -0,0 +1,386 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// System control, GPIO, timer and cycle counter models, and the table of
+// all models.
+//
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <lpc17xx.h>
+
+#include "simulator.h"
+#include "core.h"
+#include "peripherals.h"
+
+using namespace Sim;
+
+namespace { // static
+
+enum : uint32_t {
+    TCR_ENABLE = 1 << 0,
+    TCR_RESET = 1 << 1,
+};
+
+SystemControlModel systemControl;
+GpioModel gpio;
+TimerModel timers[] = { TimerModel(0), TimerModel(1), TimerModel(2), TimerModel(3) };
+SspModel ssps[] = { SspModel(0), SspModel(1) };
+GpdmaModel gpdma;
+DwtModel dwt;
+
+} // namespace "static"
+
+SystemControlModel& Sim::SystemControl () { return systemControl; }
+GpioModel& Sim::Gpio () { return gpio; }
+TimerModel& Sim::Timer (uint32_t Index) { return timers[Index]; }
+SspModel& Sim::Ssp (uint32_t Index) { return ssps[Index]; }
+GpdmaModel& Sim::Gpdma () { return gpdma; }
+DwtModel& Sim::Dwt () { return dwt; }
+
+void Sim::CreatePeripherals ()
+{
+    HostPeripherals& p = hostPeripherals;
+
+    // I2C is idle until addressed
+    p.i2c[0].I2STAT.value = 0xf8;
+    p.i2c[1].I2STAT.value = 0xf8;
+    p.i2c[2].I2STAT.value = 0xf8;
+
+    AttachPeripheral(&systemControl, &p.sc, sizeof(p.sc));
+    AttachPeripheral(&gpio, &p.gpio, sizeof(p.gpio));
+    AttachPeripheral(&gpio, &p.gpioint, sizeof(p.gpioint));
+    for (uint32_t i = 0; i != 4; ++i) {
+        AttachPeripheral(
+            &timers[i],
+            &p.tim[i],
+            sizeof(p.tim[i]),
+            TIMER0_IRQn + i,
+            true);
+    }
+    AttachPeripheral(&ssps[0], &p.ssp[0], sizeof(p.ssp[0]), SSP0_IRQn, true);
+    AttachPeripheral(&ssps[1], &p.ssp[1], sizeof(p.ssp[1]), SSP1_IRQn, true);
+    AttachPeripheral(&I2c(), &p.i2c[1], sizeof(p.i2c[1]), I2C1_IRQn, true);
+    AttachPeripheral(&gpdma, &p.gpdma, sizeof(p.gpdma), DMA_IRQn);
+    AttachPeripheral(&gpdma, &p.gpdmach, sizeof(p.gpdmach));
+    AttachPeripheral(&dwt, &p.dwt, sizeof(p.dwt));
+    for (uint32_t i = 0; i != SPI_MASTER_COUNT; ++i) {
+        AttachPeripheral(&SpiMaster(i), nullptr, 0, -1, true);
+        SpiMaster(i).Reset();
+    }
+}
+
+//
+// SystemControlModel
+//
+uint32_t SystemControlModel::TimerClockDivider (uint32_t Index) const
+{
+    static const uint32_t dividers[] = { 4, 1, 2, 8 };
+
+    // TIM0 and TIM1 are selected in PCLKSEL0, TIM2 and TIM3 in PCLKSEL1
+    const uint32_t pclksel = (Index < 2) ?
+        (hostPeripherals.sc.PCLKSEL0.value >> (2 + (2 * Index))) :
+        (hostPeripherals.sc.PCLKSEL1.value >> (12 + (2 * (Index - 2))));
+
+    return dividers[pclksel & 0x3];
+}
+
+//
+// GpioModel
+//
+uint32_t GpioModel::Read (const HostRegister& Register)
+{
+    LPC_GPIO_TypeDef& port0 = hostPeripherals.gpio[0];
+    LPC_GPIOINT_TypeDef& gpioint = hostPeripherals.gpioint;
+
+    if (&Register == &port0.FIOPIN) {
+        return (port0.FIOPIN.value & ~this->port0InputMask) |
+            (this->port0Inputs & this->port0InputMask);
+    } else if (&Register == &gpioint.IntStatus) {
+        return (((gpioint.IO0IntStatR.value | gpioint.IO0IntStatF.value) != 0) ? 1 : 0) |
+            (((gpioint.IO2IntStatR.value | gpioint.IO2IntStatF.value) != 0) ? 4 : 0);
+    } else if (&Register == &gpioint.IO0IntClr || &Register == &gpioint.IO2IntClr) {
+        return 0;
+    }
+
+    for (LPC_GPIO_TypeDef& port : hostPeripherals.gpio) {
+        // FIOSET reads back the output latch
+        if ((&Register == &port.FIOSET) || (&Register == &port.FIOCLR)) {
+            return (&Register == &port.FIOSET) ? port.FIOPIN.value : 0;
+        }
+    }
+
+    return Register.value;
+}
+
+void GpioModel::Write (HostRegister& Register, uint32_t Value)
+{
+    LPC_GPIOINT_TypeDef& gpioint = hostPeripherals.gpioint;
+
+    if (&Register == &gpioint.IO0IntClr) {
+        gpioint.IO0IntStatR.value &= ~Value;
+        gpioint.IO0IntStatF.value &= ~Value;
+        return;
+    } else if (&Register == &gpioint.IO2IntClr) {
+        gpioint.IO2IntStatR.value &= ~Value;
+        gpioint.IO2IntStatF.value &= ~Value;
+        return;
+    } else if ((&Register == &gpioint.IntStatus) ||
+               (&Register == &gpioint.IO0IntStatR) ||
+               (&Register == &gpioint.IO0IntStatF) ||
+               (&Register == &gpioint.IO2IntStatR) ||
+               (&Register == &gpioint.IO2IntStatF)) {
+
+        // read only
+        return;
+    }
+
+    for (uint32_t i = 0; i != 5; ++i) {
+        LPC_GPIO_TypeDef& port = hostPeripherals.gpio[i];
+        uint32_t latch = port.FIOPIN.value;
+
+        if (&Register == &port.FIOSET) {
+            latch |= Value;
+        } else if (&Register == &port.FIOCLR) {
+            latch &= ~Value;
+        } else if (&Register == &port.FIOPIN) {
+            latch = Value;
+        } else {
+            continue;
+        }
+
+        // P1.20 is the error LED
+        const uint32_t errLed = 1U << 20;
+        if ((i == 1) && (latch & errLed) && !(port.FIOPIN.value & errLed)) {
+            ++MutableStatistics().ErrorLedOnCount;
+        }
+
+        port.FIOPIN.value = latch;
+        return;
+    }
+
+    Register.value = Value;
+}
+
+void GpioModel::SetPort0Pin (uint32_t Pin, bool Level)
+{
+    LPC_GPIOINT_TypeDef& gpioint = hostPeripherals.gpioint;
+    const uint32_t bit = 1U << Pin;
+    const bool previous = (this->port0Inputs & bit) != 0;
+
+    this->port0InputMask |= bit;
+    if (Level) {
+        this->port0Inputs |= bit;
+    } else {
+        this->port0Inputs &= ~bit;
+    }
+
+    if (previous && !Level && (gpioint.IO0IntEnF.value & bit)) {
+        gpioint.IO0IntStatF.value |= bit;
+    } else if (!previous && Level && (gpioint.IO0IntEnR.value & bit)) {
+        gpioint.IO0IntStatR.value |= bit;
+    }
+}
+
+//
+// TimerModel
+//
+TimerModel::TimerModel (uint32_t Index) :
+    regs(&hostPeripherals.tim[Index]),
+    index(Index)
+{ }
+
+bool TimerModel::Counting () const
+{
+    // counter mode counts edges of a CAP input, which is not simulated
+    return this->running && (this->regs->CTCR.value == 0);
+}
+
+uint32_t TimerModel::CounterAt (Cycles Time) const
+{
+    if (!Counting() || (Time <= this->baseTime)) {
+        return this->baseCount;
+    }
+
+    return this->baseCount + uint32_t((Time - this->baseTime) / this->tickCycles);
+}
+
+void TimerModel::Rebase (Cycles Time)
+{
+    this->baseCount = CounterAt(Time);
+    this->baseTime = Time;
+    this->tickCycles = SystemControl().TimerClockDivider(this->index) *
+        (Cycles(this->regs->PR.value) + 1);
+}
+
+uint32_t TimerModel::Read (const HostRegister& Register)
+{
+    if (&Register == &this->regs->TC) {
+        return CounterAt(Now());
+    } else if (&Register == &this->regs->PC) {
+        if (!Counting()) return 0;
+
+        const uint32_t divider = SystemControl().TimerClockDivider(this->index);
+        return uint32_t(((Now() - this->baseTime) % this->tickCycles) / divider);
+    }
+
+    return Register.value;
+}
+
+void TimerModel::Write (HostRegister& Register, uint32_t Value)
+{
+    const Cycles now = Now();
+
+    if (&Register == &this->regs->IR) {
+        // writing a 1 clears the flag
+        this->regs->IR.value &= ~Value;
+        return;
+    } else if (&Register == &this->regs->TCR) {
+        Rebase(now);
+        if (Value & TCR_RESET) {
+            this->baseCount = 0;
+        }
+        this->running = (Value & TCR_ENABLE) && !(Value & TCR_RESET);
+        this->regs->TCR.value = Value & (TCR_ENABLE | TCR_RESET);
+    } else if (&Register == &this->regs->TC) {
+        Rebase(now);
+        this->baseCount = Value;
+    } else if ((&Register == &this->regs->PR) ||
+               (&Register == &this->regs->CTCR)) {
+
+        Rebase(now);
+        Register.value = Value;
+        Rebase(now);
+    } else if ((&Register == &this->regs->PC) ||
+               (&Register == &this->regs->CR0) ||
+               (&Register == &this->regs->CR1)) {
+
+        // prescale counter writes are not simulated, captures are read only
+        return;
+    } else {
+        Register.value = Value;
+    }
+
+    ScheduleMatch(now);
+}
+
+//
+// Computes when the counter next becomes equal to a match register that
+// has an action enabled. A counter that already equals a match register
+// only matches it again after wrapping.
+//
+void TimerModel::ScheduleMatch (Cycles Time)
+{
+    this->nextMatchTime = NEVER;
+    if (!Counting()) return;
+
+    const uint32_t count = CounterAt(Time);
+    const Cycles elapsedTicks = (Time - this->baseTime) / this->tickCycles;
+    const HostRegister* const matchRegisters[] = {
+        &this->regs->MR0,
+        &this->regs->MR1,
+        &this->regs->MR2,
+        &this->regs->MR3,
+    };
+
+    for (uint32_t channel = 0; channel != 4; ++channel) {
+        if (!((this->regs->MCR.value >> (3 * channel)) & 0x7)) continue;
+
+        Cycles ticks = uint32_t(matchRegisters[channel]->value - count);
+        if (ticks == 0) {
+            ticks = Cycles(1) << 32;
+        }
+
+        const Cycles matchTime =
+            this->baseTime + ((elapsedTicks + ticks) * this->tickCycles);
+        this->nextMatchTime = std::min(this->nextMatchTime, matchTime);
+    }
+}
+
+void TimerModel::RunEvents (Cycles Time)
+{
+    const uint32_t count = CounterAt(Time);
+    const uint32_t matchRegisters[] = {
+        this->regs->MR0.value,
+        this->regs->MR1.value,
+        this->regs->MR2.value,
+        this->regs->MR3.value,
+    };
+
+    bool reset = false;
+    bool stop = false;
+    for (uint32_t channel = 0; channel != 4; ++channel) {
+        const uint32_t actions = (this->regs->MCR.value >> (3 * channel)) & 0x7;
+        if (!actions || (matchRegisters[channel] != count)) continue;
+
+        if (actions & 0x1) {
+            this->regs->IR.value |= 1U << channel;
+        }
+        reset = reset || (actions & 0x2);
+        stop = stop || (actions & 0x4);
+    }
+
+    Rebase(Time);
+    if (reset) {
+        this->baseCount = 0;
+    }
+
+    if (stop) {
+        this->running = false;
+        this->regs->TCR.value &= ~TCR_ENABLE;
+    }
+
+    ScheduleMatch(Time);
+
+    // a reset to a value that is not matched again schedules the match
+    // after the wrap; a match at the current count must not run twice
+    if (this->nextMatchTime <= Time) {
+        this->nextMatchTime = NEVER;
+    }
+}
+
+bool TimerModel::InterruptAsserted () const
+{
+    return (this->regs->IR.value & 0x3f) != 0;
+}
+
+void TimerModel::CaptureInput (uint32_t Channel, bool Rising, Cycles Time)
+{
+    const uint32_t ccr = this->regs->CCR.value >> (3 * Channel);
+    if (!(ccr & (Rising ? 0x1 : 0x2))) return;
+
+    HostRegister& capture = (Channel == 0) ? this->regs->CR0 : this->regs->CR1;
+    capture.value = CounterAt(Time);
+
+    if (ccr & 0x4) {
+        this->regs->IR.value |= 0x10U << Channel;
+    }
+}
+
+//
+// DwtModel
+//
+uint32_t DwtModel::Read (const HostRegister& Register)
+{
+    if (&Register == &hostPeripherals.dwt.CYCCNT) {
+        const bool enabled =
+            (hostPeripherals.coreDebug.DEMCR.value & CoreDebug_DEMCR_TRCENA_Msk) &&
+            (hostPeripherals.dwt.CTRL.value & DWT_CTRL_CYCCNTENA_Msk);
+
+        if (enabled) {
+            return uint32_t(Now() - this->offset);
+        }
+    }
+
+    return Register.value;
+}
+
+void DwtModel::Write (HostRegister& Register, uint32_t Value)
+{
+    if (&Register == &hostPeripherals.dwt.CYCCNT) {
+        this->offset = Now() - Value;
+    }
+
+    Register.value = Value;
+}
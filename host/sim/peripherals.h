@@ -0,0 +1,273 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Models of the LPC1768 peripherals used by the firmware, and of the bus
+// masters that drive the testers.
+//
+#ifndef _SIM_PERIPHERALS_H_
+#define _SIM_PERIPHERALS_H_
+
+namespace Sim {
+
+//
+// Clock and power: stores the clock selections the timers count from
+//
+class SystemControlModel : public Peripheral {
+public:
+
+    // PCLK divider of timer Index (0-3)
+    uint32_t TimerClockDivider (uint32_t Index) const;
+};
+
+//
+// GPIO ports 0-4 and the GPIO interrupt status registers. Pins driven by the
+// simulated bus masters read back their level in FIOPIN.
+//
+class GpioModel : public Peripheral {
+public:
+
+    uint32_t Read (const HostRegister& Register) override;
+    void Write (HostRegister& Register, uint32_t Value) override;
+
+    // drives an input on port 0, recording the edge interrupt status
+    void SetPort0Pin (uint32_t Pin, bool Level);
+
+private:
+    uint32_t port0Inputs = ~0U;
+    uint32_t port0InputMask = 0;
+};
+
+class TimerModel : public Peripheral {
+public:
+
+    explicit TimerModel (uint32_t Index);
+
+    uint32_t Read (const HostRegister& Register) override;
+    void Write (HostRegister& Register, uint32_t Value) override;
+    Cycles NextEventTime () const override { return this->nextMatchTime; }
+    void RunEvents (Cycles Time) override;
+    bool InterruptAsserted () const override;
+
+    //
+    // An edge on capture input Channel at Time. Latches the counter in
+    // CR0/CR1 if CCR selects the edge.
+    //
+    void CaptureInput (uint32_t Channel, bool Rising, Cycles Time);
+
+private:
+    bool Counting () const;
+    uint32_t CounterAt (Cycles Time) const;
+
+    // restarts the counter from its value at Time, so that the prescaler
+    // and clock divider can change
+    void Rebase (Cycles Time);
+    void ScheduleMatch (Cycles Time);
+
+    LPC_TIM_TypeDef* const regs;
+    const uint32_t index;
+    bool running = false;
+    Cycles baseTime = 0;        // time at which the counter was baseCount
+    uint32_t baseCount = 0;
+    Cycles tickCycles = 4;      // CCLK cycles per counter increment
+    Cycles nextMatchTime = NEVER;
+};
+
+//
+// SSP in slave mode. The frames are clocked by the SPI master, which pops
+// the transmit FIFO and pushes the receive FIFO.
+//
+class SspModel : public Peripheral {
+public:
+
+    explicit SspModel (uint32_t Index);
+
+    uint32_t Read (const HostRegister& Register) override;
+    void Write (HostRegister& Register, uint32_t Value) override;
+    Cycles NextEventTime () const override { return this->timeoutTime; }
+    void RunEvents (Cycles Time) override;
+    bool InterruptAsserted () const override;
+
+    // enabled in slave mode
+    bool Enabled () const;
+    uint32_t DataBitLength () const;
+
+    // the element to shift out in the frame that begins now
+    uint32_t BeginFrame ();
+
+    //
+    // The element shifted in by the frame that ended at Time. BitCycles is
+    // the bit period, from which the receive timeout is derived.
+    //
+    void EndFrame (uint32_t Element, Cycles Time, Cycles BitCycles);
+
+    void SetSelected (bool Selected) { this->selected = Selected; }
+
+    bool TxDmaRequest () const;
+    bool RxDmaRequest () const;
+
+private:
+    enum : uint32_t { FIFO_DEPTH = 8 };
+
+    uint32_t RawInterruptStatus () const;
+
+    LPC_SSP_TypeDef* const regs;
+    uint16_t txFifo[FIFO_DEPTH];
+    uint16_t rxFifo[FIFO_DEPTH];
+    uint32_t txHead = 0;
+    uint32_t txCount = 0;
+    uint32_t rxHead = 0;
+    uint32_t rxCount = 0;
+    bool overrun = false;
+    bool timeout = false;
+    bool selected = false;
+    Cycles timeoutTime = NEVER;
+};
+
+//
+// The GPDMA. Channels that have a pending request are serviced
+// immediately, which is faster than the hardware but preserves the order
+// of the transfers relative to the peripherals.
+//
+class GpdmaModel : public Peripheral {
+public:
+
+    uint32_t Read (const HostRegister& Register) override;
+    void Write (HostRegister& Register, uint32_t Value) override;
+    bool InterruptAsserted () const override;
+
+    //
+    // Runs the transfers of all channels whose requests are asserted. Must
+    // be called whenever a peripheral's DMA request may have changed.
+    //
+    void Service ();
+
+private:
+    bool RequestAsserted (uint32_t Channel) const;
+    void TransferElement (uint32_t Channel);
+
+    bool servicing = false;
+};
+
+//
+// The data watchpoint and trace unit's cycle counter. The counter stops
+// while the core sleeps, as on the LPC1768.
+//
+class DwtModel : public Peripheral {
+public:
+
+    uint32_t Read (const HostRegister& Register) override;
+    void Write (HostRegister& Register, uint32_t Value) override;
+
+    void Sleep (Cycles Duration) { this->offset += Duration; }
+
+private:
+    Cycles offset = 0;
+};
+
+//
+// An SPI master attached to an SSP. Chip select and SCK are also connected
+// to the SSP's port 0 pins, and to capture inputs 1 and 0 of the tester's
+// capture timer: P0.16, P0.15, CAP2.1 and CAP2.0 for SSP0, and P0.6, P0.7,
+// CAP3.1 and CAP3.0 for SSP1.
+//
+enum : uint32_t {
+    SPI_MASTER_COUNT = 2,
+    SPI_MASTER_SCK_CAPTURE = 0,
+    SPI_MASTER_CS_CAPTURE = 1,
+};
+
+class SpiMasterModel : public Peripheral {
+public:
+
+    SpiMasterModel (
+        uint32_t SspIndex,
+        uint32_t CsPin,
+        uint32_t SckPin,
+        uint32_t CaptureTimer
+        );
+
+    Cycles NextEventTime () const override { return this->nextEventTime; }
+    void RunEvents (Cycles Time) override;
+    bool Busy () const override;
+
+    void Queue (const std::shared_ptr<SpiTransfer>& Transfer);
+
+    // drives chip select and SCK to their idle levels
+    void Reset ();
+
+private:
+    void StartNext (Cycles Time);
+    Cycles EdgeTime (uint32_t Edge) const;
+    void SetClock (bool Level, Cycles Time);
+
+    const uint32_t sspIndex;
+    const uint32_t csPin;
+    const uint32_t sckPin;
+    const uint32_t captureTimer;
+    std::vector<std::shared_ptr<SpiTransfer>> queue;
+    std::shared_ptr<SpiTransfer> current;
+    Cycles startTime = 0;       // chip select assertion of current
+    Cycles bitCycles = 0;
+    uint32_t edgeCount = 0;     // edges in current
+    uint32_t nextEdge = 0;      // index of the next edge, or edgeCount
+    bool selected = false;
+    bool clock = true;
+    uint32_t shiftOut = 0;      // element the slave is shifting out
+    Cycles nextEventTime = NEVER;
+};
+
+//
+// I2C1 in slave mode, and the I2C master attached to it
+//
+class I2cModel : public Peripheral {
+public:
+
+    uint32_t Read (const HostRegister& Register) override;
+    void Write (HostRegister& Register, uint32_t Value) override;
+    Cycles NextEventTime () const override { return this->nextEventTime; }
+    void RunEvents (Cycles Time) override;
+    bool InterruptAsserted () const override;
+    bool Busy () const override;
+
+    void Queue (const std::shared_ptr<I2cTransaction>& Transaction);
+
+private:
+    enum class Step { Idle, Start, Address, Data, Stop };
+    enum class Slave { NotAddressed, Receiver, Transmitter };
+
+    void Interrupt (uint32_t Status);
+    bool AddressMatches (uint8_t Address) const;
+
+    // schedules Next to begin at Time, once the slave releases SCL
+    void Schedule (Step Next, Cycles Time);
+    void BeginStep (Cycles Time);
+    void CompleteStep (Cycles Time);
+    void StartNext (Cycles Time);
+
+    std::vector<std::shared_ptr<I2cTransaction>> queue;
+    std::shared_ptr<I2cTransaction> current;
+    Step step = Step::Idle;
+    bool stepBegun = false;
+    Cycles stepTime = 0;        // time the step is due to begin
+    uint32_t byteIndex = 0;
+    bool slaveAck = false;      // AA when the current byte began
+    uint8_t shiftOut = 0;       // byte the slave is transmitting
+    Slave slave = Slave::NotAddressed;
+    bool ignoreUntilStop = false;
+    bool busClaimed = false;    // the last transaction ended without a stop
+    Cycles bitCycles = 0;
+    Cycles nextEventTime = NEVER;
+};
+
+SystemControlModel& SystemControl ();
+GpioModel& Gpio ();
+TimerModel& Timer (uint32_t Index);
+SspModel& Ssp (uint32_t Index);
+GpdmaModel& Gpdma ();
+DwtModel& Dwt ();
+SpiMasterModel& SpiMaster (uint32_t Index);
+I2cModel& I2c ();
+
+} // namespace Sim
+
+#endif // _SIM_PERIPHERALS_H_
@@ -0,0 +1,211 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Runs the firmware against simulated LPC1768 peripherals on the host.
+//
+// The firmware's main() runs on its own thread, in lock step with the
+// harness: only one of the two runs at a time, so the simulation is
+// deterministic. The harness queues bus traffic and calls Run(), which runs
+// the firmware until the traffic is complete and the firmware has gone back
+// to sleep (or has polled for SettleCycles without sleeping, since some
+// commands wait for the next transfer in a polling loop).
+//
+// Time is counted in CCLK cycles. Each register access costs AccessCycles,
+// taking an interrupt costs INTERRUPT_ENTRY_CYCLES, and code between
+// register accesses takes no time. Simulated times therefore measure the
+// register traffic of a code path and how it interleaves with the bus, not
+// its instruction timing; use host time to compare the cost of code paths.
+//
+// Simulated:
+//  - NVIC priorities, PRIMASK and BASEPRI, WFI, and the DWT cycle counter
+//    (which stops while the core sleeps)
+//  - Timers 0-3 in timer mode: match interrupts, stop and reset on match,
+//    and captures of the SPI capture inputs
+//  - SSP0 and SSP1 in slave mode, with FIFOs, interrupts and DMA requests
+//  - The GPDMA for memory and SSP transfers, with linked lists
+//  - I2C1 in slave mode, with clock stretching while SI is set
+//  - P0 pin levels and falling edge interrupt status of the SPI chip
+//    select and clock
+//
+// Not simulated: the UARTs (build with TELEMETRY=0), pin muxing, timer
+// counter mode, match outputs and the timer match DMA requests, so periodic
+// interrupts and EdgeTrace captures do not work.
+//
+#ifndef _SIM_SIMULATOR_H_
+#define _SIM_SIMULATOR_H_
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace Sim {
+
+typedef uint64_t Cycles;
+
+enum : uint32_t {
+    CCLK_FREQUENCY = 96000000,
+    INTERRUPT_ENTRY_CYCLES = 12,
+    DEFAULT_ACCESS_CYCLES = 4,
+};
+
+const Cycles NEVER = ~Cycles(0);
+
+inline Cycles MicrosToCycles (uint64_t Micros)
+{
+    return Micros * (CCLK_FREQUENCY / 1000000);
+}
+
+//
+// Starts the firmware and runs it until it is idle. Must be called once,
+// before any other function.
+//
+void Boot ();
+
+//
+// Runs the firmware until all queued bus traffic is complete and the
+// firmware is idle. Returns false if that did not happen within Timeout
+// cycles, in which case queued traffic may still be pending.
+//
+bool Run (Cycles Timeout = MicrosToCycles(2000000));
+
+//
+// Runs the firmware for Duration cycles, whether or not it is idle
+//
+void RunFor (Cycles Duration);
+
+//
+// The simulated time, in cycles since Boot
+//
+Cycles Now ();
+
+//
+// The cost of a register access. Defaults to DEFAULT_ACCESS_CYCLES.
+//
+void SetAccessCycles (uint32_t AccessCycles);
+
+//
+// How long the firmware may poll without sleeping once the bus traffic is
+// complete before Run returns
+//
+void SetSettleCycles (Cycles SettleCycles);
+
+struct Statistics {
+    uint64_t RegisterAccesses;
+    uint64_t Interrupts[64];
+    Cycles SleepCycles;
+
+    // frames clocked while the SSP's transmit FIFO was empty, and frames
+    // lost because its receive FIFO was full
+    uint64_t SspTxUnderruns;
+    uint64_t SspRxOverruns;
+
+    // times the error LED (P1.20) was turned on, e.g. by FatalError
+    uint64_t ErrorLedOnCount;
+};
+
+const Statistics& GetStatistics ();
+void ResetStatistics ();
+
+//
+// SPI masters connected to SSP0 and SSP1, with SCK and chip select
+// jumpered to CAP2.0 and CAP2.1, and to CAP3.0 and CAP3.1, as described in
+// the Readme. The masters run independently, so transfers on the two buses
+// may overlap.
+//
+struct SpiSettings {
+    SpiSettings () :
+        Bus(0),
+        Mode(3),
+        Frequency(4000000),
+        DataBitLength(8),
+        GapCycles(MicrosToCycles(20)),
+        SetupCycles(0),
+        HoldCycles(0),
+        FrameGapCycles(0)
+    { }
+
+    uint32_t Bus;               // 0 for the master on SSP0, 1 for SSP1
+    uint32_t Mode;              // SPI mode 0-3
+    uint32_t Frequency;         // SCK frequency in Hz
+    uint32_t DataBitLength;
+    Cycles GapCycles;           // idle time before chip select asserts
+    Cycles SetupCycles;         // chip select to first edge, 0 for one bit
+    Cycles HoldCycles;          // last edge to chip select, 0 for one bit
+    Cycles FrameGapCycles;      // extra idle clock time between frames
+};
+
+struct SpiTransfer {
+    SpiSettings Settings;
+    std::vector<uint16_t> Mosi;
+
+    // filled in as the transfer runs
+    std::vector<uint16_t> Miso;
+    Cycles ChipSelectAssertTime;
+    Cycles ChipSelectDeassertTime;
+    Cycles FirstFallingEdgeTime;
+    Cycles LastFallingEdgeTime;
+    bool Complete;
+};
+
+//
+// Queues a transfer on Settings.Bus. It starts Settings.GapCycles after
+// the later of the end of the previous transfer on the bus and the time it
+// is queued.
+//
+std::shared_ptr<SpiTransfer> QueueSpiTransfer (
+    const SpiSettings& Settings,
+    const std::vector<uint16_t>& Mosi
+    );
+
+//
+// I2C master connected to I2C1
+//
+struct I2cSettings {
+    I2cSettings () :
+        Frequency(400000),
+        GapCycles(MicrosToCycles(20))
+    { }
+
+    uint32_t Frequency;         // SCL frequency in Hz
+    Cycles GapCycles;           // bus free time before the start condition
+};
+
+struct I2cTransaction {
+    I2cSettings Settings;
+    uint8_t Address;            // 7-bit address
+    bool Read;
+    std::vector<uint8_t> Data;  // written data, or the data read
+    uint32_t ReadLength;
+
+    //
+    // If false the transaction ends without a stop condition, and the next
+    // transaction begins with a repeated start
+    //
+    bool Stop;
+
+    // filled in as the transaction runs
+    bool AddressAcked;
+    uint32_t BytesAcked;        // written bytes acknowledged by the slave
+    Cycles StartTime;
+    Cycles EndTime;
+    Cycles StretchCycles;       // time SCL was held low by the slave
+    bool Complete;
+};
+
+std::shared_ptr<I2cTransaction> QueueI2cWrite (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    const std::vector<uint8_t>& Data,
+    bool Stop = true
+    );
+
+std::shared_ptr<I2cTransaction> QueueI2cRead (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    uint32_t Length,
+    bool Stop = true
+    );
+
+} // namespace Sim
+
+#endif // _SIM_SIMULATOR_H_
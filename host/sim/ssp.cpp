@@ -0,0 +1,384 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// SSP slave and SPI master models
+//
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <lpc17xx.h>
+
+#include "simulator.h"
+#include "core.h"
+#include "peripherals.h"
+
+using namespace Sim;
+
+namespace { // static
+
+enum : uint32_t {
+    CR1_SSE = 1 << 1,
+    CR1_MS = 1 << 2,
+
+    SR_TFE = 1 << 0,
+    SR_TNF = 1 << 1,
+    SR_RNE = 1 << 2,
+    SR_RFF = 1 << 3,
+    SR_BSY = 1 << 4,
+
+    RIS_ROR = 1 << 0,
+    RIS_RT = 1 << 1,
+    RIS_RX = 1 << 2,
+    RIS_TX = 1 << 3,
+
+    DMACR_RX = 1 << 0,
+    DMACR_TX = 1 << 1,
+
+    // the receive timeout fires after 32 idle bit periods
+    RECEIVE_TIMEOUT_BITS = 32,
+};
+
+SpiMasterModel spiMasters[SPI_MASTER_COUNT] = {
+    SpiMasterModel(0, 16, 15, 2),
+    SpiMasterModel(1, 6, 7, 3),
+};
+
+} // namespace "static"
+
+SpiMasterModel& Sim::SpiMaster (uint32_t Index) { return spiMasters[Index]; }
+
+//
+// SspModel
+//
+SspModel::SspModel (uint32_t Index) :
+    regs(&hostPeripherals.ssp[Index])
+{ }
+
+bool SspModel::Enabled () const
+{
+    return (this->regs->CR1.value & (CR1_SSE | CR1_MS)) == (CR1_SSE | CR1_MS);
+}
+
+uint32_t SspModel::DataBitLength () const
+{
+    return (this->regs->CR0.value & 0xf) + 1;
+}
+
+uint32_t SspModel::RawInterruptStatus () const
+{
+    return (this->overrun ? RIS_ROR : 0U) |
+        (this->timeout ? RIS_RT : 0U) |
+        ((this->rxCount >= (FIFO_DEPTH / 2)) ? RIS_RX : 0U) |
+        ((this->txCount <= (FIFO_DEPTH / 2)) ? RIS_TX : 0U);
+}
+
+bool SspModel::InterruptAsserted () const
+{
+    return (RawInterruptStatus() & this->regs->IMSC.value) != 0;
+}
+
+bool SspModel::TxDmaRequest () const
+{
+    return (this->regs->DMACR.value & DMACR_TX) && (this->txCount < FIFO_DEPTH);
+}
+
+bool SspModel::RxDmaRequest () const
+{
+    return (this->regs->DMACR.value & DMACR_RX) && (this->rxCount != 0);
+}
+
+uint32_t SspModel::Read (const HostRegister& Register)
+{
+    if (&Register == &this->regs->DR) {
+        if (this->rxCount == 0) {
+            return this->regs->DR.value;
+        }
+
+        const uint32_t element = this->rxFifo[this->rxHead];
+        this->rxHead = (this->rxHead + 1) % FIFO_DEPTH;
+        --this->rxCount;
+        this->regs->DR.value = element;
+
+        if (this->rxCount == 0) {
+            this->timeout = false;
+            this->timeoutTime = NEVER;
+        }
+        return element;
+    } else if (&Register == &this->regs->SR) {
+        return ((this->txCount == 0) ? SR_TFE : 0U) |
+            ((this->txCount < FIFO_DEPTH) ? SR_TNF : 0U) |
+            ((this->rxCount != 0) ? SR_RNE : 0U) |
+            ((this->rxCount == FIFO_DEPTH) ? SR_RFF : 0U) |
+            (this->selected ? SR_BSY : 0U);
+    } else if (&Register == &this->regs->RIS) {
+        return RawInterruptStatus();
+    } else if (&Register == &this->regs->MIS) {
+        return RawInterruptStatus() & this->regs->IMSC.value;
+    } else if (&Register == &this->regs->ICR) {
+        return 0;
+    }
+
+    return Register.value;
+}
+
+void SspModel::Write (HostRegister& Register, uint32_t Value)
+{
+    if (&Register == &this->regs->DR) {
+        if (this->txCount < FIFO_DEPTH) {
+            this->txFifo[(this->txHead + this->txCount) % FIFO_DEPTH] =
+                uint16_t(Value);
+            ++this->txCount;
+        }
+        return;
+    } else if (&Register == &this->regs->ICR) {
+        if (Value & RIS_ROR) {
+            this->overrun = false;
+        }
+        if (Value & RIS_RT) {
+            this->timeout = false;
+        }
+        return;
+    } else if ((&Register == &this->regs->SR) ||
+               (&Register == &this->regs->RIS) ||
+               (&Register == &this->regs->MIS)) {
+
+        // read only
+        return;
+    }
+
+    Register.value = Value;
+
+    if (&Register == &this->regs->DMACR) {
+        Gpdma().Service();
+    } else if ((&Register == &this->regs->CR1) && !(Value & CR1_SSE)) {
+        // disabling the SSP discards whatever is left to transmit
+        this->txCount = 0;
+    }
+}
+
+void SspModel::RunEvents (Cycles /*Time*/)
+{
+    this->timeoutTime = NEVER;
+    if (this->rxCount != 0) {
+        this->timeout = true;
+    }
+}
+
+uint32_t SspModel::BeginFrame ()
+{
+    if (this->txCount == 0) {
+        ++MutableStatistics().SspTxUnderruns;
+        return 0;
+    }
+
+    const uint32_t element = this->txFifo[this->txHead];
+    this->txHead = (this->txHead + 1) % FIFO_DEPTH;
+    --this->txCount;
+
+    Gpdma().Service();
+    return element & ((1U << DataBitLength()) - 1);
+}
+
+void SspModel::EndFrame (uint32_t Element, Cycles Time, Cycles BitCycles)
+{
+    if (this->rxCount == FIFO_DEPTH) {
+        ++MutableStatistics().SspRxOverruns;
+        this->overrun = true;
+    } else {
+        this->rxFifo[(this->rxHead + this->rxCount) % FIFO_DEPTH] =
+            uint16_t(Element & ((1U << DataBitLength()) - 1));
+        ++this->rxCount;
+    }
+
+    this->timeoutTime = Time + (RECEIVE_TIMEOUT_BITS * BitCycles);
+    Gpdma().Service();
+}
+
+//
+// SpiMasterModel
+//
+SpiMasterModel::SpiMasterModel (
+    uint32_t SspIndex,
+    uint32_t CsPin,
+    uint32_t SckPin,
+    uint32_t CaptureTimer
+    ) :
+    sspIndex(SspIndex),
+    csPin(CsPin),
+    sckPin(SckPin),
+    captureTimer(CaptureTimer)
+{ }
+
+//
+// The master idles with chip select deasserted and SCK high
+//
+void SpiMasterModel::Reset ()
+{
+    Gpio().SetPort0Pin(this->csPin, true);
+    Gpio().SetPort0Pin(this->sckPin, true);
+}
+
+void SpiMasterModel::Queue (const std::shared_ptr<SpiTransfer>& Transfer)
+{
+    this->queue.push_back(Transfer);
+    if (!this->current) {
+        StartNext(Now());
+    }
+}
+
+bool SpiMasterModel::Busy () const
+{
+    return this->current || !this->queue.empty();
+}
+
+//
+// Makes the next queued transfer current. Time is the end of the previous
+// transfer, or the time the transfer was queued if the bus was idle.
+//
+void SpiMasterModel::StartNext (Cycles Time)
+{
+    this->current.reset();
+    this->nextEventTime = NEVER;
+    if (this->queue.empty()) return;
+
+    this->current = this->queue.front();
+    this->queue.erase(this->queue.begin());
+
+    const SpiSettings& settings = this->current->Settings;
+    SetClock((settings.Mode & 0x2) != 0, Time);
+
+    this->bitCycles = std::max<Cycles>(2, CCLK_FREQUENCY / settings.Frequency);
+    this->edgeCount = 2 * settings.DataBitLength *
+        uint32_t(this->current->Mosi.size());
+    this->nextEdge = 0;
+    this->startTime = Time + settings.GapCycles;
+    this->nextEventTime = this->startTime;
+
+    this->current->Miso.clear();
+    this->current->FirstFallingEdgeTime = NEVER;
+    this->current->LastFallingEdgeTime = NEVER;
+}
+
+Cycles SpiMasterModel::EdgeTime (uint32_t Edge) const
+{
+    const SpiSettings& settings = this->current->Settings;
+    const uint32_t frameEdges = 2 * settings.DataBitLength;
+    const uint32_t frame = Edge / frameEdges;
+    const uint32_t edge = Edge % frameEdges;
+    const Cycles setup = settings.SetupCycles ?
+        settings.SetupCycles : this->bitCycles;
+
+    return this->startTime + setup +
+        (frame * ((settings.DataBitLength * this->bitCycles) +
+            settings.FrameGapCycles)) +
+        ((edge / 2) * this->bitCycles) +
+        ((edge & 1) ? (this->bitCycles / 2) : 0);
+}
+
+void SpiMasterModel::SetClock (bool Level, Cycles Time)
+{
+    if (Level == this->clock) return;
+
+    this->clock = Level;
+    Gpio().SetPort0Pin(this->sckPin, Level);
+    Timer(this->captureTimer).CaptureInput(
+        SPI_MASTER_SCK_CAPTURE,
+        Level,
+        Time);
+
+    if (!Level && this->selected) {
+        if (this->current->FirstFallingEdgeTime == NEVER) {
+            this->current->FirstFallingEdgeTime = Time;
+        }
+        this->current->LastFallingEdgeTime = Time;
+    }
+}
+
+void SpiMasterModel::RunEvents (Cycles Time)
+{
+    SpiTransfer& transfer = *this->current;
+    const SpiSettings& settings = transfer.Settings;
+    const Cycles hold = settings.HoldCycles ?
+        settings.HoldCycles : this->bitCycles;
+    SspModel& ssp = Ssp(this->sspIndex);
+
+    if (!this->selected) {
+        // chip select asserts
+        this->selected = true;
+        transfer.ChipSelectAssertTime = Time;
+        Gpio().SetPort0Pin(this->csPin, false);
+        Timer(this->captureTimer).CaptureInput(
+            SPI_MASTER_CS_CAPTURE,
+            false,
+            Time);
+        ssp.SetSelected(true);
+
+        if (this->edgeCount != 0) {
+            this->nextEventTime = EdgeTime(0);
+        } else {
+            const Cycles setup = settings.SetupCycles ?
+                settings.SetupCycles : this->bitCycles;
+            this->nextEventTime = Time + setup + hold;
+        }
+        return;
+    }
+
+    if (this->nextEdge != this->edgeCount) {
+        const uint32_t frameEdges = 2 * settings.DataBitLength;
+        const uint32_t edge = this->nextEdge % frameEdges;
+        const uint32_t frame = this->nextEdge / frameEdges;
+        ++this->nextEdge;
+
+        // the slave loads its shift register at the start of each frame,
+        // and the frame is complete after its last edge
+        if (edge == 0) {
+            this->shiftOut = ssp.Enabled() ? ssp.BeginFrame() : 0;
+        }
+
+        SetClock(!this->clock, Time);
+
+        if (edge == (frameEdges - 1)) {
+            if (ssp.Enabled()) {
+                ssp.EndFrame(transfer.Mosi[frame], Time, this->bitCycles);
+            }
+            transfer.Miso.push_back(uint16_t(
+                this->shiftOut & ((1U << settings.DataBitLength) - 1)));
+        }
+
+        this->nextEventTime = (this->nextEdge != this->edgeCount) ?
+            EdgeTime(this->nextEdge) : (Time + hold);
+        return;
+    }
+
+    // chip select deasserts
+    this->selected = false;
+    transfer.ChipSelectDeassertTime = Time;
+    transfer.Complete = true;
+    Gpio().SetPort0Pin(this->csPin, true);
+    Timer(this->captureTimer).CaptureInput(
+        SPI_MASTER_CS_CAPTURE,
+        true,
+        Time);
+    ssp.SetSelected(false);
+
+    StartNext(Time);
+}
+
+std::shared_ptr<SpiTransfer> Sim::QueueSpiTransfer (
+    const SpiSettings& Settings,
+    const std::vector<uint16_t>& Mosi
+    )
+{
+    auto transfer = std::make_shared<SpiTransfer>();
+    transfer->Settings = Settings;
+    transfer->Mosi = Mosi;
+    transfer->ChipSelectAssertTime = 0;
+    transfer->ChipSelectDeassertTime = 0;
+    transfer->FirstFallingEdgeTime = NEVER;
+    transfer->LastFallingEdgeTime = NEVER;
+    transfer->Complete = false;
+
+    SpiMaster(Settings.Bus).Queue(transfer);
+    return transfer;
+}
@@ -0,0 +1,156 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Tester protocol helpers for the simulated buses
+//
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "simulator.h"
+#include "lldtester.h"
+#include "testerbus.h"
+
+using namespace Sim;
+using namespace Lldt::Spi;
+
+namespace { // static
+
+uint32_t controlBus;
+
+} // namespace "static"
+
+void Sim::SelectSpiTester (uint32_t Bus)
+{
+    controlBus = Bus;
+}
+
+SpiSettings Sim::ControlSettings ()
+{
+    SpiSettings settings;
+    settings.Bus = controlBus;
+    settings.Mode = uint32_t(SPI_CONTROL_INTERFACE_MODE);
+    settings.Frequency = SPI_CONTROL_INTERFACE_FREQUENCY;
+    settings.DataBitLength = SPI_CONTROL_INTERFACE_DATABITLENGTH;
+    return settings;
+}
+
+uint16_t Sim::ReferenceCrc16 (const void* Data, uint32_t Length)
+{
+    const uint8_t* const data = static_cast<const uint8_t*>(Data);
+    uint32_t crc = 0;
+    for (uint32_t i = 0; i != Length; ++i) {
+        crc ^= uint32_t(data[i]) << 8;
+        for (uint32_t bit = 0; bit != 8; ++bit) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return uint16_t(crc);
+}
+
+bool Sim::ValidResponse (const void* Response, uint32_t Length)
+{
+    if (Length < sizeof(TransferHeader)) return false;
+
+    TransferHeader header;
+    memcpy(&header, Response, sizeof(header));
+    if (header.Header.Length != Length) return false;
+
+    // the checksum is computed with the checksum field zeroed
+    std::vector<uint8_t> copy(
+        static_cast<const uint8_t*>(Response),
+        static_cast<const uint8_t*>(Response) + Length);
+    memset(copy.data(), 0, sizeof(header.Header.Checksum));
+
+    return ReferenceCrc16(copy.data(), Length) == header.Header.Checksum;
+}
+
+bool Sim::SpiCommand (
+    const CommandBlock& Command,
+    const std::vector<uint8_t>& Extra
+    )
+{
+    const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(&Command);
+    std::vector<uint16_t> mosi(bytes, bytes + sizeof(Command));
+    mosi.insert(mosi.end(), Extra.begin(), Extra.end());
+
+    return SpiRunTransfer(ControlSettings(), mosi) != nullptr;
+}
+
+bool Sim::SpiReadResponse (void* Response, uint32_t Length)
+{
+    auto transfer = SpiRunTransfer(
+        ControlSettings(),
+        std::vector<uint16_t>(Length, 0));
+    if (transfer == nullptr) return false;
+
+    uint8_t* const response = static_cast<uint8_t*>(Response);
+    for (uint32_t i = 0; i != Length; ++i) {
+        response[i] = uint8_t(transfer->Miso[i]);
+    }
+    return true;
+}
+
+bool Sim::SpiQuery (
+    const CommandBlock& Command,
+    void* Response,
+    uint32_t Length
+    )
+{
+    return SpiCommand(Command) &&
+        SpiReadResponse(Response, Length) &&
+        ValidResponse(Response, Length);
+}
+
+std::shared_ptr<SpiTransfer> Sim::SpiRunTransfer (
+    const SpiSettings& Settings,
+    const std::vector<uint16_t>& Mosi
+    )
+{
+    auto transfer = QueueSpiTransfer(Settings, Mosi);
+    if (!Run() || !transfer->Complete) return nullptr;
+    return transfer;
+}
+
+bool Sim::I2cWriteRegisters (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    uint8_t Register,
+    const std::vector<uint8_t>& Data
+    )
+{
+    std::vector<uint8_t> bytes(1 + Data.size());
+    bytes[0] = Register;
+    std::copy(Data.begin(), Data.end(), bytes.begin() + 1);
+
+    auto transaction = QueueI2cWrite(Settings, Address, bytes);
+    return Run() && transaction->Complete &&
+        (transaction->BytesAcked == bytes.size());
+}
+
+bool Sim::I2cReadRegisters (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    uint8_t Register,
+    uint32_t Length,
+    std::vector<uint8_t>& Data
+    )
+{
+    auto write = QueueI2cWrite(
+        Settings,
+        Address,
+        std::vector<uint8_t>(1, Register),
+        false);
+    auto read = QueueI2cRead(Settings, Address, Length);
+
+    if (!Run() || !write->Complete || !read->Complete ||
+        (write->BytesAcked != 1) || !read->AddressAcked) {
+
+        return false;
+    }
+
+    Data = read->Data;
+    return true;
+}
@@ -0,0 +1,106 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Speaks the tester protocols of lldtester.h over the simulated buses, as
+// the HLK tests do over the real ones. Each function queues its bus traffic
+// and runs the firmware until the traffic is complete.
+//
+// Include simulator.h and lldtester.h first.
+//
+#ifndef _SIM_TESTERBUS_H_
+#define _SIM_TESTERBUS_H_
+
+namespace Sim {
+
+//
+// Selects the SPI tester that SpiCommand, SpiReadResponse and SpiQuery
+// talk to: 0 for the tester on SSP0, which is the default, or 1 for the
+// tester on SSP1
+//
+void SelectSpiTester (uint32_t Bus);
+
+//
+// The settings of the selected tester's SPI control interface, over which
+// commands are sent and responses are read
+//
+SpiSettings ControlSettings ();
+
+//
+// CRC16-CCITT as used by TransferHeader, computed bit by bit so that it is
+// independent of the firmware's table driven implementation
+//
+uint16_t ReferenceCrc16 (const void* Data, uint32_t Length);
+
+//
+// Returns true if Response holds a TransferHeader whose Length is Length
+// and whose Checksum is correct
+//
+bool ValidResponse (const void* Response, uint32_t Length);
+
+//
+// Sends Command, followed in the same transfer by Extra (the command blocks
+// of a batch or the elements of an uploaded pattern). Returns false if the
+// transfer did not complete or the firmware did not become idle.
+//
+bool SpiCommand (
+    const Lldt::Spi::CommandBlock& Command,
+    const std::vector<uint8_t>& Extra = std::vector<uint8_t>()
+    );
+
+//
+// Reads a response of Length bytes into Response. The command that produces
+// it must already have been sent.
+//
+bool SpiReadResponse (void* Response, uint32_t Length);
+
+//
+// Sends a query and reads its response, which must be valid.
+//
+bool SpiQuery (
+    const Lldt::Spi::CommandBlock& Command,
+    void* Response,
+    uint32_t Length
+    );
+
+template <typename Ty>
+bool SpiQuery (const Lldt::Spi::CommandBlock& Command, Ty& Response)
+{
+    return SpiQuery(Command, &Response, sizeof(Response));
+}
+
+//
+// Clocks a transfer through the tester, e.g. one that it has been told to
+// capture. Returns nullptr if the transfer did not complete.
+//
+std::shared_ptr<SpiTransfer> SpiRunTransfer (
+    const SpiSettings& Settings,
+    const std::vector<uint16_t>& Mosi
+    );
+
+//
+// Writes Data to the registers of the I2C device at Address, starting at
+// Register. Returns false if any byte was not acknowledged.
+//
+bool I2cWriteRegisters (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    uint8_t Register,
+    const std::vector<uint8_t>& Data
+    );
+
+//
+// Reads Length bytes from the registers of the I2C device at Address,
+// starting at Register. The register address is written and the data read
+// in a single transaction with a repeated start.
+//
+bool I2cReadRegisters (
+    const I2cSettings& Settings,
+    uint8_t Address,
+    uint8_t Register,
+    uint32_t Length,
+    std::vector<uint8_t>& Data
+    );
+
+} // namespace Sim
+
+#endif // _SIM_TESTERBUS_H_
@@ -0,0 +1,422 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Tests of the host client library, run against the simulated firmware
+// through SimPort. A port that corrupts chosen transfers checks that the
+// client rejects the responses it should.
+//
+// Usage: lldt-clienttests [test name...]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "lldtester.h"
+#include "lldtclient.h"
+#include "simport.h"
+
+using namespace Lldt;
+using namespace Lldt::Spi;
+using namespace Lldt::Client;
+
+namespace { // static
+
+int checkFailures;
+
+bool Check (bool Condition, const char* Text, int Line)
+{
+    if (!Condition) {
+        fprintf(stderr, "  line %d: check failed: %s\n", Line, Text);
+        ++checkFailures;
+    }
+    return Condition;
+}
+
+#define CHECK(Condition) Check((Condition), #Condition, __LINE__)
+
+// returns from the test if the check fails
+#define REQUIRE(Condition) \
+    do { if (!CHECK(Condition)) return; } while (0)
+
+//
+// Passes transfers through to another port, flipping a bit of the data read
+// by the transfer armed with CorruptRead
+//
+class FaultPort : public SpiPort {
+public:
+    explicit FaultPort (SpiPort& Port) :
+        port(Port),
+        corruptTransfer(0),
+        corruptOffset(0)
+    { }
+
+    //
+    // Flips bit 0 of the byte at Offset of the data read by the transfer
+    // after the next Transfers transfers
+    //
+    void CorruptRead (uint32_t Transfers, uint32_t Offset)
+    {
+        this->corruptTransfer = Transfers + 1;
+        this->corruptOffset = Offset;
+    }
+
+    bool Configure (
+        SpiDataMode Mode,
+        uint32_t Frequency,
+        uint32_t DataBitLength
+        ) override
+    {
+        return this->port.Configure(Mode, Frequency, DataBitLength);
+    }
+
+    bool Transfer (const uint8_t* Write, uint8_t* Read, uint32_t Length) override
+    {
+        if (!this->port.Transfer(Write, Read, Length)) return false;
+
+        if ((this->corruptTransfer != 0) && (--this->corruptTransfer == 0) &&
+            (Read != nullptr) && (this->corruptOffset < Length)) {
+
+            Read[this->corruptOffset] ^= 1;
+        }
+        return true;
+    }
+
+    uint64_t LastTransferNanos () const override
+    {
+        return this->port.LastTransferNanos();
+    }
+
+    uint64_t NowNanos () override { return this->port.NowNanos(); }
+
+private:
+    SpiPort& port;
+    uint32_t corruptTransfer;
+    uint32_t corruptOffset;
+};
+
+FaultPort* faultPort;
+TesterClient* client;
+
+std::vector<uint8_t> Counter (uint32_t First, uint32_t Count)
+{
+    std::vector<uint8_t> bytes;
+    for (uint32_t i = 0; i != Count; ++i) {
+        bytes.push_back(uint8_t(First + i));
+    }
+    return bytes;
+}
+
+void TestDeviceInfo ()
+{
+    const TesterInfo* info = client->GetDeviceInfo();
+    REQUIRE(info != nullptr);
+    CHECK(info->DeviceId == DEVICE_ID);
+    CHECK(info->Version == VERSION);
+
+    // the maximum frequency depends on the engine and frame width
+    const uint32_t polled8 = info->MaxFrequency;
+    info = client->GetDeviceInfo(CaptureMode::Dma, 16);
+    REQUIRE(info != nullptr);
+    CHECK(info->MaxFrequency >= polled8);
+}
+
+//
+// The engine limits in TesterInfo2 give the MaxFrequency that TesterInfo
+// reports for each engine and width
+//
+void TestDeviceInfo2 ()
+{
+    const TesterInfo2* info2 = client->GetDeviceInfo2();
+    REQUIRE(info2 != nullptr);
+    CHECK(info2->DeviceId == DEVICE_ID);
+    CHECK(info2->InfoVersion == DEVICE_INFO_VERSION);
+    CHECK((info2->Capabilities & SPI_CAPABILITY_DMA_CAPTURE) != 0);
+    CHECK(info2->CaptureBufferSize == CAPTURE_BUFFER_SIZE);
+
+    static const CaptureMode engines[] = {
+        CaptureMode::Polled,
+        CaptureMode::Dma,
+        CaptureMode::Record,
+    };
+    static const uint32_t widths[] = { 4, 8, 16 };
+    for (CaptureMode engine : engines) {
+        for (uint32_t width : widths) {
+            info2 = client->GetDeviceInfo2(engine, width);
+            REQUIRE(info2 != nullptr);
+            const CaptureEngineLimits limits = info2->Engines[engine];
+            const uint32_t expected = (limits.MaxElementRate == 0) ?
+                limits.MaxFrequency :
+                std::min(limits.MaxElementRate * width, limits.MaxFrequency);
+            CHECK(info2->MaxFrequency == expected);
+
+            const TesterInfo* const info = client->GetDeviceInfo(engine, width);
+            REQUIRE(info != nullptr);
+            CHECK(info->MaxFrequency == expected);
+        }
+    }
+}
+
+void TestResponseLength ()
+{
+    CHECK(TesterClient::ResponseLength(
+        CommandBlock(SpiTesterCommand::GetDeviceInfo)) == sizeof(TesterInfo));
+    CHECK(TesterClient::ResponseLength(
+        CommandBlock(SpiTesterCommand::GetTransferInfo)) == sizeof(TransferInfo));
+
+    CommandBlock command(SpiTesterCommand::GetTransferInfo);
+    command.u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+    CHECK(TesterClient::ResponseLength(command) == sizeof(TransferInfo2));
+
+    CommandBlock deviceInfo2(SpiTesterCommand::GetDeviceInfo);
+    deviceInfo2.u.GetDeviceInfo.InfoVersion = DEVICE_INFO_VERSION;
+    CHECK(TesterClient::ResponseLength(deviceInfo2) == sizeof(TesterInfo2));
+
+    CHECK(TesterClient::ResponseLength(
+        CommandBlock(SpiTesterCommand::CaptureNextTransfer)) == 0);
+    CHECK(TesterClient::ResponseLength(
+        CommandBlock(SpiTesterCommand::AcknowledgeInterrupt)) == 0);
+}
+
+void TestInvalidResponse ()
+{
+    client->ResetStatistics();
+
+    // corrupt the payload, then the checksum, then the length
+    static const uint32_t offsets[] = { 10, 0, 2 };
+    for (uint32_t offset : offsets) {
+        faultPort->CorruptRead(1, offset);
+        CHECK(client->GetDeviceInfo() == nullptr);
+    }
+    CHECK(client->Statistics().InvalidResponses == 3);
+
+    // and the client recovers
+    CHECK(client->GetDeviceInfo() != nullptr);
+    CHECK(client->Statistics().InvalidResponses == 3);
+    CHECK(client->Statistics().TransferErrors == 0);
+}
+
+void TestCapture ()
+{
+    CaptureParameters parameters;
+    parameters.SendValue = 7;
+    parameters.ReceiveValue = 0x30;
+
+    const uint32_t count = 48;
+    const std::vector<uint8_t> mosi = Counter(parameters.SendValue, count);
+    std::vector<uint8_t> miso(count);
+
+    const TransferInfo2* info = client->Capture(
+        parameters,
+        mosi.data(),
+        miso.data(),
+        count);
+    REQUIRE(info != nullptr);
+    CHECK(info->ElementCount == count);
+    CHECK(info->MismatchIndex == count);
+    CHECK(miso == Counter(parameters.ReceiveValue, count));
+    CHECK(client->LastCaptureNanos() != 0);
+
+    // the mismatch of a corrupted element is reported
+    std::vector<uint8_t> corrupted = mosi;
+    corrupted[5] ^= 0x80;
+    info = client->Capture(parameters, corrupted.data(), nullptr, count);
+    REQUIRE(info != nullptr);
+    CHECK(info->MismatchIndex == 5);
+}
+
+void TestWideCapture ()
+{
+    CaptureParameters parameters;
+    parameters.DataBitLength = 12;
+    parameters.Frequency = 8000000;
+    parameters.Engine = CaptureMode::Dma;
+    parameters.SendValue = 0x0ff0;
+    parameters.ReceiveValue = 0x0123;
+
+    // two bytes per element, least significant first
+    const uint32_t count = 100;
+    std::vector<uint8_t> mosi;
+    std::vector<uint8_t> expectedMiso;
+    for (uint32_t i = 0; i != count; ++i) {
+        const uint32_t send = (parameters.SendValue + i) & 0xfff;
+        const uint32_t receive = (parameters.ReceiveValue + i) & 0xfff;
+        mosi.push_back(uint8_t(send));
+        mosi.push_back(uint8_t(send >> 8));
+        expectedMiso.push_back(uint8_t(receive));
+        expectedMiso.push_back(uint8_t(receive >> 8));
+    }
+    std::vector<uint8_t> miso(mosi.size());
+
+    const TransferInfo2* const info = client->Capture(
+        parameters,
+        mosi.data(),
+        miso.data(),
+        uint32_t(mosi.size()));
+    REQUIRE(info != nullptr);
+    CHECK(info->ElementCount == count);
+    CHECK(info->MismatchIndex == count);
+    CHECK(miso == expectedMiso);
+
+    // and the client goes back to the control interface
+    CHECK(client->GetDeviceInfo() != nullptr);
+}
+
+void TestUserPattern ()
+{
+    static const uint16_t table[] = { 0x5a, 0xa5, 0x00, 0xff, 0x81 };
+    const uint32_t tableLength = sizeof(table) / sizeof(table[0]);
+    REQUIRE(client->LoadPattern(CapturePattern::User, 8, table, tableLength));
+
+    CaptureParameters parameters;
+    parameters.SendValue = 1;
+    parameters.ReceiveValue = 3;
+
+    const uint32_t count = 2 * tableLength;
+    std::vector<uint8_t> mosi;
+    std::vector<uint8_t> expectedMiso;
+    for (uint32_t i = 0; i != count; ++i) {
+        mosi.push_back(uint8_t(table[(parameters.SendValue + i) % tableLength]));
+        expectedMiso.push_back(
+            uint8_t(table[(parameters.ReceiveValue + i) % tableLength]));
+    }
+    std::vector<uint8_t> miso(count);
+
+    const TransferInfo2* const info = client->Capture(
+        parameters,
+        mosi.data(),
+        miso.data(),
+        count);
+    CHECK(info != nullptr);
+    if (info != nullptr) {
+        CHECK(info->MismatchIndex == count);
+    }
+    CHECK(miso == expectedMiso);
+
+    CHECK(client->LoadPattern(CapturePattern::Counter, 8));
+    CHECK(!client->LoadPattern(
+        CapturePattern::User,
+        8,
+        table,
+        PATTERN_TABLE_LENGTH + 1));
+}
+
+void TestBatch ()
+{
+    CommandBlock transferInfo(SpiTesterCommand::GetTransferInfo);
+    transferInfo.u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+
+    client->BeginBatch();
+    REQUIRE(client->AddToBatch(CommandBlock(SpiTesterCommand::GetDeviceInfo)));
+    REQUIRE(client->AddToBatch(transferInfo));
+    REQUIRE(client->AddToBatch(CommandBlock(SpiTesterCommand::GetStreamingInfo)));
+    REQUIRE(client->ExecuteBatch());
+
+    const TesterInfo* const info = client->BatchResponse<TesterInfo>(0);
+    REQUIRE(info != nullptr);
+    CHECK(info->DeviceId == DEVICE_ID);
+    CHECK(client->BatchResponse<TransferInfo2>(1) != nullptr);
+    CHECK(client->BatchResponse<StreamingInfo>(2) != nullptr);
+
+    // the response type must match the query
+    CHECK(client->BatchResponse<TransferInfo>(1) == nullptr);
+    CHECK(client->BatchResponse<TesterInfo>(3) == nullptr);
+
+    // a corrupted response invalidates only its own entry
+    faultPort->CorruptRead(1, sizeof(TesterInfo) + 20);
+    CHECK(!client->ExecuteBatch());
+    CHECK(client->BatchResponse<TesterInfo>(0) != nullptr);
+    CHECK(client->BatchResponse<TransferInfo2>(1) == nullptr);
+    CHECK(client->BatchResponse<StreamingInfo>(2) != nullptr);
+
+    // nothing may follow a command that is not a query
+    CommandBlock loadPattern(SpiTesterCommand::LoadPattern);
+    loadPattern.u.LoadPattern.Pattern = CapturePattern::Counter;
+    loadPattern.u.LoadPattern.DataBitLength = 8;
+    client->BeginBatch();
+    REQUIRE(client->AddToBatch(CommandBlock(SpiTesterCommand::GetDeviceInfo)));
+    REQUIRE(client->AddToBatch(loadPattern));
+    CHECK(!client->AddToBatch(CommandBlock(SpiTesterCommand::GetDeviceInfo)));
+    CHECK(client->ExecuteBatch());
+    CHECK(client->BatchResponse<TesterInfo>(0) != nullptr);
+
+    // the tester does not receive uploaded patterns within a batch
+    loadPattern.u.LoadPattern.Pattern = CapturePattern::User;
+    client->BeginBatch();
+    CHECK(!client->AddToBatch(loadPattern));
+
+    // and the batch is limited to BATCH_MAX_COMMANDS
+    client->BeginBatch();
+    for (uint32_t i = 0; i != BATCH_MAX_COMMANDS; ++i) {
+        CHECK(client->AddToBatch(CommandBlock(SpiTesterCommand::GetDeviceInfo)));
+    }
+    CHECK(!client->AddToBatch(CommandBlock(SpiTesterCommand::GetDeviceInfo)));
+    CHECK(client->ExecuteBatch());
+    CHECK(client->BatchResponse<TesterInfo>(BATCH_MAX_COMMANDS - 1) != nullptr);
+}
+
+void TestNoInterruptLine ()
+{
+    // the simulator does not model the interrupt pin
+    std::vector<uint32_t> latencies;
+    CHECK(client->RunPeriodicInterrupts(1000, 1, latencies) == nullptr);
+    CHECK(latencies.empty());
+    CHECK(client->GetDeviceInfo() != nullptr);
+}
+
+struct Test {
+    const char* Name;
+    void (*Run) ();
+};
+
+const Test tests[] = {
+    { "DeviceInfo", &TestDeviceInfo },
+    { "DeviceInfo2", &TestDeviceInfo2 },
+    { "ResponseLength", &TestResponseLength },
+    { "InvalidResponse", &TestInvalidResponse },
+    { "Capture", &TestCapture },
+    { "WideCapture", &TestWideCapture },
+    { "UserPattern", &TestUserPattern },
+    { "Batch", &TestBatch },
+    { "NoInterruptLine", &TestNoInterruptLine },
+};
+
+bool Selected (const char* Name, int argc, char* argv[])
+{
+    if (argc < 2) return true;
+    for (int i = 1; i != argc; ++i) {
+        if (strcmp(argv[i], Name) == 0) return true;
+    }
+    return false;
+}
+
+} // namespace "static"
+
+int main (int argc, char* argv[])
+{
+    SimPort simPort;
+    FaultPort port(simPort);
+    TesterClient testerClient(port);
+    faultPort = &port;
+    client = &testerClient;
+
+    int failedTests = 0;
+    int ranTests = 0;
+    for (const Test& test : tests) {
+        if (!Selected(test.Name, argc, argv)) continue;
+
+        const int failuresBefore = checkFailures;
+        test.Run();
+        ++ranTests;
+
+        const bool passed = checkFailures == failuresBefore;
+        if (!passed) {
+            ++failedTests;
+        }
+        printf("%s %s\n", passed ? "PASS" : "FAIL", test.Name);
+    }
+
+    printf("%d of %d tests passed\n", ranTests - failedTests, ranTests);
+    return (failedTests == 0) ? 0 : 1;
+}
@@ -0,0 +1,901 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Regression tests of the tester firmware, run against the simulated
+// peripherals. Each test drives the buses as the HLK tests would and checks
+// the tester's responses against what the simulated masters observed.
+//
+// Usage: lldt-tests [test name...]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "simulator.h"
+#include "lldtester.h"
+#include "testerbus.h"
+
+using namespace Sim;
+using namespace Lldt;
+using namespace Lldt::Spi;
+
+namespace { // static
+
+int checkFailures;
+
+bool Check (bool Condition, const char* Text, int Line)
+{
+    if (!Condition) {
+        fprintf(stderr, "  line %d: check failed: %s\n", Line, Text);
+        ++checkFailures;
+    }
+    return Condition;
+}
+
+#define CHECK(Condition) Check((Condition), #Condition, __LINE__)
+
+// returns from the test if the check fails
+#define REQUIRE(Condition) \
+    do { if (!CHECK(Condition)) return; } while (0)
+
+//
+// The checksum the tester reports for a capture: the CRC16 of the received
+// elements, with wide elements little-endian
+//
+uint32_t CaptureChecksum (
+    const std::vector<uint16_t>& Elements,
+    uint32_t DataBitLength
+    )
+{
+    std::vector<uint8_t> bytes;
+    for (uint16_t element : Elements) {
+        bytes.push_back(uint8_t(element));
+        if (DataBitLength > 8) {
+            bytes.push_back(uint8_t(element >> 8));
+        }
+    }
+    return ReferenceCrc16(bytes.data(), uint32_t(bytes.size()));
+}
+
+std::vector<uint16_t> Counter (
+    uint32_t First,
+    uint32_t Count,
+    uint32_t DataBitLength
+    )
+{
+    std::vector<uint16_t> elements;
+    for (uint32_t i = 0; i != Count; ++i) {
+        elements.push_back(uint16_t((First + i) & ((1U << DataBitLength) - 1)));
+    }
+    return elements;
+}
+
+bool StartCapture (
+    CaptureMode Engine,
+    uint32_t DataBitLength,
+    uint16_t SendValue,
+    uint16_t ReceiveValue
+    )
+{
+    CommandBlock command(SpiTesterCommand::CaptureNextTransfer);
+    command.u.CaptureNextTransfer.Mode = Mode3;
+    command.u.CaptureNextTransfer.DataBitLength = uint8_t(DataBitLength);
+    command.u.CaptureNextTransfer.SendValue = SendValue;
+    command.u.CaptureNextTransfer.ReceiveValue = ReceiveValue;
+    command.u.CaptureNextTransfer.CaptureMode = uint8_t(Engine);
+    return SpiCommand(command);
+}
+
+bool GetTransferInfo2 (TransferInfo2& Info)
+{
+    CommandBlock command(SpiTesterCommand::GetTransferInfo);
+    command.u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+    return SpiQuery(command, Info);
+}
+
+bool LoadGeneratedPattern (CapturePattern Pattern, uint32_t DataBitLength)
+{
+    CommandBlock command(SpiTesterCommand::LoadPattern);
+    command.u.LoadPattern.Pattern = uint8_t(Pattern);
+    command.u.LoadPattern.DataBitLength = uint8_t(DataBitLength);
+    return SpiCommand(command);
+}
+
+void TestDeviceInfo ()
+{
+    TesterInfo info;
+    REQUIRE(SpiQuery(CommandBlock(SpiTesterCommand::GetDeviceInfo), info));
+    CHECK(info.DeviceId == DEVICE_ID);
+    CHECK(info.Version == VERSION);
+    CHECK(info.ClockMeasurementFrequency == CCLK_FREQUENCY);
+    CHECK(info.MinDataBitLength == 4);
+    CHECK(info.MaxDataBitLength == 16);
+    CHECK(info.MaxFrequency != 0);
+}
+
+void TestDeviceInfo2 ()
+{
+    CommandBlock command(SpiTesterCommand::GetDeviceInfo);
+    command.u.GetDeviceInfo.CaptureMode = CaptureMode::Polled;
+    command.u.GetDeviceInfo.DataBitLength = 16;
+    command.u.GetDeviceInfo.InfoVersion = DEVICE_INFO_VERSION;
+
+    TesterInfo2 info;
+    REQUIRE(SpiQuery(command, info));
+    CHECK(info.DeviceId == DEVICE_ID);
+    CHECK(info.Version == VERSION);
+    CHECK(info.InfoVersion == DEVICE_INFO_VERSION);
+    CHECK(info.Capabilities == SPI_CAPABILITIES);
+    CHECK(info.MaxInterruptFrequency == MAX_INTERRUPT_FREQUENCY);
+    CHECK(info.CaptureBufferSize == CAPTURE_BUFFER_SIZE);
+    CHECK(info.PatternTableLength == PATTERN_TABLE_LENGTH);
+    CHECK(info.BatchMaxCommands == BATCH_MAX_COMMANDS);
+    CHECK(info.BatchResponseBufferSize == BATCH_RESPONSE_BUFFER_SIZE);
+
+    // the Dma engine's limit is PCLK/12 at any width, and the Polled
+    // engine's scales with the width up to it
+    const CaptureEngineLimits& dma = info.Engines[CaptureMode::Dma];
+    const CaptureEngineLimits& polled = info.Engines[CaptureMode::Polled];
+    CHECK(dma.MaxFrequency == CCLK_FREQUENCY / 12);
+    CHECK(dma.MaxElementRate == 0);
+    CHECK(polled.MaxElementRate == POLLED_CAPTURE_MAX_FREQUENCY / 8);
+    CHECK(info.MaxFrequency ==
+        std::min(polled.MaxElementRate * 16, polled.MaxFrequency));
+
+    // masters that leave InfoVersion zero still get TesterInfo
+    command.u.GetDeviceInfo.InfoVersion = 0;
+    TesterInfo original;
+    REQUIRE(SpiQuery(command, original));
+    CHECK(original.MaxFrequency == info.MaxFrequency);
+}
+
+//
+// Captures a counter with Engine and checks the results against the
+// transfer the master clocked
+//
+void TestCapture (CaptureMode Engine, uint32_t DataBitLength)
+{
+    const uint32_t count = 64;
+    const uint16_t sendValue = 3;
+    const uint16_t receiveValue = 0x40;
+
+    REQUIRE(StartCapture(Engine, DataBitLength, sendValue, receiveValue));
+
+    SpiSettings settings;
+    settings.DataBitLength = DataBitLength;
+    settings.Frequency = 2000000;
+    const std::vector<uint16_t> mosi = Counter(sendValue, count, DataBitLength);
+    auto transfer = SpiRunTransfer(settings, mosi);
+    REQUIRE(transfer != nullptr);
+
+    TransferInfo2 info;
+    REQUIRE(GetTransferInfo2(info));
+    CHECK(info.ElementCount == count);
+    CHECK(info.MismatchIndex == count);
+    CHECK(info.Checksum == CaptureChecksum(mosi, DataBitLength));
+    CHECK(transfer->Miso == Counter(receiveValue, count, DataBitLength));
+
+    // the capture timer counts CCLK cycles
+    CHECK(info.ClockActiveTimeStatus == ClockMeasurementStatus::Success);
+    const Cycles clockActive =
+        transfer->LastFallingEdgeTime - transfer->FirstFallingEdgeTime;
+    CHECK((info.ClockActiveTime + 1 >= clockActive) &&
+          (info.ClockActiveTime <= clockActive + 1));
+
+    CHECK(info.ChipSelectTimeStatus == ClockMeasurementStatus::Success);
+    const Cycles chipSelectActive =
+        transfer->ChipSelectDeassertTime - transfer->ChipSelectAssertTime;
+    CHECK((info.ChipSelectActiveTime + 1 >= chipSelectActive) &&
+          (info.ChipSelectActiveTime <= chipSelectActive + 1));
+}
+
+void TestPolledCapture8 () { TestCapture(CaptureMode::Polled, 8); }
+void TestPolledCapture16 () { TestCapture(CaptureMode::Polled, 16); }
+void TestDmaCapture8 () { TestCapture(CaptureMode::Dma, 8); }
+void TestDmaCapture16 () { TestCapture(CaptureMode::Dma, 16); }
+void TestRecordCapture8 () { TestCapture(CaptureMode::Record, 8); }
+void TestRecordCapture12 () { TestCapture(CaptureMode::Record, 12); }
+
+//
+// Widths outside MinDataBitLength-MaxDataBitLength capture 8-bit frames
+//
+void TestOutOfRangeWidth ()
+{
+    const uint32_t count = 48;
+
+    static const CaptureMode engines[] = {
+        CaptureMode::Polled,
+        CaptureMode::Dma,
+        CaptureMode::Record,
+    };
+    static const uint32_t widths[] = { 2, 17, 32, 200 };
+
+    for (CaptureMode engine : engines) {
+        for (uint32_t width : widths) {
+            REQUIRE(StartCapture(engine, width, 5, 0x70));
+
+            SpiSettings settings;
+            settings.DataBitLength = 8;
+            settings.Frequency = 2000000;
+            const std::vector<uint16_t> mosi = Counter(5, count, 8);
+            auto transfer = SpiRunTransfer(settings, mosi);
+            REQUIRE(transfer != nullptr);
+
+            TransferInfo2 info;
+            REQUIRE(GetTransferInfo2(info));
+            CHECK(info.ElementCount == count);
+            CHECK(info.MismatchIndex == count);
+            CHECK(info.Checksum == CaptureChecksum(mosi, 8));
+            CHECK(transfer->Miso == Counter(0x70, count, 8));
+        }
+    }
+}
+
+void TestMismatch ()
+{
+    const uint32_t count = 32;
+    const uint32_t corrupted = 11;
+
+    static const CaptureMode engines[] = {
+        CaptureMode::Polled,
+        CaptureMode::Dma,
+        CaptureMode::Record,
+    };
+
+    for (CaptureMode engine : engines) {
+        REQUIRE(StartCapture(engine, 8, 0, 0));
+
+        std::vector<uint16_t> mosi = Counter(0, count, 8);
+        mosi[corrupted] ^= 0x10;
+        REQUIRE(SpiRunTransfer(SpiSettings(), mosi) != nullptr);
+
+        TransferInfo2 info;
+        REQUIRE(GetTransferInfo2(info));
+        CHECK(info.ElementCount == count);
+        CHECK(info.MismatchIndex == corrupted);
+    }
+}
+
+void TestWalkingOnes ()
+{
+    const uint32_t dataBitLength = 10;
+    const uint32_t count = 3 * dataBitLength;
+
+    REQUIRE(LoadGeneratedPattern(CapturePattern::WalkingOnes, dataBitLength));
+    REQUIRE(StartCapture(CaptureMode::Polled, dataBitLength, 2, 0));
+
+    // both sequences index the table, starting at SendValue and ReceiveValue
+    std::vector<uint16_t> mosi;
+    std::vector<uint16_t> expectedMiso;
+    for (uint32_t i = 0; i != count; ++i) {
+        mosi.push_back(uint16_t(1U << ((i + 2) % dataBitLength)));
+        expectedMiso.push_back(uint16_t(1U << (i % dataBitLength)));
+    }
+
+    SpiSettings settings;
+    settings.DataBitLength = dataBitLength;
+    auto transfer = SpiRunTransfer(settings, mosi);
+    REQUIRE(transfer != nullptr);
+
+    TransferInfo2 info;
+    REQUIRE(GetTransferInfo2(info));
+    CHECK(info.ElementCount == count);
+    CHECK(info.MismatchIndex == count);
+    CHECK(transfer->Miso == expectedMiso);
+
+    REQUIRE(LoadGeneratedPattern(CapturePattern::Counter, 8));
+}
+
+void TestCapturedData ()
+{
+    const uint32_t count = 40;
+
+    REQUIRE(StartCapture(CaptureMode::Record, 16, 0x1234, 0));
+    const std::vector<uint16_t> mosi = Counter(0x1234, count, 16);
+    SpiSettings settings;
+    settings.DataBitLength = 16;
+    REQUIRE(SpiRunTransfer(settings, mosi) != nullptr);
+
+    CommandBlock command(SpiTesterCommand::GetCapturedData);
+    command.u.GetCapturedData.ElementOffset = 4;
+    CapturedData data;
+    REQUIRE(SpiQuery(command, data));
+    CHECK(data.ElementOffset == 4);
+    CHECK(data.TotalElementCount == count);
+    CHECK(data.ElementSize == 2);
+    REQUIRE(data.ElementCount == count - 4);
+
+    for (uint32_t i = 0; i != data.ElementCount; ++i) {
+        const uint16_t element =
+            uint16_t(data.Data[2 * i] | (data.Data[(2 * i) + 1] << 8));
+        CHECK(element == mosi[4 + i]);
+    }
+}
+
+void TestBatch ()
+{
+    CommandBlock batch[3] = {
+        CommandBlock(SpiTesterCommand::GetDeviceInfo),
+        CommandBlock(SpiTesterCommand::GetTransferInfo),
+        CommandBlock(SpiTesterCommand::GetTransferInfo),
+    };
+    batch[2].u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+
+    CommandBlock command(SpiTesterCommand::ExecuteBatch);
+    command.u.ExecuteBatch.CommandCount = 3;
+    const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(batch);
+    REQUIRE(SpiCommand(command, std::vector<uint8_t>(bytes, bytes + sizeof(batch))));
+
+    // the responses are sent back to back in one transfer
+    uint8_t response[sizeof(TesterInfo) + sizeof(TransferInfo) +
+        sizeof(TransferInfo2)];
+    REQUIRE(SpiReadResponse(response, sizeof(response)));
+
+    const uint8_t* next = response;
+    CHECK(ValidResponse(next, sizeof(TesterInfo)));
+    CHECK(reinterpret_cast<const TesterInfo*>(next)->DeviceId == DEVICE_ID);
+    next += sizeof(TesterInfo);
+    CHECK(ValidResponse(next, sizeof(TransferInfo)));
+    next += sizeof(TransferInfo);
+    CHECK(ValidResponse(next, sizeof(TransferInfo2)));
+}
+
+//
+// A batch does not carry the elements of an uploaded pattern, so a User
+// LoadPattern that ends a batch is rejected and leaves the pattern alone
+//
+void TestBatchUserPattern ()
+{
+    const uint32_t count = 16;
+
+    // leave elements in the table that a User pattern would pick up
+    REQUIRE(LoadGeneratedPattern(CapturePattern::WalkingOnes, 8));
+    REQUIRE(LoadGeneratedPattern(CapturePattern::Counter, 8));
+
+    CommandBlock batch[2] = {
+        CommandBlock(SpiTesterCommand::GetDeviceInfo),
+        CommandBlock(SpiTesterCommand::LoadPattern),
+    };
+    batch[1].u.LoadPattern.Pattern = CapturePattern::User;
+    batch[1].u.LoadPattern.DataBitLength = 8;
+    batch[1].u.LoadPattern.ElementCount = 8;
+
+    CommandBlock command(SpiTesterCommand::ExecuteBatch);
+    command.u.ExecuteBatch.CommandCount = 2;
+    const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(batch);
+    REQUIRE(SpiCommand(command, std::vector<uint8_t>(bytes, bytes + sizeof(batch))));
+
+    TesterInfo info;
+    REQUIRE(SpiReadResponse(&info, sizeof(info)));
+    CHECK(ValidResponse(&info, sizeof(info)));
+
+    // captures still use the counter
+    REQUIRE(StartCapture(CaptureMode::Polled, 8, 0, 0x20));
+    SpiSettings settings;
+    const std::vector<uint16_t> mosi = Counter(0, count, 8);
+    auto transfer = SpiRunTransfer(settings, mosi);
+    REQUIRE(transfer != nullptr);
+    CHECK(transfer->Miso == Counter(0x20, count, 8));
+
+    TransferInfo2 transferInfo;
+    REQUIRE(GetTransferInfo2(transferInfo));
+    CHECK(transferInfo.MismatchIndex == count);
+}
+
+//
+// A capture queues elements the master may not clock out. They are flushed
+// when it ends, so the master reads nothing stale in the next transfer.
+//
+void TestShortCapture ()
+{
+    REQUIRE(StartCapture(CaptureMode::Record, 8, 0, 0x20));
+    auto transfer = SpiRunTransfer(SpiSettings(), Counter(0, 2, 8));
+    REQUIRE(transfer != nullptr);
+    CHECK(transfer->Miso == Counter(0x20, 2, 8));
+
+    CommandBlock command(SpiTesterCommand::GetTransferInfo);
+    command.u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+    const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(&command);
+    auto commandTransfer = SpiRunTransfer(
+        ControlSettings(),
+        std::vector<uint16_t>(bytes, bytes + sizeof(command)));
+    REQUIRE(commandTransfer != nullptr);
+    CHECK(commandTransfer->Miso ==
+        std::vector<uint16_t>(sizeof(command), 0));
+
+    TransferInfo2 info;
+    REQUIRE(SpiReadResponse(&info, sizeof(info)));
+    CHECK(ValidResponse(&info, sizeof(info)));
+    CHECK(info.ElementCount == 2);
+    CHECK(info.MismatchIndex == 2);
+}
+
+//
+// A capture that ends a batch starts once the master has read the
+// responses, and captures the transfer after them
+//
+void TestBatchCapture ()
+{
+    const uint32_t count = 24;
+
+    CommandBlock batch[2] = {
+        CommandBlock(SpiTesterCommand::GetDeviceInfo),
+        CommandBlock(SpiTesterCommand::CaptureNextTransfer),
+    };
+    batch[1].u.CaptureNextTransfer.Mode = Mode3;
+    batch[1].u.CaptureNextTransfer.DataBitLength = 8;
+    batch[1].u.CaptureNextTransfer.ReceiveValue = 0x20;
+    batch[1].u.CaptureNextTransfer.CaptureMode = uint8_t(CaptureMode::Polled);
+
+    CommandBlock command(SpiTesterCommand::ExecuteBatch);
+    command.u.ExecuteBatch.CommandCount = 2;
+    const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(batch);
+    REQUIRE(SpiCommand(command, std::vector<uint8_t>(bytes, bytes + sizeof(batch))));
+
+    TesterInfo info;
+    REQUIRE(SpiReadResponse(&info, sizeof(info)));
+    CHECK(ValidResponse(&info, sizeof(info)));
+
+    const std::vector<uint16_t> mosi = Counter(0, count, 8);
+    auto transfer = SpiRunTransfer(SpiSettings(), mosi);
+    REQUIRE(transfer != nullptr);
+    CHECK(transfer->Miso == Counter(0x20, count, 8));
+
+    TransferInfo2 transferInfo;
+    REQUIRE(GetTransferInfo2(transferInfo));
+    CHECK(transferInfo.ElementCount == count);
+    CHECK(transferInfo.MismatchIndex == count);
+}
+
+//
+// The testers on SSP0 and SSP1 keep their own captures and patterns, so
+// commands to one do not disturb the results of the other
+//
+void TestDualTesters ()
+{
+    const uint32_t count = 40;
+
+    CommandBlock infoCommand(SpiTesterCommand::GetDeviceInfo);
+    infoCommand.u.GetDeviceInfo.InfoVersion = DEVICE_INFO_VERSION;
+    TesterInfo2 info;
+    SelectSpiTester(1);
+    REQUIRE(SpiQuery(infoCommand, info));
+    CHECK(info.CaptureBufferSize == CAPTURE_BUFFER_SIZE / 4);
+    CHECK(info.EdgeTraceMaxCycles == info.CaptureBufferSize / 4);
+
+    // record a transfer on each tester
+    SelectSpiTester(0);
+    REQUIRE(StartCapture(CaptureMode::Record, 8, 0x20, 0));
+    const std::vector<uint16_t> mosi0 = Counter(0x20, count, 8);
+    SpiSettings settings0;
+    auto transfer0 = SpiRunTransfer(settings0, mosi0);
+    REQUIRE(transfer0 != nullptr);
+
+    SelectSpiTester(1);
+    REQUIRE(LoadGeneratedPattern(CapturePattern::WalkingOnes, 12));
+    REQUIRE(StartCapture(CaptureMode::Record, 12, 0, 0));
+    std::vector<uint16_t> mosi1;
+    for (uint32_t i = 0; i != count; ++i) {
+        mosi1.push_back(uint16_t(1U << (i % 12)));
+    }
+    SpiSettings settings1;
+    settings1.Bus = 1;
+    settings1.DataBitLength = 12;
+    auto transfer1 = SpiRunTransfer(settings1, mosi1);
+    REQUIRE(transfer1 != nullptr);
+    CHECK(transfer1->Miso == mosi1);
+
+    TransferInfo2 transferInfo;
+    REQUIRE(GetTransferInfo2(transferInfo));
+    CHECK(transferInfo.ElementCount == count);
+    CHECK(transferInfo.MismatchIndex == count);
+    CHECK(transferInfo.Checksum == CaptureChecksum(mosi1, 12));
+
+    // the capture on SSP0 is still there, and used the counter
+    SelectSpiTester(0);
+    REQUIRE(GetTransferInfo2(transferInfo));
+    CHECK(transferInfo.MismatchIndex == count);
+    CHECK(transfer0->Miso == Counter(0, count, 8));
+
+    CommandBlock dataCommand(SpiTesterCommand::GetCapturedData);
+    CapturedData data;
+    REQUIRE(SpiQuery(dataCommand, data));
+    CHECK(data.TotalElementCount == count);
+    CHECK(data.ElementSize == 1);
+    REQUIRE(data.ElementCount == count);
+    CHECK(std::equal(mosi0.begin(), mosi0.end(), data.Data));
+
+    SelectSpiTester(1);
+    REQUIRE(SpiQuery(dataCommand, data));
+    CHECK(data.TotalElementCount == count);
+    CHECK(data.ElementSize == 2);
+    REQUIRE(data.ElementCount == count);
+    for (uint32_t i = 0; i != count; ++i) {
+        const uint16_t element =
+            uint16_t(data.Data[2 * i] | (data.Data[(2 * i) + 1] << 8));
+        CHECK(element == mosi1[i]);
+    }
+
+    REQUIRE(LoadGeneratedPattern(CapturePattern::Counter, 8));
+}
+
+//
+// With a capture timeout, a capture whose transfer never starts gives up,
+// so the other tester is not blocked for good
+//
+void TestCaptureTimeout ()
+{
+    CommandBlock timeoutCommand(SpiTesterCommand::SetCaptureTimeout);
+    timeoutCommand.u.SetCaptureTimeout.TimeoutMillis = 2;
+    REQUIRE(SpiCommand(timeoutCommand));
+
+    const CaptureMode engines[] = {
+        CaptureMode::Polled,
+        CaptureMode::Dma,
+        CaptureMode::Record,
+        CaptureMode::EdgeTrace,
+    };
+    for (CaptureMode engine : engines) {
+        REQUIRE(StartCapture(engine, 8, 0, 0));
+        RunFor(MicrosToCycles(5000));
+
+        TransferInfo2 transferInfo;
+        REQUIRE(GetTransferInfo2(transferInfo));
+        CHECK(transferInfo.ClockActiveTimeStatus ==
+            ClockMeasurementStatus::Timeout);
+        CHECK(transferInfo.ChipSelectTimeStatus ==
+            ClockMeasurementStatus::Timeout);
+        CHECK(transferInfo.ElementCount == 0);
+    }
+
+    SelectSpiTester(1);
+    TesterInfo info;
+    REQUIRE(SpiQuery(CommandBlock(SpiTesterCommand::GetDeviceInfo), info));
+    CHECK(info.DeviceId == DEVICE_ID);
+
+    // the next capture still sees its transfer
+    SelectSpiTester(0);
+    timeoutCommand.u.SetCaptureTimeout.TimeoutMillis = 0;
+    REQUIRE(SpiCommand(timeoutCommand));
+    REQUIRE(StartCapture(CaptureMode::Polled, 8, 0, 0));
+    const std::vector<uint16_t> mosi = Counter(0, 16, 8);
+    REQUIRE(SpiRunTransfer(SpiSettings(), mosi) != nullptr);
+
+    TransferInfo2 transferInfo;
+    REQUIRE(GetTransferInfo2(transferInfo));
+    CHECK(transferInfo.ClockActiveTimeStatus ==
+        ClockMeasurementStatus::Success);
+    CHECK(transferInfo.ElementCount == mosi.size());
+    CHECK(transferInfo.MismatchIndex == mosi.size());
+}
+
+//
+// A tester does not wait for the master to read a response, so the other
+// tester answers commands while the response is pending, and the firmware
+// sleeps rather than polling chip select
+//
+void TestPendingResponse ()
+{
+    SelectSpiTester(0);
+    REQUIRE(SpiCommand(CommandBlock(SpiTesterCommand::GetDeviceInfo)));
+
+    const Cycles sleptBefore = GetStatistics().SleepCycles;
+    RunFor(MicrosToCycles(1000));
+    CHECK(GetStatistics().SleepCycles - sleptBefore > MicrosToCycles(900));
+
+    SelectSpiTester(1);
+    TesterInfo info1;
+    REQUIRE(SpiQuery(CommandBlock(SpiTesterCommand::GetDeviceInfo), info1));
+    CHECK(info1.DeviceId == DEVICE_ID);
+
+    SelectSpiTester(0);
+    TesterInfo info0;
+    REQUIRE(SpiReadResponse(&info0, sizeof(info0)));
+    CHECK(ValidResponse(&info0, sizeof(info0)));
+    CHECK(info0.DeviceId == DEVICE_ID);
+}
+
+void TestI2cEeprom ()
+{
+    const I2cSettings settings;
+    const std::vector<uint8_t> data = { 0xde, 0xad, 0xbe, 0xef, 0x5a };
+
+    REQUIRE(I2cWriteRegisters(settings, I2c::SLAVE_ADDRESS, 0x7e, data));
+
+    // the EEPROM wraps at EEPROM_ADDRESS_MAX
+    std::vector<uint8_t> readBack;
+    REQUIRE(I2cReadRegisters(
+        settings,
+        I2c::SLAVE_ADDRESS,
+        0x7e,
+        uint32_t(data.size()),
+        readBack));
+    CHECK(readBack == data);
+
+    REQUIRE(I2cReadRegisters(settings, I2c::SLAVE_ADDRESS, 0, 3, readBack));
+    CHECK(readBack == std::vector<uint8_t>(data.begin() + 2, data.end()));
+
+    REQUIRE(I2cReadRegisters(
+        settings,
+        I2c::SLAVE_ADDRESS,
+        I2c::REG_VERSION,
+        1,
+        readBack));
+    CHECK(readBack[0] == I2c::VERSION);
+}
+
+//
+// Reads a register of the capability block, most significant byte first
+//
+uint32_t CapabilityField (
+    const std::vector<uint8_t>& Block,
+    uint32_t Register,
+    uint32_t Length
+    )
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i != Length; ++i) {
+        value = (value << 8) | Block[Register - I2c::REG_CAPABILITY_VERSION + i];
+    }
+    return value;
+}
+
+void TestI2cCapabilities ()
+{
+    std::vector<uint8_t> block;
+    REQUIRE(I2cReadRegisters(
+        I2cSettings(),
+        I2c::SLAVE_ADDRESS,
+        I2c::REG_CAPABILITY_VERSION,
+        I2c::REG_CAPABILITY_END - I2c::REG_CAPABILITY_VERSION + 1,
+        block));
+
+    CHECK(CapabilityField(block, I2c::REG_CAPABILITY_VERSION, 1) ==
+        I2c::CAPABILITY_VERSION);
+    CHECK(CapabilityField(block, I2c::REG_CAPABILITIES, 4) ==
+        I2c::CAPABILITIES);
+    CHECK(CapabilityField(block, I2c::REG_CAPABILITY_MAX_BUS_SPEED_KHZ, 2) ==
+        I2c::MAX_BUS_SPEED_KHZ);
+    CHECK(CapabilityField(block, I2c::REG_CAPABILITY_EEPROM_SIZE, 2) ==
+        I2c::EEPROM_ADDRESS_MAX + 1);
+    CHECK(CapabilityField(block, I2c::REG_CAPABILITY_LARGE_EEPROM_SIZE, 2) ==
+        I2c::LARGE_EEPROM_SIZE);
+    CHECK(CapabilityField(block, I2c::REG_CAPABILITY_VIRTUAL_DEVICE_COUNT, 1) ==
+        I2c::VIRTUAL_DEVICE_COUNT);
+
+    // the rest of the block is reserved and reads as zero
+    CHECK(CapabilityField(block, I2c::REG_CAPABILITY_END, 1) == 0);
+}
+
+void TestI2cUnknownAddress ()
+{
+    auto transaction = QueueI2cWrite(I2cSettings(), 0x12, { 0, 1 });
+    REQUIRE(Run());
+    CHECK(transaction->Complete);
+    CHECK(!transaction->AddressAcked);
+}
+
+void TestI2cNak ()
+{
+    const I2cSettings settings;
+    REQUIRE(I2cWriteRegisters(
+        settings,
+        I2c::SLAVE_ADDRESS,
+        I2c::REG_NAK_CONTROL,
+        { 2 }));
+
+    // the register address and one byte are acknowledged
+    auto transaction = QueueI2cWrite(settings, I2c::SLAVE_ADDRESS, { 0, 1, 2, 3 });
+    REQUIRE(Run());
+    CHECK(transaction->Complete);
+    CHECK(transaction->AddressAcked);
+    CHECK(transaction->BytesAcked == 2);
+}
+
+void TestI2cHold ()
+{
+    const I2cSettings settings;
+    const uint32_t holdMicros = 300;
+
+    REQUIRE(I2cWriteRegisters(
+        settings,
+        I2c::SLAVE_ADDRESS,
+        I2c::REG_SCL_HOLD_MICROS_HI,
+        { uint8_t(holdMicros >> 8), uint8_t(holdMicros) }));
+    REQUIRE(I2cWriteRegisters(
+        settings,
+        I2c::SLAVE_ADDRESS,
+        I2c::REG_HOLD_WRITE_CONTROL,
+        { 0 }));
+
+    // SCL is held after the address of the next write
+    auto transaction = QueueI2cWrite(settings, I2c::SLAVE_ADDRESS, { 0, 0x11 });
+    REQUIRE(Run());
+    CHECK(transaction->Complete);
+    CHECK(transaction->BytesAcked == 2);
+    CHECK(transaction->StretchCycles >= MicrosToCycles(holdMicros));
+    CHECK(transaction->StretchCycles < MicrosToCycles(holdMicros + 50));
+
+    REQUIRE(I2cWriteRegisters(
+        settings,
+        I2c::SLAVE_ADDRESS,
+        I2c::REG_SCL_HOLD_MICROS_HI,
+        { 0, 0 }));
+}
+
+//
+// Reads a timing register, most significant byte first
+//
+bool ReadTimingField (uint8_t Register, uint32_t Length, uint64_t& Value)
+{
+    std::vector<uint8_t> data;
+    if (!I2cReadRegisters(
+            I2cSettings(),
+            I2c::SLAVE_ADDRESS,
+            Register,
+            Length,
+            data)) {
+        return false;
+    }
+
+    Value = 0;
+    for (uint8_t byte : data) {
+        Value = (Value << 8) | byte;
+    }
+    return true;
+}
+
+//
+// The tester sleeps between the bytes of a slow transaction and between
+// transactions, but the interval it measures across those sleeps must match
+// the master's to within a few cycles
+//
+void TestI2cTimingAcrossSleeps ()
+{
+    I2cSettings settings;
+    settings.Frequency = 100000;
+    std::vector<uint8_t> data(16, 0xa5);
+    data[0] = 0x10;
+
+    const Cycles sleptBefore = GetStatistics().SleepCycles;
+    auto first = QueueI2cWrite(settings, I2c::SLAVE_ADDRESS, data);
+    REQUIRE(Run());
+    REQUIRE(first->Complete);
+    uint64_t firstStart;
+    REQUIRE(ReadTimingField(I2c::REG_TIMING_START_TIME, 8, firstStart));
+
+    RunFor(MicrosToCycles(5000));
+
+    auto second = QueueI2cWrite(settings, I2c::SLAVE_ADDRESS, data);
+    REQUIRE(Run());
+    REQUIRE(second->Complete);
+    uint64_t secondStart;
+    REQUIRE(ReadTimingField(I2c::REG_TIMING_START_TIME, 8, secondStart));
+    uint64_t micros;
+    REQUIRE(ReadTimingField(I2c::REG_TIMING_TRANSACTION_MICROS, 4, micros));
+
+    // most of the interval was spent asleep
+    const Cycles interval = second->StartTime - first->StartTime;
+    CHECK(GetStatistics().SleepCycles - sleptBefore > interval / 2);
+
+    const int64_t error = int64_t(secondStart - firstStart) - int64_t(interval);
+    CHECK((error > -32) && (error < 32));
+
+    // the tester times the transaction from the address to the stop
+    // condition, one 90us byte less than the master does
+    const uint64_t masterMicros =
+        (second->EndTime - second->StartTime) / MicrosToCycles(1);
+    CHECK(micros <= masterMicros);
+    CHECK(micros + 100 >= masterMicros);
+}
+
+//
+// The I2C interrupt may preempt a polled capture, which must still keep up
+// with the master
+//
+void TestSpiWithI2c ()
+{
+    const uint32_t count = 256;
+
+    REQUIRE(StartCapture(CaptureMode::Polled, 8, 0, 0));
+
+    const std::vector<uint16_t> mosi = Counter(0, count, 8);
+    auto transfer = QueueSpiTransfer(SpiSettings(), mosi);
+    auto write = QueueI2cWrite(
+        I2cSettings(),
+        I2c::SLAVE_ADDRESS,
+        { 0x20, 1, 2, 3, 4, 5, 6, 7, 8 });
+    REQUIRE(Run());
+    CHECK(transfer->Complete);
+    CHECK(write->Complete);
+    CHECK(write->BytesAcked == 9);
+
+    TransferInfo2 info;
+    REQUIRE(GetTransferInfo2(info));
+    CHECK(info.ElementCount == count);
+    CHECK(info.MismatchIndex == count);
+}
+
+void TestNoFatalErrors ()
+{
+    CHECK(GetStatistics().ErrorLedOnCount == 0);
+    CHECK(GetStatistics().SspRxOverruns == 0);
+}
+
+struct Test {
+    const char* Name;
+    void (*Run) ();
+};
+
+const Test tests[] = {
+    { "DeviceInfo", &TestDeviceInfo },
+    { "DeviceInfo2", &TestDeviceInfo2 },
+    { "PolledCapture8", &TestPolledCapture8 },
+    { "PolledCapture16", &TestPolledCapture16 },
+    { "DmaCapture8", &TestDmaCapture8 },
+    { "DmaCapture16", &TestDmaCapture16 },
+    { "RecordCapture8", &TestRecordCapture8 },
+    { "RecordCapture12", &TestRecordCapture12 },
+    { "OutOfRangeWidth", &TestOutOfRangeWidth },
+    { "Mismatch", &TestMismatch },
+    { "WalkingOnes", &TestWalkingOnes },
+    { "CapturedData", &TestCapturedData },
+    { "Batch", &TestBatch },
+    { "BatchUserPattern", &TestBatchUserPattern },
+    { "ShortCapture", &TestShortCapture },
+    { "BatchCapture", &TestBatchCapture },
+    { "DualTesters", &TestDualTesters },
+    { "CaptureTimeout", &TestCaptureTimeout },
+    { "PendingResponse", &TestPendingResponse },
+    { "I2cEeprom", &TestI2cEeprom },
+    { "I2cCapabilities", &TestI2cCapabilities },
+    { "I2cUnknownAddress", &TestI2cUnknownAddress },
+    { "I2cNak", &TestI2cNak },
+    { "I2cHold", &TestI2cHold },
+    { "I2cTimingAcrossSleeps", &TestI2cTimingAcrossSleeps },
+    { "SpiWithI2c", &TestSpiWithI2c },
+
+    // must be last
+    { "NoFatalErrors", &TestNoFatalErrors },
+};
+
+bool Selected (const char* Name, int argc, char* argv[])
+{
+    if (argc < 2) return true;
+    for (int i = 1; i != argc; ++i) {
+        if (strcmp(argv[i], Name) == 0) return true;
+    }
+    return false;
+}
+
+} // namespace "static"
+
+int main (int argc, char* argv[])
+{
+    Boot();
+
+    // the firmware keeps its state between tests, as it does between the
+    // HLK tests, so the tests run in order on a single boot
+    int failedTests = 0;
+    int ranTests = 0;
+    for (const Test& test : tests) {
+        if (!Selected(test.Name, argc, argv)) continue;
+
+        const int failuresBefore = checkFailures;
+        SelectSpiTester(0);
+        test.Run();
+        ++ranTests;
+
+        const bool passed = checkFailures == failuresBefore;
+        if (!passed) {
+            ++failedTests;
+        }
+        printf("%s %s\n", passed ? "PASS" : "FAIL", test.Name);
+    }
+
+    printf("%d of %d tests passed\n", ranTests - failedTests, ranTests);
+    return (failedTests == 0) ? 0 : 1;
+}
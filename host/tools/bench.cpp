@@ -0,0 +1,255 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Times the tester's code paths against the simulated peripherals.
+//
+// For each scenario, reports the host time per operation, which tracks the
+// work the firmware does, and the simulated time, register accesses and
+// interrupts per operation, which track its register traffic and how it
+// interleaves with the bus. The firmware's own profile counters are read
+// back with GetProfilingInfo; in the simulator they count register access
+// cycles rather than instruction cycles.
+//
+// Usage: lldt-bench [--iterations N] [--access-cycles N] [scenario...]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "simulator.h"
+#include "lldtester.h"
+#include "testerbus.h"
+
+using namespace Sim;
+using namespace Lldt;
+using namespace Lldt::Spi;
+
+namespace { // static
+
+const char* const sectionNames[PROFILE_SECTION_COUNT] = {
+    "SpiCaptureLoop",
+    "SpiWaitForCapture",
+    "SpiSend",
+    "SpiAcknowledge",
+    "I2cEvent",
+    "SpiDispatch",
+};
+
+bool Capture (
+    CaptureMode Engine,
+    uint32_t DataBitLength,
+    uint32_t Frequency,
+    uint32_t ElementCount
+    )
+{
+    CommandBlock command(SpiTesterCommand::CaptureNextTransfer);
+    command.u.CaptureNextTransfer.Mode = Mode3;
+    command.u.CaptureNextTransfer.DataBitLength = uint8_t(DataBitLength);
+    command.u.CaptureNextTransfer.CaptureMode = uint8_t(Engine);
+    if (!SpiCommand(command)) return false;
+
+    SpiSettings settings;
+    settings.DataBitLength = DataBitLength;
+    settings.Frequency = Frequency;
+    std::vector<uint16_t> mosi(ElementCount);
+    for (uint32_t i = 0; i != ElementCount; ++i) {
+        mosi[i] = uint16_t(i & ((1U << DataBitLength) - 1));
+    }
+    if (SpiRunTransfer(settings, mosi) == nullptr) return false;
+
+    CommandBlock query(SpiTesterCommand::GetTransferInfo);
+    query.u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+    TransferInfo2 info;
+    return SpiQuery(query, info) &&
+        (info.ElementCount == ElementCount) &&
+        (info.MismatchIndex == ElementCount);
+}
+
+bool DeviceInfo ()
+{
+    TesterInfo info;
+    return SpiQuery(CommandBlock(SpiTesterCommand::GetDeviceInfo), info);
+}
+
+bool PolledCapture8 () { return Capture(CaptureMode::Polled, 8, 4000000, 256); }
+bool PolledCapture16 () { return Capture(CaptureMode::Polled, 16, 8000000, 256); }
+bool DmaCapture16 () { return Capture(CaptureMode::Dma, 16, 8000000, 1024); }
+bool RecordCapture8 () { return Capture(CaptureMode::Record, 8, 4000000, 1024); }
+
+bool Batch ()
+{
+    CommandBlock batch[3] = {
+        CommandBlock(SpiTesterCommand::GetDeviceInfo),
+        CommandBlock(SpiTesterCommand::GetTransferInfo),
+        CommandBlock(SpiTesterCommand::GetStreamingInfo),
+    };
+
+    CommandBlock command(SpiTesterCommand::ExecuteBatch);
+    command.u.ExecuteBatch.CommandCount = 3;
+    const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(batch);
+    if (!SpiCommand(command, std::vector<uint8_t>(bytes, bytes + sizeof(batch)))) {
+        return false;
+    }
+
+    uint8_t response[sizeof(TesterInfo) + sizeof(TransferInfo) +
+        sizeof(StreamingInfo)];
+    return SpiReadResponse(response, sizeof(response)) &&
+        ValidResponse(response, sizeof(TesterInfo));
+}
+
+bool I2cEepromWrite ()
+{
+    return I2cWriteRegisters(
+        I2cSettings(),
+        I2c::SLAVE_ADDRESS,
+        0,
+        std::vector<uint8_t>(16, 0xa5));
+}
+
+bool I2cEepromRead ()
+{
+    std::vector<uint8_t> data;
+    return I2cReadRegisters(I2cSettings(), I2c::SLAVE_ADDRESS, 0, 16, data) &&
+        (data.size() == 16);
+}
+
+struct Scenario {
+    const char* Name;
+    bool (*Run) ();
+};
+
+const Scenario scenarios[] = {
+    { "DeviceInfo", &DeviceInfo },
+    { "Batch", &Batch },
+    { "PolledCapture8", &PolledCapture8 },
+    { "PolledCapture16", &PolledCapture16 },
+    { "DmaCapture16", &DmaCapture16 },
+    { "RecordCapture8", &RecordCapture8 },
+    { "I2cEepromWrite", &I2cEepromWrite },
+    { "I2cEepromRead", &I2cEepromRead },
+};
+
+bool ReadProfile (bool Reset, ProfilingInfo& Info)
+{
+    CommandBlock command(SpiTesterCommand::GetProfilingInfo);
+    command.u.GetProfilingInfo.Reset = Reset ? 1 : 0;
+    return SpiQuery(command, Info);
+}
+
+uint64_t TotalInterrupts (const Statistics& S)
+{
+    uint64_t total = 0;
+    for (uint64_t count : S.Interrupts) {
+        total += count;
+    }
+    return total;
+}
+
+bool RunScenario (const Scenario& S, uint32_t Iterations)
+{
+    ProfilingInfo profile;
+    if (!ReadProfile(true, profile)) return false;
+    ResetStatistics();
+
+    const Cycles startCycles = Now();
+    const auto startTime = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i != Iterations; ++i) {
+        if (!S.Run()) {
+            fprintf(stderr, "%s: iteration %u failed\n", S.Name, i);
+            return false;
+        }
+    }
+    const auto endTime = std::chrono::steady_clock::now();
+    const Cycles endCycles = Now();
+    const Statistics statistics = GetStatistics();
+
+    if (!ReadProfile(true, profile)) return false;
+
+    const double hostMicros = std::chrono::duration<double, std::micro>(
+        endTime - startTime).count();
+    printf(
+        "%-16s %8u %12.2f %12.1f %12.1f %10.2f\n",
+        S.Name,
+        Iterations,
+        hostMicros / Iterations,
+        (double(endCycles - startCycles) / MicrosToCycles(1)) / Iterations,
+        double(statistics.RegisterAccesses) / Iterations,
+        double(TotalInterrupts(statistics)) / Iterations);
+
+    for (uint32_t i = 0; i != PROFILE_SECTION_COUNT; ++i) {
+        const ProfileCounters& counters = profile.Sections[i];
+        if (counters.Count == 0) continue;
+
+        printf(
+            "    %-20s count %8u  mean %8.1f  max %8u  max iteration %6u\n",
+            sectionNames[i],
+            counters.Count,
+            double(counters.TotalCycles) / counters.Count,
+            counters.MaxCycles,
+            counters.MaxIterationCycles);
+    }
+    return true;
+}
+
+bool Selected (const char* Name, const std::vector<const char*>& Names)
+{
+    if (Names.empty()) return true;
+    for (const char* name : Names) {
+        if (strcmp(name, Name) == 0) return true;
+    }
+    return false;
+}
+
+} // namespace "static"
+
+int main (int argc, char* argv[])
+{
+    uint32_t iterations = 200;
+    uint32_t accessCycles = DEFAULT_ACCESS_CYCLES;
+    std::vector<const char*> names;
+
+    for (int i = 1; i != argc; ++i) {
+        if ((strcmp(argv[i], "--iterations") == 0) && (i + 1 != argc)) {
+            iterations = uint32_t(strtoul(argv[++i], nullptr, 0));
+        } else if ((strcmp(argv[i], "--access-cycles") == 0) && (i + 1 != argc)) {
+            accessCycles = uint32_t(strtoul(argv[++i], nullptr, 0));
+        } else if (argv[i][0] == '-') {
+            fprintf(
+                stderr,
+                "Usage: %s [--iterations N] [--access-cycles N] [scenario...]\n",
+                argv[0]);
+            return 2;
+        } else {
+            names.push_back(argv[i]);
+        }
+    }
+
+    if (iterations == 0) {
+        fprintf(stderr, "--iterations must be at least 1\n");
+        return 2;
+    }
+
+    Boot();
+    SetAccessCycles(accessCycles);
+
+    printf(
+        "%-16s %8s %12s %12s %12s %10s\n",
+        "scenario",
+        "ops",
+        "host us/op",
+        "sim us/op",
+        "accesses/op",
+        "irqs/op");
+
+    bool passed = true;
+    for (const Scenario& scenario : scenarios) {
+        if (!Selected(scenario.Name, names)) continue;
+        passed = RunScenario(scenario, iterations) && passed;
+    }
+
+    return passed ? 0 : 1;
+}
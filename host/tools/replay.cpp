@@ -0,0 +1,424 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Replays a script of bus traffic against the simulated tester, checking
+// the responses. Used to regression test protocol changes without hardware.
+//
+// Usage: lldt-replay <script>
+//
+// A script has one directive per line. '#' starts a comment, and numbers
+// may be decimal or 0x-prefixed hex.
+//
+//   spi <key>=<value>...       Settings of subsequent 'transfer' directives:
+//                              mode, frequency, bits, gap-us, setup-us,
+//                              hold-us and frame-gap-us
+//   command <byte>...          Sends a command block and any bytes that
+//                              follow it on the control interface
+//   read <size>                Reads a response of <size> bytes, or of the
+//                              size of the named lldtester.h structure,
+//                              and checks its header
+//   transfer <element>...      Clocks a transfer with the 'spi' settings.
+//   transfer counter <first> <count>
+//                              The received elements become the result.
+//   i2c <key>=<value>...       Settings of subsequent I2C directives:
+//                              frequency and gap-us
+//   i2c-write <address> <byte>...
+//   i2c-read <address> <register> <length>
+//                              Writes the register address and reads with a
+//                              repeated start. The data becomes the result.
+//   expect <offset> <byte>...  Checks bytes of the last response or result
+//   expect-u32 <offset> <value>
+//                              Checks a little-endian 32-bit field
+//   expect-nack                Checks that the last I2C write was not
+//                              fully acknowledged
+//   wait-us <micros>           Runs the firmware for <micros>
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "simulator.h"
+#include "lldtester.h"
+#include "testerbus.h"
+
+using namespace Sim;
+using namespace Lldt::Spi;
+
+namespace { // static
+
+struct NamedSize {
+    const char* Name;
+    uint32_t Size;
+};
+
+const NamedSize responseSizes[] = {
+    { "TesterInfo", sizeof(TesterInfo) },
+    { "TesterInfo2", sizeof(TesterInfo2) },
+    { "TransferInfo", sizeof(TransferInfo) },
+    { "TransferInfo2", sizeof(TransferInfo2) },
+    { "CapturedData", sizeof(CapturedData) },
+    { "PeriodicInterruptInfo", sizeof(PeriodicInterruptInfo) },
+    { "InterruptLatencyHistogram", sizeof(InterruptLatencyHistogram) },
+    { "InterruptSweepInfo", sizeof(InterruptSweepInfo) },
+    { "EdgeTraceInfo", sizeof(EdgeTraceInfo) },
+    { "ProfilingInfo", sizeof(ProfilingInfo) },
+    { "StreamingInfo", sizeof(StreamingInfo) },
+};
+
+struct Replay {
+    SpiSettings spi;
+    I2cSettings i2c;
+
+    // the last response, the elements of the last transfer, or the data of
+    // the last I2C read
+    std::vector<uint8_t> result;
+    bool lastWriteAcked = true;
+};
+
+bool ParseNumber (const std::string& Token, uint32_t& Value)
+{
+    char* end;
+    const unsigned long value = strtoul(Token.c_str(), &end, 0);
+    if (Token.empty() || (*end != '\0')) return false;
+    Value = uint32_t(value);
+    return true;
+}
+
+bool ParseNumbers (
+    const std::vector<std::string>& Tokens,
+    size_t First,
+    std::vector<uint32_t>& Values
+    )
+{
+    Values.clear();
+    for (size_t i = First; i < Tokens.size(); ++i) {
+        uint32_t value;
+        if (!ParseNumber(Tokens[i], value)) return false;
+        Values.push_back(value);
+    }
+    return true;
+}
+
+std::vector<uint8_t> Bytes (const std::vector<uint32_t>& Values)
+{
+    return std::vector<uint8_t>(Values.begin(), Values.end());
+}
+
+struct SettingKey {
+    const char* Name;
+    uint32_t* Value;
+};
+
+//
+// Applies <key>=<value> tokens to the values of Keys
+//
+bool ParseSettings (
+    const std::vector<std::string>& Tokens,
+    const SettingKey* Keys,
+    size_t KeyCount
+    )
+{
+    for (size_t i = 1; i < Tokens.size(); ++i) {
+        const size_t equals = Tokens[i].find('=');
+        if (equals == std::string::npos) return false;
+
+        const std::string key = Tokens[i].substr(0, equals);
+        size_t k = 0;
+        while ((k != KeyCount) && (key != Keys[k].Name)) ++k;
+        if (k == KeyCount) return false;
+
+        if (!ParseNumber(Tokens[i].substr(equals + 1), *Keys[k].Value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t CyclesToMicros (Cycles Value)
+{
+    return uint32_t(Value / MicrosToCycles(1));
+}
+
+bool SpiSettingsDirective (Replay& R, const std::vector<std::string>& Tokens)
+{
+    uint32_t gapMicros = CyclesToMicros(R.spi.GapCycles);
+    uint32_t setupMicros = CyclesToMicros(R.spi.SetupCycles);
+    uint32_t holdMicros = CyclesToMicros(R.spi.HoldCycles);
+    uint32_t frameGapMicros = CyclesToMicros(R.spi.FrameGapCycles);
+
+    const SettingKey keys[] = {
+        { "mode", &R.spi.Mode },
+        { "frequency", &R.spi.Frequency },
+        { "bits", &R.spi.DataBitLength },
+        { "gap-us", &gapMicros },
+        { "setup-us", &setupMicros },
+        { "hold-us", &holdMicros },
+        { "frame-gap-us", &frameGapMicros },
+    };
+    if (!ParseSettings(Tokens, keys, sizeof(keys) / sizeof(keys[0]))) {
+        return false;
+    }
+
+    R.spi.GapCycles = MicrosToCycles(gapMicros);
+    R.spi.SetupCycles = MicrosToCycles(setupMicros);
+    R.spi.HoldCycles = MicrosToCycles(holdMicros);
+    R.spi.FrameGapCycles = MicrosToCycles(frameGapMicros);
+    return (R.spi.Mode <= 3) && (R.spi.Frequency != 0) &&
+        (R.spi.DataBitLength >= 4) && (R.spi.DataBitLength <= 16);
+}
+
+bool I2cSettingsDirective (Replay& R, const std::vector<std::string>& Tokens)
+{
+    uint32_t gapMicros = CyclesToMicros(R.i2c.GapCycles);
+
+    const SettingKey keys[] = {
+        { "frequency", &R.i2c.Frequency },
+        { "gap-us", &gapMicros },
+    };
+    if (!ParseSettings(Tokens, keys, sizeof(keys) / sizeof(keys[0]))) {
+        return false;
+    }
+
+    R.i2c.GapCycles = MicrosToCycles(gapMicros);
+    return R.i2c.Frequency != 0;
+}
+
+bool ReadDirective (Replay& R, const std::vector<std::string>& Tokens)
+{
+    if (Tokens.size() != 2) return false;
+
+    uint32_t size = 0;
+    for (const NamedSize& named : responseSizes) {
+        if (Tokens[1] == named.Name) {
+            size = named.Size;
+        }
+    }
+    if ((size == 0) && !ParseNumber(Tokens[1], size)) return false;
+
+    R.result.resize(size);
+    if (!SpiReadResponse(R.result.data(), size)) {
+        fprintf(stderr, "response transfer did not complete\n");
+        return false;
+    }
+    if (!ValidResponse(R.result.data(), size)) {
+        fprintf(stderr, "response header is invalid\n");
+        return false;
+    }
+    return true;
+}
+
+bool TransferDirective (Replay& R, const std::vector<std::string>& Tokens)
+{
+    std::vector<uint32_t> values;
+    std::vector<uint16_t> mosi;
+    if ((Tokens.size() == 4) && (Tokens[1] == "counter")) {
+        if (!ParseNumbers(Tokens, 2, values)) return false;
+        for (uint32_t i = 0; i != values[1]; ++i) {
+            mosi.push_back(uint16_t(values[0] + i));
+        }
+    } else {
+        if (!ParseNumbers(Tokens, 1, values)) return false;
+        mosi.assign(values.begin(), values.end());
+    }
+
+    const uint32_t mask = (1U << R.spi.DataBitLength) - 1;
+    for (uint16_t& element : mosi) {
+        element &= mask;
+    }
+
+    auto transfer = SpiRunTransfer(R.spi, mosi);
+    if (transfer == nullptr) {
+        fprintf(stderr, "transfer did not complete\n");
+        return false;
+    }
+
+    // wide elements are stored little-endian, as in CapturedData
+    R.result.clear();
+    for (uint16_t element : transfer->Miso) {
+        R.result.push_back(uint8_t(element));
+        if (R.spi.DataBitLength > 8) {
+            R.result.push_back(uint8_t(element >> 8));
+        }
+    }
+    return true;
+}
+
+bool ExpectDirective (
+    const Replay& R,
+    const std::vector<std::string>& Tokens,
+    bool Field
+    )
+{
+    std::vector<uint32_t> values;
+    if ((Tokens.size() < 3) || !ParseNumbers(Tokens, 1, values)) return false;
+
+    const uint32_t offset = values[0];
+    std::vector<uint8_t> expected;
+    if (Field) {
+        if (values.size() != 2) return false;
+        for (uint32_t i = 0; i != 4; ++i) {
+            expected.push_back(uint8_t(values[1] >> (8 * i)));
+        }
+    } else {
+        expected.assign(values.begin() + 1, values.end());
+    }
+
+    if ((offset + expected.size()) > R.result.size()) {
+        fprintf(
+            stderr,
+            "expected %zu bytes at offset %u of a %zu byte result\n",
+            expected.size(),
+            offset,
+            R.result.size());
+        return false;
+    }
+
+    for (size_t i = 0; i != expected.size(); ++i) {
+        if (R.result[offset + i] != expected[i]) {
+            fprintf(
+                stderr,
+                "byte %zu is 0x%02x, expected 0x%02x\n",
+                offset + i,
+                R.result[offset + i],
+                expected[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RunDirective (Replay& R, const std::vector<std::string>& Tokens)
+{
+    const std::string& directive = Tokens[0];
+    std::vector<uint32_t> values;
+
+    if (directive == "spi") {
+        return SpiSettingsDirective(R, Tokens);
+    } else if (directive == "i2c") {
+        return I2cSettingsDirective(R, Tokens);
+    } else if (directive == "command") {
+        if (!ParseNumbers(Tokens, 1, values) ||
+            (values.size() < sizeof(CommandBlock))) {
+
+            return false;
+        }
+
+        CommandBlock command;
+        const std::vector<uint8_t> bytes = Bytes(values);
+        memcpy(&command, bytes.data(), sizeof(command));
+        return SpiCommand(
+            command,
+            std::vector<uint8_t>(bytes.begin() + sizeof(command), bytes.end()));
+    } else if (directive == "read") {
+        return ReadDirective(R, Tokens);
+    } else if (directive == "transfer") {
+        return TransferDirective(R, Tokens);
+    } else if (directive == "i2c-write") {
+        if (!ParseNumbers(Tokens, 1, values) || (values.size() < 2)) {
+            return false;
+        }
+
+        const std::vector<uint8_t> bytes = Bytes(values);
+        auto transaction = QueueI2cWrite(
+            R.i2c,
+            bytes[0],
+            std::vector<uint8_t>(bytes.begin() + 1, bytes.end()));
+        if (!Run() || !transaction->Complete) return false;
+
+        R.lastWriteAcked = transaction->AddressAcked &&
+            (transaction->BytesAcked == (bytes.size() - 1));
+        return true;
+    } else if (directive == "i2c-read") {
+        if (!ParseNumbers(Tokens, 1, values) || (values.size() != 3)) {
+            return false;
+        }
+
+        return I2cReadRegisters(
+            R.i2c,
+            uint8_t(values[0]),
+            uint8_t(values[1]),
+            values[2],
+            R.result);
+    } else if (directive == "expect") {
+        return ExpectDirective(R, Tokens, false);
+    } else if (directive == "expect-u32") {
+        return ExpectDirective(R, Tokens, true);
+    } else if (directive == "expect-nack") {
+        return !R.lastWriteAcked;
+    } else if (directive == "wait-us") {
+        if (!ParseNumbers(Tokens, 1, values) || (values.size() != 1)) {
+            return false;
+        }
+
+        RunFor(MicrosToCycles(values[0]));
+        return true;
+    }
+
+    fprintf(stderr, "unknown directive\n");
+    return false;
+}
+
+} // namespace "static"
+
+int main (int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <script>\n", argv[0]);
+        return 2;
+    }
+
+    FILE* script = fopen(argv[1], "r");
+    if (script == nullptr) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 2;
+    }
+
+    Boot();
+
+    Replay replay;
+    char line[1024];
+    uint32_t lineNumber = 0;
+    uint32_t directives = 0;
+    while (fgets(line, sizeof(line), script) != nullptr) {
+        ++lineNumber;
+
+        std::string text(line);
+        text = text.substr(0, text.find('#'));
+
+        std::istringstream stream(text);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (stream >> token) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) continue;
+
+        const Cycles start = Now();
+        if (!RunDirective(replay, tokens)) {
+            fprintf(stderr, "%s:%u: failed: %s", argv[1], lineNumber, line);
+            fclose(script);
+            return 1;
+        }
+        ++directives;
+
+        printf(
+            "%10.1f us %8.1f us  %s",
+            double(start) / MicrosToCycles(1),
+            double(Now() - start) / MicrosToCycles(1),
+            line);
+    }
+    fclose(script);
+
+    if (GetStatistics().ErrorLedOnCount != 0) {
+        fprintf(stderr, "%s: the firmware reported a fatal error\n", argv[1]);
+        return 1;
+    }
+
+    printf("%u directives passed\n", directives);
+    return 0;
+}
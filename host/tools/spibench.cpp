@@ -0,0 +1,498 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Measures SPI throughput, error rates and interrupt acknowledge latency
+// through the host client library, against a tester on a spidev device or
+// against the simulated firmware.
+//
+// For each combination of capture engine, frame width, clock frequency and
+// transfer size, runs the captures and reports:
+//  - wire Mbit/s: the payload bits over the time chip select was asserted
+//  - effective Mbit/s: the payload bits over the time of the whole capture,
+//    including the command and the TransferInfo query
+//  - the captures the tester saw a mismatch in, those in which MISO did not
+//    carry the tester's counter, and those lost to protocol errors
+// Frequencies above the MaxFrequency the tester reports for the engine and
+// width are marked with '*'.
+//
+// With an interrupt line, each interrupt frequency runs a periodic interrupt
+// session and reports the acknowledge latency percentiles, measured by the
+// tester from the falling edge of the interrupt to the acknowledge.
+//
+// --auto takes the engines, frequencies and interrupt frequencies from the
+// tester's TesterInfo2 in place of the lists given: each engine the tester
+// implements is run at a quarter, half and all of its maximum frequency for
+// each width, and interrupts at each power of ten from 1kHz up to the
+// tester's maximum.
+//
+// Usage: lldt-spibench (--simulator | --spidev DEVICE [--gpio CHIP:LINE])
+//            [--auto] [--engines Polled,Dma,Record] [--frequencies HZ,...]
+//            [--widths BITS,...] [--sizes ELEMENTS,...] [--iterations N]
+//            [--interrupt-frequencies HZ,...] [--interrupt-duration S]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lldtester.h"
+#include "lldtclient.h"
+#include "simport.h"
+#ifdef LLDT_SPIDEV
+#include "spidevport.h"
+#endif
+
+using namespace Lldt;
+using namespace Lldt::Spi;
+using namespace Lldt::Client;
+
+namespace { // static
+
+struct EngineName {
+    const char* Name;
+    CaptureMode Engine;
+};
+
+const EngineName engineNames[] = {
+    { "Polled", CaptureMode::Polled },
+    { "Dma", CaptureMode::Dma },
+    { "Record", CaptureMode::Record },
+};
+
+const char* EngineToString (CaptureMode Engine)
+{
+    for (const EngineName& name : engineNames) {
+        if (name.Engine == Engine) return name.Name;
+    }
+    return "?";
+}
+
+bool ParseEngines (const char* Text, std::vector<CaptureMode>& Engines)
+{
+    Engines.clear();
+    std::string text(Text);
+    size_t start = 0;
+    while (start <= text.size()) {
+        const size_t end = std::min(text.find(',', start), text.size());
+        const std::string item = text.substr(start, end - start);
+
+        bool found = false;
+        for (const EngineName& name : engineNames) {
+            if (strcasecmp(item.c_str(), name.Name) == 0) {
+                Engines.push_back(name.Engine);
+                found = true;
+            }
+        }
+        if (!found) return false;
+        start = end + 1;
+    }
+    return !Engines.empty();
+}
+
+bool ParseList (const char* Text, std::vector<uint32_t>& Values)
+{
+    Values.clear();
+    const char* next = Text;
+    for (;;) {
+        char* end;
+        const unsigned long value = strtoul(next, &end, 0);
+        if ((end == next) || (value == 0)) return false;
+        Values.push_back(uint32_t(value));
+
+        if (*end == '\0') return true;
+        if (*end != ',') return false;
+        next = end + 1;
+    }
+}
+
+//
+// Selects the engines and interrupt frequencies of an --auto run
+//
+void AutoTune (
+    const TesterInfo2& Info,
+    std::vector<CaptureMode>& Engines,
+    std::vector<uint32_t>& InterruptFrequencies
+    )
+{
+    Engines = { CaptureMode::Polled };
+    if (Info.Capabilities & SPI_CAPABILITY_DMA_CAPTURE) {
+        Engines.push_back(CaptureMode::Dma);
+    }
+    if (Info.Capabilities & SPI_CAPABILITY_RECORD_CAPTURE) {
+        Engines.push_back(CaptureMode::Record);
+    }
+
+    InterruptFrequencies.clear();
+    for (uint32_t frequency = 1000;
+         frequency <= Info.MaxInterruptFrequency;
+         frequency *= 10) {
+
+        InterruptFrequencies.push_back(frequency);
+    }
+}
+
+uint16_t ElementMask (uint32_t DataBitLength)
+{
+    return uint16_t((1U << DataBitLength) - 1);
+}
+
+//
+// Packs Count elements of a counter starting at First in SpiPort's byte
+// layout
+//
+void Counter (
+    uint32_t First,
+    uint32_t Count,
+    uint32_t DataBitLength,
+    std::vector<uint8_t>& Bytes
+    )
+{
+    const uint32_t elementSize = (DataBitLength > 8) ? 2 : 1;
+    Bytes.resize(Count * elementSize);
+    for (uint32_t i = 0; i != Count; ++i) {
+        const uint16_t element = uint16_t((First + i) & ElementMask(DataBitLength));
+        if (elementSize == 2) {
+            Bytes[2 * i] = uint8_t(element);
+            Bytes[2 * i + 1] = uint8_t(element >> 8);
+        } else {
+            Bytes[i] = uint8_t(element);
+        }
+    }
+}
+
+struct SweepResult {
+    uint32_t Captures;
+    uint32_t TesterMismatches;
+    uint32_t MisoMismatches;
+    uint32_t ProtocolErrors;
+    uint64_t WireNanos;
+    uint64_t TotalNanos;
+};
+
+SweepResult RunCaptures (
+    TesterClient& Client,
+    SpiPort& Port,
+    const CaptureParameters& Parameters,
+    uint32_t ElementCount,
+    uint32_t Iterations
+    )
+{
+    SweepResult result = SweepResult();
+
+    std::vector<uint8_t> mosi;
+    std::vector<uint8_t> expectedMiso;
+    Counter(Parameters.SendValue, ElementCount, Parameters.DataBitLength, mosi);
+    Counter(
+        Parameters.ReceiveValue,
+        ElementCount,
+        Parameters.DataBitLength,
+        expectedMiso);
+    std::vector<uint8_t> miso(mosi.size());
+
+    for (uint32_t i = 0; i != Iterations; ++i) {
+        const uint64_t start = Port.NowNanos();
+        const TransferInfo2* const info = Client.Capture(
+            Parameters,
+            mosi.data(),
+            miso.data(),
+            uint32_t(mosi.size()));
+        const uint64_t end = Port.NowNanos();
+
+        ++result.Captures;
+        if (info == nullptr) {
+            ++result.ProtocolErrors;
+            continue;
+        }
+
+        result.WireNanos += Client.LastCaptureNanos();
+        result.TotalNanos += end - start;
+        if ((info->ElementCount != ElementCount) ||
+            (info->MismatchIndex != ElementCount)) {
+
+            ++result.TesterMismatches;
+        }
+        if (miso != expectedMiso) {
+            ++result.MisoMismatches;
+        }
+    }
+
+    return result;
+}
+
+double Mbps (uint64_t Bits, uint64_t Nanos)
+{
+    return (Nanos == 0) ? 0.0 : (double(Bits) * 1000.0) / double(Nanos);
+}
+
+uint32_t Percentile (const std::vector<uint32_t>& Sorted, uint32_t Percent)
+{
+    const size_t index = ((Sorted.size() - 1) * Percent) / 100;
+    return Sorted[index];
+}
+
+void PrintUsage (const char* Name)
+{
+    fprintf(
+        stderr,
+        "Usage: %s (--simulator | --spidev DEVICE [--gpio CHIP:LINE])\n"
+        "           [--auto] [--engines Polled,Dma,Record] [--frequencies HZ,...]\n"
+        "           [--widths BITS,...] [--sizes ELEMENTS,...] [--iterations N]\n"
+        "           [--interrupt-frequencies HZ,...] [--interrupt-duration S]\n",
+        Name);
+}
+
+} // namespace "static"
+
+int main (int argc, char* argv[])
+{
+    bool simulator = false;
+    bool autoTune = false;
+    const char* device = nullptr;
+    std::string gpioChip;
+    uint32_t gpioLine = 0;
+    std::vector<CaptureMode> engines = { CaptureMode::Polled, CaptureMode::Dma };
+    std::vector<uint32_t> frequencies = { 1000000, 4000000, 8000000 };
+    std::vector<uint32_t> widths = { 8, 16 };
+    std::vector<uint32_t> sizes = { 64, 1024 };
+    std::vector<uint32_t> interruptFrequencies = { 1000 };
+    uint32_t iterations = 20;
+    uint32_t interruptDuration = 1;
+
+    for (int i = 1; i != argc; ++i) {
+        const bool hasValue = i + 1 != argc;
+        bool valid = true;
+        if (strcmp(argv[i], "--simulator") == 0) {
+            simulator = true;
+        } else if (strcmp(argv[i], "--auto") == 0) {
+            autoTune = true;
+        } else if ((strcmp(argv[i], "--spidev") == 0) && hasValue) {
+            device = argv[++i];
+        } else if ((strcmp(argv[i], "--gpio") == 0) && hasValue) {
+            const char* const value = argv[++i];
+            const char* const colon = strrchr(value, ':');
+            valid = colon != nullptr;
+            if (valid) {
+                gpioChip.assign(value, colon);
+                gpioLine = uint32_t(strtoul(colon + 1, nullptr, 0));
+            }
+        } else if ((strcmp(argv[i], "--engines") == 0) && hasValue) {
+            valid = ParseEngines(argv[++i], engines);
+        } else if ((strcmp(argv[i], "--frequencies") == 0) && hasValue) {
+            valid = ParseList(argv[++i], frequencies);
+        } else if ((strcmp(argv[i], "--widths") == 0) && hasValue) {
+            valid = ParseList(argv[++i], widths);
+        } else if ((strcmp(argv[i], "--sizes") == 0) && hasValue) {
+            valid = ParseList(argv[++i], sizes);
+        } else if ((strcmp(argv[i], "--iterations") == 0) && hasValue) {
+            iterations = uint32_t(strtoul(argv[++i], nullptr, 0));
+            valid = iterations != 0;
+        } else if ((strcmp(argv[i], "--interrupt-frequencies") == 0) && hasValue) {
+            valid = ParseList(argv[++i], interruptFrequencies);
+        } else if ((strcmp(argv[i], "--interrupt-duration") == 0) && hasValue) {
+            interruptDuration = uint32_t(strtoul(argv[++i], nullptr, 0));
+            valid = (interruptDuration != 0) && (interruptDuration <= 0xffff);
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            PrintUsage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (simulator == (device != nullptr)) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    std::unique_ptr<SpiPort> port;
+    if (simulator) {
+        port.reset(new SimPort());
+    } else {
+#ifdef LLDT_SPIDEV
+        SpidevPort* const spidev = new SpidevPort();
+        port.reset(spidev);
+        if (!spidev->Open(
+                device,
+                gpioChip.empty() ? nullptr : gpioChip.c_str(),
+                gpioLine)) {
+
+            return 1;
+        }
+#else
+        fprintf(stderr, "spidev is only supported on Linux\n");
+        return 2;
+#endif
+    }
+
+    TesterClient client(*port);
+    // responses are overwritten by the next query, so keep a copy
+    const TesterInfo* const response = client.GetDeviceInfo();
+    if ((response == nullptr) || (response->DeviceId != DEVICE_ID)) {
+        fprintf(stderr, "No tester responded to GetDeviceInfo\n");
+        return 1;
+    }
+    const TesterInfo deviceInfo = *response;
+    printf("Tester version %u\n", deviceInfo.Version);
+
+    uint32_t captureBufferSize = CAPTURE_BUFFER_SIZE;
+    if (autoTune) {
+        const TesterInfo2* const info2 = client.GetDeviceInfo2();
+        if (info2 == nullptr) {
+            fprintf(stderr, "The tester does not report TesterInfo2\n");
+            return 1;
+        }
+        captureBufferSize = info2->CaptureBufferSize;
+        AutoTune(*info2, engines, interruptFrequencies);
+        printf("Capabilities 0x%08x\n", info2->Capabilities);
+    }
+
+    // the sweep checks MISO against the tester's counter
+    if (!client.LoadPattern(CapturePattern::Counter, 8)) {
+        fprintf(stderr, "Failed to select the counter pattern\n");
+        return 1;
+    }
+
+    printf(
+        "%-7s %5s %10s %8s %6s %10s %10s %8s %8s %8s\n",
+        "engine",
+        "width",
+        "frequency",
+        "elements",
+        "ops",
+        "wire Mb/s",
+        "eff Mb/s",
+        "tester",
+        "miso",
+        "protocol");
+
+    bool passed = true;
+    for (CaptureMode engine : engines) {
+        for (uint32_t width : widths) {
+            const TesterInfo* const info = client.GetDeviceInfo(engine, width);
+            if (info == nullptr) {
+                fprintf(stderr, "GetDeviceInfo failed for %s\n", EngineToString(engine));
+                passed = false;
+                continue;
+            }
+            if ((width < info->MinDataBitLength) || (width > info->MaxDataBitLength)) {
+                continue;
+            }
+            const uint32_t maxFrequency = info->MaxFrequency;
+            const uint32_t elementSize = (width > 8) ? 2 : 1;
+            if (autoTune) {
+                frequencies = { maxFrequency / 4, maxFrequency / 2, maxFrequency };
+            }
+
+            for (uint32_t frequency : frequencies) {
+                for (uint32_t size : sizes) {
+                    // the DMA engines record into the capture buffer
+                    if ((engine != CaptureMode::Polled) &&
+                        ((size * elementSize) > captureBufferSize)) {
+
+                        continue;
+                    }
+
+                    CaptureParameters parameters;
+                    parameters.DataBitLength = width;
+                    parameters.Frequency = frequency;
+                    parameters.Engine = engine;
+                    parameters.SendValue = 0;
+                    parameters.ReceiveValue = uint16_t(0x5a & ElementMask(width));
+
+                    const SweepResult result = RunCaptures(
+                        client,
+                        *port,
+                        parameters,
+                        size,
+                        iterations);
+
+                    const uint64_t bits = uint64_t(size) * width;
+                    const uint32_t succeeded = result.Captures - result.ProtocolErrors;
+                    printf(
+                        "%-7s %5u %9u%c %8u %6u %10.2f %10.2f %8u %8u %8u\n",
+                        EngineToString(engine),
+                        width,
+                        frequency,
+                        (frequency > maxFrequency) ? '*' : ' ',
+                        size,
+                        result.Captures,
+                        Mbps(bits * succeeded, result.WireNanos),
+                        Mbps(bits * succeeded, result.TotalNanos),
+                        result.TesterMismatches,
+                        result.MisoMismatches,
+                        result.ProtocolErrors);
+
+                    // errors are expected above the tester's rated frequency
+                    if ((frequency <= maxFrequency) &&
+                        ((result.TesterMismatches + result.MisoMismatches +
+                          result.ProtocolErrors) != 0)) {
+
+                        passed = false;
+                    }
+                }
+            }
+        }
+    }
+
+    if (!port->HasInterruptLine()) {
+        printf("No interrupt line, skipping interrupt latency\n");
+    } else {
+        printf(
+            "\n%10s %10s %8s %8s %8s %10s %10s %10s %10s\n",
+            "irq Hz",
+            "interrupts",
+            "acked",
+            "late",
+            "dropped",
+            "p50 us",
+            "p90 us",
+            "p99 us",
+            "max us");
+
+        const double ticksPerMicro = deviceInfo.ClockMeasurementFrequency / 1e6;
+        for (uint32_t frequency : interruptFrequencies) {
+            std::vector<uint32_t> latencies;
+            const PeriodicInterruptInfo* const info = client.RunPeriodicInterrupts(
+                frequency,
+                uint16_t(interruptDuration),
+                latencies);
+            if (info == nullptr) {
+                fprintf(stderr, "Interrupt session at %u Hz failed\n", frequency);
+                passed = false;
+                continue;
+            }
+
+            std::sort(latencies.begin(), latencies.end());
+            const bool any = !latencies.empty();
+            printf(
+                "%10u %10u %8u %8u %8u %10.2f %10.2f %10.2f %10.2f\n",
+                frequency,
+                info->InterruptCount,
+                info->AcknowledgedBeforeDeadlineCount,
+                info->AcknowledgedAfterDeadlineCount,
+                info->DroppedInterruptCount(),
+                any ? Percentile(latencies, 50) / ticksPerMicro : 0.0,
+                any ? Percentile(latencies, 90) / ticksPerMicro : 0.0,
+                any ? Percentile(latencies, 99) / ticksPerMicro : 0.0,
+                any ? latencies.back() / ticksPerMicro : 0.0);
+        }
+    }
+
+    const ClientStatistics& statistics = client.Statistics();
+    printf(
+        "\n%llu transfers, %llu failed, %llu invalid responses, "
+        "%llu invalid acknowledges\n",
+        (unsigned long long)statistics.Transfers,
+        (unsigned long long)statistics.TransferErrors,
+        (unsigned long long)statistics.InvalidResponses,
+        (unsigned long long)statistics.InvalidAcknowledges);
+
+    return passed ? 0 : 1;
+}
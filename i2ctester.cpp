@@ -4,15 +4,30 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <lpc17xx.h>
 
 #include "util.h"
 #include "Lpc17xxHardware.h"
 #include "lldtester.h"
+#include "profiler.h"
+#include "telemetry.h"
 #include "i2ctester.h"
 
 using namespace Lldt::I2c;
 
+namespace { // static
+
+//
+// Backing store of the large EEPROM. The AHB SRAM is not initialized at
+// startup, so it is filled by I2cTester::Init.
+//
+AHBSRAM1_SECTION uint8_t largeEeprom[LARGE_EEPROM_SIZE];
+
+} // namespace "static"
+
+I2cTester* I2cTester::instance;
+
 void FatalError ()
 {
     for (;;) {
@@ -24,36 +39,155 @@ void FatalError ()
     }
 }
 
-//
-// Delay for the specified interval while blinking the activity LED
-//
-void BlinkDelay ( uint32_t Milliseconds )
+uint32_t I2cTester::CurrentHoldMicros ( ) const
 {
-    int end = Millis() + Milliseconds;
-    int nextToggle = 0;
-    uint32_t i = 0;
-
-    int now;
-    while ((now = Millis()) < end) {
-        if (now >= nextToggle) {
-            if (++i & 1)
-                ActLedOn();
-            else
-                ActLedOff();
-            nextToggle += 500;
-        }
+    // a nonzero microsecond hold time takes precedence over the millisecond
+    // hold time
+    uint32_t timeInMicros =
+        (this->device->storage[REG_SCL_HOLD_MICROS_HI] << 8) |
+        this->device->storage[REG_SCL_HOLD_MICROS_LO];
+    if (timeInMicros != 0) {
+        return timeInMicros;
     }
 
-    ActLedOff();
+    uint32_t timeInMillis =
+        (this->device->storage[REG_SCL_HOLD_MILLIS_HI] << 8) |
+        this->device->storage[REG_SCL_HOLD_MILLIS_LO];
+    return timeInMillis * 1000;
 }
 
-void I2cTester::DelayCurrentHoldMillis ( )
+void I2cTester::BeginHold ( )
 {
-    uint32_t timeInMillis =
-        (storage[REG_SCL_HOLD_MILLIS_HI] << 8) |
-        storage[REG_SCL_HOLD_MILLIS_LO];
-    DBGPRINT("DelayCurrentHoldMillis for %lu ms\n\r", timeInMillis);
-    BlinkDelay(timeInMillis);
+    uint32_t timeInMicros = this->CurrentHoldMicros();
+    TelemetryLog(TELEMETRY_I2C_HOLD, timeInMicros);
+
+    this->device->state |= STATE_HOLDING;
+    NVIC_DisableIRQ(I2C1_IRQn);
+    ActLedBlinkStart();
+    SetAlarm(
+        TIM_MATCH_CHANNEL(HOLD_ALARM_CHANNEL),
+        timeInMicros,
+        &I2cTester::HoldAlarm);
+}
+
+void I2cTester::EndHold ( )
+{
+    ActLedBlinkStop();
+    this->device->state &= ~STATE_HOLDING;
+
+    // clears SI, which releases SCL
+    this->Ack();
+    this->timing.byteStartTime = ElapsedCycles();
+    NVIC_EnableIRQ(I2C1_IRQn);
+}
+
+void I2cTester::HoldAlarm ( )
+{
+    instance->EndHold();
+}
+
+void I2cTester::ResetDevice ( VirtualDevice& Device, uint8_t Index )
+{
+    Device.state = STATE_NORMAL;
+    Device.address = 0;
+    Device.countdown = 0;
+    Device.scheduleCounter = 0;
+    Device.addressBytesPending = 0;
+    Device.checksum.Reset();
+
+    memset(Device.storage, 0x55, sizeof(Device.storage));
+    Device.storage[REG_VERSION] = VERSION;
+    Device.storage[REG_DISABLE_REPEATED_STARTS] = 0;
+    Device.storage[REG_SCL_HOLD_MILLIS_HI] = 0x01;
+    Device.storage[REG_SCL_HOLD_MILLIS_LO] = 0xF4;
+    Device.storage[REG_SCL_HOLD_MICROS_HI] = 0;
+    Device.storage[REG_SCL_HOLD_MICROS_LO] = 0;
+    Device.storage[REG_FAULT_SCHEDULE_ACTION] = FAULT_SCHEDULE_NONE;
+    Device.storage[REG_FAULT_SCHEDULE_INDEX] = 0;
+    Device.storage[REG_FAULT_SCHEDULE_PERIOD] = 1;
+    Device.storage[REG_FAULT_SCHEDULE_COUNT] = 0;
+    Device.storage[REG_DEVICE_INDEX] = Index;
+    Device.storage[REG_VIRTUAL_DEVICE_ADDRESS_1] = 0;
+    Device.storage[REG_VIRTUAL_DEVICE_ADDRESS_2] = 0;
+    Device.storage[REG_VIRTUAL_DEVICE_ADDRESS_3] = 0;
+    Device.storage[REG_LARGE_EEPROM_ENABLE] = 0;
+    Device.storage[REG_LARGE_EEPROM_WRITE_CRC_HI] = 0;
+    Device.storage[REG_LARGE_EEPROM_WRITE_CRC_LO] = 0;
+    Device.storage[REG_LARGE_EEPROM_READ_CRC_HI] = 0;
+    Device.storage[REG_LARGE_EEPROM_READ_CRC_LO] = 0;
+    memset(
+        Device.storage + REG_TIMING_BYTE_COUNT_HI,
+        0,
+        REG_TIMING_SERVICE_CYCLES_LO - REG_TIMING_BYTE_COUNT_HI + 1);
+    Device.storage[REG_MAX_BUS_SPEED_KHZ_HI] = uint8_t(MAX_BUS_SPEED_KHZ >> 8);
+    Device.storage[REG_MAX_BUS_SPEED_KHZ_LO] = uint8_t(MAX_BUS_SPEED_KHZ);
+    memset(Device.storage + REG_TIMING_START_TIME, 0, 8);
+    memset(
+        Device.storage + REG_PROFILE_SELECT,
+        0,
+        REG_PROFILE_MEAN_CYCLES + 3 - REG_PROFILE_SELECT);
+    memset(
+        Device.storage + REG_CAPABILITY_VERSION,
+        0,
+        REG_CAPABILITY_END - REG_CAPABILITY_VERSION + 1);
+    Device.storage[REG_CAPABILITY_VERSION] = CAPABILITY_VERSION;
+    for (uint32_t i = 0; i != 4; ++i) {
+        Device.storage[REG_CAPABILITIES + i] =
+            uint8_t(CAPABILITIES >> (24 - (8 * i)));
+    }
+    Device.storage[REG_CAPABILITY_MAX_BUS_SPEED_KHZ] =
+        uint8_t(MAX_BUS_SPEED_KHZ >> 8);
+    Device.storage[REG_CAPABILITY_MAX_BUS_SPEED_KHZ + 1] =
+        uint8_t(MAX_BUS_SPEED_KHZ);
+    Device.storage[REG_CAPABILITY_EEPROM_SIZE] =
+        uint8_t((EEPROM_ADDRESS_MAX + 1) >> 8);
+    Device.storage[REG_CAPABILITY_EEPROM_SIZE + 1] =
+        uint8_t(EEPROM_ADDRESS_MAX + 1);
+    Device.storage[REG_CAPABILITY_LARGE_EEPROM_SIZE] =
+        uint8_t(LARGE_EEPROM_SIZE >> 8);
+    Device.storage[REG_CAPABILITY_LARGE_EEPROM_SIZE + 1] =
+        uint8_t(LARGE_EEPROM_SIZE);
+    Device.storage[REG_CAPABILITY_VIRTUAL_DEVICE_COUNT] = VIRTUAL_DEVICE_COUNT;
+    Device.storage[REG_CAPABILITY_NACK_INDEX_MAX] = NACK_INDEX_MAX;
+    Device.storage[REG_CAPABILITY_STRETCH_INDEX_MAX] = STRETCH_INDEX_MAX;
+    Device.storage[REG_HOLD_READ_CONTROL] = 0xff;
+    Device.storage[REG_HOLD_WRITE_CONTROL] = 0xff;
+    Device.storage[REG_NAK_CONTROL] = 0xff;
+    Device.storage[REG_CHECKSUM_UPDATE] = 0;
+    Device.storage[REG_CHECKSUM_RESET] = 0;
+}
+
+PeripheralRegister* I2cTester::SlaveAddressRegister ( uint32_t Index )
+{
+    // I2ADR1-3 are not adjacent to I2ADR0
+    return (Index == 0) ? &LPC_I2C1->I2ADR0 : (&LPC_I2C1->I2ADR1 + (Index - 1));
+}
+
+void I2cTester::SelectDevice ( uint8_t AddressByte )
+{
+    // The received address byte is in I2DAT. General calls, and addresses
+    // matched by no other register, are handled by the primary device.
+    this->device = &this->devices[0];
+    for (uint32_t i = 1; i < VIRTUAL_DEVICE_COUNT; ++i) {
+        const uint32_t slaveAddress = *SlaveAddressRegister(i) >> 1;
+        if ((slaveAddress != 0) && (slaveAddress == uint32_t(AddressByte >> 1))) {
+            this->device = &this->devices[i];
+            break;
+        }
+    }
+}
+
+void I2cTester::SetVirtualDeviceAddress ( uint32_t Index, uint8_t Address )
+{
+    // an address of 0 disables the device. The primary address can not be
+    // shared, since the primary device would always respond.
+    Address &= 0x7f;
+    if (Address == SLAVE_ADDRESS) {
+        Address = 0;
+    }
+
+    this->devices[0].storage[REG_VIRTUAL_DEVICE_ADDRESS_1 + Index - 1] = Address;
+    *SlaveAddressRegister(Index) = Address << 1;
 }
 
 //
@@ -61,24 +195,17 @@ void I2cTester::DelayCurrentHoldMillis ( )
 //
 void I2cTester::Init ( )
 {
-    this->state = STATE_NORMAL;
-    this->address = 0;
-    this->countdown = 0;
-    this->isFirstByte = false;
-    
-    memset(this->storage, sizeof(this->storage), 0);
-    this->storage[REG_VERSION] = VERSION;
-    this->storage[REG_DISABLE_REPEATED_STARTS] = 0;
-    this->storage[REG_SCL_HOLD_MILLIS_HI] = 0x01;
-    this->storage[REG_SCL_HOLD_MILLIS_LO] = 0xF4;
-    this->storage[REG_HOLD_READ_CONTROL] = 0xff;
-    this->storage[REG_HOLD_WRITE_CONTROL] = 0xff;
-    this->storage[REG_NAK_CONTROL] = 0xff;
-    this->storage[REG_CHECKSUM_UPDATE] = 0;
-    this->storage[REG_CHECKSUM_RESET] = 0;
-    
+    for (uint32_t i = 0; i < VIRTUAL_DEVICE_COUNT; ++i) {
+        this->ResetDevice(this->devices[i], uint8_t(i));
+    }
+    this->device = &this->devices[0];
+    this->largeEepromDevice = nullptr;
+    memset(largeEeprom, 0x55, sizeof(largeEeprom));
+
     SetPeripheralPowerState(CLKPWR_PCONP_PCI2C1, true);
-    SetPeripheralClockDivider(CLKPWR_PCLKSEL_I2C1, CLKPWR_PCLKSEL_CCLK_DIV_4);
+    // run I2C1 at CCLK so that SI is raised, and cleared, with the least
+    // delay after each event
+    SetPeripheralClockDivider(CLKPWR_PCLKSEL_I2C1, CLKPWR_PCLKSEL_CCLK_DIV_1);
 
     // P0.1 (SCL), P0.0 (SDA)
     LPC_PINCON->PINSEL0 = LPC_PINCON->PINSEL0 | (0x3 << 2) | (0x3 << 0);
@@ -91,20 +218,45 @@ void I2cTester::Init ( )
     // Select open drain mode for P0.1, P0.0
     LPC_PINCON->PINMODE_OD0 |= (1 << 1) | (1 << 0);
 
-    // Set clock rate of 100kHz
+    // Set clock rate to the maximum bus speed. SCLL/SCLH are only used in
+    // master mode; as a slave, the master's clock is followed.
     LPC_I2C1->I2SCLL = LPC_I2C1->I2SCLH =
-        GetPeripheralClockFrequency(CLKPWR_PCLKSEL_I2C1) / 100000 / 2;
+        GetPeripheralClockFrequency(CLKPWR_PCLKSEL_I2C1) /
+        (MAX_BUS_SPEED_KHZ * 1000) / 2;
 
     LPC_I2C1->I2CONCLR = I2C_I2CONCLR_I2ENC;
     LPC_I2C1->I2ADR0 = SLAVE_ADDRESS << 1;
     LPC_I2C1->I2MASK0 = 0;
 
+    // the virtual devices are disabled until the master assigns them an
+    // address
+    for (uint32_t i = 1; i < VIRTUAL_DEVICE_COUNT; ++i) {
+        *SlaveAddressRegister(i) = 0;
+        (&LPC_I2C1->I2MASK0)[i] = 0;
+    }
+
     LPC_I2C1->I2CONCLR = I2C_I2CONCLR_STAC | I2C_I2CONCLR_STOC | I2C_I2CONCLR_SIC;
     LPC_I2C1->I2CONSET = I2C_I2CONSET_I2EN | I2C_I2CONSET_AA;
+
+    // Service the bus from the I2C1 interrupt. It has the highest priority
+    // so that SPI real-time loops never stall the bus. The hold alarm runs
+    // from the default timer interrupt at the same priority so that it
+    // never preempts the state machine.
+    instance = this;
+    NVIC_SetPriority(I2C1_IRQn, IRQ_PRIORITY_I2C);
+    NVIC_SetPriority(DefaultTimerIrq(), IRQ_PRIORITY_I2C);
+    NVIC_EnableIRQ(I2C1_IRQn);
+}
+
+extern "C" void I2C1_IRQHandler ()
+{
+    I2cTester::instance->RunStateMachine();
 }
 
 void I2cTester::RunStateMachine ( )
 {
+    const uint32_t now = ElapsedCycles();
+
     switch (LPC_I2C1->I2STAT) {
     // All Master
     case I2C_I2STAT_M_TX_START:     // sent start condition
@@ -127,20 +279,26 @@ void I2cTester::RunStateMachine ( )
     case I2C_I2STAT_S_RX_ARB_LOST_M_SLA:        // lost arbitration, returned ack
     case I2C_I2STAT_S_RX_ARB_LOST_M_GENCALL:    // lost arbitration, returned ack
         ActLedOn();
+        this->SelectDevice(uint8_t(LPC_I2C1->I2DAT));
+        this->BeginTransactionTiming(now);
         this->AddressedForWrite();
         break;
     case I2C_I2STAT_S_RX_PRE_SLA_DAT_ACK:       // data received, returned ack
     case I2C_I2STAT_S_RX_PRE_GENCALL_DAT_ACK:   // data received generally, returned ack
         ActLedOn();
+        this->RecordByteTiming(now);
         this->ByteReceived(LPC_I2C1->I2DAT);
         break;
     case I2C_I2STAT_S_RX_STA_STO_SLVREC_SLVTRX: // stop or repeated start condition received
         ActLedOn();
+        this->EndTransactionTiming(now);
         this->StopReceived();
         this->ReleaseBus();
         break;
     case I2C_I2STAT_S_RX_PRE_SLA_DAT_NACK:      // data received, returned nack
     case I2C_I2STAT_S_RX_PRE_GENCALL_DAT_NACK:  // data received generally, returned nack
+        this->RecordByteTiming(now);
+
         // nack back at master
         this->Nack();
         // ack future responses and leave slave receiver state
@@ -149,17 +307,26 @@ void I2cTester::RunStateMachine ( )
     // Slave Transmitter
     case I2C_I2STAT_S_TX_SLAR_ACK:              // addressed, returned ack
     case I2C_I2STAT_S_TX_ARB_LOST_M_SLA:        // arbitration lost, returned ack
+        this->SelectDevice(uint8_t(LPC_I2C1->I2DAT));
+        this->BeginTransactionTiming(now);
         this->ByteRequested(true);
         ActLedOn();
         break;
     case I2C_I2STAT_S_TX_DAT_ACK:               // byte sent, ack returned
+        this->RecordByteTiming(now);
         this->ByteRequested(false);
         ActLedOn();
         break;
     case I2C_I2STAT_S_TX_DAT_NACK:              // received nack, we are done
+        // the stop condition is not reported after the master NAKs
+        this->RecordByteTiming(now);
+        this->EndTransactionTiming(now);
         this->Ack();
         break;
     case I2C_I2STAT_S_TX_LAST_DAT_ACK:          // received ack, but we are done already!
+        this->RecordByteTiming(now);
+        this->EndTransactionTiming(now);
+
         // ack future responses
         this->Ack();
         break;
@@ -173,176 +340,496 @@ void I2cTester::RunStateMachine ( )
         break;
     }
 
+    // SI has been cleared unless a hold began, in which case EndHold
+    // records the release of SCL. The time from the event to here is how
+    // long the tester stretched SCL.
+    const uint32_t end = ElapsedCycles();
+    this->timing.byteStartTime = end;
+    this->timing.longestService = std::max(this->timing.longestService, end - now);
+    ProfileRecord(PROFILE_I2C_EVENT, end - now);
     ActLedOff();
 }
 
+void I2cTester::BeginTransactionTiming ( uint32_t Now )
+{
+    // a transaction that ended without a stop condition
+    if (this->timing.active) {
+        this->EndTransactionTiming(this->timing.byteStartTime);
+    }
+
+    this->timing.device = this->device;
+    this->timing.startTime = Now;
+    this->timing.shortestByte = 0xffffffff;
+    this->timing.longestByte = 0;
+    this->timing.longestService = 0;
+    this->timing.byteCount = 0;
+    this->timing.active = true;
+    this->timing.excluded = false;
+}
+
+void I2cTester::RecordByteTiming ( uint32_t Now )
+{
+    if (!this->timing.active) return;
+
+    const uint32_t byteTime = Now - this->timing.byteStartTime;
+    this->timing.shortestByte = std::min(this->timing.shortestByte, byteTime);
+    this->timing.longestByte = std::max(this->timing.longestByte, byteTime);
+    ++(this->timing.byteCount);
+}
+
+//
+// Publish the timing of the transaction to the timing registers of the
+// device it addressed. Transactions that access the timing registers are
+// not published, so that reading the registers does not overwrite them.
+//
+void I2cTester::EndTransactionTiming ( uint32_t Now )
+{
+    if (!this->timing.active) return;
+    this->timing.active = false;
+    TelemetryLog(
+        TELEMETRY_I2C_TRANSACTION,
+        uint32_t(this->timing.device - this->devices),
+        this->timing.byteCount);
+    if (this->timing.excluded) return;
+
+    const uint32_t cyclesPerMicro = SystemCoreClock / 1000000;
+    uint32_t bitRate = 0;
+    uint32_t longestGapNanos = 0;
+    if (this->timing.byteCount != 0) {
+        // each byte takes 9 clocks. The shortest byte is assumed to have
+        // no gap, and any extra time in other bytes is a gap.
+        bitRate = (9 * SystemCoreClock) / std::max(this->timing.shortestByte, uint32_t(1));
+        longestGapNanos = uint32_t(
+            (uint64_t(this->timing.longestByte - this->timing.shortestByte) * 1000) /
+            cyclesPerMicro);
+    }
+    const uint32_t transactionMicros =
+        (Now - this->timing.startTime) / cyclesPerMicro;
+
+    uint8_t* const storage = this->timing.device->storage;
+    storage[REG_TIMING_BYTE_COUNT_HI] = uint8_t(this->timing.byteCount >> 8);
+    storage[REG_TIMING_BYTE_COUNT_LO] = uint8_t(this->timing.byteCount);
+    for (uint32_t i = 0; i < 4; ++i) {
+        const uint32_t shift = 24 - (8 * i);
+        storage[REG_TIMING_BIT_RATE + i] = uint8_t(bitRate >> shift);
+        storage[REG_TIMING_LONGEST_GAP_NANOS + i] = uint8_t(longestGapNanos >> shift);
+        storage[REG_TIMING_TRANSACTION_MICROS + i] = uint8_t(transactionMicros >> shift);
+    }
+    const uint32_t serviceCycles =
+        std::min(this->timing.longestService, uint32_t(0xffff));
+    storage[REG_TIMING_SERVICE_CYCLES_HI] = uint8_t(serviceCycles >> 8);
+    storage[REG_TIMING_SERVICE_CYCLES_LO] = uint8_t(serviceCycles);
+    const uint64_t startTime = ElapsedCyclesToTime(this->timing.startTime);
+    for (uint32_t i = 0; i < 8; ++i) {
+        storage[REG_TIMING_START_TIME + i] = uint8_t(startTime >> (56 - (8 * i)));
+    }
+    ++storage[REG_TIMING_SEQUENCE];
+}
+
+void I2cTester::SelectProfileSection ( uint8_t Value )
+{
+    const uint8_t section = Value & ~PROFILE_SELECT_RESET;
+    ProfileCounters counters = ProfileCounters();
+    if (section < PROFILE_SECTION_COUNT) {
+        counters = GetProfileCounters(ProfileSection(section));
+    }
+
+    if (Value & PROFILE_SELECT_RESET) {
+        ProfileReset();
+    }
+
+    const uint32_t meanCycles = counters.Count ?
+        uint32_t(std::min(
+            counters.TotalCycles / counters.Count,
+            uint64_t(0xffffff))) :
+        0;
+
+    uint8_t* const storage = this->device->storage;
+    storage[REG_PROFILE_SELECT] = section;
+    for (uint32_t i = 0; i < 4; ++i) {
+        const uint32_t shift = 24 - (8 * i);
+        storage[REG_PROFILE_COUNT + i] = uint8_t(counters.Count >> shift);
+        storage[REG_PROFILE_MIN_CYCLES + i] = uint8_t(counters.MinCycles >> shift);
+        storage[REG_PROFILE_MAX_CYCLES + i] = uint8_t(counters.MaxCycles >> shift);
+    }
+    for (uint32_t i = 0; i < 3; ++i) {
+        storage[REG_PROFILE_MEAN_CYCLES + i] = uint8_t(meanCycles >> (16 - (8 * i)));
+    }
+}
+
+void I2cTester::ExcludeTimingIfTimingRegister ( )
+{
+    const uint16_t address = this->device->address;
+    if ((this->device == this->largeEepromDevice) &&
+        (address < LARGE_EEPROM_REGISTER_BASE)) {
+
+        return;
+    }
+
+    const uint8_t reg = uint8_t(address);
+    if (((reg >= REG_TIMING_BYTE_COUNT_HI) && (reg <= REG_TIMING_SERVICE_CYCLES_LO)) ||
+        ((reg >= REG_TIMING_START_TIME) && (reg < REG_TIMING_START_TIME + 8))) {
+
+        this->timing.excluded = true;
+    }
+}
+
+void I2cTester::ApplyFaultSchedule ( bool isRead )
+{
+    const uint8_t action = this->device->storage[REG_FAULT_SCHEDULE_ACTION];
+    if (action == FAULT_SCHEDULE_NONE) return;
+
+    // hold read applies to read transactions, all other actions
+    // apply to write transactions
+    if ((action == FAULT_SCHEDULE_HOLD_READ) != isRead) return;
+
+    // a period of 0 is treated as 1
+    if (++(this->device->scheduleCounter) < this->device->storage[REG_FAULT_SCHEDULE_PERIOD])
+        return;
+
+    this->device->scheduleCounter = 0;
+
+    const uint8_t index = this->device->storage[REG_FAULT_SCHEDULE_INDEX];
+    switch (action) {
+    case FAULT_SCHEDULE_NAK_WRITE:
+        this->device->storage[REG_NAK_CONTROL] = index;
+        break;
+    case FAULT_SCHEDULE_HOLD_WRITE:
+        this->device->storage[REG_HOLD_WRITE_CONTROL] = index;
+        break;
+    case FAULT_SCHEDULE_HOLD_READ:
+        this->device->storage[REG_HOLD_READ_CONTROL] = index;
+        break;
+    case FAULT_SCHEDULE_DISABLE_REPEATED_STARTS:
+        this->device->storage[REG_DISABLE_REPEATED_STARTS] = 1;
+        break;
+    default:
+        // unknown actions are never applied
+        return;
+    }
+
+    // a count of 0 applies the schedule until it is cleared
+    uint8_t& count = this->device->storage[REG_FAULT_SCHEDULE_COUNT];
+    if ((count != 0) && (--count == 0)) {
+        this->device->storage[REG_FAULT_SCHEDULE_ACTION] = FAULT_SCHEDULE_NONE;
+    }
+}
+
 void I2cTester::AddressedForWrite ( )
 {
-    this->isFirstByte = true;
+    this->device->addressBytesPending =
+        (this->device == this->largeEepromDevice) ? 2 : 1;
+    this->ApplyFaultSchedule(false);
 
     // if NAK is armed, check if NAK length is 0, or set up NAK state
-    if (this->storage[REG_NAK_CONTROL] != 0xff) {
-        if (this->storage[REG_NAK_CONTROL] == 0) {
+    if (this->device->storage[REG_NAK_CONTROL] != 0xff) {
+        if (this->device->storage[REG_NAK_CONTROL] == 0) {
             this->Nack();
-            this->state &= ~STATE_NAK_WRITE;
+            this->device->state &= ~STATE_NAK_WRITE;
         } else {
             this->Ack();
-            this->countdown = storage[REG_NAK_CONTROL];
-            this->state |= STATE_NAK_WRITE;
+            this->device->countdown = this->device->storage[REG_NAK_CONTROL];
+            this->device->state |= STATE_NAK_WRITE;
         }
         // NAK is always one-shot. This resets NAK control.
-        this->storage[REG_NAK_CONTROL] = 0xff;
-    } else if (this->storage[REG_HOLD_WRITE_CONTROL] != 0xff) {
-        if (this->storage[REG_HOLD_WRITE_CONTROL] == 0) {
-            this->DelayCurrentHoldMillis();
-            this->state &= STATE_HOLD_WRITE;
+        this->device->storage[REG_NAK_CONTROL] = 0xff;
+    } else if (this->device->storage[REG_HOLD_WRITE_CONTROL] != 0xff) {
+        const uint8_t holdWriteControl = this->device->storage[REG_HOLD_WRITE_CONTROL];
+
+        // Hold write is always one-shot. This resets hold write.
+        this->device->storage[REG_HOLD_WRITE_CONTROL] = 0xff;
+
+        if (holdWriteControl == 0) {
+            // acknowledged when the hold ends
+            this->device->state &= ~STATE_HOLD_WRITE;
+            this->BeginHold();
         } else {
             // enter hold write state
-            this->countdown = this->storage[REG_HOLD_WRITE_CONTROL];
-            this->state |= STATE_HOLD_WRITE;
+            this->device->countdown = holdWriteControl;
+            this->device->state |= STATE_HOLD_WRITE;
+            this->Ack();
         }
-
-        this->Ack();
-
-        // Hold write is always one-shot. This resets hold write.
-        this->storage[REG_HOLD_WRITE_CONTROL] = 0xff;
-    } else if (this->storage[REG_DISABLE_REPEATED_STARTS] != 0) {
+    } else if (this->device->storage[REG_DISABLE_REPEATED_STARTS] != 0) {
         this->Ack();
 
         // if disable repeated starts is armed, set the NO_RS flag
-        this->state |= STATE_NO_RS;
+        this->device->state |= STATE_NO_RS;
 
         // disabling repeated start is always a one-shot operation
-        this->storage[REG_DISABLE_REPEATED_STARTS] = 0;
+        this->device->storage[REG_DISABLE_REPEATED_STARTS] = 0;
     } else {
         this->Ack();
 
         // if write NAK or HOLD_WRITE are not armed, ensure we
         // are not in those states
-        this->state &= ~(STATE_HOLD_WRITE | STATE_NAK_WRITE | STATE_NO_RS);
+        this->device->state &= ~(STATE_HOLD_WRITE | STATE_NAK_WRITE | STATE_NO_RS);
     }
 }
 
 void I2cTester::ByteReceived ( uint8_t data )
 {
-    if (this->state & STATE_NAK_WRITE) {
+    if (this->device->state & STATE_NAK_WRITE) {
         // count down until it's time to NAK.
         // zero-length NAK would have been handled in AddressedForWrite
-        if (--(this->countdown) == 0) {
+        if (--(this->device->countdown) == 0) {
             // NAKing here means the next byte that the master sends will
             // be NAKed.
             this->Nack();
-            this->state &= ~STATE_NAK_WRITE;
+            this->device->state &= ~STATE_NAK_WRITE;
         } else {
             this->Ack();
         }
-    } else if (this->state & STATE_HOLD_WRITE) {
-        if (--(this->countdown) == 0) {
-            this->DelayCurrentHoldMillis();
-            this->state &= ~STATE_HOLD_WRITE;
-        }
-
+    } else if (this->device->state & STATE_HOLD_WRITE) {
         // data received in HOLD_WRITE mode is ignored
 
-        this->Ack();
+        if (--(this->device->countdown) == 0) {
+            // acknowledged when the hold ends
+            this->device->state &= ~STATE_HOLD_WRITE;
+            this->BeginHold();
+        } else {
+            this->Ack();
+        }
     } else {
         this->Ack();
 
-        if (this->isFirstByte) {
-            this->isFirstByte = false;
-            this->address = data;
+        if (this->device->addressBytesPending != 0) {
+            // the large EEPROM's address is sent most significant byte first
+            --(this->device->addressBytesPending);
+            this->device->address = (this->device == this->largeEepromDevice) ?
+                uint16_t((this->device->address << 8) | data) : data;
+
+            if (this->device->addressBytesPending == 0) {
+                this->ExcludeTimingIfTimingRegister();
+            }
             return;
         }
 
-        // if we're in eeprom range, increment and wrap address
-        if (this->address <= EEPROM_ADDRESS_MAX) {
-            this->storage[this->address] = data;
-            this->address = (this->address + 1) % (EEPROM_ADDRESS_MAX + 1);
-            return;
+        if (this->device == this->largeEepromDevice) {
+            const uint16_t address = this->device->address;
+            if (address < LARGE_EEPROM_SIZE) {
+                largeEeprom[address] = data;
+                this->UpdateLargeEepromCrc(
+                    this->largeEepromWriteCrc,
+                    REG_LARGE_EEPROM_WRITE_CRC_HI,
+                    data);
+                this->device->address = (address + 1) % LARGE_EEPROM_SIZE;
+                return;
+            } else if (address < LARGE_EEPROM_REGISTER_BASE) {
+                // writes between the memory and the register space are ignored
+                ++(this->device->address);
+                return;
+            }
         }
 
-        // update register with data. address does not auto increment
-        // for register writes
-        switch (this->address) {
-        case REG_SCL_HOLD_MILLIS_HI:
-            // increment address so that both HI and LO bytes can
-            // be written in a single operation
-            this->storage[this->address] = data;
-            ++(this->address);
-            break;
-        case REG_DISABLE_REPEATED_STARTS:
-        case REG_SCL_HOLD_MILLIS_LO:
-        case REG_HOLD_READ_CONTROL:
-        case REG_HOLD_WRITE_CONTROL:
-        case REG_NAK_CONTROL:
-            this->storage[this->address] = data;
-            break;
-        case REG_CHECKSUM_UPDATE:
-        {
-            uint32_t crc = this->checksum.Update(data);
-            this->storage[REG_CHECKSUM_UPDATE] = uint8_t((crc >> 8) & 0xff);
-            this->storage[REG_CHECKSUM_RESET] =  uint8_t(crc & 0xff);
-            break;
+        // the low byte of the address selects the register
+        uint8_t address = uint8_t(this->device->address);
+        this->WriteRegister(address, data);
+        this->device->address = (this->device->address & 0xff00) | address;
+    }
+}
+
+void I2cTester::WriteRegister ( uint8_t& Address, uint8_t Data )
+{
+    // if we're in eeprom range, increment and wrap address
+    if (Address <= EEPROM_ADDRESS_MAX) {
+        this->device->storage[Address] = Data;
+        Address = (Address + 1) % (EEPROM_ADDRESS_MAX + 1);
+        return;
+    }
+
+    // update register with data. address does not auto increment
+    // for register writes
+    switch (Address) {
+    case REG_SCL_HOLD_MILLIS_HI:
+    case REG_SCL_HOLD_MICROS_HI:
+    case REG_FAULT_SCHEDULE_INDEX:
+    case REG_FAULT_SCHEDULE_PERIOD:
+        // increment address so that multi-byte registers can
+        // be written in a single operation
+        this->device->storage[Address] = Data;
+        ++Address;
+        break;
+    case REG_DISABLE_REPEATED_STARTS:
+    case REG_SCL_HOLD_MILLIS_LO:
+    case REG_SCL_HOLD_MICROS_LO:
+    case REG_FAULT_SCHEDULE_COUNT:
+    case REG_HOLD_READ_CONTROL:
+    case REG_HOLD_WRITE_CONTROL:
+    case REG_NAK_CONTROL:
+        this->device->storage[Address] = Data;
+        break;
+    case REG_FAULT_SCHEDULE_ACTION:
+        // writing the action restarts the schedule. Increment address
+        // so the whole schedule can be written in a single operation.
+        this->device->storage[Address] = Data;
+        this->device->scheduleCounter = 0;
+        ++Address;
+        break;
+    case REG_CHECKSUM_UPDATE:
+    {
+        uint32_t crc = this->device->checksum.Update(Data);
+        this->device->storage[REG_CHECKSUM_UPDATE] = uint8_t((crc >> 8) & 0xff);
+        this->device->storage[REG_CHECKSUM_RESET] =  uint8_t(crc & 0xff);
+        break;
+    }
+    case REG_VIRTUAL_DEVICE_ADDRESS_1:
+    case REG_VIRTUAL_DEVICE_ADDRESS_2:
+    case REG_VIRTUAL_DEVICE_ADDRESS_3:
+        // only the primary device assigns addresses. Increment address so
+        // that all addresses can be written in a single operation.
+        if (this->device == &this->devices[0]) {
+            this->SetVirtualDeviceAddress(
+                Address - REG_VIRTUAL_DEVICE_ADDRESS_1 + 1,
+                Data);
         }
-        case REG_CHECKSUM_RESET:
-            this->checksum.Reset();
-            this->storage[REG_CHECKSUM_UPDATE] = 0;
-            this->storage[REG_CHECKSUM_RESET] = 0;
-            break;
-        default:
-            // writes to reserved registers are ignored
-            break;
+        ++Address;
+        break;
+    case REG_LARGE_EEPROM_ENABLE:
+        this->EnableLargeEeprom(Data != 0);
+        break;
+    case REG_PROFILE_SELECT:
+        this->SelectProfileSection(Data);
+        break;
+    case REG_LARGE_EEPROM_WRITE_CRC_HI:
+        if (this->device == this->largeEepromDevice) {
+            this->largeEepromWriteCrc.Reset();
+            this->device->storage[REG_LARGE_EEPROM_WRITE_CRC_HI] = 0;
+            this->device->storage[REG_LARGE_EEPROM_WRITE_CRC_LO] = 0;
+        }
+        break;
+    case REG_LARGE_EEPROM_READ_CRC_HI:
+        if (this->device == this->largeEepromDevice) {
+            this->largeEepromReadCrc.Reset();
+            this->device->storage[REG_LARGE_EEPROM_READ_CRC_HI] = 0;
+            this->device->storage[REG_LARGE_EEPROM_READ_CRC_LO] = 0;
         }
+        break;
+    case REG_CHECKSUM_RESET:
+        this->device->checksum.Reset();
+        this->device->storage[REG_CHECKSUM_UPDATE] = 0;
+        this->device->storage[REG_CHECKSUM_RESET] = 0;
+        break;
+    default:
+        // writes to reserved registers are ignored
+        break;
     }
 }
 
 void I2cTester::ByteRequested ( bool isStart )
 {
-    if (isStart && (this->storage[REG_HOLD_READ_CONTROL] != 0xff)) {
-        if (this->storage[REG_HOLD_READ_CONTROL] == 0) {
-            this->countdown = 0;
-            this->DelayCurrentHoldMillis();
-        } else {
-            // enter the hold read state
-            this->countdown = this->storage[REG_HOLD_READ_CONTROL];
-            this->state |= STATE_HOLD_READ;
-        }
+    if (isStart) {
+        this->ApplyFaultSchedule(true);
+        this->ExcludeTimingIfTimingRegister();
+    }
 
-        LPC_I2C1->I2DAT = this->countdown;
-        this->Ack();
+    if (isStart && (this->device->storage[REG_HOLD_READ_CONTROL] != 0xff)) {
+        const uint8_t holdReadControl = this->device->storage[REG_HOLD_READ_CONTROL];
 
         // ensure that hold read is a one-shot operation
-        this->storage[REG_HOLD_READ_CONTROL] = 0xff;
-    } else if (this->state & STATE_HOLD_READ) {
+        this->device->storage[REG_HOLD_READ_CONTROL] = 0xff;
+
+        if (holdReadControl == 0) {
+            this->device->countdown = 0;
+            LPC_I2C1->I2DAT = this->device->countdown;
+
+            // the byte is released when the hold ends
+            this->BeginHold();
+        } else {
+            // enter the hold read state
+            this->device->countdown = holdReadControl;
+            this->device->state |= STATE_HOLD_READ;
+            LPC_I2C1->I2DAT = this->device->countdown;
+            this->Ack();
+        }
+    } else if (this->device->state & STATE_HOLD_READ) {
         // hold read state counts down until it's time to hold
-        if (--(this->countdown) == 0) {
-            this->DelayCurrentHoldMillis();
+        LPC_I2C1->I2DAT = --(this->device->countdown);
+        if (this->device->countdown == 0) {
+            this->BeginHold();
+        } else {
+            this->Ack();
         }
-
-        LPC_I2C1->I2DAT = this->countdown;
-        this->Ack();
     } else {
         // all other states return current register value
-        LPC_I2C1->I2DAT = this->storage[this->address];
+        LPC_I2C1->I2DAT = this->ReadByte();
         this->Ack();
+    }
+}
 
-        if (this->address <= EEPROM_ADDRESS_MAX) {
-            // addresses within the eeprom increment and wrap
-            this->address = (this->address + 1) % (EEPROM_ADDRESS_MAX + 1);
-        } else {
-            // address increments and wraps
-            ++(this->address);
+uint8_t I2cTester::ReadByte ( )
+{
+    if (this->device == this->largeEepromDevice) {
+        const uint16_t address = this->device->address;
+        if (address < LARGE_EEPROM_SIZE) {
+            const uint8_t data = largeEeprom[address];
+            this->UpdateLargeEepromCrc(
+                this->largeEepromReadCrc,
+                REG_LARGE_EEPROM_READ_CRC_HI,
+                data);
+            this->device->address = (address + 1) % LARGE_EEPROM_SIZE;
+            return data;
+        } else if (address < LARGE_EEPROM_REGISTER_BASE) {
+            ++(this->device->address);
+            return 0x55;
         }
     }
+
+    // the low byte of the address selects the register
+    uint8_t address = uint8_t(this->device->address);
+    const uint8_t data = this->device->storage[address];
+
+    if (address <= EEPROM_ADDRESS_MAX) {
+        // addresses within the eeprom increment and wrap
+        address = (address + 1) % (EEPROM_ADDRESS_MAX + 1);
+    } else {
+        // address increments and wraps
+        ++address;
+    }
+
+    this->device->address = (this->device->address & 0xff00) | address;
+    return data;
+}
+
+void I2cTester::EnableLargeEeprom ( bool Enable )
+{
+    VirtualDevice* const previous = this->largeEepromDevice;
+    if (previous != nullptr) {
+        previous->storage[REG_LARGE_EEPROM_ENABLE] = 0;
+        previous->address &= 0xff;
+        this->largeEepromDevice = nullptr;
+    }
+
+    if (!Enable) return;
+
+    // the memory is shared, so enabling it on one device disables it on
+    // any other device. The contents are kept.
+    this->largeEepromDevice = this->device;
+    this->device->storage[REG_LARGE_EEPROM_ENABLE] = 1;
+    this->largeEepromWriteCrc.Reset();
+    this->largeEepromReadCrc.Reset();
+    this->device->storage[REG_LARGE_EEPROM_WRITE_CRC_HI] = 0;
+    this->device->storage[REG_LARGE_EEPROM_WRITE_CRC_LO] = 0;
+    this->device->storage[REG_LARGE_EEPROM_READ_CRC_HI] = 0;
+    this->device->storage[REG_LARGE_EEPROM_READ_CRC_LO] = 0;
+
+    // the register space moves to the top of the address space
+    this->device->address |= LARGE_EEPROM_REGISTER_BASE;
+}
+
+void I2cTester::UpdateLargeEepromCrc ( Crc16& Crc, uint8_t HiRegister, uint8_t Data )
+{
+    const uint32_t crc = Crc.Update(Data);
+    this->device->storage[HiRegister] = uint8_t((crc >> 8) & 0xff);
+    this->device->storage[HiRegister + 1] = uint8_t(crc & 0xff);
 }
 
 void I2cTester::StopReceived ( )
 {
     // check if we should fail repeated starts
-    if (this->state & STATE_NO_RS) {
+    if (this->device->state & STATE_NO_RS) {
         this->Stop();
 
         // disabling repeated starts is always a one-shot operation
-        this->state &= ~STATE_NO_RS;
+        this->device->state &= ~STATE_NO_RS;
     }
 }
\ No newline at end of file
@@ -12,34 +12,46 @@ class I2cTester
 public:
 
     I2cTester () :
-        state(STATE_NORMAL),
-        address(0),
-        countdown(0),
-        isFirstByte(false)
+        device(&devices[0]),
+        largeEepromDevice(nullptr),
+        timing()
     { }
 
     //
-    // Initialize I2C1 in slave mode on P0.0 (SDA) and P0.1 (SCL)
+    // Initialize I2C1 in slave mode on P0.0 (SDA) and P0.1 (SCL) and enable
+    // the I2C1 interrupt
     //
     void Init ( );
 
     //
-    // Call this in a loop to run the I2C state machine
+    // Runs the I2C state machine. Called from I2C1_IRQHandler each time
+    // the I2C1 SI flag is set.
     //
     void RunStateMachine ( );
 
+    //
+    // The tester serviced by I2C1_IRQHandler
+    //
+    static I2cTester* instance;
+
 private:
 
     enum : uint16_t {
         SCL_HOLD_DEFAULT = 15000
     };
 
+    // default timer match channel that ends an SCL hold
+    enum : uint32_t {
+        HOLD_ALARM_CHANNEL = TIM_MATCH_CHANNEL_0
+    };
+
     enum STATE : uint32_t {
         STATE_NORMAL = 0,
         STATE_NAK_WRITE = 0x1,  // NAK_WRITE, HOLD_WRITE and NO_RS are mutually exclusive
         STATE_HOLD_WRITE = 0x2,
         STATE_NO_RS = 0x4,
         STATE_HOLD_READ = 0x8,  // HOLD_READ can be combined with NAK_WRITE or HOLD_WRITE
+        STATE_HOLDING = 0x10,   // SCL is being held low until the hold alarm fires
     };
 
     static void Ack ( )
@@ -65,19 +77,104 @@ private:
         LPC_I2C1->I2CONSET = I2C_I2CONSET_I2EN | I2C_I2CONSET_AA;
     }
 
+    //
+    // The state of a virtual device. The primary device responds to
+    // SLAVE_ADDRESS, and each of the other devices responds to the address
+    // in one of I2ADR1-3 once the master has assigned it one. Each device
+    // has its own register file, fault injection state and checksum.
+    //
+    struct VirtualDevice {
+        int state;              // bitwise OR of STATE values
+        Crc16 checksum;         // current checksum
+        uint16_t address;       // current EEPROM address
+        uint8_t countdown;      // counts down number of bytes until special operation
+        uint8_t scheduleCounter;    // transactions since the fault schedule was last applied
+        uint8_t addressBytesPending;    // address bytes still expected in this write
+        uint8_t storage[256];   // provide 256 bytes of storage in our virtual eeprom
+    };
+
+    static void ResetDevice ( VirtualDevice& Device, uint8_t Index );
+    static PeripheralRegister* SlaveAddressRegister ( uint32_t Index );
+
+    //
+    // Select the device addressed by the address byte of the current
+    // transaction
+    //
+    void SelectDevice ( uint8_t AddressByte );
+    void SetVirtualDeviceAddress ( uint32_t Index, uint8_t Address );
+
+    //
+    // Arm the one-shot register selected by the fault schedule if this
+    // transaction is the next one the schedule applies to
+    //
+    void ApplyFaultSchedule ( bool isRead );
+
     void AddressedForWrite ( );
     void ByteReceived ( uint8_t data );
     void ByteRequested ( bool isStart );
     void StopReceived ( );
 
-    void DelayCurrentHoldMillis ( );
+    //
+    // Access the 256-byte register space of the current device. Address is
+    // advanced as described in the register documentation.
+    //
+    void WriteRegister ( uint8_t& Address, uint8_t Data );
+    uint8_t ReadByte ( );
+
+    //
+    // The large EEPROM replaces the 8-bit address space of at most one
+    // device with a 16-bit address space, where the register space is
+    // mapped at LARGE_EEPROM_REGISTER_BASE.
+    //
+    void EnableLargeEeprom ( bool Enable );
+    void UpdateLargeEepromCrc ( Crc16& Crc, uint8_t HiRegister, uint8_t Data );
+
+    //
+    // Snapshot the profiling counters of the section written to
+    // REG_PROFILE_SELECT into the profiling registers of the current device
+    //
+    void SelectProfileSection ( uint8_t Value );
+
+    //
+    // Begin holding SCL low for the currently configured hold time. SI is
+    // left set so the hardware keeps stretching the clock, and the I2C1
+    // interrupt is disabled until the hold alarm acknowledges the pending
+    // event and releases the bus.
+    //
+    uint32_t CurrentHoldMicros ( ) const;
+    void BeginHold ( );
+    void EndHold ( );
+    static void HoldAlarm ( );
+
+    VirtualDevice devices[VIRTUAL_DEVICE_COUNT];
+    VirtualDevice* device;  // the device addressed by the current transaction
+    VirtualDevice* largeEepromDevice;   // the device using the large EEPROM
+
+    //
+    // Timing of the current transaction, in CCLK cycles. Bytes are timed
+    // from the release of SCL after the previous event to the next event,
+    // so time the tester spends holding SCL is not counted.
+    //
+    struct TransactionTiming {
+        VirtualDevice* device;  // the device addressed by the transaction
+        uint32_t startTime;     // when the address byte was acknowledged
+        uint32_t byteStartTime; // when SCL was last released
+        uint32_t shortestByte;
+        uint32_t longestByte;
+        uint32_t longestService;    // longest run of the state machine
+        uint16_t byteCount;
+        bool active;
+        bool excluded;          // the transaction accesses the timing registers
+    };
+
+    void BeginTransactionTiming ( uint32_t Now );
+    void RecordByteTiming ( uint32_t Now );
+    void EndTransactionTiming ( uint32_t Now );
+    void ExcludeTimingIfTimingRegister ( );
 
-    int state;              // bitwise OR of STATE values
-    Crc16 checksum;         // current checksum
-    uint8_t address;        // current EEPROM address
-    uint8_t countdown;      // counts down number of bytes until special operation
-    bool isFirstByte;
-    uint8_t storage[256];   // provide 256 bytes of storage in our virtual eeprom
+    TransactionTiming timing;
+    Crc16 largeEepromWriteCrc;  // bytes written to the large EEPROM
+    Crc16 largeEepromReadCrc;   // bytes read from the large EEPROM
 };
 
 } // namespace I2c
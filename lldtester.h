@@ -13,6 +13,198 @@
 #include <climits>
 
 namespace Lldt {
+
+//
+// Code sections timed by the DWT cycle counter profiler. Counters for each
+// section are returned by the SPI GetProfilingInfo command and through the
+// I2C profiling registers.
+//
+enum ProfileSection : uint32_t {
+    PROFILE_SPI_CAPTURE_LOOP,       // Polled and Record engine element loop
+    PROFILE_SPI_WAIT_FOR_CAPTURE,   // Waiting for the first SCK edge
+    PROFILE_SPI_SEND,               // Queueing a response for transmission
+    PROFILE_SPI_ACKNOWLEDGE,        // SCK edge to acknowledge response queued
+    PROFILE_I2C_EVENT,              // One pass of the I2C state machine
+    PROFILE_SPI_DISPATCH,           // SSP interrupt to the tester running
+    PROFILE_SECTION_COUNT,
+};
+
+#pragma pack(push,1)
+
+//
+// Counters for one profiled section. Times are in CPU clock cycles.
+//
+struct ProfileCounters {
+    //
+    // The number of times the section ran
+    //
+    uint32_t Count;
+
+    //
+    // The shortest and longest run of the section. Both are 0 if Count is 0.
+    //
+    uint32_t MinCycles;
+    uint32_t MaxCycles;
+
+    //
+    // The sum of all runs of the section
+    //
+    uint64_t TotalCycles;
+
+    //
+    // For sections that contain a loop, the longest single iteration of the
+    // loop. This is the figure to compare against the time per element at
+    // the target clock rate. 0 for sections without a loop.
+    //
+    uint32_t MaxIterationCycles;
+};
+
+#pragma pack(pop) // pack(push,1)
+
+//
+// The tester writes a binary event log to UART0 (the mbed serial port) at
+// TELEMETRY_BAUD_RATE, 8N1. The log is a stream of TelemetryRecords, which
+// are decoded on the host.
+//
+enum : uint32_t {
+    TELEMETRY_BAUD_RATE = 115200,
+
+    //
+    // Value of the Sync field of every record. A host that joins the
+    // stream part way through should scan for a Sync byte followed by a
+    // valid Event.
+    //
+    TELEMETRY_SYNC = 0xA5,
+};
+
+//
+// Records are written to one stream per context, so that recording never
+// has to wait for another context. Each stream numbers its records.
+//
+enum TelemetryStream : uint8_t {
+    TELEMETRY_STREAM_THREAD,        // main loop
+    TELEMETRY_STREAM_INTERRUPT,     // I2C and default timer interrupts
+    TELEMETRY_STREAM_COUNT,
+};
+
+enum TelemetryEvent : uint8_t {
+    TELEMETRY_INVALID,
+
+    //
+    // Records were dropped because the stream was full.
+    // Args[0]: the number of records dropped
+    //
+    TELEMETRY_RECORDS_DROPPED,
+
+    //
+    // The tester started. Args[0]: cycle counter frequency in Hz
+    //
+    TELEMETRY_STARTED,
+
+    //
+    // An SPI command was received. Args[0]: command code,
+    // Args[1]: the first 4 bytes of the command parameters
+    //
+    TELEMETRY_SPI_COMMAND,
+
+    //
+    // An SPI command was not recognized. Args[0]: command code
+    //
+    TELEMETRY_SPI_INVALID_COMMAND,
+
+    //
+    // A response could not be sent. Args[0]: TelemetrySendError,
+    // Args[1]: length of the response
+    //
+    TELEMETRY_SPI_SEND_ERROR,
+
+    //
+    // A capture completed. Args[0]: elements received,
+    // Args[1]: index of the first mismatched element
+    //
+    TELEMETRY_SPI_CAPTURE_COMPLETE,
+
+    //
+    // Periodic interrupt mode started. Args[0]: interrupt frequency,
+    // Args[1]: number of interrupts
+    //
+    TELEMETRY_SPI_INTERRUPTS_STARTED,
+
+    //
+    // A periodic interrupt was acknowledged. Args[0]: interrupts generated
+    // so far, Args[1]: time since the falling edge
+    // (ClockMeasurementFrequency ticks)
+    //
+    TELEMETRY_SPI_INTERRUPT_ACKNOWLEDGED,
+
+    //
+    // Periodic interrupt mode ended. Args[0]: PeriodicInterruptStatus,
+    // Args[1]: interrupts acknowledged
+    //
+    TELEMETRY_SPI_INTERRUPTS_STOPPED,
+
+    //
+    // A StartPeriodicInterrupts or StartInterruptSweep command was
+    // rejected. Args[0]: interrupt frequency, Args[1]: duration
+    //
+    TELEMETRY_SPI_INTERRUPTS_INVALID,
+
+    //
+    // An interrupt sweep started or ended. Args[0]: maximum frequency, or
+    // saturation frequency when ended, Args[1]: step duration in
+    // milliseconds, or step count when ended
+    //
+    TELEMETRY_SPI_SWEEP_STARTED,
+    TELEMETRY_SPI_SWEEP_STOPPED,
+
+    //
+    // The I2C tester began holding SCL. Args[0]: hold time in microseconds
+    //
+    TELEMETRY_I2C_HOLD,
+
+    //
+    // An I2C transaction ended. Args[0]: virtual device index,
+    // Args[1]: bytes transferred
+    //
+    TELEMETRY_I2C_TRANSACTION,
+
+    //
+    // A streaming session started or ended. Args[0]: transfer limit, or
+    // transfers completed when ended, Args[1]: idle timeout in
+    // milliseconds, or transfers with a mismatch when ended
+    //
+    TELEMETRY_SPI_STREAMING_STARTED,
+    TELEMETRY_SPI_STREAMING_STOPPED,
+};
+
+enum TelemetrySendError : uint32_t {
+    TELEMETRY_SEND_TOO_LARGE,
+    TELEMETRY_SEND_FIFO_NOT_EMPTY,
+    TELEMETRY_SEND_INCOMPLETE,
+};
+
+#pragma pack(push,1)
+
+struct TelemetryRecord {
+    uint8_t Sync;           // TELEMETRY_SYNC
+    uint8_t Event;          // TelemetryEvent
+    uint8_t Stream;         // TelemetryStream
+
+    //
+    // Incremented for each record written to the stream
+    //
+    uint8_t Sequence;
+
+    //
+    // The low 32 bits of the tester timebase when the event was recorded
+    //
+    uint32_t Timestamp;
+
+    uint32_t Args[2];
+};
+
+#pragma pack(pop) // pack(push,1)
+
 namespace I2c {
 
 enum {
@@ -29,10 +221,102 @@ enum {
 
     NACK_INDEX_MAX = 0xFE,
     STRETCH_INDEX_MAX = 0xFE,
+
+    //
+    // The number of virtual devices, including the primary device at
+    // SLAVE_ADDRESS
+    //
+    VIRTUAL_DEVICE_COUNT = 4,
+
+    //
+    // Size of the large EEPROM, and the address at which the register space
+    // is mapped while the large EEPROM is enabled
+    //
+    LARGE_EEPROM_SIZE = 0x2000,
+    LARGE_EEPROM_REGISTER_BASE = 0xFF00,
+
+    //
+    // The fastest SCL rate supported by the tester. I2C1 is on standard
+    // open drain pins, which are rated for Fast-mode but not Fast-mode Plus.
+    //
+    MAX_BUS_SPEED_KHZ = 400,
+
+    //
+    // Set in a value written to REG_PROFILE_SELECT to reset all profiling
+    // counters after the selected section is read
+    //
+    PROFILE_SELECT_RESET = 0x80,
+
+    //
+    // Version of the capability register block at REG_CAPABILITY_VERSION.
+    // Increment this when registers are added to the block.
+    //
+    CAPABILITY_VERSION = 1,
+};
+
+//
+// Flags reported in the REG_CAPABILITIES register. Each flag is set if the
+// tester implements the registers of the corresponding feature; testers
+// that predate the capability block implement none of them.
+//
+enum CAPABILITY : uint32_t {
+    CAPABILITY_VIRTUAL_DEVICES = 1 << 0,    // REG_VIRTUAL_DEVICE_ADDRESS_1-3
+    CAPABILITY_LARGE_EEPROM = 1 << 1,       // REG_LARGE_EEPROM_ENABLE
+    CAPABILITY_FAULT_SCHEDULE = 1 << 2,     // REG_FAULT_SCHEDULE_ACTION
+    CAPABILITY_SCL_HOLD_MICROS = 1 << 3,    // REG_SCL_HOLD_MICROS_HI/LO
+    CAPABILITY_TIMING = 1 << 4,             // REG_TIMING_BYTE_COUNT_HI
+    CAPABILITY_PROFILING = 1 << 5,          // REG_PROFILE_SELECT
+
+    //
+    // The capabilities of this tester
+    //
+    CAPABILITIES = CAPABILITY_VIRTUAL_DEVICES | CAPABILITY_LARGE_EEPROM |
+        CAPABILITY_FAULT_SCHEDULE | CAPABILITY_SCL_HOLD_MICROS |
+        CAPABILITY_TIMING | CAPABILITY_PROFILING,
 };
 
 enum REGISTERS {
     EEPROM_ADDRESS_MAX = 0x7F,
+    REG_SCL_HOLD_MICROS_HI = 0x80,
+    REG_SCL_HOLD_MICROS_LO = 0x81,
+    REG_FAULT_SCHEDULE_ACTION = 0x82,
+    REG_FAULT_SCHEDULE_INDEX = 0x83,
+    REG_FAULT_SCHEDULE_PERIOD = 0x84,
+    REG_FAULT_SCHEDULE_COUNT = 0x85,
+    REG_DEVICE_INDEX = 0x86,
+    REG_VIRTUAL_DEVICE_ADDRESS_1 = 0x87,
+    REG_VIRTUAL_DEVICE_ADDRESS_2 = 0x88,
+    REG_VIRTUAL_DEVICE_ADDRESS_3 = 0x89,
+    REG_LARGE_EEPROM_ENABLE = 0x8A,
+    REG_LARGE_EEPROM_WRITE_CRC_HI = 0x8B,
+    REG_LARGE_EEPROM_WRITE_CRC_LO = 0x8C,
+    REG_LARGE_EEPROM_READ_CRC_HI = 0x8D,
+    REG_LARGE_EEPROM_READ_CRC_LO = 0x8E,
+    REG_TIMING_BYTE_COUNT_HI = 0x90,
+    REG_TIMING_BYTE_COUNT_LO = 0x91,
+    REG_TIMING_BIT_RATE = 0x92,             // 4 bytes, most significant first
+    REG_TIMING_LONGEST_GAP_NANOS = 0x96,    // 4 bytes, most significant first
+    REG_TIMING_TRANSACTION_MICROS = 0x9A,   // 4 bytes, most significant first
+    REG_TIMING_SEQUENCE = 0x9E,
+    REG_TIMING_SERVICE_CYCLES_HI = 0x9F,
+    REG_TIMING_SERVICE_CYCLES_LO = 0xA0,
+    REG_MAX_BUS_SPEED_KHZ_HI = 0xA1,
+    REG_MAX_BUS_SPEED_KHZ_LO = 0xA2,
+    REG_TIMING_START_TIME = 0xA3,           // 8 bytes, most significant first
+    REG_PROFILE_SELECT = 0xB0,
+    REG_PROFILE_COUNT = 0xB1,               // 4 bytes, most significant first
+    REG_PROFILE_MIN_CYCLES = 0xB5,          // 4 bytes, most significant first
+    REG_PROFILE_MAX_CYCLES = 0xB9,          // 4 bytes, most significant first
+    REG_PROFILE_MEAN_CYCLES = 0xBD,         // 3 bytes, most significant first
+    REG_CAPABILITY_VERSION = 0xC0,
+    REG_CAPABILITIES = 0xC1,                // 4 bytes, most significant first
+    REG_CAPABILITY_MAX_BUS_SPEED_KHZ = 0xC5, // 2 bytes, most significant first
+    REG_CAPABILITY_EEPROM_SIZE = 0xC7,      // 2 bytes, most significant first
+    REG_CAPABILITY_LARGE_EEPROM_SIZE = 0xC9, // 2 bytes, most significant first
+    REG_CAPABILITY_VIRTUAL_DEVICE_COUNT = 0xCB,
+    REG_CAPABILITY_NACK_INDEX_MAX = 0xCC,
+    REG_CAPABILITY_STRETCH_INDEX_MAX = 0xCD,
+    REG_CAPABILITY_END = 0xDF,              // last register of the block
     REG_VERSION = 0xF7,
     REG_DISABLE_REPEATED_STARTS = 0xF8,
     REG_SCL_HOLD_MILLIS_HI = 0xF9,
@@ -44,6 +328,18 @@ enum REGISTERS {
     REG_CHECKSUM_RESET = 0xFF,
 };
 
+//
+// Actions that can be applied by the fault schedule. The schedule arms the
+// corresponding one-shot register on every Kth matching transaction.
+//
+enum FAULT_SCHEDULE_ACTION : uint8_t {
+    FAULT_SCHEDULE_NONE = 0,
+    FAULT_SCHEDULE_NAK_WRITE = 1,                   // arms NAK_CONTROL
+    FAULT_SCHEDULE_HOLD_WRITE = 2,                  // arms HOLD_WRITE_CONTROL
+    FAULT_SCHEDULE_HOLD_READ = 3,                   // arms HOLD_READ_CONTROL
+    FAULT_SCHEDULE_DISABLE_REPEATED_STARTS = 4,     // arms DISABLE_REPEATED_STARTS
+};
+
 } // namespace I2c
 namespace Spi {
 
@@ -58,6 +354,18 @@ enum : uint32_t {
     // to the interface.
     //
     VERSION = 2,
+
+    //
+    // The most recent version of the TransferInfo structure returned by
+    // GetTransferInfo
+    //
+    TRANSFER_INFO_VERSION = 2,
+
+    //
+    // The most recent version of the TesterInfo structure returned by
+    // GetDeviceInfo
+    //
+    DEVICE_INFO_VERSION = 2,
 };
 
 //
@@ -71,6 +379,17 @@ enum SpiTesterCommand {
     StartPeriodicInterrupts,
     AcknowledgeInterrupt,
     GetPeriodicInterruptInfo,
+    GetCapturedData,
+    GetInterruptLatencyHistogram,
+    StartInterruptSweep,
+    GetInterruptSweepInfo,
+    ExecuteBatch,
+    GetEdgeTraceInfo,
+    GetProfilingInfo,
+    LoadPattern,
+    StartStreaming,
+    GetStreamingInfo,
+    SetCaptureTimeout,
 };
 
 //
@@ -81,6 +400,22 @@ enum class ClockMeasurementStatus {
     UnknownError,
     EdgeNotDetected,
     Overflow,
+    Timeout,
+};
+
+//
+// The reasons a streaming session can end.
+//
+enum class StreamingStopReason {
+    //
+    // TransferCount transfers were captured.
+    //
+    Completed,
+
+    //
+    // No transfer started for IdleTimeoutMillis milliseconds.
+    //
+    IdleTimeout,
 };
 
 //
@@ -93,6 +428,189 @@ enum SpiDataMode {
     Mode3,
 };
 
+//
+// Engines that can be used to capture a transfer.
+//
+enum CaptureMode {
+    //
+    // The CPU services the SSP FIFOs and verifies each element as it is
+    // received. The CPU time spent per element limits the clock frequency,
+    // so narrow frames have a lower maximum frequency than wide frames.
+    //
+    Polled,
+
+    //
+    // The GPDMA streams the transmit pattern into the SSP and records
+    // received elements into a buffer of CAPTURE_BUFFER_SIZE bytes, which
+    // is verified after chip select deasserts. Elements beyond the end of
+    // the buffer are lost and reported as a mismatch.
+    //
+    Dma,
+
+    //
+    // The CPU services the SSP FIFOs and records received elements into
+    // the same buffer as the Dma engine without verifying them. The
+    // elements are verified after chip select deasserts. Elements beyond
+    // the end of the buffer are counted and reported as a mismatch.
+    //
+    Record,
+
+    //
+    // The CPU verifies elements as in the Polled engine, while the GPDMA
+    // timestamps every edge of SCK for the first EDGE_TRACE_MAX_CYCLES
+    // clock cycles. The edge statistics are returned by GetEdgeTraceInfo,
+    // and the raw trace by GetCapturedData.
+    //
+    EdgeTrace,
+};
+
+//
+// Flags reported in TesterInfo2::Capabilities. Each flag is set if the
+// tester implements the corresponding commands, engines or structures.
+// Testers that do not return TesterInfo2 implement none of them.
+//
+enum SpiCapability : uint32_t {
+    SPI_CAPABILITY_DMA_CAPTURE = 1 << 0,        // CaptureMode::Dma
+    SPI_CAPABILITY_RECORD_CAPTURE = 1 << 1,     // CaptureMode::Record
+    SPI_CAPABILITY_EDGE_TRACE = 1 << 2,         // CaptureMode::EdgeTrace, GetEdgeTraceInfo
+    SPI_CAPABILITY_TRANSFER_INFO2 = 1 << 3,     // TransferInfo2
+    SPI_CAPABILITY_CAPTURED_DATA = 1 << 4,      // GetCapturedData
+    SPI_CAPABILITY_LATENCY_HISTOGRAM = 1 << 5,  // GetInterruptLatencyHistogram
+    SPI_CAPABILITY_INTERRUPT_SWEEP = 1 << 6,    // StartInterruptSweep
+    SPI_CAPABILITY_BATCH = 1 << 7,              // ExecuteBatch
+    SPI_CAPABILITY_PROFILING = 1 << 8,          // GetProfilingInfo
+    SPI_CAPABILITY_PATTERNS = 1 << 9,           // LoadPattern
+    SPI_CAPABILITY_STREAMING = 1 << 10,         // StartStreaming
+    SPI_CAPABILITY_CAPTURE_TIMEOUT = 1 << 11,   // SetCaptureTimeout
+
+    //
+    // The capabilities of this tester
+    //
+    SPI_CAPABILITIES = SPI_CAPABILITY_DMA_CAPTURE |
+        SPI_CAPABILITY_RECORD_CAPTURE | SPI_CAPABILITY_EDGE_TRACE |
+        SPI_CAPABILITY_TRANSFER_INFO2 | SPI_CAPABILITY_CAPTURED_DATA |
+        SPI_CAPABILITY_LATENCY_HISTOGRAM | SPI_CAPABILITY_INTERRUPT_SWEEP |
+        SPI_CAPABILITY_BATCH | SPI_CAPABILITY_PROFILING |
+        SPI_CAPABILITY_PATTERNS | SPI_CAPABILITY_STREAMING |
+        SPI_CAPABILITY_CAPTURE_TIMEOUT,
+};
+
+//
+// Sequences of elements that a capture expects from and sends to the
+// master. The pattern is selected by LoadPattern, and applies to all
+// captures until the next LoadPattern.
+//
+enum CapturePattern {
+    //
+    // Elements increment from SendValue and ReceiveValue. This is the
+    // default.
+    //
+    Counter,
+
+    //
+    // The output of the PRBS-7 generator x^7 + x^6 + 1, seeded with all
+    // ones and split into DataBitLength-bit elements, most significant bit
+    // first. The table holds a whole period of the sequence.
+    //
+    Prbs7,
+
+    //
+    // The output of the PRBS-15 generator x^15 + x^14 + 1, generated as for
+    // Prbs7. The table holds the first PATTERN_TABLE_LENGTH elements.
+    //
+    Prbs15,
+
+    //
+    // DataBitLength elements, each with a single bit set, starting with
+    // bit 0.
+    //
+    WalkingOnes,
+
+    //
+    // Elements uploaded by the master.
+    //
+    User,
+};
+
+enum : uint32_t {
+    //
+    // The maximum clock frequency supported by the Polled capture engine
+    // for 8-bit frames. The maximum for other frame widths scales with the
+    // width, and is reported by GetDeviceInfo.
+    //
+    POLLED_CAPTURE_MAX_FREQUENCY = 5000000,
+
+    //
+    // The number of capture engines, and of entries in TesterInfo2::Engines.
+    //
+    CAPTURE_MODE_COUNT = CaptureMode::EdgeTrace + 1,
+
+    //
+    // Size in bytes of the buffer used by the Dma capture engine. Elements
+    // of 8 bits or less occupy one byte, wider elements occupy two. The
+    // tester on SSP1 has a smaller buffer, whose size it reports in
+    // TesterInfo2::CaptureBufferSize.
+    //
+    CAPTURE_BUFFER_SIZE = 8192,
+
+    //
+    // Number of bytes of captured data returned by each GetCapturedData
+    // command.
+    //
+    CAPTURED_DATA_PAGE_SIZE = 128,
+
+    //
+    // Number of buckets in the interrupt latency histogram. This covers the
+    // full range of a uint32_t latency.
+    //
+    LATENCY_HISTOGRAM_BUCKET_COUNT = 124,
+
+    //
+    // The highest interrupt frequency supported by periodic interrupt mode.
+    //
+    MAX_INTERRUPT_FREQUENCY = 1000000,
+
+    //
+    // The maximum number of steps in an interrupt sweep.
+    //
+    INTERRUPT_SWEEP_MAX_STEPS = 16,
+
+    //
+    // An interrupt sweep stops when the difference between the highest
+    // passing frequency and the lowest failing frequency is no more than
+    // 1/INTERRUPT_SWEEP_RESOLUTION of the failing frequency.
+    //
+    INTERRUPT_SWEEP_RESOLUTION = 64,
+
+    //
+    // The maximum number of command blocks in a batch.
+    //
+    BATCH_MAX_COMMANDS = 8,
+
+    //
+    // The maximum combined length of the responses to a batch.
+    //
+    BATCH_RESPONSE_BUFFER_SIZE = 1024,
+
+    //
+    // The number of SCK clock cycles recorded by the EdgeTrace capture
+    // engine of a tester with a CAPTURE_BUFFER_SIZE buffer. Each cycle has
+    // a leading and a trailing edge.
+    //
+    EDGE_TRACE_MAX_CYCLES = CAPTURE_BUFFER_SIZE / sizeof(uint32_t),
+
+    //
+    // The maximum number of elements in the pattern table used by captures
+    // with a CapturePattern other than Counter.
+    //
+    PATTERN_TABLE_LENGTH = 1024,
+
+    //
+    // The idle timeout of a streaming session whose IdleTimeoutMillis is 0.
+    //
+    STREAMING_DEFAULT_IDLE_TIMEOUT_MILLIS = 1000,
+};
+
 enum : uint32_t { INVALID_TIME_SINCE_FALLING_EDGE = 0xffffffffUL };
 
 //
@@ -141,7 +659,9 @@ struct TesterInfo : public TransferHeader {
     uint32_t Version;
 
     //
-    // The maximum SPI clock frequency at which the test device can operate.
+    // The maximum SPI clock frequency at which the test device can operate
+    // using the capture engine and frame width requested in the GetDeviceInfo
+    // command.
     //
     uint32_t MaxFrequency;
 
@@ -162,6 +682,96 @@ struct TesterInfo : public TransferHeader {
     uint8_t MaxDataBitLength;
 };
 
+//
+// The clock rate limits of a capture engine.
+//
+struct CaptureEngineLimits {
+    //
+    // The maximum SPI clock frequency of the engine at any frame width.
+    //
+    uint32_t MaxFrequency;
+
+    //
+    // The maximum number of elements per second that the engine can
+    // service, or 0 if the engine is limited only by MaxFrequency. The
+    // maximum frequency for frames of DataBitLength bits is
+    // min(MaxElementRate * DataBitLength, MaxFrequency).
+    //
+    uint32_t MaxElementRate;
+};
+
+//
+// Version 2 of the output of GetDeviceInfo. Adds the features, rate limits
+// and buffer sizes of the tester, so that a master can select the fastest
+// configuration that the tester supports without probing.
+//
+struct TesterInfo2 : public TesterInfo {
+    //
+    // The version of this structure (DEVICE_INFO_VERSION).
+    //
+    uint16_t InfoVersion;
+
+    //
+    // SpiCapability flags.
+    //
+    uint32_t Capabilities;
+
+    //
+    // The highest interrupt frequency supported by periodic interrupt mode
+    // (MAX_INTERRUPT_FREQUENCY).
+    //
+    uint32_t MaxInterruptFrequency;
+
+    //
+    // The size in bytes of the buffer used by the Dma and Record engines
+    // (CAPTURE_BUFFER_SIZE).
+    //
+    uint32_t CaptureBufferSize;
+
+    //
+    // The maximum number of elements in the pattern table
+    // (PATTERN_TABLE_LENGTH).
+    //
+    uint32_t PatternTableLength;
+
+    //
+    // The number of bytes returned by each GetCapturedData command
+    // (CAPTURED_DATA_PAGE_SIZE).
+    //
+    uint32_t CapturedDataPageSize;
+
+    //
+    // The number of SCK cycles recorded by the EdgeTrace engine
+    // (EDGE_TRACE_MAX_CYCLES).
+    //
+    uint32_t EdgeTraceMaxCycles;
+
+    //
+    // The maximum number of commands in a batch (BATCH_MAX_COMMANDS), and
+    // the maximum combined length of their responses
+    // (BATCH_RESPONSE_BUFFER_SIZE).
+    //
+    uint32_t BatchMaxCommands;
+    uint32_t BatchResponseBufferSize;
+
+    //
+    // The maximum number of steps in an interrupt sweep
+    // (INTERRUPT_SWEEP_MAX_STEPS).
+    //
+    uint32_t InterruptSweepMaxSteps;
+
+    //
+    // The number of buckets in the interrupt latency histogram
+    // (LATENCY_HISTOGRAM_BUCKET_COUNT).
+    //
+    uint32_t LatencyHistogramBucketCount;
+
+    //
+    // The clock rate limits of each engine, indexed by CaptureMode.
+    //
+    CaptureEngineLimits Engines[CAPTURE_MODE_COUNT];
+};
+
 //
 // Contains information about a captured transfer.
 //
@@ -197,6 +807,281 @@ struct TransferInfo : public TransferHeader {
 
 };
 
+//
+// Version 2 of the output of GetTransferInfo. Adds the timing of the chip
+// select signal, which is where per-transfer overhead of the master's
+// driver shows up. Times are in units of ClockMeasurementFrequency ticks.
+//
+struct TransferInfo2 : public TransferInfo {
+    //
+    // The version of this structure (TRANSFER_INFO_VERSION).
+    //
+    uint32_t InfoVersion;
+
+    //
+    // Status code indicating if the chip select timing was successfully
+    // measured. EdgeNotDetected means that no chip select edge was
+    // captured, or that the capture engine does not measure chip select
+    // timing.
+    //
+    ClockMeasurementStatus ChipSelectTimeStatus;
+
+    //
+    // The time from chip select asserting to the first falling edge of SCK.
+    // 0 unless ClockActiveTimeStatus is Success.
+    //
+    uint32_t SetupTime;
+
+    //
+    // The time from the last falling edge of SCK to chip select deasserting.
+    // 0 unless ClockActiveTimeStatus is Success.
+    //
+    uint32_t HoldTime;
+
+    //
+    // The time from chip select asserting to chip select deasserting.
+    //
+    uint32_t ChipSelectActiveTime;
+
+    //
+    // The time chip select was deasserted before the captured transfer,
+    // i.e. since the end of the transfer that carried the capture command.
+    //
+    uint32_t InterTransferGap;
+
+    //
+    // The tester timebase when chip select asserted: CPU cycles since the
+    // tester started, on the same clock as the I2C TIMING_START_TIME
+    // register and the telemetry log. 0 unless ChipSelectTimeStatus is
+    // Success.
+    //
+    uint64_t ChipSelectAssertTime;
+};
+
+//
+// Output of the GetInterruptLatencyHistogram command. Contains the
+// distribution of acknowledge latencies (AcknowledgeInterruptInfo::
+// TimeSinceFallingEdge) of the most recent periodic interrupt session,
+// in units of ClockMeasurementFrequency ticks. Already-acknowledged
+// interrupts are not included.
+//
+struct InterruptLatencyHistogram : public TransferHeader {
+    //
+    // The number of latencies recorded in the histogram.
+    //
+    uint32_t SampleCount;
+
+    //
+    // The smallest and largest latencies recorded. Both are 0 if no
+    // latencies were recorded.
+    //
+    uint32_t MinLatency;
+    uint32_t MaxLatency;
+
+    //
+    // The sum of all latencies recorded. Divide by SampleCount to obtain
+    // the mean latency.
+    //
+    uint64_t TotalLatency;
+
+    //
+    // Log-scale histogram of latencies. Each power of two is divided into
+    // four buckets, and latencies less than 8 ticks each have their own
+    // bucket. Bucket i counts latencies in the range
+    // [BucketLowerBound(i), BucketLowerBound(i + 1)).
+    //
+    uint32_t Buckets[LATENCY_HISTOGRAM_BUCKET_COUNT];
+
+    //
+    // Returns the smallest latency counted by the specified bucket. Returns
+    // 0xffffffff for LATENCY_HISTOGRAM_BUCKET_COUNT, so that it can be used
+    // as the upper bound of the last bucket.
+    //
+    static uint32_t BucketLowerBound (uint32_t Index)
+    {
+        if (Index < 8) return Index;
+        if (Index >= LATENCY_HISTOGRAM_BUCKET_COUNT) return 0xffffffffUL;
+        const uint32_t exponent = (Index >> 2) + 1;
+        return (4 | (Index & 3)) << (exponent - 2);
+    }
+};
+
+//
+// Output of the GetCapturedData command. Contains a page of the elements
+// recorded by the most recent Dma or Record capture.
+//
+struct CapturedData : public TransferHeader {
+    //
+    // Index of the first element in Data. Echoes the ElementOffset
+    // parameter of the command.
+    //
+    uint32_t ElementOffset;
+
+    //
+    // The total number of elements recorded by the most recent capture.
+    // This is 0 if the most recent capture used the Polled engine.
+    //
+    uint32_t TotalElementCount;
+
+    //
+    // The number of valid elements in Data.
+    //
+    uint16_t ElementCount;
+
+    //
+    // The size of each element in bytes: 1 for data bit lengths of 8 or
+    // less, 2 for wider elements, or 0 if no data was recorded. Wide
+    // elements are stored little-endian.
+    //
+    uint8_t ElementSize;
+
+    uint8_t Reserved;
+
+    uint8_t Data[CAPTURED_DATA_PAGE_SIZE];
+};
+
+//
+// Output of the GetEdgeTraceInfo command. Describes the SCK edges of the
+// most recent EdgeTrace capture. Times are in units of
+// ClockMeasurementFrequency ticks. A clock cycle runs from a leading edge to
+// the next leading edge, where the leading edge is the first edge after
+// chip select asserts.
+//
+struct EdgeTraceInfo : public TransferHeader {
+    //
+    // The number of leading and trailing edges recorded. Edges after the
+    // first EDGE_TRACE_MAX_CYCLES clock cycles are not recorded.
+    //
+    uint32_t LeadingEdgeCount;
+    uint32_t TrailingEdgeCount;
+
+    //
+    // The number of edges implied by the elements received: two per bit.
+    // If this is more than LeadingEdgeCount + TrailingEdgeCount, edges
+    // were not recorded. If it is less, the master sent a partial element.
+    //
+    uint32_t ExpectedEdgeCount;
+
+    //
+    // The shortest, longest and mean clock period. All are 0 if fewer
+    // than two leading edges were recorded.
+    //
+    uint32_t MinPeriod;
+    uint32_t MaxPeriod;
+    uint32_t MeanPeriod;
+
+    //
+    // The index of the clock cycle with the longest period, i.e. the
+    // largest gap in the clock. The gap follows bit LargestGapIndex of
+    // the transfer.
+    //
+    uint32_t LargestGapIndex;
+
+    //
+    // The shortest, longest and mean time SCK is high, in thousandths of
+    // the clock period. Only cycles with a recorded trailing edge count.
+    //
+    uint16_t MinDutyCycle;
+    uint16_t MaxDutyCycle;
+    uint16_t MeanDutyCycle;
+
+    //
+    // Nonzero if the leading edge is a falling edge, i.e. SCK idles high.
+    //
+    uint8_t LeadingEdgeFalling;
+
+    uint8_t Reserved;
+};
+
+//
+// Output of the GetProfilingInfo command. Contains the cycle counter
+// profile of the tester's time critical code since the counters were last
+// reset.
+//
+struct ProfilingInfo : public TransferHeader {
+    //
+    // The frequency of the cycle counter in Hz
+    //
+    uint32_t CycleFrequency;
+
+    //
+    // The number of valid entries in Sections (PROFILE_SECTION_COUNT)
+    //
+    uint32_t SectionCount;
+
+    ProfileCounters Sections[PROFILE_SECTION_COUNT];
+};
+
+//
+// Output of the GetStreamingInfo command. Contains the totals of the most
+// recent streaming session. Times are in units of ClockMeasurementFrequency
+// ticks.
+//
+struct StreamingInfo : public TransferHeader {
+    //
+    // Why the session ended.
+    //
+    StreamingStopReason StopReason;
+
+    //
+    // The data bit length of the session.
+    //
+    uint32_t DataBitLength;
+
+    //
+    // The number of transfers captured.
+    //
+    uint32_t TransferCount;
+
+    //
+    // The number of elements received in all transfers.
+    //
+    uint64_t ElementCount;
+
+    //
+    // The number of transfers that contained an out-of-sequence element.
+    // The sequence continues across transfers, so every transfer after a
+    // lost or extra element also mismatches.
+    //
+    uint32_t MismatchTransferCount;
+
+    //
+    // The index of the first transfer with an out-of-sequence element, and
+    // the index of the element within that transfer. Both are 0 if
+    // MismatchTransferCount is 0.
+    //
+    uint32_t FirstMismatchTransfer;
+    uint32_t FirstMismatchIndex;
+
+    //
+    // The sum of the clock active times of the transfers whose clock active
+    // time was measured, and the number of transfers whose clock active
+    // time could not be measured.
+    //
+    uint64_t ClockActiveTime;
+    uint32_t UnmeasuredTransferCount;
+
+    //
+    // The sum of the chip select active times. 0 if the chip select timing
+    // was not measured.
+    //
+    uint64_t ChipSelectActiveTime;
+
+    //
+    // The smallest and largest time chip select was deasserted between two
+    // transfers of the session. Both are 0 if fewer than two transfers had
+    // their chip select timing measured.
+    //
+    uint32_t MinInterTransferGap;
+    uint32_t MaxInterTransferGap;
+
+    //
+    // The time from chip select asserting for the first transfer to chip
+    // select deasserting after the last transfer.
+    //
+    uint64_t WallTime;
+};
+
 //
 // Bitfield structure indicating possible errors that can occur in
 // periodic interrupt mode.
@@ -235,7 +1120,8 @@ union PeriodicInterruptStatus {
         //
         // The specified duration and frequency would result in a total number
         // of interrupts that would exceed the range of a uint32_t. Use a lower
-        // frequency or duration.
+        // frequency or duration. Also set if the frequency is 0 or greater
+        // than MAX_INTERRUPT_FREQUENCY.
         //
         uint32_t ArithmeticOverflow : 1;
 
@@ -347,6 +1233,45 @@ struct PeriodicInterruptInfo : public TransferHeader {
     }
 };
 
+//
+// Results of one step of an interrupt sweep.
+//
+struct InterruptSweepStep {
+    uint32_t InterruptFrequency;
+    uint32_t InterruptCount;
+    uint32_t AcknowledgedBeforeDeadlineCount;
+    uint32_t AcknowledgedAfterDeadlineCount;
+
+    //
+    // Nonzero if the step stayed within the threshold.
+    //
+    uint32_t Passed;
+};
+
+//
+// Output of the GetInterruptSweepInfo command.
+//
+struct InterruptSweepInfo : public TransferHeader {
+    //
+    // Errors that occurred during any step of the sweep. If NotAcknowledged
+    // or IncompleteReceive is set, the sweep was stopped early.
+    //
+    PeriodicInterruptStatus Status;
+
+    //
+    // The highest frequency that stayed within the threshold, or 0 if no
+    // step passed.
+    //
+    uint32_t SaturationFrequency;
+
+    //
+    // The number of valid entries in Steps.
+    //
+    uint32_t StepCount;
+
+    InterruptSweepStep Steps[INTERRUPT_SWEEP_MAX_STEPS];
+};
+
 //
 // Represents the binary format of a command sent to the test device.
 //
@@ -358,22 +1283,60 @@ struct CommandBlock {
 
     uint8_t Command;    // SpiTesterCommand
     union {
+        struct {
+            //
+            // The capture engine for which MaxFrequency should be reported.
+            // Masters that leave this zero get the Polled engine's limit.
+            //
+            uint8_t CaptureMode;        // CaptureMode
+
+            //
+            // The frame width for which MaxFrequency should be reported.
+            // Masters that leave this zero get the limit for 8-bit frames.
+            //
+            uint8_t DataBitLength;
+
+            //
+            // The version of TesterInfo to return. Masters that leave this
+            // zero get the original TesterInfo; 2 or more returns
+            // TesterInfo2.
+            //
+            uint8_t InfoVersion;
+        } GetDeviceInfo;
+
         struct {
             uint8_t Mode;               // SpiDataMode
             uint8_t DataBitLength;
 
             //
             // The initial value that the tester should expect the master
-            // to send
+            // to send, or the index in the pattern table of the first
+            // element if a pattern has been loaded
             //
             uint16_t SendValue;
 
             //
-            // The initial value that the tester should send to the master.
+            // The initial value that the tester should send to the master,
+            // or the index in the pattern table of the first element.
             //
             uint16_t ReceiveValue;
+
+            //
+            // The engine used to capture the transfer. Masters that leave
+            // this zero get the Polled engine.
+            //
+            uint8_t CaptureMode;        // CaptureMode
         } CaptureNextTransfer;
 
+        struct {
+            //
+            // The version of TransferInfo to return. Masters that leave
+            // this zero get the original TransferInfo; 2 or more returns
+            // TransferInfo2.
+            //
+            uint8_t InfoVersion;
+        } GetTransferInfo;
+
         struct {
             //
             // The rate at which to generate interrupts. A falling edge will
@@ -407,6 +1370,96 @@ struct CommandBlock {
             }
         } StartPeriodicInterrupts;
 
+        struct {
+            //
+            // The highest interrupt frequency to try, and the frequency of
+            // the first step. Clamped to MAX_INTERRUPT_FREQUENCY.
+            //
+            uint32_t MaxFrequency;
+
+            //
+            // How long to generate interrupts at each step in milliseconds.
+            //
+            uint16_t StepDurationMillis;
+
+            //
+            // A step passes if the number of interrupts that were dropped or
+            // acknowledged after the deadline is no more than this many
+            // thousandths of the interrupts generated.
+            //
+            uint8_t ThresholdPerMille;
+        } StartInterruptSweep;
+
+        struct {
+            //
+            // The number of command blocks that follow this command block
+            // in the same transfer. Clamped to BATCH_MAX_COMMANDS.
+            //
+            uint8_t CommandCount;
+        } ExecuteBatch;
+
+        struct {
+            //
+            // Index of the first element to return.
+            //
+            uint32_t ElementOffset;
+        } GetCapturedData;
+
+        struct {
+            //
+            // If nonzero, the counters are reset after they are returned.
+            //
+            uint8_t Reset;
+        } GetProfilingInfo;
+
+        struct {
+            uint8_t Pattern;            // CapturePattern
+
+            //
+            // The width of the elements of a generated pattern.
+            //
+            uint8_t DataBitLength;
+
+            //
+            // For the User pattern, the index in the table of the first
+            // element that follows
+            //
+            uint16_t ElementOffset;
+
+            //
+            // For the User pattern, the number of uint16_t elements that
+            // follow this command block in the same transfer. The table
+            // ends after the last element.
+            //
+            uint16_t ElementCount;
+        } LoadPattern;
+
+        struct {
+            uint8_t Mode;               // SpiDataMode
+            uint8_t DataBitLength;
+
+            //
+            // The number of transfers after which the session ends, or 0
+            // to stream until the idle timeout.
+            //
+            uint16_t TransferCount;
+
+            //
+            // The session ends when no transfer starts for this many
+            // milliseconds. Masters that leave this zero get
+            // STREAMING_DEFAULT_IDLE_TIMEOUT_MILLIS.
+            //
+            uint16_t IdleTimeoutMillis;
+        } StartStreaming;
+
+        struct {
+            //
+            // How long CaptureNextTransfer waits for chip select to
+            // assert before it gives up, or 0 to wait forever.
+            //
+            uint16_t TimeoutMillis;
+        } SetCaptureTimeout;
+
         uint8_t RawBytes[7];
     } u;
 };
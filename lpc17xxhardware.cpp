@@ -2,11 +2,27 @@
 // Copyright (C) Microsoft. All rights reserved.
 //
 #include <stdint.h>
+#include <algorithm>
 #include <lpc17xx.h>
 
 #include "Lpc17xxHardware.h"
 
 LPC_TIM_TypeDef* _defaultTimer;
+Timebase _timebase;
+
+namespace { // static
+
+AlarmCallback _alarmCallbacks[TIM_MATCH_CHANNEL_3 + 1];
+
+// bitmask of armed alarm channels
+uint32_t _armedAlarms;
+
+PeripheralRegister* MatchRegister (TIM_MATCH_CHANNEL Channel)
+{
+    return &_defaultTimer->MR0 + Channel;
+}
+
+} // namespace "static"
 
 void SetPeripheralPowerState (CLKPWR_PCONP Peripheral, bool Enable)
 {
@@ -94,6 +110,22 @@ void SetDefaultTimer (LPC_TIM_TypeDef* Timer)
     Timer->IR = 0x3f;           // clear interrupts
     // take out of reset and enable for counting
     Timer->TCR = TIM_TCR_ENABLE;
+
+    // match interrupts are only enabled while an alarm is armed
+    NVIC_EnableIRQ(DefaultTimerIrq());
+}
+
+IRQn_Type DefaultTimerIrq ()
+{
+    if (_defaultTimer == LPC_TIM0) {
+        return TIMER0_IRQn;
+    } else if (_defaultTimer == LPC_TIM1) {
+        return TIMER1_IRQn;
+    } else if (_defaultTimer == LPC_TIM2) {
+        return TIMER2_IRQn;
+    } else {
+        return TIMER3_IRQn;
+    }
 }
 
 uint32_t Micros ()
@@ -101,6 +133,59 @@ uint32_t Micros ()
     return _defaultTimer->TC;
 }
 
+void SetAlarm (
+    TIM_MATCH_CHANNEL Channel,
+    uint32_t Micros,
+    AlarmCallback Callback
+    )
+{
+    _defaultTimer->MCR &= ~TIM_MCR_INT_ON_MATCH(Channel);
+    _defaultTimer->IR = TIM_IR_MATCH_FLAG(Channel);
+
+    _alarmCallbacks[Channel] = Callback;
+    _armedAlarms |= 1U << Channel;
+
+    *MatchRegister(Channel) = _defaultTimer->TC + Micros;
+    _defaultTimer->MCR |= TIM_MCR_INT_ON_MATCH(Channel);
+
+    // If the match time has already passed, the match will not occur until
+    // the counter wraps. The interrupt handler checks for alarms that are
+    // already due, so just pend the interrupt.
+    if (int32_t(_defaultTimer->TC - *MatchRegister(Channel)) >= 0) {
+        NVIC_SetPendingIRQ(DefaultTimerIrq());
+    }
+}
+
+void CancelAlarm (TIM_MATCH_CHANNEL Channel)
+{
+    _defaultTimer->MCR &= ~TIM_MCR_INT_ON_MATCH(Channel);
+    _defaultTimer->IR = TIM_IR_MATCH_FLAG(Channel);
+    _armedAlarms &= ~(1U << Channel);
+}
+
+//
+// Dispatch alarms that have expired. Only the default timer's interrupt is
+// enabled, and TIMER0, TIMER2 and TIMER3 belong to the SPI testers, so the
+// handler is only provided for TIMER1, which is the default timer.
+//
+extern "C" void TIMER1_IRQHandler ()
+{
+    for (uint32_t channel = TIM_MATCH_CHANNEL_0;
+         channel <= TIM_MATCH_CHANNEL_3;
+         ++channel) {
+
+        const TIM_MATCH_CHANNEL matchChannel = TIM_MATCH_CHANNEL(channel);
+        if (!(_armedAlarms & (1U << channel))) continue;
+
+        if ((_defaultTimer->IR & TIM_IR_MATCH_FLAG(matchChannel)) ||
+            (int32_t(_defaultTimer->TC - *MatchRegister(matchChannel)) >= 0)) {
+
+            CancelAlarm(matchChannel);
+            _alarmCallbacks[channel]();
+        }
+    }
+}
+
 void DelayMicros (uint32_t Micros)
 {
     uint32_t start = _defaultTimer->TC;
@@ -113,3 +198,183 @@ void DelayMicros (uint32_t Micros)
         while(_defaultTimer->TC < end && _defaultTimer->TC >= start);
     }
 }
+
+void CycleCounterInit ()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+namespace { // static
+
+//
+// The difference between the default timer and the cycle counter when the
+// timebase was initialized
+//
+uint32_t sleepReference;
+
+//
+// Samples ElapsedCycles() often enough that it wraps at most once between
+// samples. It wraps every 44 seconds at 96MHz.
+//
+void TimebaseAlarm ()
+{
+    enum : uint32_t { TIMEBASE_UPDATE_MICROS = 10000000 };
+
+    const uint32_t now = ElapsedCycles();
+    if (now < _timebase.low) {
+        ++_timebase.high;
+    }
+    _timebase.low = now;
+    ++_timebase.sequence;
+
+    SetAlarm(TIMEBASE_ALARM_CHANNEL, TIMEBASE_UPDATE_MICROS, &TimebaseAlarm);
+}
+
+//
+// Returns the default timer's count and prescale count as a single count of
+// PCLK ticks, modulo 2^32
+//
+uint32_t DefaultTimerPclkTicks ()
+{
+    uint32_t tc;
+    uint32_t pc;
+    do {
+        tc = _defaultTimer->TC;
+        pc = _defaultTimer->PC;
+    } while (tc != _defaultTimer->TC);
+
+    return (tc * (_defaultTimer->PR + 1)) + pc;
+}
+
+//
+// The default timer runs at CCLK/4 and keeps counting while the core
+// sleeps, so its lead over the cycle counter grows by the time asleep
+//
+inline uint32_t DefaultTimerLead ()
+{
+    return (4 * DefaultTimerPclkTicks()) - CycleCount();
+}
+
+} // namespace "static"
+
+void SleepUntilInterrupt ()
+{
+    __WFI();
+
+    // The time asleep is measured from the reference each time rather than
+    // accumulated sleep by sleep, so the error is bounded by the timer's
+    // resolution however often the core sleeps. A sample that is up to a
+    // timer tick early is ignored, so the timebase never goes backwards.
+    const uint32_t asleep = DefaultTimerLead() - sleepReference;
+    if (int32_t(asleep - _timebase.asleep) > 0) {
+        _timebase.asleep = asleep;
+    }
+}
+
+void TimebaseInit ()
+{
+    __disable_irq();
+    sleepReference = DefaultTimerLead();
+    _timebase.asleep = 0;
+    TimebaseAlarm();
+    __enable_irq();
+}
+
+//
+// Power up the GPDMA controller and enable it in little endian mode
+//
+void GpdmaInit ()
+{
+    SetPeripheralPowerState(CLKPWR_PCONP_PCGPDMA, true);
+
+    LPC_GPDMA->DMACIntTCClear = 0xff;
+    LPC_GPDMA->DMACIntErrClr = 0xff;
+    LPC_GPDMA->DMACConfig = GPDMA_CONFIG_ENABLE;
+    while (!(LPC_GPDMA->DMACConfig & GPDMA_CONFIG_ENABLE));
+}
+
+LPC_GPDMACH_TypeDef* GpdmaChannel (uint32_t Channel)
+{
+    static LPC_GPDMACH_TypeDef* const channels[] = {
+        LPC_GPDMACH0,
+        LPC_GPDMACH1,
+        LPC_GPDMACH2,
+        LPC_GPDMACH3,
+        LPC_GPDMACH4,
+        LPC_GPDMACH5,
+        LPC_GPDMACH6,
+        LPC_GPDMACH7,
+    };
+
+    return channels[Channel & 0x7];
+}
+
+//
+// Halt a channel, allowing data already in the channel FIFO to drain to its
+// destination, then disable it.
+//
+void GpdmaStopChannel (uint32_t Channel)
+{
+    LPC_GPDMACH_TypeDef* const channel = GpdmaChannel(Channel);
+
+    channel->DMACCConfig |= GPDMA_CFG_H;
+    while (channel->DMACCConfig & GPDMA_CFG_A);
+    channel->DMACCConfig &= ~(GPDMA_CFG_E | GPDMA_CFG_H);
+    while (LPC_GPDMA->DMACEnbldChns & (1 << Channel));
+
+    LPC_GPDMA->DMACIntTCClear = 1 << Channel;
+    LPC_GPDMA->DMACIntErrClr = 1 << Channel;
+}
+
+//
+// Program and enable a channel to perform Count transfers. Control supplies
+// everything but the transfer size. Transfers larger than
+// GPDMA_MAX_TRANSFER_SIZE are split into a chain of linked list items which
+// are written to Lli, which must have room for
+// (Count - 1) / GPDMA_MAX_TRANSFER_SIZE items.
+//
+void GpdmaProgramChannel (
+    uint32_t Channel,
+    GPDMA_LLI* Lli,
+    uint32_t SrcAddr,
+    uint32_t DestAddr,
+    uint32_t Count,
+    uint32_t Control,
+    uint32_t Config
+    )
+{
+    LPC_GPDMACH_TypeDef* const channel = GpdmaChannel(Channel);
+
+    // address increment per transfer for each side of the transfer
+    const uint32_t srcStep = (Control & GPDMA_CTRL_SI) ?
+        (1U << ((Control >> 18) & 0x7)) : 0;
+    const uint32_t destStep = (Control & GPDMA_CTRL_DI) ?
+        (1U << ((Control >> 21) & 0x7)) : 0;
+
+    uint32_t size = std::min<uint32_t>(Count, GPDMA_MAX_TRANSFER_SIZE);
+    uint32_t remaining = Count - size;
+
+    LPC_GPDMA->DMACIntTCClear = 1 << Channel;
+    LPC_GPDMA->DMACIntErrClr = 1 << Channel;
+
+    channel->DMACCSrcAddr = SrcAddr;
+    channel->DMACCDestAddr = DestAddr;
+    channel->DMACCLLI = remaining ? DmaAddress(Lli) : 0;
+    channel->DMACCControl = Control | GPDMA_CTRL_TRANSFER_SIZE(size);
+
+    for (GPDMA_LLI* lli = Lli; remaining != 0; ++lli) {
+        SrcAddr += size * srcStep;
+        DestAddr += size * destStep;
+        size = std::min<uint32_t>(remaining, GPDMA_MAX_TRANSFER_SIZE);
+        remaining -= size;
+
+        lli->SrcAddr = SrcAddr;
+        lli->DestAddr = DestAddr;
+        lli->NextLli = remaining ? DmaAddress(lli + 1) : 0;
+        lli->Control = Control | GPDMA_CTRL_TRANSFER_SIZE(size);
+    }
+
+    channel->DMACCConfig = Config | GPDMA_CFG_E;
+}
@@ -10,25 +10,48 @@
 #include "util.h"
 #include "Lpc17xxHardware.h"
 #include "lldtester.h"
+#include "profiler.h"
+#include "telemetry.h"
+#include "scheduler.h"
 #include "i2ctester.h"
 #include "spitester.h"
+#if SELFTEST
+#include "selftest.h"
+#endif // SELFTEST
 
 int main ()
 {
     ActLedInit();
     ErrLedInit();
-    SetDefaultTimer(LPC_TIM3);
+    SetDefaultTimer(LPC_TIM1);
+    GpdmaInit();
+    CycleCounterInit();
+    TimebaseInit();
+    Lldt::ProfileReset();
+    Lldt::TelemetryInit();
     
     Lldt::I2c::I2cTester i2cTester;
-    Lldt::Spi::SpiTester spiTester;
+    Lldt::Spi::Spi0Tester spiTester;
+#if SPI_TESTER_SSP1
+    Lldt::Spi::Spi1Tester spi1Tester;
+#endif // SPI_TESTER_SSP1
 
     i2cTester.Init();
     spiTester.Init();
+#if SPI_TESTER_SSP1
+    spi1Tester.Init();
+#endif // SPI_TESTER_SSP1
 
-    for (;;) {
-        i2cTester.RunStateMachine();
-        spiTester.RunStateMachine();
-    }
+#if SELFTEST
+    // The self-test runs the testers' work items while it waits, and the
+    // testers remain available to a host once it has printed its results.
+    Lldt::SelfTest::Run();
+#endif // SELFTEST
+
+    // The I2C tester runs from its interrupt. Each SPI tester runs a command
+    // to completion once its SSP interrupt reports that one is arriving,
+    // and the core sleeps while neither has work.
+    Lldt::SchedulerRun();
 
     return 0;
 }
@@ -0,0 +1,43 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+#include <stdint.h>
+#include <lpc17xx.h>
+
+#include "util.h"
+#include "Lpc17xxHardware.h"
+#include "lldtester.h"
+#include "profiler.h"
+
+using namespace Lldt;
+
+ProfileSectionCounters Lldt::profileSections[PROFILE_SECTION_COUNT];
+
+void Lldt::ProfileReset ()
+{
+    DisableIrq disableIrq;
+
+    for (uint32_t i = 0; i < PROFILE_SECTION_COUNT; ++i) {
+        ProfileSectionCounters& counters = profileSections[i];
+        counters.count = 0;
+        counters.minCycles = 0xffffffff;
+        counters.maxCycles = 0;
+        counters.totalCycles = 0;
+        counters.maxIterationCycles = 0;
+    }
+}
+
+ProfileCounters Lldt::GetProfileCounters (ProfileSection Section)
+{
+    ProfileCounters result;
+    DisableIrq disableIrq;
+
+    const ProfileSectionCounters& counters = profileSections[Section];
+    result.Count = counters.count;
+    result.MinCycles = counters.count ? counters.minCycles : 0;
+    result.MaxCycles = counters.maxCycles;
+    result.TotalCycles = counters.totalCycles;
+    result.MaxIterationCycles = counters.maxIterationCycles;
+
+    return result;
+}
@@ -0,0 +1,115 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Cycle counter profiler for the tester's time critical code. Sections are
+// timed with the DWT cycle counter, which costs a single load at each end of
+// the section. Each section is only recorded from one context: the SPI
+// sections from the main loop and the I2C section from the I2C interrupt.
+//
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+namespace Lldt {
+
+struct ProfileSectionCounters {
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    uint32_t maxIterationCycles;
+};
+
+extern ProfileSectionCounters profileSections[PROFILE_SECTION_COUNT];
+
+//
+// Records one run of Section. IterationCycles is the longest iteration of
+// the loop in the section, if it has one.
+//
+inline void ProfileRecord (
+    ProfileSection Section,
+    uint32_t Cycles,
+    uint32_t IterationCycles = 0
+    )
+{
+    ProfileSectionCounters& counters = profileSections[Section];
+    ++counters.count;
+    counters.totalCycles += Cycles;
+    if (Cycles < counters.minCycles) {
+        counters.minCycles = Cycles;
+    }
+    if (Cycles > counters.maxCycles) {
+        counters.maxCycles = Cycles;
+    }
+    if (IterationCycles > counters.maxIterationCycles) {
+        counters.maxIterationCycles = IterationCycles;
+    }
+}
+
+//
+// Records the lifetime of the object as one run of a section.
+//
+class ProfileScope {
+public:
+    explicit ProfileScope (ProfileSection Section) :
+        section(Section),
+        start(CycleCount())
+    { }
+
+    ~ProfileScope ()
+    {
+        ProfileRecord(this->section, CycleCount() - this->start);
+    }
+
+private:
+    const ProfileSection section;
+    const uint32_t start;
+};
+
+//
+// Tracks the longest iteration of a loop, for the IterationCycles of
+// ProfileRecord. Timing each iteration costs a load, a compare and a store,
+// so it is only compiled in when PROFILE_ITERATIONS is 1. Otherwise Max()
+// is 0.
+//
+class ProfileIterations {
+public:
+#if PROFILE_ITERATIONS
+    ProfileIterations () :
+        last(CycleCount()),
+        max(0)
+    { }
+
+    void Mark ()
+    {
+        const uint32_t now = CycleCount();
+        if (now - this->last > this->max) {
+            this->max = now - this->last;
+        }
+        this->last = now;
+    }
+
+    uint32_t Max () const { return this->max; }
+
+private:
+    uint32_t last;
+    uint32_t max;
+#else
+    void Mark () { }
+
+    uint32_t Max () const { return 0; }
+#endif
+};
+
+//
+// Resets the counters of all sections. Must be called once at startup.
+//
+void ProfileReset ();
+
+//
+// Returns a consistent snapshot of the counters of Section.
+//
+ProfileCounters GetProfileCounters (ProfileSection Section);
+
+} // namespace Lldt
+
+#endif // _PROFILER_H_
@@ -0,0 +1,78 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+#include <stdint.h>
+#include <lpc17xx.h>
+
+#include "util.h"
+#include "Lpc17xxHardware.h"
+#include "lldtester.h"
+#include "profiler.h"
+#include "scheduler.h"
+
+using namespace Lldt;
+
+namespace { // static
+
+struct WorkItem {
+    WorkCallback callback;
+    void* context;
+    uint32_t postCycle;     // CycleCount() when the item was posted
+};
+
+WorkItem workItems[WORK_ITEM_COUNT];
+
+// bitmask of pending work items
+volatile uint32_t pendingItems;
+
+} // namespace "static"
+
+void Lldt::SchedulerRegister (
+    WORK_ITEM Item,
+    WorkCallback Callback,
+    void* Context
+    )
+{
+    workItems[Item].callback = Callback;
+    workItems[Item].context = Context;
+}
+
+void Lldt::SchedulerPost (WORK_ITEM Item)
+{
+    DisableIrq disableIrq;
+
+    if (!(pendingItems & (1U << Item))) {
+        workItems[Item].postCycle = CycleCount();
+        pendingItems |= 1U << Item;
+    }
+}
+
+void Lldt::SchedulerRunOnce ()
+{
+    __disable_irq();
+    if (pendingItems == 0) {
+        SleepUntilInterrupt();
+
+        // run the interrupt that woke the core
+        __enable_irq();
+        return;
+    }
+
+    uint32_t item = 0;
+    while (!(pendingItems & (1U << item))) {
+        ++item;
+    }
+    pendingItems &= ~(1U << item);
+    const uint32_t postCycle = workItems[item].postCycle;
+    __enable_irq();
+
+    ProfileRecord(PROFILE_SPI_DISPATCH, CycleCount() - postCycle);
+    workItems[item].callback(workItems[item].context);
+}
+
+void Lldt::SchedulerRun ()
+{
+    for (;;) {
+        SchedulerRunOnce();
+    }
+}
@@ -0,0 +1,47 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Runs work posted by interrupts from the main loop, in priority order, and
+// sleeps when there is no work. Work items run to completion, so the
+// latency of a work item is bounded by the longest running item plus the
+// dispatch latency (PROFILE_SPI_DISPATCH). Work that cannot wait, such as
+// servicing the I2C slave, is done in the interrupt itself.
+//
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+namespace Lldt {
+
+//
+// Work items in priority order. Lower values are run first.
+//
+enum WORK_ITEM : uint32_t {
+    WORK_ITEM_SPI0 = 0,
+    WORK_ITEM_SPI1 = 1,
+    WORK_ITEM_COUNT,
+};
+
+typedef void (*WorkCallback) (void* Context);
+
+void SchedulerRegister (WORK_ITEM Item, WorkCallback Callback, void* Context);
+
+//
+// Marks Item as pending. May be called from any context. Posting an item
+// that is already pending has no effect.
+//
+void SchedulerPost (WORK_ITEM Item);
+
+//
+// Runs the highest priority pending work item. If none is pending, sleeps
+// until the next interrupt instead, and returns once it has run.
+//
+void SchedulerRunOnce ();
+
+//
+// Runs pending work items forever
+//
+void SchedulerRun ();
+
+} // namespace Lldt
+
+#endif // _SCHEDULER_H_
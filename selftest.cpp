@@ -0,0 +1,663 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Loopback self-test.
+//
+// The SPI master runs from the default timer's alarm interrupt, which has
+// the same priority as the I2C tester and so is not masked by the SPI
+// tester's real-time loops. Each transfer is clocked by the GPDMA feeding
+// SSP1, so the only CPU time the master takes from the tester is an alarm
+// at the start and end of each transfer. The I2C master is polled from the
+// main loop, while the I2C tester runs from its interrupt as usual.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <lpc17xx.h>
+
+#include "util.h"
+#include "Lpc17xxHardware.h"
+#include "lldtester.h"
+#include "profiler.h"
+#include "telemetry.h"
+#include "scheduler.h"
+#include "selftest.h"
+
+#if SPI_TESTER_SSP1
+#error "The self-test drives SSP1 as the SPI master. Build with SPI_TESTER_SSP1=0."
+#endif // SPI_TESTER_SSP1
+
+#if TELEMETRY_ENABLED
+#error "The self-test prints its results on UART0. Build with TELEMETRY=0."
+#endif // TELEMETRY_ENABLED
+
+using namespace Lldt;
+using namespace Lldt::Spi;
+
+namespace { // static
+
+enum : uint32_t {
+    // P0.25 (mbed p17) drives the SPI tester's chip select
+    MASTER_CS_PIN = 25,
+
+    // The elements clocked by each capture, and the captures at each rate.
+    // A rate is clean if every capture is.
+    CAPTURE_ELEMENT_COUNT = 1024,
+    CAPTURE_ITERATIONS = 8,
+
+    // Time allowed for the tester to run a command before the master starts
+    // the next transfer. The capture engines prefill their buffers before
+    // they wait for chip select, so the capture itself is given longer.
+    COMMAND_GAP_MICROS = 200,
+    CAPTURE_GAP_MICROS = 1000,
+
+    // margin after the expected end of a transfer before its completion
+    // is checked, and between checks
+    TRANSFER_MARGIN_MICROS = 5,
+
+    MASTER_TIMEOUT_MILLIS = 1000,
+    RESYNCHRONIZE_ATTEMPTS = 4,
+
+    I2C_TRANSFER_LENGTH = 16,
+    I2C_ITERATIONS = 16,
+    I2C_TIMEOUT_MICROS = 10000,
+};
+
+const TIM_MATCH_CHANNEL MASTER_ALARM_CHANNEL = TIM_MATCH_CHANNEL_1;
+
+//
+// SSP1 clock dividers of the SPI sweep, slowest first. SSP1 runs at CCLK,
+// so at 96MHz these are 1MHz to 24MHz.
+//
+const uint32_t spiDividers[] = { 96, 48, 32, 24, 20, 16, 14, 12, 10, 8, 6, 4 };
+
+const uint32_t i2cFrequencies[] = {
+    100000,
+    400000,
+    1000000,
+    1500000,
+    2000000,
+    3000000,
+};
+
+struct SweepMode {
+    const char* Name;
+    CaptureMode Engine;
+    uint32_t DataBitLength;
+};
+
+const SweepMode spiModes[] = {
+    { "Polled", CaptureMode::Polled, 8 },
+    { "Polled", CaptureMode::Polled, 16 },
+    { "Dma", CaptureMode::Dma, 8 },
+    { "Dma", CaptureMode::Dma, 16 },
+    { "Record", CaptureMode::Record, 8 },
+    { "Record", CaptureMode::Record, 16 },
+};
+
+//
+// One transfer of the SPI master. Tx may be nullptr to send zeros, and Rx
+// may be nullptr to discard what is received.
+//
+struct MasterTransfer {
+    uint32_t Divider;
+    uint32_t DataBitLength;
+    const void* Tx;
+    void* Rx;
+    uint32_t Count;         // elements
+    uint32_t DelayMicros;   // idle time before chip select asserts
+};
+
+enum : uint32_t { MASTER_QUEUE_LENGTH = 4 };
+
+MasterTransfer masterQueue[MASTER_QUEUE_LENGTH];
+uint32_t masterQueueLength;
+uint32_t masterNext;
+volatile bool masterDone;
+
+// source of the zeros sent by transfers without Tx, and sink of the data
+// received by transfers without Rx
+const uint32_t masterZero = 0;
+uint32_t masterDiscard;
+
+uint16_t masterTxBuffer[CAPTURE_ELEMENT_COUNT];
+uint16_t masterRxBuffer[CAPTURE_ELEMENT_COUNT];
+
+void MasterCsAssert ()
+{
+    LPC_GPIO0->FIOCLR = 1 << MASTER_CS_PIN;
+}
+
+void MasterCsDeassert ()
+{
+    LPC_GPIO0->FIOSET = 1 << MASTER_CS_PIN;
+}
+
+void MasterInit ()
+{
+    SetPeripheralPowerState(CLKPWR_PCONP_PCSSP1, true);
+    SetPeripheralClockDivider(CLKPWR_PCLKSEL_SSP1, CLKPWR_PCLKSEL_CCLK_DIV_1);
+
+    // SCK1 (P0.7), MISO1 (P0.8), MOSI1 (P0.9). SSEL1 (P0.6) is left to the
+    // SPI tester's interrupt output, and chip select is driven by GPIO.
+    uint32_t temp =
+        (LPC_PINCON->PINSEL0 & ~((0x3 << 14) | (0x3 << 16) | (0x3 << 18)));
+    temp |= (0x2 << 14) | (0x2 << 16) | (0x2 << 18);
+    LPC_PINCON->PINSEL0 = temp;
+
+    MasterCsDeassert();
+    LPC_GPIO0->FIODIR |= 1 << MASTER_CS_PIN;
+
+    LPC_SSP1->IMSC = 0;
+    LPC_SSP1->DMACR = 0;
+    LPC_SSP1->CR1 = 0;
+}
+
+uint32_t TransferMicros (const MasterTransfer& Transfer)
+{
+    const uint64_t bits = uint64_t(Transfer.Count) * Transfer.DataBitLength;
+    return uint32_t(
+        (bits * Transfer.Divider * 1000000 + SystemCoreClock - 1) /
+        SystemCoreClock);
+}
+
+void MasterBeginAlarm ();
+
+void MasterEndAlarm ()
+{
+    // the last frame has been clocked once it has been received
+    if (LPC_GPDMA->DMACEnbldChns & (1 << DMA_CHANNEL_SPI1_RX)) {
+        SetAlarm(MASTER_ALARM_CHANNEL, TRANSFER_MARGIN_MICROS, &MasterEndAlarm);
+        return;
+    }
+
+    MasterCsDeassert();
+    LPC_SSP1->DMACR = 0;
+    GpdmaStopChannel(DMA_CHANNEL_SPI1_TX);
+
+    if (++masterNext == masterQueueLength) {
+        masterDone = true;
+        return;
+    }
+
+    SetAlarm(
+        MASTER_ALARM_CHANNEL,
+        masterQueue[masterNext].DelayMicros,
+        &MasterBeginAlarm);
+}
+
+//
+// Starts the next transfer in the queue. Mode 3, like the control
+// interface, so SCK idles high across the change of frame width.
+//
+void MasterBeginAlarm ()
+{
+    const MasterTransfer& transfer = masterQueue[masterNext];
+    const bool wide = transfer.DataBitLength > 8;
+    const GPDMA_WIDTH width = wide ? GPDMA_WIDTH_HALFWORD : GPDMA_WIDTH_BYTE;
+
+    LPC_SSP1->CR1 = 0;
+    LPC_SSP1->CR0 = SSP_CR0_FRF_SPI | SSP_CR0_CPOL_HI | SSP_CR0_CPHA_SECOND |
+        SSP_CR0_DSS(transfer.DataBitLength) |
+        SSP_CR0_SCR((transfer.Divider / 2) - 1);
+    LPC_SSP1->CPSR = 2;
+    LPC_SSP1->CR1 = SSP_CR1_SSP_EN;
+
+    // drain anything left from the previous transfer
+    while (LPC_SSP1->SR & SSP_SR_RNE) {
+        masterDiscard = LPC_SSP1->DR;
+    }
+
+    GpdmaProgramChannel(
+        DMA_CHANNEL_SPI1_RX,
+        nullptr,
+        DmaAddress(&LPC_SSP1->DR),
+        (transfer.Rx != nullptr) ?
+            DmaAddress(transfer.Rx) : DmaAddress(&masterDiscard),
+        transfer.Count,
+        GPDMA_CTRL_SBSIZE(GPDMA_BSIZE_1) | GPDMA_CTRL_DBSIZE(GPDMA_BSIZE_1) |
+        GPDMA_CTRL_SWIDTH(width) | GPDMA_CTRL_DWIDTH(width) |
+        ((transfer.Rx != nullptr) ? uint32_t(GPDMA_CTRL_DI) : 0),
+        GPDMA_CFG_SRC_PERIPHERAL(GPDMA_CONN_SSP1_RX) |
+        GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_P2M));
+
+    GpdmaProgramChannel(
+        DMA_CHANNEL_SPI1_TX,
+        nullptr,
+        (transfer.Tx != nullptr) ?
+            DmaAddress(transfer.Tx) : DmaAddress(&masterZero),
+        DmaAddress(&LPC_SSP1->DR),
+        transfer.Count,
+        GPDMA_CTRL_SBSIZE(GPDMA_BSIZE_4) | GPDMA_CTRL_DBSIZE(GPDMA_BSIZE_4) |
+        GPDMA_CTRL_SWIDTH(width) | GPDMA_CTRL_DWIDTH(width) |
+        ((transfer.Tx != nullptr) ? uint32_t(GPDMA_CTRL_SI) : 0),
+        GPDMA_CFG_DEST_PERIPHERAL(GPDMA_CONN_SSP1_TX) |
+        GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_M2P));
+
+    MasterCsAssert();
+    LPC_SSP1->DMACR = SSP_DMACR_RXDMA_EN | SSP_DMACR_TXDMA_EN;
+
+    SetAlarm(
+        MASTER_ALARM_CHANNEL,
+        TransferMicros(transfer) + TRANSFER_MARGIN_MICROS,
+        &MasterEndAlarm);
+}
+
+//
+// Runs a sequence of transfers, running the testers' work items until the
+// last one completes
+//
+bool RunMaster (const MasterTransfer* Transfers, uint32_t Count)
+{
+    std::copy(Transfers, Transfers + Count, masterQueue);
+    masterQueueLength = Count;
+    masterNext = 0;
+    masterDone = false;
+
+    {
+        // alarms are set at the default timer's interrupt priority
+        DisableIrq disableIrq;
+        SetAlarm(MASTER_ALARM_CHANNEL, Transfers[0].DelayMicros, &MasterBeginAlarm);
+    }
+
+    const uint32_t start = Millis();
+    while (!masterDone) {
+        SchedulerRunOnce();
+
+        if ((Millis() - start) > MASTER_TIMEOUT_MILLIS) {
+            DisableIrq disableIrq;
+            CancelAlarm(MASTER_ALARM_CHANNEL);
+            LPC_SSP1->DMACR = 0;
+            GpdmaStopChannel(DMA_CHANNEL_SPI1_RX);
+            GpdmaStopChannel(DMA_CHANNEL_SPI1_TX);
+            MasterCsDeassert();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+MasterTransfer ControlTransfer (
+    const void* Tx,
+    void* Rx,
+    uint32_t Length,
+    uint32_t DelayMicros
+    )
+{
+    MasterTransfer transfer;
+    transfer.Divider = SystemCoreClock / SPI_CONTROL_INTERFACE_FREQUENCY;
+    transfer.DataBitLength = SPI_CONTROL_INTERFACE_DATABITLENGTH;
+    transfer.Tx = Tx;
+    transfer.Rx = Rx;
+    transfer.Count = Length;
+    transfer.DelayMicros = DelayMicros;
+    return transfer;
+}
+
+bool ValidResponse (const TransferHeader& Response, uint32_t Length)
+{
+    if (Response.Header.Length != Length) return false;
+
+    // the checksum is computed with the checksum field zeroed
+    uint8_t copy[BATCH_RESPONSE_BUFFER_SIZE];
+    memcpy(copy, &Response, Length);
+    memset(copy, 0, sizeof(Response.Header.Checksum));
+    return Crc16().Update(copy, Length) == Response.Header.Checksum;
+}
+
+//
+// Sends a query and reads its response over the control interface
+//
+template <typename Ty>
+bool Query (const CommandBlock& Command, Ty& Response)
+{
+    const MasterTransfer transfers[] = {
+        ControlTransfer(&Command, nullptr, sizeof(Command), COMMAND_GAP_MICROS),
+        ControlTransfer(nullptr, &Response, sizeof(Response), COMMAND_GAP_MICROS),
+    };
+
+    return RunMaster(transfers, 2) && ValidResponse(Response, sizeof(Response));
+}
+
+//
+// After a failed capture the tester may have seen a partial command. Each
+// command ends at chip select, so a few queries bring it back in step.
+//
+bool Resynchronize ()
+{
+    for (uint32_t i = 0; i != RESYNCHRONIZE_ATTEMPTS; ++i) {
+        TesterInfo info;
+        if (Query(CommandBlock(SpiTesterCommand::GetDeviceInfo), info) &&
+            (info.DeviceId == DEVICE_ID)) {
+
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t AdvertisedFrequency (const SweepMode& Mode)
+{
+    CommandBlock command(SpiTesterCommand::GetDeviceInfo);
+    command.u.GetDeviceInfo.CaptureMode = uint8_t(Mode.Engine);
+    command.u.GetDeviceInfo.DataBitLength = uint8_t(Mode.DataBitLength);
+
+    TesterInfo info;
+    return Query(command, info) ? info.MaxFrequency : 0;
+}
+
+//
+// Captures a counter at SystemCoreClock / Divider, and checks both what
+// the tester received and what it sent
+//
+bool CaptureOnce (const SweepMode& Mode, uint32_t Divider, uint32_t Iteration)
+{
+    const uint32_t mask = (1U << Mode.DataBitLength) - 1;
+    const uint16_t sendValue = uint16_t((Iteration * 0x1d3) & mask);
+    const uint16_t receiveValue = uint16_t(~sendValue & mask);
+
+    // narrow frames are packed one per byte
+    uint8_t* const tx8 = reinterpret_cast<uint8_t*>(masterTxBuffer);
+    for (uint32_t i = 0; i != CAPTURE_ELEMENT_COUNT; ++i) {
+        const uint32_t element = (sendValue + i) & mask;
+        if (Mode.DataBitLength > 8) {
+            masterTxBuffer[i] = uint16_t(element);
+        } else {
+            tx8[i] = uint8_t(element);
+        }
+    }
+    memset(masterRxBuffer, 0, sizeof(masterRxBuffer));
+
+    CommandBlock capture(SpiTesterCommand::CaptureNextTransfer);
+    capture.u.CaptureNextTransfer.Mode = Mode3;
+    capture.u.CaptureNextTransfer.DataBitLength = uint8_t(Mode.DataBitLength);
+    capture.u.CaptureNextTransfer.SendValue = sendValue;
+    capture.u.CaptureNextTransfer.ReceiveValue = receiveValue;
+    capture.u.CaptureNextTransfer.CaptureMode = uint8_t(Mode.Engine);
+
+    CommandBlock query(SpiTesterCommand::GetTransferInfo);
+    query.u.GetTransferInfo.InfoVersion = TRANSFER_INFO_VERSION;
+
+    MasterTransfer data;
+    data.Divider = Divider;
+    data.DataBitLength = Mode.DataBitLength;
+    data.Tx = masterTxBuffer;
+    data.Rx = masterRxBuffer;
+    data.Count = CAPTURE_ELEMENT_COUNT;
+    data.DelayMicros = CAPTURE_GAP_MICROS;
+
+    TransferInfo2 info;
+    const MasterTransfer transfers[] = {
+        ControlTransfer(&capture, nullptr, sizeof(capture), COMMAND_GAP_MICROS),
+        data,
+        ControlTransfer(&query, nullptr, sizeof(query), COMMAND_GAP_MICROS),
+        ControlTransfer(nullptr, &info, sizeof(info), COMMAND_GAP_MICROS),
+    };
+    if (!RunMaster(transfers, sizeof(transfers) / sizeof(transfers[0])) ||
+        !ValidResponse(info, sizeof(info)) ||
+        (info.ElementCount != CAPTURE_ELEMENT_COUNT) ||
+        (info.MismatchIndex != CAPTURE_ELEMENT_COUNT)) {
+
+        return false;
+    }
+
+    const uint8_t* const rx8 = reinterpret_cast<const uint8_t*>(masterRxBuffer);
+    for (uint32_t i = 0; i != CAPTURE_ELEMENT_COUNT; ++i) {
+        const uint32_t received = (Mode.DataBitLength > 8) ?
+            masterRxBuffer[i] : rx8[i];
+        if ((received & mask) != ((receiveValue + i) & mask)) return false;
+    }
+    return true;
+}
+
+//
+// Returns the highest clean SPI clock rate of Mode, or 0 if it was not
+// clean at any rate. The sweep stops at the first rate that is not clean.
+//
+uint32_t SweepSpi (const SweepMode& Mode)
+{
+    uint32_t highest = 0;
+    for (uint32_t divider : spiDividers) {
+        const uint32_t frequency = SystemCoreClock / divider;
+
+        bool clean = true;
+        for (uint32_t i = 0; clean && (i != CAPTURE_ITERATIONS); ++i) {
+            clean = CaptureOnce(Mode, divider, i);
+        }
+
+        if (!clean) {
+            Resynchronize();
+            break;
+        }
+        highest = frequency;
+    }
+    return highest;
+}
+
+//
+// I2C2 master on P0.10 (SDA2, mbed p28) and P0.11 (SCL2, mbed p27)
+//
+void I2cMasterInit (uint32_t Frequency)
+{
+    SetPeripheralPowerState(CLKPWR_PCONP_PCI2C2, true);
+    SetPeripheralClockDivider(CLKPWR_PCLKSEL_I2C2, CLKPWR_PCLKSEL_CCLK_DIV_1);
+
+    LPC_PINCON->PINSEL0 =
+        (LPC_PINCON->PINSEL0 & ~((0x3 << 20) | (0x3 << 22))) |
+        (0x2 << 20) | (0x2 << 22);
+
+    // Select pull-up and open drain mode for P0.10, P0.11
+    LPC_PINCON->PINMODE0 = LPC_PINCON->PINMODE0 & ~((0x3 << 20) | (0x3 << 22));
+    LPC_PINCON->PINMODE_OD0 |= (1 << 10) | (1 << 11);
+
+    LPC_I2C2->I2CONCLR = I2C_I2CONCLR_I2ENC | I2C_I2CONCLR_AAC |
+        I2C_I2CONCLR_STAC | I2C_I2CONCLR_SIC;
+
+    // the I2C block needs SCLL and SCLH of at least 4
+    const uint32_t half = std::max<uint32_t>(
+        GetPeripheralClockFrequency(CLKPWR_PCLKSEL_I2C2) / Frequency / 2,
+        4);
+    LPC_I2C2->I2SCLL = half;
+    LPC_I2C2->I2SCLH = half;
+
+    LPC_I2C2->I2CONSET = I2C_I2CONSET_I2EN;
+}
+
+bool I2cWait ()
+{
+    const uint32_t start = Micros();
+    while (!(LPC_I2C2->I2CONSET & I2C_I2CONSET_SI)) {
+        if ((Micros() - start) > I2C_TIMEOUT_MICROS) return false;
+    }
+    return true;
+}
+
+bool I2cStart ()
+{
+    LPC_I2C2->I2CONSET = I2C_I2CONSET_STA;
+    LPC_I2C2->I2CONCLR = I2C_I2CONCLR_SIC;
+    const bool started = I2cWait() &&
+        ((LPC_I2C2->I2STAT == I2C_I2STAT_M_TX_START) ||
+         (LPC_I2C2->I2STAT == I2C_I2STAT_M_TX_RESTART));
+    LPC_I2C2->I2CONCLR = I2C_I2CONCLR_STAC;
+    return started;
+}
+
+bool I2cWriteByte (uint8_t Data, uint32_t AckStatus)
+{
+    LPC_I2C2->I2DAT = Data;
+    LPC_I2C2->I2CONCLR = I2C_I2CONCLR_SIC;
+    return I2cWait() && (LPC_I2C2->I2STAT == AckStatus);
+}
+
+bool I2cReadByte (bool Ack, uint8_t& Data)
+{
+    if (Ack) {
+        LPC_I2C2->I2CONSET = I2C_I2CONSET_AA;
+    } else {
+        LPC_I2C2->I2CONCLR = I2C_I2CONCLR_AAC;
+    }
+    LPC_I2C2->I2CONCLR = I2C_I2CONCLR_SIC;
+
+    if (!I2cWait() ||
+        (LPC_I2C2->I2STAT !=
+            (Ack ? I2C_I2STAT_M_RX_DAT_ACK : I2C_I2STAT_M_RX_DAT_NACK))) {
+
+        return false;
+    }
+    Data = uint8_t(LPC_I2C2->I2DAT);
+    return true;
+}
+
+void I2cStop ()
+{
+    LPC_I2C2->I2CONSET = I2C_I2CONSET_STO;
+    LPC_I2C2->I2CONCLR = I2C_I2CONCLR_SIC;
+
+    const uint32_t start = Micros();
+    while ((LPC_I2C2->I2CONSET & I2C_I2CONSET_STO) &&
+           ((Micros() - start) <= I2C_TIMEOUT_MICROS));
+}
+
+//
+// Writes a block of the tester's EEPROM and reads it back with a repeated
+// start. Cycles receives the time both transactions took.
+//
+bool I2cOnce (uint32_t Iteration, uint32_t& Cycles)
+{
+    using namespace Lldt::I2c;
+
+    const uint8_t address = uint8_t(
+        (Iteration * I2C_TRANSFER_LENGTH) & EEPROM_ADDRESS_MAX &
+        ~(I2C_TRANSFER_LENGTH - 1));
+    uint8_t data[I2C_TRANSFER_LENGTH];
+    for (uint32_t i = 0; i != I2C_TRANSFER_LENGTH; ++i) {
+        data[i] = uint8_t((Iteration * 31) + (i * 7));
+    }
+
+    const uint32_t start = CycleCount();
+
+    bool ok = I2cStart() &&
+        I2cWriteByte(SLAVE_ADDRESS << 1, I2C_I2STAT_M_TX_SLAW_ACK) &&
+        I2cWriteByte(address, I2C_I2STAT_M_TX_DAT_ACK);
+    for (uint32_t i = 0; ok && (i != I2C_TRANSFER_LENGTH); ++i) {
+        ok = I2cWriteByte(data[i], I2C_I2STAT_M_TX_DAT_ACK);
+    }
+    I2cStop();
+
+    uint8_t readBack[I2C_TRANSFER_LENGTH];
+    ok = ok && I2cStart() &&
+        I2cWriteByte(SLAVE_ADDRESS << 1, I2C_I2STAT_M_TX_SLAW_ACK) &&
+        I2cWriteByte(address, I2C_I2STAT_M_TX_DAT_ACK) &&
+        I2cStart() &&
+        I2cWriteByte((SLAVE_ADDRESS << 1) | 1, I2C_I2STAT_M_RX_SLAR_ACK);
+    for (uint32_t i = 0; ok && (i != I2C_TRANSFER_LENGTH); ++i) {
+        ok = I2cReadByte(i != (I2C_TRANSFER_LENGTH - 1), readBack[i]);
+    }
+    I2cStop();
+
+    Cycles = CycleCount() - start;
+    return ok && (memcmp(data, readBack, sizeof(data)) == 0);
+}
+
+//
+// Returns the highest clean SCL rate, or 0 if none was clean. Effective
+// receives the bit rate achieved at that rate, which is lower than the SCL
+// rate when the tester stretches the clock.
+//
+uint32_t SweepI2c (uint32_t& Effective)
+{
+    // address, register address and data of the write, and address,
+    // register address, address and data of the read
+    const uint64_t bitsPerIteration = 9 * ((2 + I2C_TRANSFER_LENGTH) +
+        (3 + I2C_TRANSFER_LENGTH));
+
+    uint32_t highest = 0;
+    Effective = 0;
+    for (uint32_t frequency : i2cFrequencies) {
+        I2cMasterInit(frequency);
+
+        bool clean = true;
+        uint64_t cycles = 0;
+        for (uint32_t i = 0; clean && (i != I2C_ITERATIONS); ++i) {
+            uint32_t iterationCycles;
+            clean = I2cOnce(i, iterationCycles);
+            cycles += iterationCycles;
+        }
+
+        printf(
+            "I2C %7u Hz: %s\r\n",
+            unsigned(frequency),
+            clean ? "clean" : "errors");
+        if (!clean) break;
+
+        highest = frequency;
+        Effective = uint32_t(
+            (bitsPerIteration * I2C_ITERATIONS * SystemCoreClock) / cycles);
+    }
+
+    LPC_I2C2->I2CONCLR = I2C_I2CONCLR_I2ENC;
+    return highest;
+}
+
+} // namespace "static"
+
+bool Lldt::SelfTest::Run ()
+{
+    printf("\r\nLoopback self-test\r\n");
+
+    MasterInit();
+    if (!Resynchronize()) {
+        printf("The SPI tester did not respond on SSP1. Check the wiring.\r\n");
+        ErrLedOn();
+        return false;
+    }
+
+    bool passed = true;
+
+    uint32_t measured[sizeof(spiModes) / sizeof(spiModes[0])];
+    uint32_t advertised[sizeof(spiModes) / sizeof(spiModes[0])];
+    for (uint32_t i = 0; i != sizeof(spiModes) / sizeof(spiModes[0]); ++i) {
+        const SweepMode& mode = spiModes[i];
+        advertised[i] = AdvertisedFrequency(mode);
+        measured[i] = SweepSpi(mode);
+        printf(
+            "SPI %-6s %2u bits: %8u Hz clean\r\n",
+            mode.Name,
+            unsigned(mode.DataBitLength),
+            unsigned(measured[i]));
+        passed = passed && (measured[i] >= advertised[i]);
+    }
+
+    uint32_t i2cEffective;
+    const uint32_t i2cMeasured = SweepI2c(i2cEffective);
+    const uint32_t i2cAdvertised = I2c::MAX_BUS_SPEED_KHZ * 1000;
+    passed = passed && (i2cMeasured >= i2cAdvertised);
+
+    // The rates are limited to the master's dividers, so each is a lower
+    // bound on the tester's limit, to within one step of the sweep.
+    printf("\r\nMode              highest clean   advertised\r\n");
+    for (uint32_t i = 0; i != sizeof(spiModes) / sizeof(spiModes[0]); ++i) {
+        printf(
+            "SPI %-6s %2u bits %10u Hz %10u Hz%s\r\n",
+            spiModes[i].Name,
+            unsigned(spiModes[i].DataBitLength),
+            unsigned(measured[i]),
+            unsigned(advertised[i]),
+            (measured[i] < advertised[i]) ? " FAILED" : "");
+    }
+    printf(
+        "I2C               %10u Hz %10u Hz%s (%u bit/s effective)\r\n",
+        unsigned(i2cMeasured),
+        unsigned(i2cAdvertised),
+        (i2cMeasured < i2cAdvertised) ? " FAILED" : "",
+        unsigned(i2cEffective));
+    printf("Self-test %s\r\n", passed ? "passed" : "FAILED");
+
+    // the I2C tester lights the ACT LED whenever it is addressed
+    if (!passed) ErrLedOn();
+
+    return passed;
+}
@@ -0,0 +1,31 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Loopback self-test, built into the image produced with SELFTEST=1.
+//
+// SSP1 is driven as an SPI master into the SPI tester on SSP0, and I2C2 as
+// an I2C master into the I2C tester on I2C1, so that the tester code paths
+// that the HLK tests exercise are measured on the device itself. See
+// "Self-Test Image" in the Readme for the wiring.
+//
+#ifndef _SELFTEST_H_
+#define _SELFTEST_H_
+
+namespace Lldt {
+namespace SelfTest {
+
+//
+// Sweeps the SPI clock rate for each capture engine and frame width, and
+// the I2C clock rate, and prints the highest rate at which each ran clean
+// to the serial port. The testers must have been initialized. Work items
+// are run while the sweep waits for the master, so the testers run as they
+// do in the production image.
+//
+// Returns true if every mode ran clean at the rates the tester advertises.
+//
+bool Run ();
+
+} // namespace SelfTest
+} // namespace Lldt
+
+#endif // _SELFTEST_H_
@@ -5,6 +5,43 @@ CPPSRC= \
     main.cpp \
     i2ctester.cpp \
     lpc17xxhardware.cpp \
+    profiler.cpp \
+    scheduler.cpp \
     spitester.cpp \
+    telemetry.cpp \
     util.cpp \
 
+
+# Set to 1 to run a second SPI tester on SSP1. This moves the interrupt pin
+# of the tester on SSP0 from P0.6 to P0.11. See "Second SPI Tester" in the
+# Readme.
+SPI_TESTER_SSP1=0
+
+# Set to 0 to compile out the telemetry log on UART0. The log is always
+# compiled out in _DEBUG builds, where UART0 carries printf output.
+TELEMETRY=1
+
+# Set to 1 to time each iteration of the capture loops, for the
+# MaxIterationCycles of GetProfilingInfo. This adds a few cycles to every
+# element, so it is off by default and MaxIterationCycles reads back 0.
+PROFILE_ITERATIONS=0
+
+# Set to 1 to build the loopback self-test image, which drives the testers
+# from SSP1 and I2C2. See "Self-Test Image" in the Readme.
+SELFTEST=0
+
+!if $(SELFTEST)
+TARGETNAME=busses-tester-selftest-mbed_LPC1768
+CPPSRC=$(CPPSRC) selftest.cpp
+
+# the self-test prints its results on UART0
+TELEMETRY=0
+
+# the self-test drives SSP1 as the SPI master
+SPI_TESTER_SSP1=0
+!endif
+
+CDEFINES=$(CDEFINES) -DSPI_TESTER_SSP1=$(SPI_TESTER_SSP1)
+CDEFINES=$(CDEFINES) -DSELFTEST=$(SELFTEST)
+CDEFINES=$(CDEFINES) -DTELEMETRY=$(TELEMETRY)
+CDEFINES=$(CDEFINES) -DPROFILE_ITERATIONS=$(PROFILE_ITERATIONS)
@@ -3,117 +3,612 @@
 //
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <algorithm>
 #include <lpc17xx.h>
 
 #include "lldtester.h"
 #include "util.h"
 #include "Lpc17xxHardware.h"
+#include "scheduler.h"
 #include "spitester.h"
+#include "profiler.h"
+#include "telemetry.h"
 
+using namespace Lldt;
 using namespace Lldt::Spi;
 
-uint32_t SpiTester::dummy;
-volatile uint32_t SpiTester::remainingInterrupts;
+template <typename Traits>
+uint32_t SpiTester<Traits>::dummy;
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::chipSelectDeassertCycle;
+
+template <typename Traits>
+bool SpiTester<Traits>::sendPending;
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::sendLength;
+
+template <typename Traits>
+const CommandBlock* SpiTester<Traits>::deferredCommand;
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::capturedElementCount;
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::capturedElementSize;
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::edgeTraceTrailingCount;
+
+template <typename Traits>
+CommandBlock SpiTester<Traits>::batchCommands[BATCH_MAX_COMMANDS];
+
+template <typename Traits>
+uint16_t SpiTester<Traits>::patternTable[PATTERN_TABLE_LENGTH];
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::patternLength;
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::captureTimeoutMillis;
+
+//
+// The buffers that the GPDMA reads and writes. Those of the tester on SSP0
+// fill AHBSRAM0, so the rest are in AHBSRAM1.
+//
+template <>
+AHBSRAM0_SECTION uint8_t
+Spi0Tester::captureRxBuffer[Ssp0Traits::CAPTURE_BUFFER_SIZE] = { };
+
+template <>
+AHBSRAM0_SECTION uint8_t
+Spi0Tester::captureTxBuffer[Ssp0Traits::CAPTURE_BUFFER_SIZE] = { };
+
+template <>
+AHBSRAM1_SECTION GPDMA_LLI
+Spi0Tester::captureRxLli[Spi0Tester::DMA_CAPTURE_LLI_COUNT] = { };
+
+template <>
+AHBSRAM1_SECTION GPDMA_LLI
+Spi0Tester::captureTxLli[Spi0Tester::DMA_CAPTURE_LLI_COUNT] = { };
+
+template <>
+AHBSRAM1_SECTION uint8_t
+Spi0Tester::responseBuffer[BATCH_RESPONSE_BUFFER_SIZE] = { };
+
+#if SPI_TESTER_SSP1
+template <>
+AHBSRAM1_SECTION uint8_t
+Spi1Tester::captureRxBuffer[Ssp1Traits::CAPTURE_BUFFER_SIZE] = { };
+
+template <>
+AHBSRAM1_SECTION uint8_t
+Spi1Tester::captureTxBuffer[Ssp1Traits::CAPTURE_BUFFER_SIZE] = { };
+
+template <>
+AHBSRAM1_SECTION GPDMA_LLI
+Spi1Tester::captureRxLli[Spi1Tester::DMA_CAPTURE_LLI_COUNT] = { };
+
+template <>
+AHBSRAM1_SECTION GPDMA_LLI
+Spi1Tester::captureTxLli[Spi1Tester::DMA_CAPTURE_LLI_COUNT] = { };
+
+template <>
+AHBSRAM1_SECTION uint8_t
+Spi1Tester::responseBuffer[BATCH_RESPONSE_BUFFER_SIZE] = { };
+#endif // SPI_TESTER_SSP1
 
 namespace { // static
 
+enum : uint32_t {
+    //
+    // Number of transmit pattern elements computed before the DMA is armed.
+    //
+    TX_PATTERN_PREFILL = 256,
+};
+
+//
+// Written to the interrupt timer's MCR by the GPDMA to stop generating
+// interrupts. The value is the same for both testers.
+//
+AHBSRAM1_SECTION uint32_t interruptStopMcr;
+
+//
+// The sequences of elements expected and sent by a capture. The capture
+// loops are instantiated for each, so that the counter does not pay for
+// the table lookup, and a pattern costs the same per element whatever its
+// contents. Both are constructed from the tester's pattern table, which
+// the counter ignores. A sequence constructed from the Position() of
+// another continues where the other left off.
+//
+class CounterSequence
+{
+public:
+
+    CounterSequence (
+        const uint16_t* /*Table*/,
+        uint32_t /*Length*/,
+        uint32_t Start
+        ) :
+        value(Start)
+    { }
+
+    uint32_t Next ( ) { return this->value++; }
+
+    uint32_t Position ( ) const { return this->value; }
+
+private:
+
+    uint32_t value;
+};
+
+class PatternSequence
+{
+public:
+
+    PatternSequence (const uint16_t* Table, uint32_t Length, uint32_t Start) :
+        table(Table),
+        index((Length != 0) ? (Start % Length) : 0),
+        length(Length)
+    { }
+
+    uint32_t Next ( )
+    {
+        const uint32_t value = this->table[this->index];
+        if (++this->index == this->length) this->index = 0;
+        return value;
+    }
+
+    uint32_t Position ( ) const { return this->index; }
+
+private:
+
+    const uint16_t* table;
+    uint32_t index;
+    uint32_t length;
+};
+
+//
+// Fills the pattern table with the output of a Fibonacci LFSR of the given
+// order, split into DataBitLength-bit elements, most significant bit first.
+// The elements repeat with the period of the sequence if the table can
+// hold it. Returns the number of elements generated.
+//
+uint32_t GeneratePrbs (
+    uint16_t* Table,
+    uint32_t Order,
+    uint32_t Tap,
+    uint32_t DataBitLength
+    )
+{
+    const uint32_t period = (1U << Order) - 1;
+    const uint32_t length = std::min(period, uint32_t(PATTERN_TABLE_LENGTH));
+
+    uint32_t state = period;
+    for (uint32_t i = 0; i != length; ++i) {
+        uint32_t element = 0;
+        for (uint32_t bit = 0; bit != DataBitLength; ++bit) {
+            const uint32_t feedback =
+                ((state >> (Order - 1)) ^ (state >> (Tap - 1))) & 1;
+            state = ((state << 1) | feedback) & period;
+            element = (element << 1) | feedback;
+        }
+        Table[i] = uint16_t(element);
+    }
+
+    return length;
+}
+
+//
+// Fills a tester's captureTxBuffer with the transmit sequence. The pattern
+// is filled a piece at a time so that the DMA can be started before the
+// whole buffer has been computed.
+//
+class TxPatternFiller
+{
+public:
+
+    TxPatternFiller (
+        uint8_t* Buffer,
+        const uint16_t* Table,
+        uint32_t Length,
+        uint32_t Value,
+        uint32_t Mask,
+        bool Wide,
+        uint32_t Count
+        ) :
+        buffer(Buffer),
+        counter(Table, Length, Value),
+        pattern(Table, Length, Value),
+        length(Length),
+        mask(Mask),
+        index(0),
+        count(Count),
+        wide(Wide)
+    { }
+
+    bool Done ( ) const { return this->index == this->count; }
+
+    void Fill (uint32_t Count)
+    {
+        if (this->length != 0) {
+            Fill(this->pattern, Count);
+        } else {
+            Fill(this->counter, Count);
+        }
+    }
+
+private:
+
+    template <typename Sequence>
+    void Fill (Sequence& Source, uint32_t Count)
+    {
+        const uint32_t end = std::min(this->index + Count, this->count);
+
+        if (this->wide) {
+            uint16_t* const buffer = reinterpret_cast<uint16_t*>(this->buffer);
+            for (; this->index != end; ++this->index)
+                buffer[this->index] = uint16_t(Source.Next() & this->mask);
+        } else {
+            for (; this->index != end; ++this->index)
+                this->buffer[this->index] = uint8_t(Source.Next() & this->mask);
+        }
+    }
+
+    uint8_t* buffer;
+    CounterSequence counter;
+    PatternSequence pattern;
+    uint32_t length;
+    uint32_t mask;
+    uint32_t index;
+    uint32_t count;
+    bool wide;
+};
+
+//
+// Returns the index of the InterruptLatencyHistogram bucket that counts
+// the specified latency
+//
+inline uint32_t LatencyHistogramBucket (uint32_t Latency)
+{
+    if (Latency < 8) return Latency;
+    const uint32_t exponent = 31 - __CLZ(Latency);
+    return ((exponent - 1) << 2) | ((Latency >> (exponent - 2)) & 0x3);
+}
+
+inline void RecordLatency (InterruptLatencyHistogram& Histogram, uint32_t Latency)
+{
+    ++Histogram.SampleCount;
+    Histogram.MinLatency = std::min(Histogram.MinLatency, Latency);
+    Histogram.MaxLatency = std::max(Histogram.MaxLatency, Latency);
+    Histogram.TotalLatency += Latency;
+    ++Histogram.Buckets[LatencyHistogramBucket(Latency)];
+}
+
+//
+// Computes the checksum of Count received elements
+//
+inline uint32_t CaptureChecksum (const uint8_t* Buffer, uint32_t Count)
+{
+    return Crc16().Update(Buffer, Count);
+}
+
+inline uint32_t CaptureChecksum (const uint16_t* Buffer, uint32_t Count)
+{
+    uint32_t checksum = 0;
+    for (const uint16_t* end = Buffer + Count; Buffer != end; ++Buffer) {
+        checksum = crc16_update16(checksum, *Buffer);
+    }
+    return checksum;
+}
+
+//
+// Returns the index of the first of Count received elements that does not
+// match Expected, or Count if they all match
+//
+template <typename Ty, typename Sequence>
+uint32_t FindMismatch (
+    const Ty* Buffer,
+    uint32_t Count,
+    Sequence Expected,
+    uint32_t DataMask
+    )
+{
+    uint32_t mismatchIndex = 0;
+    while ((mismatchIndex != Count) &&
+           (Buffer[mismatchIndex] == (Expected.Next() & DataMask))) {
+
+        ++mismatchIndex;
+    }
+
+    return mismatchIndex;
+}
+
+//
+// Computes the checksum of Count received elements and finds the index of
+// the first element that does not match the expected sequence.
+//
+template <typename Ty>
+uint32_t VerifyCapture (
+    const Ty* Buffer,
+    uint32_t Count,
+    const uint16_t* Table,
+    uint32_t Length,
+    uint32_t RxValue,
+    uint32_t DataMask,
+    uint32_t* MismatchIndexPtr
+    )
+{
+    if (Length != 0) {
+        *MismatchIndexPtr = FindMismatch(
+            Buffer,
+            Count,
+            PatternSequence(Table, Length, RxValue),
+            DataMask);
+    } else {
+        *MismatchIndexPtr = FindMismatch(
+            Buffer,
+            Count,
+            CounterSequence(Table, Length, RxValue),
+            DataMask);
+    }
+
+    return CaptureChecksum(Buffer, Count);
+}
+
 //
-// Configure P0.6 as MAT2.0
+// Computes the clock period and duty cycle statistics of an edge trace.
+// Trailing edge i follows leading edge i.
 //
-void MuxInterruptOutput ()
+void AnalyzeEdgeTrace (
+    const uint32_t* Leading,
+    const uint32_t* Trailing,
+    uint32_t LeadingCount,
+    uint32_t TrailingCount,
+    bool LeadingEdgeFalling,
+    EdgeTraceInfo& Info
+    )
 {
-    // P0.6 - MAT2.0 - O - Match output for Timer 2, channel 0.
-    LPC_PINCON->PINSEL0 |= 0x3 << 12;
+    Info.LeadingEdgeCount = LeadingCount;
+    Info.TrailingEdgeCount = TrailingCount;
+    Info.LeadingEdgeFalling = LeadingEdgeFalling;
+    if (LeadingCount < 2) return;
+
+    uint32_t minPeriod = 0xffffffff;
+    uint32_t maxPeriod = 0;
+    uint32_t minDutyCycle = 1000;
+    uint32_t maxDutyCycle = 0;
+    uint64_t totalHighTime = 0;
+    uint64_t totalDutyCycleTime = 0;
+    for (uint32_t i = 0; i != (LeadingCount - 1); ++i) {
+        const uint32_t period = Leading[i + 1] - Leading[i];
+        minPeriod = std::min(minPeriod, period);
+        if (period > maxPeriod) {
+            maxPeriod = period;
+            Info.LargestGapIndex = i;
+        }
+
+        if ((i >= TrailingCount) || (period == 0)) continue;
+
+        // the first half of the cycle is low if the leading edge falls
+        const uint32_t firstHalf = std::min(
+            Trailing[i] - Leading[i],
+            period);
+        const uint32_t highTime =
+            LeadingEdgeFalling ? (period - firstHalf) : firstHalf;
+        const uint32_t dutyCycle =
+            uint32_t((uint64_t(highTime) * 1000) / period);
+
+        minDutyCycle = std::min(minDutyCycle, dutyCycle);
+        maxDutyCycle = std::max(maxDutyCycle, dutyCycle);
+        totalHighTime += highTime;
+        totalDutyCycleTime += period;
+    }
+
+    Info.MinPeriod = minPeriod;
+    Info.MaxPeriod = maxPeriod;
+    Info.MeanPeriod =
+        (Leading[LeadingCount - 1] - Leading[0]) /
+        (LeadingCount - 1);
+
+    if (totalDutyCycleTime != 0) {
+        Info.MinDutyCycle = uint16_t(minDutyCycle);
+        Info.MaxDutyCycle = uint16_t(maxDutyCycle);
+        Info.MeanDutyCycle =
+            uint16_t((totalHighTime * 1000) / totalDutyCycleTime);
+    }
 }
 
 //
-// Configure P0.6 as GPIO input
+// Snapshots the profiling counters, optionally resetting them.
 //
-void DemuxInterruptOutput ()
+ProfilingInfo ReadProfilingInfo (const CommandBlock& Command)
 {
-    // P0.6 - I/O - General purpose digital input/output pin.
-    LPC_PINCON->PINSEL0 &= ~(0x3 << 12);
+    auto info = ProfilingInfo();
+    info.CycleFrequency = SystemCoreClock;
+    info.SectionCount = PROFILE_SECTION_COUNT;
+    for (uint32_t i = 0; i < PROFILE_SECTION_COUNT; ++i) {
+        info.Sections[i] = GetProfileCounters(ProfileSection(i));
+    }
+
+    if (Command.u.GetProfilingInfo.Reset) {
+        ProfileReset();
+    }
+
+    return info;
 }
 
 //
-// Enabling falling edge detection for P0.15 (SCK0)
+// Enabling falling edge detection for the SCK pin
 //
+template <typename Traits>
 void EnableSckFallingEdgeDetection ()
 {
-    LPC_GPIOINT->IO0IntEnR &= ~(1 << 15);
-    LPC_GPIOINT->IO0IntClr = 1 << 15;
-    LPC_GPIOINT->IO0IntEnF |= 1 << 15;
+    LPC_GPIOINT->IO0IntEnR &= ~(1 << Traits::SCK_PIN);
+    LPC_GPIOINT->IO0IntClr = 1 << Traits::SCK_PIN;
+    LPC_GPIOINT->IO0IntEnF |= 1 << Traits::SCK_PIN;
 }
 
 //
 // Disable interrupt flag on SCK falling edge
 //
+template <typename Traits>
 void DisableSckFallingEdgeDetection ()
 {
-    LPC_GPIOINT->IO0IntEnF &= ~(1 << 15);
+    LPC_GPIOINT->IO0IntEnF &= ~(1 << Traits::SCK_PIN);
+}
+
+//
+// Returns the number of falling edges generated on the interrupt pin so far
+// in periodic interrupt mode
+//
+inline uint32_t GeneratedInterruptCount (uint32_t InterruptCount)
+{
+    return std::min(uint32_t(LPC_TIM0->TC), InterruptCount);
 }
 
 //
 // Waits for the next falling edge of SCK.
 //
+template <typename Traits>
 void WaitForSckFallingEdge ()
 {
-    LPC_GPIOINT->IO0IntClr = 1 << 15;
-    while (!(LPC_GPIOINT->IO0IntStatF & (1 << 15)));
+    LPC_GPIOINT->IO0IntClr = 1 << Traits::SCK_PIN;
+    while (!(LPC_GPIOINT->IO0IntStatF & (1 << Traits::SCK_PIN)));
 }
 
 
 } // namespace "static"
 
-void SpiTester::Init ()
+template <typename Traits>
+void SpiTester<Traits>::Init ()
 {
     SspInit();
     TimerInit();
 
-    uint32_t sspClk = GetPeripheralClockFrequency(CLKPWR_PCLKSEL_SSP0);
+    uint32_t sspClk = GetPeripheralClockFrequency(Traits::SSP_PCLK);
+
+    // In slave mode the SSP can receive at up to PCLK/12. The DMA engine
+    // keeps up with the SSP, while the polled engine is limited by the
+    // number of elements per second the CPU can service.
+    this->maxDmaFrequency = sspClk / 12;
+    this->maxPolledElementRate = POLLED_CAPTURE_MAX_FREQUENCY / 8;
 
     this->testerInfo.DeviceId = DEVICE_ID;
     this->testerInfo.Version = VERSION;
-    this->testerInfo.MaxFrequency = std::min(uint32_t(5000000), sspClk / 12);
+    this->testerInfo.MaxFrequency = MaxFrequency(CaptureMode::Polled, 8);
     this->testerInfo.ClockMeasurementFrequency = SystemCoreClock;
     this->testerInfo.MinDataBitLength = MIN_DATA_BIT_LENGTH;
     this->testerInfo.MaxDataBitLength = MAX_DATA_BIT_LENGTH;
 
+    this->testerInfo2 = TesterInfo2();
+    static_cast<TesterInfo&>(this->testerInfo2) = this->testerInfo;
+    this->testerInfo2.InfoVersion = DEVICE_INFO_VERSION;
+    this->testerInfo2.Capabilities = SPI_CAPABILITIES;
+    this->testerInfo2.MaxInterruptFrequency = MAX_INTERRUPT_FREQUENCY;
+    this->testerInfo2.CaptureBufferSize = Traits::CAPTURE_BUFFER_SIZE;
+    this->testerInfo2.PatternTableLength = PATTERN_TABLE_LENGTH;
+    this->testerInfo2.CapturedDataPageSize = CAPTURED_DATA_PAGE_SIZE;
+    this->testerInfo2.EdgeTraceMaxCycles = EDGE_TRACE_MAX_CYCLES;
+    this->testerInfo2.BatchMaxCommands = BATCH_MAX_COMMANDS;
+    this->testerInfo2.BatchResponseBufferSize = BATCH_RESPONSE_BUFFER_SIZE;
+    this->testerInfo2.InterruptSweepMaxSteps = INTERRUPT_SWEEP_MAX_STEPS;
+    this->testerInfo2.LatencyHistogramBucketCount =
+        LATENCY_HISTOGRAM_BUCKET_COUNT;
+    for (uint32_t i = 0; i != CAPTURE_MODE_COUNT; ++i) {
+        this->testerInfo2.Engines[i] = EngineLimits(CaptureMode(i));
+    }
+
     this->transferInfo = TransferInfo();
+    this->transferInfo2 = TransferInfo2();
+    this->transferInfo2.InfoVersion = TRANSFER_INFO_VERSION;
     this->interruptInfo = PeriodicInterruptInfo();
+    this->latencyHistogram = InterruptLatencyHistogram();
+    this->sweepInfo = InterruptSweepInfo();
+    this->edgeTraceInfo = EdgeTraceInfo();
+    this->streamingInfo = StreamingInfo();
+
+    PrepareResponse(this->testerInfo);
+    PrepareResponse(this->testerInfo2);
+    PrepareResponse(this->transferInfo);
+    PrepareResponse(this->transferInfo2);
+    PrepareResponse(this->interruptInfo);
+    PrepareResponse(this->latencyHistogram);
+    PrepareResponse(this->sweepInfo);
+    PrepareResponse(this->edgeTraceInfo);
+    PrepareResponse(this->streamingInfo);
+
+    // commands are received by the tester's work item
+    SchedulerRegister(Traits::SCHEDULER_WORK_ITEM, &RunWorkItem, this);
+    NVIC_SetPriority(Traits::SSP_IRQ, IRQ_PRIORITY_SCHEDULER);
+    NVIC_EnableIRQ(Traits::SSP_IRQ);
+    EnableCommandInterrupt();
 
     DBGPRINT(
-        "sspClk = %lu, Maximum clock rate = %lu\n\r",
+        "sspClk = %lu, Maximum clock rate = %lu (DMA %lu)\n\r",
         sspClk,
-        this->testerInfo.MaxFrequency);
+        this->testerInfo.MaxFrequency,
+        this->maxDmaFrequency);
+}
+
+//
+// The engines that service the FIFOs with the CPU are limited by the
+// element rate, and all engines by the SSP.
+//
+template <typename Traits>
+CaptureEngineLimits SpiTester<Traits>::EngineLimits (CaptureMode Mode) const
+{
+    CaptureEngineLimits limits;
+    limits.MaxFrequency = this->maxDmaFrequency;
+
+    switch (Mode) {
+    case CaptureMode::Dma:
+        limits.MaxElementRate = 0;
+        break;
+    case CaptureMode::Polled:
+    default:
+        limits.MaxElementRate = this->maxPolledElementRate;
+        break;
+    }
+    return limits;
+}
+
+template <typename Traits>
+uint32_t SpiTester<Traits>::MaxFrequency (
+    CaptureMode Mode,
+    uint32_t DataBitLength
+    ) const
+{
+    const CaptureEngineLimits limits = EngineLimits(Mode);
+    if (limits.MaxElementRate == 0) {
+        return limits.MaxFrequency;
+    }
+
+    return std::min(
+        limits.MaxElementRate * EffectiveDataBitLength(DataBitLength),
+        limits.MaxFrequency);
 }
 
 //
-// Initialize SSP0 in slave mode
+// Initialize the SSP in slave mode
 //
-void SpiTester::SspInit ()
+template <typename Traits>
+void SpiTester<Traits>::SspInit ()
 {
     // Power
-    SetPeripheralPowerState(CLKPWR_PCONP_PCSSP0, true);
+    SetPeripheralPowerState(Traits::SSP_POWER, true);
 
     // Clock (set to maximum)
-    SetPeripheralClockDivider(CLKPWR_PCLKSEL_SSP0, CLKPWR_PCLKSEL_CCLK_DIV_1);
+    SetPeripheralClockDivider(Traits::SSP_PCLK, CLKPWR_PCLKSEL_CCLK_DIV_1);
 
     // Configure Pins
-
-    // SCK0 (P0.15)
-    LPC_PINCON->PINSEL0 = (LPC_PINCON->PINSEL0 & ~(0x3 << 30)) | (0x2 << 30);
-
-    // SSEL0 (P0.16), MISO0 (P0.17), MOSI (P0.18)
-    uint32_t temp = 
-        (LPC_PINCON->PINSEL1 & ~((0x3 << 2) | (0x3 << 4) | (0x3 << 0)));
-    temp |= (0x2 << 2) | (0x2 << 4) | (0x2 << 0);
-    LPC_PINCON->PINSEL1 = temp;
+    Traits::MuxSspPins();
 
     // Disable interrupts
-    LPC_SSP0->IMSC = 0;
-    LPC_SSP0->CPSR = 2;
+    Traits::Ssp()->IMSC = 0;
+    Traits::Ssp()->CPSR = 2;
 
     // Program control registers and enable
     SspSetDataMode(
@@ -121,7 +616,8 @@ void SpiTester::SspInit ()
         SPI_CONTROL_INTERFACE_DATABITLENGTH);
 }
 
-void SpiTester::SspSetDataMode (SpiDataMode Mode, uint32_t DataBitLength)
+template <typename Traits>
+void SpiTester<Traits>::SspSetDataMode (SpiDataMode Mode, uint32_t DataBitLength)
 {
     uint32_t cr0 = SSP_CR0_FRF_SPI;
 
@@ -145,123 +641,236 @@ void SpiTester::SspSetDataMode (SpiDataMode Mode, uint32_t DataBitLength)
         cr0 |= SSP_CR0_DSS(8);
     }
 
-    LPC_SSP0->CR1 = SSP_CR1_SLAVE_EN;
-    LPC_SSP0->CR0 = cr0;
-    LPC_SSP0->CR1 = SSP_CR1_SSP_EN | SSP_CR1_SLAVE_EN;
+    Traits::Ssp()->CR1 = SSP_CR1_SLAVE_EN;
+    Traits::Ssp()->CR0 = cr0;
+    Traits::Ssp()->CR1 = SSP_CR1_SSP_EN | SSP_CR1_SLAVE_EN;
 }
 
 //
 // Data.Header.Length must be already set to the total length of the structure
 //
-void SpiTester::SspSendImpl (TransferHeader& Data)
+template <typename Traits>
+void SpiTester<Traits>::SetChecksum (TransferHeader& Data)
 {
-    const uint8_t* const beginBytePtr = reinterpret_cast<const uint8_t*>(&Data);
-
-    // Compute checksum
     Data.Header.Checksum = 0;
-    Data.Header.Checksum = Crc16().Update(beginBytePtr, Data.Header.Length);
+    Data.Header.Checksum = Crc16().Update(
+        reinterpret_cast<const uint8_t*>(&Data),
+        Data.Header.Length);
+}
+
+//
+// Data must be prepared with PrepareResponse
+//
+template <typename Traits>
+void SpiTester<Traits>::SspSendImpl (const TransferHeader& Data)
+{
+    SspSendBytes(reinterpret_cast<const uint8_t*>(&Data), Data.Header.Length);
+}
+
+//
+// Queues Length bytes for the next transfer. The data is staged in
+// responseBuffer and fed to the SSP by the GPDMA, which fills the transmit
+// FIFO before chip select asserts and keeps it full at any clock rate the
+// SSP can receive at, so the CPU does not need to mask interrupts. The
+// tester does not wait for the master to read the response; FinishSend
+// runs from the work item that the SSP interrupt of the transfer posts.
+//
+template <typename Traits>
+void SpiTester<Traits>::SspSendBytes (const uint8_t* Data, uint32_t Length)
+{
+    const uint32_t sendStart = CycleCount();
+
+    if (Length > sizeof(responseBuffer)) {
+        TelemetryLog(TELEMETRY_SPI_SEND_ERROR, TELEMETRY_SEND_TOO_LARGE, Length);
+        return;
+    }
 
     // precondition: FIFO must be empty
-    if (!(LPC_SSP0->SR & SSP_SR_TFE)) {
-        DBGPRINT("SSP transmit fifo is not empty!\n\r");
+    if (!(Traits::Ssp()->SR & SSP_SR_TFE)) {
+        TelemetryLog(
+            TELEMETRY_SPI_SEND_ERROR,
+            TELEMETRY_SEND_FIFO_NOT_EMPTY,
+            Length);
         return;
     }
 
-    // preload FIFO with data
-    const uint8_t* bytePtr;
-    {
-        const uint8_t* const preloadEndPtr =
-            beginBytePtr + std::min<uint32_t>(Data.Header.Length, 8);
-        for (bytePtr = beginBytePtr; bytePtr != preloadEndPtr; ++bytePtr) {
-            LPC_SSP0->DR = *bytePtr;
-        }
+    if (Data != responseBuffer) {
+        memcpy(responseBuffer, Data, Length);
     }
 
-    // wait for the transfer to begin
-    while (!ChipSelectAsserted());
+    // The TX FIFO requests a burst whenever it is half empty
+    GpdmaProgramChannel(
+        Traits::DMA_CHANNEL_TX,
+        nullptr,
+        DmaAddress(responseBuffer),
+        DmaAddress(&Traits::Ssp()->DR),
+        Length,
+        GPDMA_CTRL_SBSIZE(GPDMA_BSIZE_4) | GPDMA_CTRL_DBSIZE(GPDMA_BSIZE_4) |
+        GPDMA_CTRL_SWIDTH(GPDMA_WIDTH_BYTE) |
+        GPDMA_CTRL_DWIDTH(GPDMA_WIDTH_BYTE) | GPDMA_CTRL_SI,
+        GPDMA_CFG_DEST_PERIPHERAL(Traits::DMA_CONN_TX) |
+        GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_M2P));
+
+    Traits::Ssp()->DMACR = SSP_DMACR_TXDMA_EN;
+
+    // the response is queued; the rest is waiting for the master
+    ProfileRecord(PROFILE_SPI_SEND, CycleCount() - sendStart);
+    sendPending = true;
+    sendLength = Length;
+}
 
-    // disable interrupts and send data
-    bool transmitUnderrun = false;
-    {
-        DisableIrq disableIrq;
+//
+// Completes the send queued by SspSendBytes once the master has begun to
+// clock the response out. The tester only waits for the rest of that
+// transfer, not for the master to start it, so the other SPI tester keeps
+// running while a response is waiting to be read.
+//
+template <typename Traits>
+void SpiTester<Traits>::FinishSend ()
+{
+    // the interrupt may have been taken for a stale timeout
+    if (!ChipSelectAsserted() && !(Traits::Ssp()->SR & SSP_SR_RNE)) return;
 
-        const uint8_t* const endBytePtr = beginBytePtr + Data.Header.Length;
-        while (bytePtr != endBytePtr) {
-            uint32_t status = LPC_SSP0->SR;
+    WaitForCsToDeassert();
+    Traits::Ssp()->DMACR = 0;
+    if (LPC_GPDMA->DMACEnbldChns & (1 << Traits::DMA_CHANNEL_TX)) {
+        TelemetryLog(
+            TELEMETRY_SPI_SEND_ERROR,
+            TELEMETRY_SEND_INCOMPLETE,
+            sendLength);
+    }
+    GpdmaStopChannel(Traits::DMA_CHANNEL_TX);
+    sendPending = false;
 
-            if (status & SSP_SR_TFE) {
-                // If transmit FIFO is empty, a transmit underrun occurred
-                transmitUnderrun = true;
-            }
+    if (deferredCommand != nullptr) {
+        const CommandBlock& command = *deferredCommand;
+        deferredCommand = nullptr;
+        RunBatchModalCommand(command);
+    }
+}
 
-            if (status & SSP_SR_TNF) {
-                LPC_SSP0->DR = *bytePtr;
-                ++bytePtr;
-            }
+template <typename Traits>
+void SpiTester<Traits>::WaitForCsToDeassert ()
+{
+    while (ChipSelectAsserted() || (Traits::Ssp()->SR & SSP_SR_RNE))
+        dummy = Traits::Ssp()->DR;
 
-            if (!ChipSelectAsserted()) {
-                return;
-            }
-        }
-    } // enable IRQ
+    chipSelectDeassertCycle = ElapsedCycles();
+}
 
-    WaitForCsToDeassert();
+//
+// Returns the Now() by which chip select must assert for a capture, or
+// UINT64_MAX if there is no capture timeout.
+//
+template <typename Traits>
+uint64_t SpiTester<Traits>::CaptureDeadline ()
+{
+    if (captureTimeoutMillis == 0) return UINT64_MAX;
+
+    return Now() + uint64_t(captureTimeoutMillis) * (SystemCoreClock / 1000);
+}
+
+//
+// Waits for chip select to assert at the start of a capture. Returns false
+// if the capture timeout expires first.
+//
+template <typename Traits>
+bool SpiTester<Traits>::WaitForChipSelect ()
+{
+    // without a timeout, keep the wait as short as possible, so that the
+    // first SCK edge is not missed
+    if (captureTimeoutMillis == 0) {
+        while (!ChipSelectAsserted());
+        return true;
+    }
 
-    if (transmitUnderrun) {
-        DBGPRINT("Transmit underrun occurred!\n\r");
+    const uint64_t deadline = CaptureDeadline();
+    while (!ChipSelectAsserted()) {
+        if (Now() >= deadline) return false;
     }
+    return true;
 }
 
-void SpiTester::WaitForCsToDeassert ()
+//
+// Fills in the results of a polled or Record capture whose transfer did
+// not start before the capture timeout
+//
+template <typename Traits>
+void SpiTester<Traits>::TimeOutCapture (PolledCaptureState& State)
 {
-    while (ChipSelectAsserted() || (LPC_SSP0->SR & SSP_SR_RNE))
-        dummy = LPC_SSP0->DR;
+    State.ClockActiveTimeStatus = ClockMeasurementStatus::Timeout;
+    State.Capture = 0;
+    State.ChipSelectAssert = 0;
+    State.Checksum = 0;
+    State.ElementCount = 0;
+    State.MismatchIndex = 0;
 }
 
 //
-// Initialize TIMER2 to capture inputs on CAP2.0
+// Initialize the capture timer to capture inputs on capture channels 0 and 1, and
+// the interrupt timer to drive the interrupt pin
 //
-void SpiTester::TimerInit ()
+template <typename Traits>
+void SpiTester<Traits>::TimerInit ()
 {
     // Initialize clock and power, use highest posible resolution
-    SetPeripheralPowerState(CLKPWR_PCONP_PCTIM2, true);
-    SetPeripheralClockDivider(CLKPWR_PCLKSEL_TIMER2, CLKPWR_PCLKSEL_CCLK_DIV_1);
+    SetPeripheralPowerState(Traits::CAPTURE_TIMER_POWER, true);
+    SetPeripheralClockDivider(
+        Traits::CAPTURE_TIMER_PCLK,
+        CLKPWR_PCLKSEL_CCLK_DIV_1);
 
-    // P0.4 - CAP2.0 - I - Capture input for Timer 2, channel 0.
-    LPC_PINCON->PINSEL0 |= 0x3 << 8;
+    Traits::MuxCaptureInput();
 
     // Put timer in reset
-    LPC_TIM2->TCR = TIM_TCR_RESET;
+    Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
 
     // Timer mode
-    LPC_TIM2->TCR = 0;
+    Traits::CaptureTimer()->TCR = 0;
 
     // Increment Timer Counter on every PCLK
-    LPC_TIM2->PR = 0;
-
-    // Ensure MAT2.0 is initially high
-    LPC_TIM2->EMR |= (1U << TIM_MATCH_CHANNEL_0);
+    Traits::CaptureTimer()->PR = 0;
+
+    // The interrupt timer may be shared with another tester, so only the
+    // clock and the tester's own match output are configured
+    SetPeripheralPowerState(Traits::INTERRUPT_TIMER_POWER, true);
+    SetPeripheralClockDivider(
+        Traits::INTERRUPT_TIMER_PCLK,
+        CLKPWR_PCLKSEL_CCLK_DIV_1);
+
+    // Ensure the match output is initially high
+    Traits::InterruptTimer()->EMR |= (1U << Traits::INTERRUPT_MATCH_CHANNEL);
+
+    // TIM0 counts the falling edges generated on the match output in
+    // periodic interrupt mode, and must be clocked from the same PCLK as
+    // the interrupt timer
+    SetPeripheralPowerState(CLKPWR_PCONP_PCTIM0, true);
+    SetPeripheralClockDivider(CLKPWR_PCLKSEL_TIMER0, CLKPWR_PCLKSEL_CCLK_DIV_1);
+    LPC_TIM0->TCR = TIM_TCR_RESET;
+    LPC_TIM0->CTCR = 0;
 }
 
-ClockMeasurementStatus SpiTester::WaitForCapture (uint32_t* CapturePtr)
+template <typename Traits>
+ClockMeasurementStatus SpiTester<Traits>::WaitForCapture (uint32_t* CapturePtr)
 {
+    ProfileScope profile(PROFILE_SPI_WAIT_FOR_CAPTURE);
+
     // wait for first capture or first byte to be received
     uint32_t capture;
 
     // Check the CR0 register more frequently than the RNE register so that
     // CR0 doesn't get overwritten by the next falling edge.
-    while (!(LPC_SSP0->SR & SSP_SR_RNE)) {
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
-        if ((capture = LPC_TIM2->CR0) != 0) break;
+    while (!(Traits::Ssp()->SR & SSP_SR_RNE)) {
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
     }
 
     if (capture != 0) {
@@ -270,74 +879,73 @@ ClockMeasurementStatus SpiTester::WaitForCapture (uint32_t* CapturePtr)
     }
 
     // give approximation of first falling edge based on timer register
-    *CapturePtr = LPC_TIM2->TC;
+    *CapturePtr = Traits::CaptureTimer()->TC;
     return ClockMeasurementStatus::EdgeNotDetected;
 }
 
-TransferInfo SpiTester::CaptureTransfer (const CommandBlock& Command)
+//
+// The receive/transmit loop of the polled capture engine, specialized for
+// each frame width so that the data mask and the number of checksum bytes
+// are compile-time constants, and for each kind of sequence.
+//
+template <typename Traits>
+template <uint32_t DataBitLength, typename Sequence>
+void SpiTester<Traits>::CapturePolledLoop (PolledCaptureState& State)
 {
-    auto transferInfo = TransferInfo();
-
+    const uint32_t dataMask = (1U << DataBitLength) - 1;
     uint32_t checksum = 0;
-    const uint32_t dataMask = 
-        (1 << Command.u.CaptureNextTransfer.DataBitLength) - 1;
-    // This is the value we should expect to receive from the master
-    uint32_t rxValue = Command.u.CaptureNextTransfer.SendValue;
-    // This is the value we should send to the master
-    uint32_t txValue = Command.u.CaptureNextTransfer.ReceiveValue;
+    uint32_t count = 0;
+    // The values we should expect to receive from the master
+    Sequence rxSequence(patternTable, patternLength, State.RxValue);
+    // The values we should send to the master
+    Sequence txSequence(patternTable, patternLength, State.TxValue);
     bool mismatchDetected = false;
 
-    SspSetDataMode(
-        SpiDataMode(Command.u.CaptureNextTransfer.Mode),
-        Command.u.CaptureNextTransfer.DataBitLength);
-
-    // Put timer in reset
-    LPC_TIM2->TCR = TIM_TCR_RESET;
-
-    // Stop the counter if overflow is detected
-    LPC_TIM2->MCR = TIM_MCR_STOP_ON_MATCH(TIM_MATCH_CHANNEL_0);
-    LPC_TIM2->MR0 = 0xffffffff;
-
-    // Capture CR0 on falling edge
-    LPC_TIM2->CCR = TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_0);
+    // Mask everything but the I2C interrupt for the duration of the transfer
+    SpiCriticalSection criticalSection;
 
-    __disable_irq();
+    // do initial fill of TX fifo. Between the transfers of a streaming
+    // session the FIFO still holds the next elements of the sequence.
+    PrimeTxFifo(txSequence, dataMask);
 
-    // do initial fill of TX fifo
-    for (int i = 0; i < 8; ++i) {
-        LPC_SSP0->DR = txValue & dataMask;
-        ++txValue;
+    // Wait for CS to assert. The capture timer is already running, so
+    // that the chip select edge is captured.
+    if (!WaitForChipSelect()) {
+        TimeOutCapture(State);
+        return;
     }
 
-    // Wait for CS to assert
-    while (!ChipSelectAsserted());
+    State.ClockActiveTimeStatus = WaitForCapture(&State.Capture);
 
-    // start timer
-    LPC_TIM2->TCR = TIM_TCR_ENABLE;
+    // the chip select capture has settled by the time SCK has toggled
+    State.ChipSelectAssert = Traits::CaptureTimer()->CR1;
 
-    uint32_t capture1;
-    transferInfo.ClockActiveTimeStatus = WaitForCapture(&capture1);
+    const uint32_t loopStart = CycleCount();
+    ProfileIterations iterations;
 
     for (;;) {
+        // the longest iteration bounds the rate at which elements can be
+        // serviced
+        iterations.Mark();
+
         // byte received?
-        uint32_t status = LPC_SSP0->SR;
+        uint32_t status = Traits::Ssp()->SR;
 
         if (status & SSP_SR_RNE) {
-            uint32_t data = LPC_SSP0->DR;
+            uint32_t data = Traits::Ssp()->DR;
 
             //add to checksum
-            checksum = crc16_update(checksum, uint8_t(data));
-            // checksum.Update(uint8_t(data));
-            if (dataMask & (1 << 8)) {
-                checksum = crc16_update(checksum, uint8_t(data >> 8));
+            if (DataBitLength > 8) {
+                checksum = crc16_update16(checksum, data);
+            } else {
+                checksum = crc16_update(checksum, uint8_t(data));
             }
 
-            if ((data != (rxValue & dataMask)) && !mismatchDetected) {
+            if ((data != (rxSequence.Next() & dataMask)) && !mismatchDetected) {
                 mismatchDetected = true;
-                transferInfo.MismatchIndex =
-                    rxValue - Command.u.CaptureNextTransfer.SendValue;
+                State.MismatchIndex = count;
             }
-            ++rxValue;
+            ++count;
         } else if (!ChipSelectAsserted()) {
             // only check if chip select is deasserted if the receive FIFO
             // has been purged
@@ -346,32 +954,126 @@ TransferInfo SpiTester::CaptureTransfer (const CommandBlock& Command)
 
         // space available in TX FIFO?
         if (status & SSP_SR_TNF) {
-            LPC_SSP0->DR = txValue & dataMask;
-            ++txValue;
+            Traits::Ssp()->DR = txSequence.Next() & dataMask;
         }
     }
 
-    __enable_irq();
+    ProfileRecord(
+        PROFILE_SPI_CAPTURE_LOOP,
+        CycleCount() - loopStart,
+        iterations.Max());
+
+    State.RxValue = rxSequence.Position();
+    State.TxValue = txSequence.Position();
+    State.Checksum = checksum;
+    State.ElementCount = count;
+    if (!mismatchDetected)
+        State.MismatchIndex = State.ElementCount;
+}
+
+template <typename Traits>
+template <typename Sequence>
+typename SpiTester<Traits>::PolledCaptureLoop
+SpiTester<Traits>::SelectPolledCaptureLoop (uint32_t DataBitLength)
+{
+    static const PolledCaptureLoop captureLoops[] = {
+        &CapturePolledLoop<4, Sequence>,
+        &CapturePolledLoop<5, Sequence>,
+        &CapturePolledLoop<6, Sequence>,
+        &CapturePolledLoop<7, Sequence>,
+        &CapturePolledLoop<8, Sequence>,
+        &CapturePolledLoop<9, Sequence>,
+        &CapturePolledLoop<10, Sequence>,
+        &CapturePolledLoop<11, Sequence>,
+        &CapturePolledLoop<12, Sequence>,
+        &CapturePolledLoop<13, Sequence>,
+        &CapturePolledLoop<14, Sequence>,
+        &CapturePolledLoop<15, Sequence>,
+        &CapturePolledLoop<16, Sequence>,
+    };
+    static_assert(
+        (sizeof(captureLoops) / sizeof(captureLoops[0])) ==
+            (MAX_DATA_BIT_LENGTH - MIN_DATA_BIT_LENGTH + 1),
+        "captureLoops must have an entry for each data bit length");
+
+    return captureLoops[DataBitLength - MIN_DATA_BIT_LENGTH];
+}
+
+template <typename Traits>
+void SpiTester<Traits>::RunPolledCaptureLoop (
+    uint32_t DataBitLength,
+    PolledCaptureState& State
+    )
+{
+    if (patternLength != 0) {
+        SelectPolledCaptureLoop<PatternSequence>(DataBitLength)(State);
+    } else {
+        SelectPolledCaptureLoop<CounterSequence>(DataBitLength)(State);
+    }
+}
+
+template <typename Traits>
+TransferInfo2 SpiTester<Traits>::CaptureTransfer (const CommandBlock& Command)
+{
+    auto transferInfo = TransferInfo2();
+
+    const uint32_t dataBitLength = EffectiveDataBitLength(
+        Command.u.CaptureNextTransfer.DataBitLength);
+
+    PolledCaptureState state;
+    state.RxValue = Command.u.CaptureNextTransfer.SendValue;
+    state.TxValue = Command.u.CaptureNextTransfer.ReceiveValue;
+
+    SspSetDataMode(
+        SpiDataMode(Command.u.CaptureNextTransfer.Mode),
+        dataBitLength);
+
+    // Put timer in reset
+    Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+
+    // Stop the counter if overflow is detected
+    Traits::CaptureTimer()->MCR = TIM_MCR_STOP_ON_MATCH(TIM_MATCH_CHANNEL_0);
+    Traits::CaptureTimer()->MR0 = 0xffffffff;
+
+    // Capture CR0 on falling edge of SCK, and CR1 on both edges of CS
+    Traits::CaptureTimer()->CCR = TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_0) |
+        TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_1) |
+        TIM_CCR_RISING(TIM_CAPTURE_CHANNEL_1);
+
+    // start timer
+    Traits::CaptureTimer()->TCR = TIM_TCR_ENABLE;
+    const uint32_t timerStartCycle = ElapsedCycles();
 
+    RunPolledCaptureLoop(dataBitLength, state);
+    const uint32_t chipSelectDeassert = Traits::CaptureTimer()->CR1;
+    capturedElementCount = 0;
+    capturedElementSize = 0;
+
+    transferInfo.ClockActiveTimeStatus = state.ClockActiveTimeStatus;
     if (transferInfo.ClockActiveTimeStatus == ClockMeasurementStatus::Success) {
         // did timer overflow?
-        if (!(LPC_TIM2->TCR & TIM_TCR_ENABLE)) {
+        if (!(Traits::CaptureTimer()->TCR & TIM_TCR_ENABLE)) {
             transferInfo.ClockActiveTimeStatus = 
                 ClockMeasurementStatus::Overflow;
         } else {
             // measurement was captured successfully
-            uint32_t capture2 = LPC_TIM2->CR0;
-            LPC_TIM2->TCR = TIM_TCR_RESET;
+            uint32_t capture2 = Traits::CaptureTimer()->CR0;
+            Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
 
-            transferInfo.ClockActiveTime = capture2 - capture1;
+            transferInfo.ClockActiveTime = capture2 - state.Capture;
         }
     }
 
-    transferInfo.Checksum = checksum;
-    transferInfo.ElementCount = 
-        rxValue - Command.u.CaptureNextTransfer.SendValue;
-    if (!mismatchDetected)
-        transferInfo.MismatchIndex = transferInfo.ElementCount;
+    MeasureChipSelectTiming(
+        transferInfo,
+        timerStartCycle,
+        state.ChipSelectAssert,
+        chipSelectDeassert,
+        state.Capture);
+
+    transferInfo.Checksum = state.Checksum;
+    transferInfo.ElementCount = state.ElementCount;
+    transferInfo.MismatchIndex = state.MismatchIndex;
 
     SspSetDataMode(
         SPI_CONTROL_INTERFACE_MODE,
@@ -380,127 +1082,1001 @@ TransferInfo SpiTester::CaptureTransfer (const CommandBlock& Command)
     return transferInfo;
 }
 
-extern "C" void TIMER2_IRQHandler ()
+//
+// Computes the chip select timing of a capture from the chip select edges
+// captured in CR1. Must be called after the clock active time has been
+// measured. The capture timer and ElapsedCycles() both count CCLK cycles, so
+// the gap since the previous transfer can be computed across the two.
+//
+template <typename Traits>
+void SpiTester<Traits>::MeasureChipSelectTiming (
+    TransferInfo2& Info,
+    uint32_t TimerStartCycle,
+    uint32_t ChipSelectAssert,
+    uint32_t ChipSelectDeassert,
+    uint32_t FirstEdge
+    )
 {
-    LPC_TIM2->IR = TIM_IR_MASK;
-    if (--SpiTester::remainingInterrupts == 0) {
-        // Disable falling edge generation, but still need to keep clock
-        // running for latency calculation of final interrupt
-        LPC_TIM2->TCR = TIM_TCR_RESET;
-        LPC_TIM2->MCR = 0;
-        LPC_TIM2->TCR = TIM_TCR_ENABLE;
+    if ((Info.ClockActiveTimeStatus == ClockMeasurementStatus::Overflow) ||
+        (Info.ClockActiveTimeStatus == ClockMeasurementStatus::Timeout)) {
+
+        Info.ChipSelectTimeStatus = Info.ClockActiveTimeStatus;
+        return;
+    }
+
+    // CR1 is not written if the chip select capture input is not connected
+    if (ChipSelectDeassert <= ChipSelectAssert) {
+        Info.ChipSelectTimeStatus = ClockMeasurementStatus::EdgeNotDetected;
+        return;
+    }
+
+    Info.ChipSelectTimeStatus = ClockMeasurementStatus::Success;
+    Info.ChipSelectActiveTime = ChipSelectDeassert - ChipSelectAssert;
+    Info.InterTransferGap =
+        (TimerStartCycle + ChipSelectAssert) - chipSelectDeassertCycle;
+    Info.ChipSelectAssertTime =
+        ElapsedCyclesToTime(TimerStartCycle + ChipSelectAssert);
+
+    if (Info.ClockActiveTimeStatus == ClockMeasurementStatus::Success) {
+        Info.SetupTime = FirstEdge - ChipSelectAssert;
+        Info.HoldTime =
+            ChipSelectDeassert - (FirstEdge + Info.ClockActiveTime);
     }
 }
 
-PeriodicInterruptInfo SpiTester::RunPeriodicInterrupts (
-    const CommandBlock& Command
-    )
+template <typename Traits>
+ClockMeasurementStatus SpiTester<Traits>::WaitForCaptureDma (uint32_t* CapturePtr)
 {
-    DBGPRINT("Entering periodic interrupt mode\n\r");
-    auto interruptInfo = PeriodicInterruptInfo();
+    ProfileScope profile(PROFILE_SPI_WAIT_FOR_CAPTURE);
+
+    uint32_t capture = 0;
+
+    // The DMA drains the receive FIFO, so wait for the first capture or for
+    // the transfer to end. Check CR0 more frequently than chip select so
+    // that CR0 doesn't get overwritten by the next falling edge.
+    while (ChipSelectAsserted()) {
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+        if ((capture = Traits::CaptureTimer()->CR0) != 0) break;
+    }
 
-    // program timer to bring external match output low, reset, and
-    // generate interrupt
-    const uint32_t period = this->testerInfo.ClockMeasurementFrequency /
-        Command.u.StartPeriodicInterrupts.InterruptFrequency;
-    uint32_t interruptCount;
+    if (capture != 0) {
+        *CapturePtr = capture;
+        return ClockMeasurementStatus::Success;
+    }
+
+    *CapturePtr = Traits::CaptureTimer()->TC;
+    return ClockMeasurementStatus::EdgeNotDetected;
+}
+
+//
+// The receive/transmit loop of the Record capture engine. Received elements
+// are stored in captureRxBuffer without being verified. Elements that do
+// not fit in the buffer are counted but discarded.
+//
+template <typename Traits>
+template <typename Ty, typename Sequence>
+void SpiTester<Traits>::CaptureRecordLoop (PolledCaptureState& State)
+{
+    Ty* const buffer = reinterpret_cast<Ty*>(captureRxBuffer);
+    const uint32_t capacity = Traits::CAPTURE_BUFFER_SIZE / sizeof(Ty);
+    const uint32_t dataMask = State.DataMask;
+    uint32_t count = 0;
+    // The values we should send to the master
+    Sequence txSequence(patternTable, patternLength, State.TxValue);
+
+    // Mask everything but the I2C interrupt for the duration of the transfer
+    SpiCriticalSection criticalSection;
+
+    // do initial fill of TX fifo
+    PrimeTxFifo(txSequence, dataMask);
+
+    // Wait for CS to assert. The capture timer is already running, so
+    // that the chip select edge is captured.
+    if (!WaitForChipSelect()) {
+        TimeOutCapture(State);
+        return;
+    }
+
+    State.ClockActiveTimeStatus = WaitForCapture(&State.Capture);
+
+    // the chip select capture has settled by the time SCK has toggled
+    State.ChipSelectAssert = Traits::CaptureTimer()->CR1;
+
+    const uint32_t loopStart = CycleCount();
+    ProfileIterations iterations;
+
+    for (;;) {
+        // the longest iteration bounds the rate at which elements can be
+        // serviced
+        iterations.Mark();
+
+        // byte received?
+        uint32_t status = Traits::Ssp()->SR;
+
+        if (status & SSP_SR_RNE) {
+            uint32_t data = Traits::Ssp()->DR;
+            if (count < capacity) {
+                buffer[count] = Ty(data);
+            }
+            ++count;
+        } else if (!ChipSelectAsserted()) {
+            // only check if chip select is deasserted if the receive FIFO
+            // has been purged
+            break;
+        }
+
+        // space available in TX FIFO?
+        if (status & SSP_SR_TNF) {
+            Traits::Ssp()->DR = txSequence.Next() & dataMask;
+        }
+    }
+
+    ProfileRecord(
+        PROFILE_SPI_CAPTURE_LOOP,
+        CycleCount() - loopStart,
+        iterations.Max());
+
+    State.ElementCount = count;
+}
+
+template <typename Traits>
+TransferInfo2 SpiTester<Traits>::CaptureTransferRecord (const CommandBlock& Command)
+{
+    auto transferInfo = TransferInfo2();
+
+    const uint32_t dataBitLength = EffectiveDataBitLength(
+        Command.u.CaptureNextTransfer.DataBitLength);
+    const bool wide = dataBitLength > 8;
+
+    PolledCaptureState state;
+    state.TxValue = Command.u.CaptureNextTransfer.ReceiveValue;
+    state.DataMask = (1U << dataBitLength) - 1;
+
+    SspSetDataMode(
+        SpiDataMode(Command.u.CaptureNextTransfer.Mode),
+        dataBitLength);
+
+    // Put timer in reset
+    Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+
+    // Stop the counter if overflow is detected
+    Traits::CaptureTimer()->MCR = TIM_MCR_STOP_ON_MATCH(TIM_MATCH_CHANNEL_0);
+    Traits::CaptureTimer()->MR0 = 0xffffffff;
+
+    // Capture CR0 on falling edge of SCK, and CR1 on both edges of CS
+    Traits::CaptureTimer()->CCR = TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_0) |
+        TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_1) |
+        TIM_CCR_RISING(TIM_CAPTURE_CHANNEL_1);
+
+    // start timer
+    Traits::CaptureTimer()->TCR = TIM_TCR_ENABLE;
+    const uint32_t timerStartCycle = ElapsedCycles();
+
+    if (patternLength != 0) {
+        if (wide) {
+            CaptureRecordLoop<uint16_t, PatternSequence>(state);
+        } else {
+            CaptureRecordLoop<uint8_t, PatternSequence>(state);
+        }
+    } else if (wide) {
+        CaptureRecordLoop<uint16_t, CounterSequence>(state);
+    } else {
+        CaptureRecordLoop<uint8_t, CounterSequence>(state);
+    }
+    const uint32_t chipSelectDeassert = Traits::CaptureTimer()->CR1;
+
+    transferInfo.ClockActiveTimeStatus = state.ClockActiveTimeStatus;
+    if (transferInfo.ClockActiveTimeStatus == ClockMeasurementStatus::Success) {
+        // did timer overflow?
+        if (!(Traits::CaptureTimer()->TCR & TIM_TCR_ENABLE)) {
+            transferInfo.ClockActiveTimeStatus =
+                ClockMeasurementStatus::Overflow;
+        } else {
+            // measurement was captured successfully
+            uint32_t capture2 = Traits::CaptureTimer()->CR0;
+            Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+
+            transferInfo.ClockActiveTime = capture2 - state.Capture;
+        }
+    }
+
+    MeasureChipSelectTiming(
+        transferInfo,
+        timerStartCycle,
+        state.ChipSelectAssert,
+        chipSelectDeassert,
+        state.Capture);
+
+    const uint32_t capacity =
+        wide ? (Traits::CAPTURE_BUFFER_SIZE / 2) : Traits::CAPTURE_BUFFER_SIZE;
+    const uint32_t recorded = std::min(state.ElementCount, capacity);
+
+    if (wide) {
+        transferInfo.Checksum = VerifyCapture(
+            reinterpret_cast<const uint16_t*>(captureRxBuffer),
+            recorded,
+            patternTable,
+            patternLength,
+            Command.u.CaptureNextTransfer.SendValue,
+            state.DataMask,
+            &transferInfo.MismatchIndex);
+    } else {
+        transferInfo.Checksum = VerifyCapture(
+            captureRxBuffer,
+            recorded,
+            patternTable,
+            patternLength,
+            Command.u.CaptureNextTransfer.SendValue,
+            state.DataMask,
+            &transferInfo.MismatchIndex);
+    }
+
+    transferInfo.ElementCount = state.ElementCount;
+    capturedElementCount = recorded;
+    capturedElementSize = wide ? sizeof(uint16_t) : sizeof(uint8_t);
+
+    SspSetDataMode(
+        SPI_CONTROL_INTERFACE_MODE,
+        SPI_CONTROL_INTERFACE_DATABITLENGTH);
+
+    return transferInfo;
+}
+
+template <typename Traits>
+CapturedData SpiTester<Traits>::GetCapturedData (const CommandBlock& Command)
+{
+    auto capturedData = CapturedData();
+
+    const uint32_t offset = Command.u.GetCapturedData.ElementOffset;
+    capturedData.ElementOffset = offset;
+    capturedData.TotalElementCount = capturedElementCount;
+    capturedData.ElementSize = uint8_t(capturedElementSize);
+
+    if ((capturedElementSize == sizeof(uint32_t)) &&
+        (offset < capturedElementCount)) {
+
+        // an edge trace interleaves the leading and trailing edge of each
+        // clock cycle. Missing trailing edges are returned as 0.
+        const uint32_t* const edgeTraceLeading =
+            reinterpret_cast<const uint32_t*>(captureRxBuffer);
+        const uint32_t* const edgeTraceTrailing =
+            reinterpret_cast<const uint32_t*>(captureTxBuffer);
+        const uint32_t count = std::min(
+            capturedElementCount - offset,
+            uint32_t(sizeof(capturedData.Data) / sizeof(uint32_t)));
+
+        for (uint32_t i = 0; i != count; ++i) {
+            const uint32_t index = offset + i;
+            const uint32_t cycle = index / 2;
+            uint32_t edge;
+            if (!(index & 1)) {
+                edge = edgeTraceLeading[cycle];
+            } else if (cycle < edgeTraceTrailingCount) {
+                edge = edgeTraceTrailing[cycle];
+            } else {
+                edge = 0;
+            }
+
+            memcpy(capturedData.Data + (i * sizeof(edge)), &edge, sizeof(edge));
+        }
+
+        capturedData.ElementCount = uint16_t(count);
+    } else if ((capturedElementSize != 0) && (offset < capturedElementCount)) {
+        const uint32_t count = std::min(
+            capturedElementCount - offset,
+            uint32_t(sizeof(capturedData.Data) / capturedElementSize));
+
+        memcpy(
+            capturedData.Data,
+            captureRxBuffer + (offset * capturedElementSize),
+            count * capturedElementSize);
+
+        capturedData.ElementCount = uint16_t(count);
+    }
+
+    return capturedData;
+}
+
+//
+// Capture a transfer using the GPDMA. One channel streams a precomputed
+// transmit pattern into the SSP while another records received elements
+// into AHB SRAM. The received elements are verified after chip select
+// deasserts, so the CPU does no per-element work during the transfer.
+//
+template <typename Traits>
+TransferInfo2 SpiTester<Traits>::CaptureTransferDma (const CommandBlock& Command)
+{
+    auto transferInfo = TransferInfo2();
+
+    const uint32_t dataBitLength = EffectiveDataBitLength(
+        Command.u.CaptureNextTransfer.DataBitLength);
+    const uint32_t dataMask = (1 << dataBitLength) - 1;
+    const bool wide = dataBitLength > 8;
+    const GPDMA_WIDTH width = wide ? GPDMA_WIDTH_HALFWORD : GPDMA_WIDTH_BYTE;
+    const uint32_t capacity =
+        wide ? (Traits::CAPTURE_BUFFER_SIZE / 2) : Traits::CAPTURE_BUFFER_SIZE;
+
+    SspSetDataMode(
+        SpiDataMode(Command.u.CaptureNextTransfer.Mode),
+        dataBitLength);
+
+    TxPatternFiller txPattern(
+        captureTxBuffer,
+        patternTable,
+        patternLength,
+        Command.u.CaptureNextTransfer.ReceiveValue,
+        dataMask,
+        wide,
+        capacity);
+
+    txPattern.Fill(TX_PATTERN_PREFILL);
+
+    GpdmaProgramChannel(
+        Traits::DMA_CHANNEL_RX,
+        captureRxLli,
+        DmaAddress(&Traits::Ssp()->DR),
+        DmaAddress(captureRxBuffer),
+        capacity,
+        GPDMA_CTRL_SBSIZE(GPDMA_BSIZE_1) | GPDMA_CTRL_DBSIZE(GPDMA_BSIZE_1) |
+        GPDMA_CTRL_SWIDTH(width) | GPDMA_CTRL_DWIDTH(width) | GPDMA_CTRL_DI,
+        GPDMA_CFG_SRC_PERIPHERAL(Traits::DMA_CONN_RX) |
+        GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_P2M));
+
+    // The TX FIFO requests a burst whenever it is half empty
+    GpdmaProgramChannel(
+        Traits::DMA_CHANNEL_TX,
+        captureTxLli,
+        DmaAddress(captureTxBuffer),
+        DmaAddress(&Traits::Ssp()->DR),
+        capacity,
+        GPDMA_CTRL_SBSIZE(GPDMA_BSIZE_4) | GPDMA_CTRL_DBSIZE(GPDMA_BSIZE_4) |
+        GPDMA_CTRL_SWIDTH(width) | GPDMA_CTRL_DWIDTH(width) | GPDMA_CTRL_SI,
+        GPDMA_CFG_DEST_PERIPHERAL(Traits::DMA_CONN_TX) |
+        GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_M2P));
+
+    // Put timer in reset
+    Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+
+    // Stop the counter if overflow is detected
+    Traits::CaptureTimer()->MCR = TIM_MCR_STOP_ON_MATCH(TIM_MATCH_CHANNEL_0);
+    Traits::CaptureTimer()->MR0 = 0xffffffff;
+
+    // Capture CR0 on falling edge of SCK, and CR1 on both edges of CS
+    Traits::CaptureTimer()->CCR = TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_0) |
+        TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_1) |
+        TIM_CCR_RISING(TIM_CAPTURE_CHANNEL_1);
+
+    // Start servicing the SSP. The TX channel fills the FIFO immediately.
+    Traits::Ssp()->DMACR = SSP_DMACR_RXDMA_EN | SSP_DMACR_TXDMA_EN;
+
+    // IRQs only need to be masked until the first falling edge has been
+    // captured. After that, the DMA does all of the work.
+    uint32_t capture1;
+    uint32_t chipSelectAssert;
+    uint32_t timerStartCycle;
     {
+        SpiCriticalSection criticalSection;
+
+        // start timer, so that the chip select edge is captured
+        Traits::CaptureTimer()->TCR = TIM_TCR_ENABLE;
+        timerStartCycle = ElapsedCycles();
+
+        // Wait for CS to assert, continuing to compute the pattern
+        const uint64_t deadline = CaptureDeadline();
+        while (!ChipSelectAsserted() && (Now() < deadline)) {
+            txPattern.Fill(8);
+        }
+
+        if (ChipSelectAsserted()) {
+            transferInfo.ClockActiveTimeStatus = WaitForCaptureDma(&capture1);
+            chipSelectAssert = Traits::CaptureTimer()->CR1;
+        } else {
+            transferInfo.ClockActiveTimeStatus = ClockMeasurementStatus::Timeout;
+            capture1 = 0;
+            chipSelectAssert = 0;
+        }
+    }
+
+    while (ChipSelectAsserted()) {
+        txPattern.Fill(64);
+    }
+    chipSelectDeassertCycle = ElapsedCycles();
+
+    // Wait for the DMA to move the tail of the transfer out of the FIFO
+    while ((Traits::Ssp()->SR & SSP_SR_RNE) &&
+           (LPC_GPDMA->DMACEnbldChns & (1 << Traits::DMA_CHANNEL_RX)));
+
+    Traits::Ssp()->DMACR = 0;
+    GpdmaStopChannel(Traits::DMA_CHANNEL_RX);
+    GpdmaStopChannel(Traits::DMA_CHANNEL_TX);
+    const uint32_t chipSelectDeassert = Traits::CaptureTimer()->CR1;
+
+    const uint32_t received = (GpdmaChannel(Traits::DMA_CHANNEL_RX)->DMACCDestAddr -
+        DmaAddress(captureRxBuffer)) >> (wide ? 1 : 0);
+
+    // Anything left in the FIFO did not fit in the buffer
+    uint32_t lost = 0;
+    while (Traits::Ssp()->SR & SSP_SR_RNE) {
+        dummy = Traits::Ssp()->DR;
+        ++lost;
+    }
+
+    if (Traits::Ssp()->RIS & SSP_RIS_ROR) {
+        // the receive FIFO overflowed, so the element count is a lower bound
+        Traits::Ssp()->ICR = SSP_ICR_ROR;
+        ++lost;
+    }
+
+    if (transferInfo.ClockActiveTimeStatus == ClockMeasurementStatus::Success) {
+        // did timer overflow?
+        if (!(Traits::CaptureTimer()->TCR & TIM_TCR_ENABLE)) {
+            transferInfo.ClockActiveTimeStatus =
+                ClockMeasurementStatus::Overflow;
+        } else {
+            // measurement was captured successfully
+            uint32_t capture2 = Traits::CaptureTimer()->CR0;
+            Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+
+            transferInfo.ClockActiveTime = capture2 - capture1;
+        }
+    }
+
+    MeasureChipSelectTiming(
+        transferInfo,
+        timerStartCycle,
+        chipSelectAssert,
+        chipSelectDeassert,
+        capture1);
+
+    if (wide) {
+        transferInfo.Checksum = VerifyCapture(
+            reinterpret_cast<const uint16_t*>(captureRxBuffer),
+            received,
+            patternTable,
+            patternLength,
+            Command.u.CaptureNextTransfer.SendValue,
+            dataMask,
+            &transferInfo.MismatchIndex);
+    } else {
+        transferInfo.Checksum = VerifyCapture(
+            captureRxBuffer,
+            received,
+            patternTable,
+            patternLength,
+            Command.u.CaptureNextTransfer.SendValue,
+            dataMask,
+            &transferInfo.MismatchIndex);
+    }
+
+    transferInfo.ElementCount = received + lost;
+    capturedElementCount = received;
+    capturedElementSize = wide ? sizeof(uint16_t) : sizeof(uint8_t);
+
+    SspSetDataMode(
+        SPI_CONTROL_INTERFACE_MODE,
+        SPI_CONTROL_INTERFACE_DATABITLENGTH);
+
+    return transferInfo;
+}
+
+//
+// Capture a transfer with the polled engine while the GPDMA timestamps
+// every SCK edge. Timer captures can not request DMA transfers, so the
+// capture timer counts SCK edges instead: it matches MR0 on each leading
+// edge, and is reset to 0 on the following trailing edge, where it matches
+// MR1. Each match requests a transfer of TIM0's counter, which counts CCLK
+// cycles, into the trace. The CPU does no per-edge work.
+//
+template <typename Traits>
+TransferInfo2 SpiTester<Traits>::CaptureTransferEdgeTrace (
+    const CommandBlock& Command
+    )
+{
+    LPC_TIM_TypeDef* const timer = Traits::CaptureTimer();
+    uint32_t* const edgeTraceLeading =
+        reinterpret_cast<uint32_t*>(captureRxBuffer);
+    uint32_t* const edgeTraceTrailing =
+        reinterpret_cast<uint32_t*>(captureTxBuffer);
+    const uint32_t dmaRequests =
+        DMAREQSEL_TIMER_MATCH(Traits::DMA_CONN_TRACE_LEADING) |
+        DMAREQSEL_TIMER_MATCH(Traits::DMA_CONN_TRACE_TRAILING);
+
+    const uint32_t dataBitLength = EffectiveDataBitLength(
+        Command.u.CaptureNextTransfer.DataBitLength);
+
+    PolledCaptureState state;
+    state.RxValue = Command.u.CaptureNextTransfer.SendValue;
+    state.TxValue = Command.u.CaptureNextTransfer.ReceiveValue;
+
+    SspSetDataMode(
+        SpiDataMode(Command.u.CaptureNextTransfer.Mode),
+        dataBitLength);
+
+    // Count both edges of the capture input
+    timer->TCR = TIM_TCR_RESET;
+    timer->CCR = 0;
+    timer->CTCR = TIM_CTCR_COUNTER_MODE_BOTH_EDGES;
+    timer->MCR = TIM_MCR_RESET_ON_MATCH(TIM_MATCH_CHANNEL_0);
+    timer->MR0 = 1;
+    timer->MR1 = 0;
+
+    LPC_TIM0->TCR = TIM_TCR_RESET;
+    LPC_TIM0->PR = 0;
+    LPC_TIM0->MCR = 0;
+
+    LPC_SC->DMAREQSEL |= dmaRequests;
+    GpdmaProgramChannel(
+        DMA_CHANNEL_SPI_EDGE_TRACE_LEADING,
+        nullptr,
+        DmaAddress(&LPC_TIM0->TC),
+        DmaAddress(edgeTraceLeading),
+        EDGE_TRACE_MAX_CYCLES,
+        GPDMA_CTRL_SWIDTH(GPDMA_WIDTH_WORD) |
+        GPDMA_CTRL_DWIDTH(GPDMA_WIDTH_WORD) | GPDMA_CTRL_DI,
+        GPDMA_CFG_SRC_PERIPHERAL(Traits::DMA_CONN_TRACE_LEADING) |
+        GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_P2M));
+    GpdmaProgramChannel(
+        DMA_CHANNEL_SPI_EDGE_TRACE_TRAILING,
+        nullptr,
+        DmaAddress(&LPC_TIM0->TC),
+        DmaAddress(edgeTraceTrailing),
+        EDGE_TRACE_MAX_CYCLES,
+        GPDMA_CTRL_SWIDTH(GPDMA_WIDTH_WORD) |
+        GPDMA_CTRL_DWIDTH(GPDMA_WIDTH_WORD) | GPDMA_CTRL_DI,
+        GPDMA_CFG_SRC_PERIPHERAL(Traits::DMA_CONN_TRACE_TRAILING) |
+        GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_P2M));
+
+    auto stopTrace = Finally([&] {
+        GpdmaStopChannel(DMA_CHANNEL_SPI_EDGE_TRACE_LEADING);
+        GpdmaStopChannel(DMA_CHANNEL_SPI_EDGE_TRACE_TRAILING);
+        LPC_SC->DMAREQSEL &= ~dmaRequests;
+
+        // The capture timer may also be an interrupt timer, which runs in
+        // timer mode
+        timer->TCR = TIM_TCR_RESET;
+        timer->MCR = 0;
+        timer->CTCR = 0;
+        LPC_TIM0->TCR = TIM_TCR_RESET;
+    });
+
+    LPC_TIM0->TCR = TIM_TCR_ENABLE;
+    timer->TCR = TIM_TCR_ENABLE;
+    RunPolledCaptureLoop(dataBitLength, state);
+
+    GpdmaStopChannel(DMA_CHANNEL_SPI_EDGE_TRACE_LEADING);
+    GpdmaStopChannel(DMA_CHANNEL_SPI_EDGE_TRACE_TRAILING);
+
+    const uint32_t leadingCount =
+        (GpdmaChannel(DMA_CHANNEL_SPI_EDGE_TRACE_LEADING)->DMACCDestAddr -
+         DmaAddress(edgeTraceLeading)) / sizeof(uint32_t);
+    uint32_t trailingCount =
+        (GpdmaChannel(DMA_CHANNEL_SPI_EDGE_TRACE_TRAILING)->DMACCDestAddr -
+         DmaAddress(edgeTraceTrailing)) / sizeof(uint32_t);
+
+    // MR1 matches the counter's initial value, which may request a
+    // transfer before the first edge
+    if ((trailingCount != 0) &&
+        ((leadingCount == 0) || (edgeTraceTrailing[0] < edgeTraceLeading[0]))) {
+
+        --trailingCount;
+        memmove(
+            edgeTraceTrailing,
+            edgeTraceTrailing + 1,
+            trailingCount * sizeof(uint32_t));
+    }
+    trailingCount = std::min(trailingCount, leadingCount);
+
+    // SCK has returned to its idle level, which is the level before the
+    // leading edge
+    const bool leadingEdgeFalling =
+        (LPC_GPIO0->FIOPIN & (1 << Traits::SCK_PIN)) != 0;
+
+    this->edgeTraceInfo = EdgeTraceInfo();
+    this->edgeTraceInfo.ExpectedEdgeCount =
+        2 * state.ElementCount * dataBitLength;
+    AnalyzeEdgeTrace(
+        edgeTraceLeading,
+        edgeTraceTrailing,
+        leadingCount,
+        trailingCount,
+        leadingEdgeFalling,
+        this->edgeTraceInfo);
+
+    // ClockActiveTime is measured between the first and last falling edges.
+    // The capture timer is counting edges, so chip select is not timed.
+    auto transferInfo = TransferInfo2();
+    transferInfo.ChipSelectTimeStatus = ClockMeasurementStatus::EdgeNotDetected;
+    const uint32_t* const fallingEdges =
+        leadingEdgeFalling ? edgeTraceLeading : edgeTraceTrailing;
+    const uint32_t fallingCount =
+        leadingEdgeFalling ? leadingCount : trailingCount;
+
+    if (state.ClockActiveTimeStatus == ClockMeasurementStatus::Timeout) {
+        transferInfo.ClockActiveTimeStatus = ClockMeasurementStatus::Timeout;
+        transferInfo.ChipSelectTimeStatus = ClockMeasurementStatus::Timeout;
+    } else if (fallingCount == 0) {
+        transferInfo.ClockActiveTimeStatus =
+            ClockMeasurementStatus::EdgeNotDetected;
+    } else if (leadingCount == EDGE_TRACE_MAX_CYCLES) {
+        transferInfo.ClockActiveTimeStatus = ClockMeasurementStatus::Overflow;
+    } else {
+        transferInfo.ClockActiveTimeStatus = ClockMeasurementStatus::Success;
+        transferInfo.ClockActiveTime =
+            fallingEdges[fallingCount - 1] - fallingEdges[0];
+    }
+
+    transferInfo.Checksum = state.Checksum;
+    transferInfo.ElementCount = state.ElementCount;
+    transferInfo.MismatchIndex = state.MismatchIndex;
+
+    capturedElementCount = 2 * leadingCount;
+    capturedElementSize = sizeof(uint32_t);
+    edgeTraceTrailingCount = trailingCount;
+
+    SspSetDataMode(
+        SPI_CONTROL_INTERFACE_MODE,
+        SPI_CONTROL_INTERFACE_DATABITLENGTH);
+
+    return transferInfo;
+}
+
+//
+// Captures consecutive transfers with the polled capture engine without
+// returning to the control interface between them, and accumulates their
+// totals. The expected and transmitted sequences start at 0 and continue
+// across transfers, so the session behaves as one stream that the master
+// splits into transfers.
+//
+template <typename Traits>
+StreamingInfo SpiTester<Traits>::RunStreamingSession (
+    const CommandBlock& Command
+    )
+{
+    auto info = StreamingInfo();
+
+    const uint32_t dataBitLength = EffectiveDataBitLength(
+        Command.u.StartStreaming.DataBitLength);
+    const uint32_t transferLimit = Command.u.StartStreaming.TransferCount;
+    const uint32_t idleTimeoutMillis =
+        (Command.u.StartStreaming.IdleTimeoutMillis != 0) ?
+        Command.u.StartStreaming.IdleTimeoutMillis :
+        uint32_t(STREAMING_DEFAULT_IDLE_TIMEOUT_MILLIS);
+    const uint64_t idleTimeout =
+        uint64_t(idleTimeoutMillis) * (SystemCoreClock / 1000);
+
+    info.StopReason = StreamingStopReason::IdleTimeout;
+    info.DataBitLength = dataBitLength;
+
+    PolledCaptureState state;
+    state.RxValue = 0;
+    state.TxValue = 0;
+
+    SspSetDataMode(
+        SpiDataMode(Command.u.StartStreaming.Mode),
+        dataBitLength);
+    capturedElementCount = 0;
+    capturedElementSize = 0;
+
+    TelemetryLog(
+        TELEMETRY_SPI_STREAMING_STARTED,
+        transferLimit,
+        idleTimeoutMillis);
+
+    uint64_t firstAssertTime = 0;
+    uint64_t lastDeassertTime = 0;
+    uint32_t gapCount = 0;
+    bool previousMeasured = false;
+
+    for (;;) {
+        if ((transferLimit != 0) && (info.TransferCount == transferLimit)) {
+            info.StopReason = StreamingStopReason::Completed;
+            break;
+        }
+
         // Put timer in reset
-        LPC_TIM2->TCR = TIM_TCR_RESET;
-        LPC_TIM2->IR = TIM_IR_MASK;
+        Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+
+        // Stop the counter if overflow is detected
+        Traits::CaptureTimer()->MCR = TIM_MCR_STOP_ON_MATCH(TIM_MATCH_CHANNEL_0);
+        Traits::CaptureTimer()->MR0 = 0xffffffff;
+
+        // Capture CR0 on falling edge of SCK, and CR1 on both edges of CS
+        Traits::CaptureTimer()->CCR = TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_0) |
+            TIM_CCR_FALLING(TIM_CAPTURE_CHANNEL_1) |
+            TIM_CCR_RISING(TIM_CAPTURE_CHANNEL_1);
+
+        // start timer
+        Traits::CaptureTimer()->TCR = TIM_TCR_ENABLE;
+        const uint32_t timerStartCycle = ElapsedCycles();
+
+        // wait for the next transfer, unless the master has gone idle
+        const uint64_t deadline = Now() + idleTimeout;
+        while (!ChipSelectAsserted() && (Now() < deadline));
+        if (!ChipSelectAsserted()) break;
+
+        const uint32_t assertSeen = ElapsedCycles();
+        RunPolledCaptureLoop(dataBitLength, state);
+        const uint32_t chipSelectDeassert = Traits::CaptureTimer()->CR1;
+        const uint32_t deassertSeen = ElapsedCycles();
+
+        auto transferInfo = TransferInfo2();
+        transferInfo.ClockActiveTimeStatus = state.ClockActiveTimeStatus;
+        if (transferInfo.ClockActiveTimeStatus == ClockMeasurementStatus::Success) {
+            // did timer overflow?
+            if (!(Traits::CaptureTimer()->TCR & TIM_TCR_ENABLE)) {
+                transferInfo.ClockActiveTimeStatus =
+                    ClockMeasurementStatus::Overflow;
+            } else {
+                // measurement was captured successfully
+                uint32_t capture2 = Traits::CaptureTimer()->CR0;
+                Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+
+                transferInfo.ClockActiveTime = capture2 - state.Capture;
+            }
+        }
+
+        MeasureChipSelectTiming(
+            transferInfo,
+            timerStartCycle,
+            state.ChipSelectAssert,
+            chipSelectDeassert,
+            state.Capture);
+
+        // Fall back to the edges seen by the CPU if chip select was not
+        // captured
+        uint32_t assertCycle = assertSeen;
+        uint32_t deassertCycle = deassertSeen;
+        const bool measured =
+            transferInfo.ChipSelectTimeStatus == ClockMeasurementStatus::Success;
+        if (measured) {
+            assertCycle = timerStartCycle + state.ChipSelectAssert;
+            deassertCycle = timerStartCycle + chipSelectDeassert;
+            info.ChipSelectActiveTime += transferInfo.ChipSelectActiveTime;
+
+            if (previousMeasured) {
+                const uint32_t gap = transferInfo.InterTransferGap;
+                info.MinInterTransferGap = (gapCount == 0) ?
+                    gap : std::min(info.MinInterTransferGap, gap);
+                info.MaxInterTransferGap =
+                    std::max(info.MaxInterTransferGap, gap);
+                ++gapCount;
+            }
+        }
+        previousMeasured = measured;
+        chipSelectDeassertCycle = deassertCycle;
+
+        if (info.TransferCount == 0) {
+            firstAssertTime = ElapsedCyclesToTime(assertCycle);
+        }
+        lastDeassertTime = ElapsedCyclesToTime(deassertCycle);
+
+        if (transferInfo.ClockActiveTimeStatus == ClockMeasurementStatus::Success) {
+            info.ClockActiveTime += transferInfo.ClockActiveTime;
+        } else {
+            ++info.UnmeasuredTransferCount;
+        }
+
+        if (state.MismatchIndex != state.ElementCount) {
+            if (info.MismatchTransferCount == 0) {
+                info.FirstMismatchTransfer = info.TransferCount;
+                info.FirstMismatchIndex = state.MismatchIndex;
+            }
+            ++info.MismatchTransferCount;
+        }
+
+        info.ElementCount += state.ElementCount;
+        ++info.TransferCount;
+    }
+
+    Traits::CaptureTimer()->TCR = TIM_TCR_RESET;
+    info.WallTime = lastDeassertTime - firstAssertTime;
+
+    TelemetryLog(
+        TELEMETRY_SPI_STREAMING_STOPPED,
+        info.TransferCount,
+        info.MismatchTransferCount);
+
+    SspSetDataMode(
+        SPI_CONTROL_INTERFACE_MODE,
+        SPI_CONTROL_INTERFACE_DATABITLENGTH);
+
+    return info;
+}
+
+template <typename Traits>
+PeriodicInterruptInfo SpiTester<Traits>::RunPeriodicInterrupts (
+    const CommandBlock& Command
+    )
+{
+    uint32_t interruptCount;
+    if (!Command.u.StartPeriodicInterrupts.ComputeInterruptCount(
+            interruptCount) ||
+        (Command.u.StartPeriodicInterrupts.InterruptFrequency == 0) ||
+        (Command.u.StartPeriodicInterrupts.InterruptFrequency >
+            MAX_INTERRUPT_FREQUENCY)) {
+
+        TelemetryLog(
+            TELEMETRY_SPI_INTERRUPTS_INVALID,
+            Command.u.StartPeriodicInterrupts.InterruptFrequency,
+            Command.u.StartPeriodicInterrupts.DurationInSeconds);
+
+        auto interruptInfo = PeriodicInterruptInfo();
+        interruptInfo.Status.s.ArithmeticOverflow = true;
+        return interruptInfo;
+    }
+
+    return RunPeriodicInterrupts(
+        Command.u.StartPeriodicInterrupts.InterruptFrequency,
+        interruptCount);
+}
+
+template <typename Traits>
+PeriodicInterruptInfo SpiTester<Traits>::RunPeriodicInterrupts (
+    uint32_t InterruptFrequency,
+    uint32_t InterruptCount
+    )
+{
+    TelemetryLog(
+        TELEMETRY_SPI_INTERRUPTS_STARTED,
+        InterruptFrequency,
+        InterruptCount);
+    auto interruptInfo = PeriodicInterruptInfo();
+    const uint32_t interruptCount = InterruptCount;
 
-        // On period signal, generate interrupt and reset
-        LPC_TIM2->MCR =
-            TIM_MCR_INT_ON_MATCH(TIM_MATCH_CHANNEL_0) |
-            TIM_MCR_RESET_ON_MATCH(TIM_MATCH_CHANNEL_0);
+    LPC_TIM_TypeDef* const timer = Traits::InterruptTimer();
+    const TIM_MATCH_CHANNEL channel = Traits::INTERRUPT_MATCH_CHANNEL;
+    const uint32_t emrMask = (1U << channel) | TIM_EMR_TOGGLE_ON_MATCH(channel);
 
-        LPC_TIM2->MR0 = period;
+    this->latencyHistogram = InterruptLatencyHistogram();
+    this->latencyHistogram.MinLatency = 0xffffffff;
+    auto finalizeHistogram = Finally([&] {
+        if (this->latencyHistogram.SampleCount == 0) {
+            this->latencyHistogram.MinLatency = 0;
+        }
+    });
 
-        // Bring channel 0 low (P4.28) on match, and ensure that match channel
-        // is initially high
-        LPC_TIM2->EMR = (1U << TIM_MATCH_CHANNEL_0) |
-            TIM_EMR_LOW_ON_MATCH(TIM_MATCH_CHANNEL_0);
+    // program timer to bring external match output low, reset, and
+    // generate interrupt
+    const uint32_t period =
+        this->testerInfo.ClockMeasurementFrequency / InterruptFrequency;
+    {
+        // Put timer in reset
+        timer->TCR = TIM_TCR_RESET;
+        timer->IR = TIM_IR_MASK;
 
-        LPC_TIM2->CCR = 0;
+        // On period signal, reset. The counter runs from 0 to period - 1,
+        // so TC is the time since the most recent falling edge.
+        timer->MCR = TIM_MCR_RESET_ON_MATCH(channel);
+        *(&timer->MR0 + channel) = period - 1;
 
-        if (!Command.u.StartPeriodicInterrupts.ComputeInterruptCount(
-                interruptCount)) {
+        // Bring the match output low on match, and ensure that it is
+        // initially high. The other match outputs of the timer may belong
+        // to another tester, so they are left alone.
+        timer->EMR = (timer->EMR & ~emrMask) |
+            (1U << channel) | TIM_EMR_LOW_ON_MATCH(channel);
 
-            DBGPRINT(
-                "Interrupt count overflow. "
-                "(DurationInSeconds=%d, InterruptFrequency=%lu)\n\r",
-                Command.u.StartPeriodicInterrupts.DurationInSeconds,
-                Command.u.StartPeriodicInterrupts.InterruptFrequency);
+        timer->CCR = 0;
 
-            interruptInfo.Status.s.ArithmeticOverflow = true;
+        if (interruptCount == 0) {
             return interruptInfo;
         }
-        this->remainingInterrupts = interruptCount;
 
-        // Start generating falling edges on the external match pin
-        MuxInterruptOutput();
-        NVIC_EnableIRQ(TIMER2_IRQn);
-        LPC_TIM2->TCR = TIM_TCR_ENABLE;
+        // TIM0 counts periods in lock-step with the interrupt timer, so
+        // that its counter holds the number of falling edges generated so
+        // far.
+        LPC_TIM0->TCR = TIM_TCR_RESET;
+        LPC_TIM0->IR = TIM_IR_MASK;
+        LPC_TIM0->PR = period - 1;
+        LPC_TIM0->MCR = 0;
+
+        if (interruptCount == 1) {
+            // The timer generates a single falling edge if it never resets
+            timer->MCR = 0;
+        } else {
+            // When the next-to-last falling edge has been generated, MAT0.1
+            // triggers a DMA transfer that clears timer->MCR. The timer stops
+            // resetting on match, so the last falling edge is generated
+            // without any further intervention from the CPU.
+            LPC_TIM0->MR1 = interruptCount - 1;
+            interruptStopMcr = 0;
+            LPC_SC->DMAREQSEL |= DMAREQSEL_TIMER_MATCH(GPDMA_CONN_MAT0_1);
+            GpdmaProgramChannel(
+                DMA_CHANNEL_SPI_INTERRUPT_STOP,
+                nullptr,
+                DmaAddress(&interruptStopMcr),
+                DmaAddress(&timer->MCR),
+                1,
+                GPDMA_CTRL_SWIDTH(GPDMA_WIDTH_WORD) |
+                GPDMA_CTRL_DWIDTH(GPDMA_WIDTH_WORD),
+                GPDMA_CFG_DEST_PERIPHERAL(GPDMA_CONN_MAT0_1) |
+                GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_M2P));
+        }
+
+        // Start generating falling edges on the external match pin. TIM0
+        // is started after the interrupt timer so that it increments just
+        // after each falling edge.
+        Traits::MuxInterruptOutput();
+        timer->TCR = TIM_TCR_ENABLE;
+        LPC_TIM0->TCR = TIM_TCR_ENABLE;
     }
 
     uint32_t alreadyAckedCount = 0;
     uint32_t ackedPastDeadlineCount = 0;
     uint32_t ackedBeforeDeadlineCount = 0;
-    uint32_t lastAckedInterruptCount = interruptCount;
+    uint32_t lastAckedInterruptCount = 0;
 
-    // Enable falling edge detection for SCK0 (P0.15)
-    EnableSckFallingEdgeDetection();
+    // Enable falling edge detection for SCK
+    EnableSckFallingEdgeDetection<Traits>();
 
     auto finally = Finally([&] {
-        DisableSckFallingEdgeDetection();
+        DisableSckFallingEdgeDetection<Traits>();
 
-        // Put timer in reset to disable interrupts
-        LPC_TIM2->TCR = TIM_TCR_RESET;
-        NVIC_DisableIRQ(TIMER2_IRQn);
+        // Put timers in reset to stop generating interrupts
+        timer->TCR = TIM_TCR_RESET;
+        LPC_TIM0->TCR = TIM_TCR_RESET;
+        GpdmaStopChannel(DMA_CHANNEL_SPI_INTERRUPT_STOP);
+        LPC_SC->DMAREQSEL &= ~DMAREQSEL_TIMER_MATCH(GPDMA_CONN_MAT0_1);
 
         // De-assert and demux the interrupt signal
-        LPC_TIM2->EMR = (1U << TIM_MATCH_CHANNEL_0);
-        DemuxInterruptOutput();
+        timer->EMR = (timer->EMR & ~emrMask) | (1U << channel);
+        Traits::DemuxInterruptOutput();
         ActLedOff();
     });
 
-    while (this->remainingInterrupts) {
+    while (GeneratedInterruptCount(interruptCount) != interruptCount) {
         // Clear receive FIFO and queue 8 dummy bytes to output FIFO
         static_assert(
             sizeof(CommandBlock) == 8,
             "Verifying that CommandBlock is the same size as the FIFO");
 
         for (int i = sizeof(CommandBlock); i; --i) {
-            LPC_SSP0->DR = 0;
-            this->dummy = LPC_SSP0->DR;
+            Traits::Ssp()->DR = 0;
+            this->dummy = Traits::Ssp()->DR;
         }
 
-        DBGPRINT(
-            "Waiting for SCK to assert. (Rx Fifo empty = %ld)\n\r",
-            LPC_SSP0->SR & SSP_SR_RNE);
-
         // wait for falling edge of SCK. While we're waiting, the timer match
         // will be reached, the interrupt signal will be asserted, and the
         // interrupt count will be incremented.
-        WaitForSckFallingEdge();
-        uint32_t capture = LPC_TIM2->TC;
+        WaitForSckFallingEdge<Traits>();
+        uint32_t capture = timer->TC;
+        const uint32_t acknowledgeStart = CycleCount();
+
+        // TIM0 increments just after each falling edge, so read it after
+        // the interrupt timer to ensure the count includes the edge that capture is
+        // relative to.
+        const uint32_t generatedCount = GeneratedInterruptCount(interruptCount);
+
+        // After the last falling edge the timer no longer resets, and counts up
+        // from the match value
+        if (capture >= period) {
+            capture -= period - 1;
+        }
 
         // deassert interrupt signal
-        LPC_TIM2->EMR |= (1U << TIM_MATCH_CHANNEL_0);
+        timer->EMR |= (1U << channel);
 
-        DisableIrq disableIrq;
+        SpiCriticalSection criticalSection;
 
         // capture and verify the first byte received. If it is not
         // AcknowledgeInterrupt, leave interrupt mode
         {
-            while (!(LPC_SSP0->SR & SSP_SR_RNE)) {
+            while (!(Traits::Ssp()->SR & SSP_SR_RNE)) {
                 if (!ChipSelectAsserted()) {
                     interruptInfo.Status.s.IncompleteReceive = true;
                     return interruptInfo;
                 }
             }
 
-            uint32_t commandByte = LPC_SSP0->DR;
+            uint32_t commandByte = Traits::Ssp()->DR;
             if (commandByte != SpiTesterCommand::AcknowledgeInterrupt) {
                 interruptInfo.Status.s.NotAcknowledged = true;
                 WaitForCsToDeassert();
@@ -512,8 +2088,7 @@ PeriodicInterruptInfo SpiTester::RunPeriodicInterrupts (
         // in response to the AcknowledgeInterrupt command
         AcknowledgeInterruptInfo ackInfo;
         {
-            int difference =
-                lastAckedInterruptCount - this->remainingInterrupts;
+            int difference = generatedCount - lastAckedInterruptCount;
 
             if (difference < 0) {
                 // this should never happen
@@ -535,7 +2110,7 @@ PeriodicInterruptInfo SpiTester::RunPeriodicInterrupts (
                 ackInfo.TimeSinceFallingEdge =
                     (difference - 1) * period + capture;
             }
-            lastAckedInterruptCount -= difference;
+            lastAckedInterruptCount += difference;
 
             // Use a very simple checksum so that we can meet the SPI transfer
             // deadline
@@ -548,7 +2123,7 @@ PeriodicInterruptInfo SpiTester::RunPeriodicInterrupts (
         for (const uint8_t* dataPtr = reinterpret_cast<const uint8_t*>(&ackInfo);
              dataPtr != endPtr;) {
 
-            uint32_t status = LPC_SSP0->SR;
+            uint32_t status = Traits::Ssp()->SR;
 
             if (status & SSP_SR_TFE) {
                 interruptInfo.Status.s.TransmitUnderrun = true;
@@ -557,7 +2132,7 @@ PeriodicInterruptInfo SpiTester::RunPeriodicInterrupts (
 
             // space available in TX FIFO?
             if (status & SSP_SR_TNF) {
-                LPC_SSP0->DR = *dataPtr;
+                Traits::Ssp()->DR = *dataPtr;
                 ++dataPtr;
             }
 
@@ -567,74 +2142,470 @@ PeriodicInterruptInfo SpiTester::RunPeriodicInterrupts (
             }
         }
 
+        ProfileRecord(
+            PROFILE_SPI_ACKNOWLEDGE,
+            CycleCount() - acknowledgeStart);
+
+        // update the histogram after the response has been sent so that it
+        // does not add to the acknowledge path
+        if (ackInfo.TimeSinceFallingEdge != INVALID_TIME_SINCE_FALLING_EDGE) {
+            RecordLatency(this->latencyHistogram, ackInfo.TimeSinceFallingEdge);
+        }
+        TelemetryLog(
+            TELEMETRY_SPI_INTERRUPT_ACKNOWLEDGED,
+            generatedCount,
+            ackInfo.TimeSinceFallingEdge);
+
         WaitForCsToDeassert();
     }
 
-    if (this->remainingInterrupts != 0) {
-        DBGPRINT("remainingInterrupts is not zero!");
-    }
 
     interruptInfo.InterruptCount = interruptCount;
     interruptInfo.AcknowledgedBeforeDeadlineCount = ackedBeforeDeadlineCount;
     interruptInfo.AcknowledgedAfterDeadlineCount = ackedPastDeadlineCount;
     interruptInfo.AlreadyAcknowledgedCount = alreadyAckedCount;
 
-    DBGPRINT(
-        "Leaving interrupt mode. "
-        "(negativeCountalreadyAckedCount=%lu, ackedPastDeadlineCount=%lu, "
-        "ackedBeforeDeadlineCount=%lu, interruptCount=%lu\n\r",
-        alreadyAckedCount,
-        ackedPastDeadlineCount,
-        ackedBeforeDeadlineCount,
-        interruptCount);
+    TelemetryLog(
+        TELEMETRY_SPI_INTERRUPTS_STOPPED,
+        interruptInfo.Status.AsUInt32,
+        interruptInfo.TotalAcknowledgeCount());
 
     return interruptInfo;
 }
 
-bool SpiTester::ReceiveCommand (CommandBlock& Command)
+//
+// Binary search for the highest interrupt frequency at which the master
+// keeps up. The first step runs at MaxFrequency, and each following step
+// runs halfway between the highest passing and lowest failing frequencies.
+//
+template <typename Traits>
+InterruptSweepInfo SpiTester<Traits>::RunInterruptSweep (const CommandBlock& Command)
+{
+    auto sweepInfo = InterruptSweepInfo();
+
+    const uint32_t stepDurationMillis =
+        Command.u.StartInterruptSweep.StepDurationMillis;
+    const uint32_t threshold = Command.u.StartInterruptSweep.ThresholdPerMille;
+
+    uint32_t passFrequency = 0;
+    uint32_t failFrequency = std::min(
+        Command.u.StartInterruptSweep.MaxFrequency,
+        uint32_t(MAX_INTERRUPT_FREQUENCY));
+    uint32_t frequency = failFrequency;
+
+    TelemetryLog(TELEMETRY_SPI_SWEEP_STARTED, frequency, stepDurationMillis);
+
+    while ((sweepInfo.StepCount < INTERRUPT_SWEEP_MAX_STEPS) &&
+           (frequency > passFrequency)) {
+
+        const uint32_t interruptCount = uint32_t(
+            uint64_t(frequency) * stepDurationMillis / 1000);
+        if (interruptCount == 0) {
+            sweepInfo.Status.s.ArithmeticOverflow = true;
+            break;
+        }
+
+        const PeriodicInterruptInfo stepInfo =
+            RunPeriodicInterrupts(frequency, interruptCount);
+        sweepInfo.Status.AsUInt32 |= stepInfo.Status.AsUInt32;
+        this->interruptInfo = stepInfo;
+
+        // interrupts that were dropped or acknowledged after the deadline
+        const uint32_t missedCount =
+            stepInfo.InterruptCount - stepInfo.AcknowledgedBeforeDeadlineCount;
+        const bool passed =
+            (uint64_t(missedCount) * 1000) <=
+            (uint64_t(threshold) * stepInfo.InterruptCount);
+
+        InterruptSweepStep& step = sweepInfo.Steps[sweepInfo.StepCount++];
+        step.InterruptFrequency = frequency;
+        step.InterruptCount = stepInfo.InterruptCount;
+        step.AcknowledgedBeforeDeadlineCount =
+            stepInfo.AcknowledgedBeforeDeadlineCount;
+        step.AcknowledgedAfterDeadlineCount =
+            stepInfo.AcknowledgedAfterDeadlineCount;
+        step.Passed = passed;
+
+        // the master stopped acknowledging interrupts
+        if (stepInfo.Status.s.NotAcknowledged ||
+            stepInfo.Status.s.IncompleteReceive) {
+
+            break;
+        }
+
+        if (passed) {
+            passFrequency = frequency;
+        } else {
+            failFrequency = frequency;
+        }
+
+        if ((failFrequency - passFrequency) <=
+            (failFrequency / INTERRUPT_SWEEP_RESOLUTION)) {
+
+            break;
+        }
+
+        frequency = passFrequency + (failFrequency - passFrequency) / 2;
+    }
+
+    sweepInfo.SaturationFrequency = passFrequency;
+
+    TelemetryLog(
+        TELEMETRY_SPI_SWEEP_STOPPED,
+        sweepInfo.SaturationFrequency,
+        sweepInfo.StepCount);
+
+    return sweepInfo;
+}
+
+template <typename Traits>
+bool SpiTester<Traits>::ReceiveCommand (CommandBlock& Command)
 {
     // is there any data waiting for us?
-    if (!(LPC_SSP0->SR & SSP_SR_RNE)) return false;
+    if (!(Traits::Ssp()->SR & SSP_SR_RNE)) return false;
 
     // receive a command block
-    for (size_t i = 0; i < sizeof(Command); ) {
+    if (!ReceiveBytes(reinterpret_cast<uint8_t*>(&Command), sizeof(Command))) {
+        return false;
+    }
+
+    // the command blocks of a batch follow in the same transfer
+    if (Command.Command == SpiTesterCommand::ExecuteBatch) {
+        const uint32_t count = std::min<uint32_t>(
+            Command.u.ExecuteBatch.CommandCount,
+            BATCH_MAX_COMMANDS);
+
+        if (!ReceiveBytes(
+                reinterpret_cast<uint8_t*>(batchCommands),
+                count * sizeof(CommandBlock))) {
+
+            return false;
+        }
+    }
+
+    // the elements of an uploaded pattern follow in the same transfer
+    if ((Command.Command == SpiTesterCommand::LoadPattern) &&
+        (Command.u.LoadPattern.Pattern == CapturePattern::User)) {
+
+        const uint32_t offset = std::min<uint32_t>(
+            Command.u.LoadPattern.ElementOffset,
+            PATTERN_TABLE_LENGTH);
+        const uint32_t count = std::min<uint32_t>(
+            Command.u.LoadPattern.ElementCount,
+            PATTERN_TABLE_LENGTH - offset);
+
+        if (!ReceiveBytes(
+                reinterpret_cast<uint8_t*>(patternTable + offset),
+                count * sizeof(uint16_t))) {
+
+            return false;
+        }
+    }
+
+    WaitForCsToDeassert();
+    return true;
+}
+
+template <typename Traits>
+bool SpiTester<Traits>::ReceiveBytes (uint8_t* Buffer, uint32_t Length)
+{
+    for (uint32_t i = 0; i < Length; ) {
         // byte received?
-        if (LPC_SSP0->SR & SSP_SR_RNE) {
-            uint32_t data = LPC_SSP0->DR;
-            reinterpret_cast<uint8_t*>(&Command)[i] = uint8_t(data);
+        if (Traits::Ssp()->SR & SSP_SR_RNE) {
+            uint32_t data = Traits::Ssp()->DR;
+            Buffer[i] = uint8_t(data);
             ++i;
         } else if (!ChipSelectAsserted()) {
             return false;
         }
     }
 
-    WaitForCsToDeassert();
     return true;
 }
 
-void SpiTester::RunStateMachine ()
+//
+// Returns the response to a command that only returns data, or nullptr if
+// the command is not a query. Results are prepared when they are produced,
+// so most queries do not need to compute a checksum.
+//
+template <typename Traits>
+TransferHeader* SpiTester<Traits>::QueryResponse (const CommandBlock& Command)
 {
-    CommandBlock command;
-    if (ReceiveCommand(command)) {
-        switch (command.Command) {
-        case SpiTesterCommand::GetDeviceInfo:
-            SspSendWithChecksum(this->testerInfo);
+    switch (Command.Command) {
+    case SpiTesterCommand::GetDeviceInfo:
+    {
+        // The tester info only changes with the requested capture engine,
+        // so its checksum is recomputed only when MaxFrequency changes.
+        const uint32_t maxFrequency = MaxFrequency(
+            CaptureMode(Command.u.GetDeviceInfo.CaptureMode),
+            Command.u.GetDeviceInfo.DataBitLength);
+
+        if (Command.u.GetDeviceInfo.InfoVersion >= DEVICE_INFO_VERSION) {
+            if (maxFrequency != this->testerInfo2.MaxFrequency) {
+                this->testerInfo2.MaxFrequency = maxFrequency;
+                PrepareResponse(this->testerInfo2);
+            }
+            return &this->testerInfo2;
+        }
+
+        if (maxFrequency != this->testerInfo.MaxFrequency) {
+            this->testerInfo.MaxFrequency = maxFrequency;
+            PrepareResponse(this->testerInfo);
+        }
+        return &this->testerInfo;
+    }
+    case SpiTesterCommand::GetTransferInfo:
+        if (Command.u.GetTransferInfo.InfoVersion >= TRANSFER_INFO_VERSION) {
+            return &this->transferInfo2;
+        }
+        return &this->transferInfo;
+    case SpiTesterCommand::GetPeriodicInterruptInfo:
+        return &this->interruptInfo;
+    case SpiTesterCommand::GetInterruptSweepInfo:
+        return &this->sweepInfo;
+    case SpiTesterCommand::GetInterruptLatencyHistogram:
+        return &this->latencyHistogram;
+    case SpiTesterCommand::GetCapturedData:
+        this->capturedData = GetCapturedData(Command);
+        return PrepareResponse(this->capturedData);
+    case SpiTesterCommand::GetEdgeTraceInfo:
+        return &this->edgeTraceInfo;
+    case SpiTesterCommand::GetProfilingInfo:
+        this->profilingInfo = ReadProfilingInfo(Command);
+        return PrepareResponse(this->profilingInfo);
+    case SpiTesterCommand::GetStreamingInfo:
+        return &this->streamingInfo;
+    default:
+        return nullptr;
+    }
+}
+
+//
+// Selects the sequence used by subsequent captures. The elements of a User
+// pattern have already been received into the table by ReceiveCommand.
+// Returns false if the pattern is invalid.
+//
+template <typename Traits>
+bool SpiTester<Traits>::LoadPattern (const CommandBlock& Command)
+{
+    const uint32_t dataBitLength = EffectiveDataBitLength(
+        Command.u.LoadPattern.DataBitLength);
+
+    switch (Command.u.LoadPattern.Pattern) {
+    case CapturePattern::Counter:
+        patternLength = 0;
+        return true;
+    case CapturePattern::Prbs7:
+        patternLength = GeneratePrbs(patternTable, 7, 6, dataBitLength);
+        return true;
+    case CapturePattern::Prbs15:
+        patternLength = GeneratePrbs(patternTable, 15, 14, dataBitLength);
+        return true;
+    case CapturePattern::WalkingOnes:
+        for (uint32_t i = 0; i != dataBitLength; ++i) {
+            patternTable[i] = uint16_t(1U << i);
+        }
+        patternLength = dataBitLength;
+        return true;
+    case CapturePattern::User:
+        patternLength = std::min<uint32_t>(
+            Command.u.LoadPattern.ElementOffset +
+                Command.u.LoadPattern.ElementCount,
+            PATTERN_TABLE_LENGTH);
+        return true;
+    default:
+        return false;
+    }
+}
+
+//
+// Runs a command that takes control of the bus for the following transfers.
+// Returns false if the command is invalid.
+//
+template <typename Traits>
+bool SpiTester<Traits>::RunModalCommand (const CommandBlock& Command)
+{
+    // whatever the command queued and the master did not clock out would
+    // otherwise be sent ahead of the next response
+    auto flushTxFifo = Finally([] { FlushTxFifo(); });
+
+    switch (Command.Command) {
+    case SpiTesterCommand::CaptureNextTransfer:
+        switch (Command.u.CaptureNextTransfer.CaptureMode) {
+        case CaptureMode::Dma:
+            this->transferInfo2 = CaptureTransferDma(Command);
             break;
-        case SpiTesterCommand::CaptureNextTransfer:
-            this->transferInfo = CaptureTransfer(command);
+        case CaptureMode::Record:
+            this->transferInfo2 = CaptureTransferRecord(Command);
             break;
-        case SpiTesterCommand::GetTransferInfo:
-            SspSendWithChecksum(this->transferInfo);
+        case CaptureMode::EdgeTrace:
+            this->transferInfo2 = CaptureTransferEdgeTrace(Command);
+            PrepareResponse(this->edgeTraceInfo);
             break;
-        case SpiTesterCommand::StartPeriodicInterrupts:
-            this->interruptInfo = RunPeriodicInterrupts(command);
+        case CaptureMode::Polled:
+        default:
+            this->transferInfo2 = CaptureTransfer(Command);
             break;
-        case SpiTesterCommand::GetPeriodicInterruptInfo:
-            SspSendWithChecksum(this->interruptInfo);
+        }
+
+        TelemetryLog(
+            TELEMETRY_SPI_CAPTURE_COMPLETE,
+            this->transferInfo2.ElementCount,
+            this->transferInfo2.MismatchIndex);
+
+        // the original TransferInfo is the start of TransferInfo2
+        this->transferInfo2.InfoVersion = TRANSFER_INFO_VERSION;
+        this->transferInfo = this->transferInfo2;
+        PrepareResponse(this->transferInfo);
+        PrepareResponse(this->transferInfo2);
+        return true;
+    case SpiTesterCommand::StartPeriodicInterrupts:
+        this->interruptInfo = RunPeriodicInterrupts(Command);
+        break;
+    case SpiTesterCommand::StartInterruptSweep:
+        this->sweepInfo = RunInterruptSweep(Command);
+        break;
+    case SpiTesterCommand::LoadPattern:
+        return LoadPattern(Command);
+    case SpiTesterCommand::SetCaptureTimeout:
+        captureTimeoutMillis = Command.u.SetCaptureTimeout.TimeoutMillis;
+        return true;
+    case SpiTesterCommand::StartStreaming:
+        this->streamingInfo = RunStreamingSession(Command);
+        PrepareResponse(this->streamingInfo);
+        return true;
+    default:
+        return false;
+    }
+
+    // Both interrupt commands update all of the interrupt results
+    PrepareResponse(this->interruptInfo);
+    PrepareResponse(this->latencyHistogram);
+    PrepareResponse(this->sweepInfo);
+    return true;
+}
+
+//
+// Runs the commands of a batch. The responses of the queries are sent back
+// to back in a single transfer. A command that is not a query ends the
+// batch, and runs after the responses have been sent. It stays in
+// batchCommands until then, because the next command is not received
+// before the send finishes.
+//
+template <typename Traits>
+void SpiTester<Traits>::RunBatch (const CommandBlock& Command)
+{
+    const uint32_t count = std::min<uint32_t>(
+        Command.u.ExecuteBatch.CommandCount,
+        BATCH_MAX_COMMANDS);
+
+    uint32_t length = 0;
+    const CommandBlock* modalCommand = nullptr;
+    for (uint32_t i = 0; i != count; ++i) {
+        TransferHeader* const response = QueryResponse(batchCommands[i]);
+        if (response == nullptr) {
+            modalCommand = &batchCommands[i];
             break;
-        default:
-            // invalid command
+        }
+
+        // responses that do not fit end the batch
+        if ((length + response->Header.Length) > sizeof(responseBuffer)) {
             break;
         }
+
+        memcpy(responseBuffer + length, response, response->Header.Length);
+        length += response->Header.Length;
+    }
+
+    if (length != 0) {
+        SspSendBytes(responseBuffer, length);
+    }
+
+    if (modalCommand == nullptr) return;
+
+    if (sendPending) {
+        deferredCommand = modalCommand;
+    } else {
+        RunBatchModalCommand(*modalCommand);
+    }
+}
+
+//
+// Runs the command that ended a batch. Only the command blocks of a batch
+// are received, so a command that carries a payload is rejected rather
+// than run without it.
+//
+template <typename Traits>
+void SpiTester<Traits>::RunBatchModalCommand (const CommandBlock& Command)
+{
+    if ((Command.Command == SpiTesterCommand::LoadPattern) &&
+        (Command.u.LoadPattern.Pattern == CapturePattern::User)) {
+
+        TelemetryLog(TELEMETRY_SPI_INVALID_COMMAND, Command.Command);
+        return;
+    }
+
+    if (!RunModalCommand(Command)) {
+        TelemetryLog(TELEMETRY_SPI_INVALID_COMMAND, Command.Command);
     }
-}
\ No newline at end of file
+}
+
+template <typename Traits>
+void SpiTester<Traits>::RunStateMachine ()
+{
+    // the data of a response transfer is not a command
+    if (sendPending) {
+        FinishSend();
+        return;
+    }
+
+    CommandBlock command;
+    if (ReceiveCommand(command)) {
+        uint32_t parameters;
+        memcpy(&parameters, command.u.RawBytes, sizeof(parameters));
+        TelemetryLog(TELEMETRY_SPI_COMMAND, command.Command, parameters);
+
+        if (command.Command == SpiTesterCommand::ExecuteBatch) {
+            RunBatch(command);
+        } else if (TransferHeader* response = QueryResponse(command)) {
+            SspSendImpl(*response);
+        } else if (!RunModalCommand(command)) {
+            TelemetryLog(TELEMETRY_SPI_INVALID_COMMAND, command.Command);
+        }
+    }
+}
+
+template <typename Traits>
+void SpiTester<Traits>::SspInterrupt ()
+{
+    // the work item services the SSP until it re-enables the interrupt
+    Traits::Ssp()->IMSC = 0;
+    SchedulerPost(Traits::SCHEDULER_WORK_ITEM);
+}
+
+template <typename Traits>
+void SpiTester<Traits>::RunWorkItem (void* Context)
+{
+    static_cast<SpiTester*>(Context)->RunStateMachine();
+    EnableCommandInterrupt();
+}
+
+extern "C" void SSP0_IRQHandler ()
+{
+    Spi0Tester::SspInterrupt();
+}
+
+#if SPI_TESTER_SSP1
+extern "C" void SSP1_IRQHandler ()
+{
+    Spi1Tester::SspInterrupt();
+}
+#endif // SPI_TESTER_SSP1
+
+//
+// Instantiate the testers that main() runs
+//
+template class Lldt::Spi::SpiTester<Lldt::Spi::Ssp0Traits>;
+#if SPI_TESTER_SSP1
+template class Lldt::Spi::SpiTester<Lldt::Spi::Ssp1Traits>;
+#endif // SPI_TESTER_SSP1
@@ -7,6 +7,182 @@
 namespace Lldt {
 namespace Spi {
 
+//
+// The peripherals and pins used by a SpiTester instance. The SSP's chip
+// select and clock pins must be on port 0 so that the tester can poll
+// chip select and detect clock edges through GPIO. The capture input must
+// be connected to SCK by a jumper, and the second capture input to chip
+// select. The capture timer's match 0 and match 1 DMA requests are used to
+// trace SCK edges.
+//
+// Each tester has its own capture timer. The only match outputs on the
+// mbed's pins that SSP1 does not use belong to TIMER3, so when both testers
+// are built their interrupt outputs are on TIMER3, and each tester has its
+// own match channel. TIM0 is shared by both testers to count interrupts.
+// The commands that use the shared timers run to completion in a work item,
+// so they never overlap.
+//
+// CAPTURE_BUFFER_SIZE is the size of the tester's capture buffers, which
+// must fit in AHB SRAM alongside those of the other tester.
+//
+struct Ssp0Traits {
+    static LPC_SSP_TypeDef* Ssp () { return LPC_SSP0; }
+
+    static const CLKPWR_PCONP SSP_POWER = CLKPWR_PCONP_PCSSP0;
+    static const CLKPWR_PCLKSEL SSP_PCLK = CLKPWR_PCLKSEL_SSP0;
+    static const GPDMA_CONN DMA_CONN_RX = GPDMA_CONN_SSP0_RX;
+    static const GPDMA_CONN DMA_CONN_TX = GPDMA_CONN_SSP0_TX;
+    static const DMA_CHANNEL DMA_CHANNEL_RX = DMA_CHANNEL_SPI_RX;
+    static const DMA_CHANNEL DMA_CHANNEL_TX = DMA_CHANNEL_SPI_TX;
+    static const IRQn_Type SSP_IRQ = SSP0_IRQn;
+    static const WORK_ITEM SCHEDULER_WORK_ITEM = WORK_ITEM_SPI0;
+
+    enum : uint32_t {
+        SCK_PIN = 15,
+        CS_PIN = 16,
+        CAPTURE_BUFFER_SIZE = Lldt::Spi::CAPTURE_BUFFER_SIZE,
+    };
+
+    static void MuxSspPins ()
+    {
+        // SCK0 (P0.15)
+        LPC_PINCON->PINSEL0 =
+            (LPC_PINCON->PINSEL0 & ~(0x3 << 30)) | (0x2 << 30);
+
+        // SSEL0 (P0.16), MISO0 (P0.17), MOSI (P0.18)
+        uint32_t temp =
+            (LPC_PINCON->PINSEL1 & ~((0x3 << 2) | (0x3 << 4) | (0x3 << 0)));
+        temp |= (0x2 << 2) | (0x2 << 4) | (0x2 << 0);
+        LPC_PINCON->PINSEL1 = temp;
+    }
+
+    static LPC_TIM_TypeDef* CaptureTimer () { return LPC_TIM2; }
+
+    static const CLKPWR_PCONP CAPTURE_TIMER_POWER = CLKPWR_PCONP_PCTIM2;
+    static const CLKPWR_PCLKSEL CAPTURE_TIMER_PCLK = CLKPWR_PCLKSEL_TIMER2;
+    static const GPDMA_CONN DMA_CONN_TRACE_LEADING = GPDMA_CONN_MAT2_0;
+    static const GPDMA_CONN DMA_CONN_TRACE_TRAILING = GPDMA_CONN_MAT2_1;
+
+    static void MuxCaptureInput ()
+    {
+        // P0.4 - CAP2.0 - I - Capture input for Timer 2, channel 0.
+        // P0.5 - CAP2.1 - I - Capture input for Timer 2, channel 1.
+        LPC_PINCON->PINSEL0 |= (0x3 << 8) | (0x3 << 10);
+    }
+
+#if SPI_TESTER_SSP1
+    //
+    // P0.6 is SSEL1, so the interrupt output moves to MAT3.1 (P0.11)
+    //
+    static LPC_TIM_TypeDef* InterruptTimer () { return LPC_TIM3; }
+
+    static const CLKPWR_PCONP INTERRUPT_TIMER_POWER = CLKPWR_PCONP_PCTIM3;
+    static const CLKPWR_PCLKSEL INTERRUPT_TIMER_PCLK = CLKPWR_PCLKSEL_TIMER3;
+    static const TIM_MATCH_CHANNEL INTERRUPT_MATCH_CHANNEL =
+        TIM_MATCH_CHANNEL_1;
+
+    static void MuxInterruptOutput ()
+    {
+        // P0.11 - MAT3.1 - O - Match output for Timer 3, channel 1.
+        LPC_PINCON->PINSEL0 |= 0x3 << 22;
+    }
+
+    static void DemuxInterruptOutput ()
+    {
+        // P0.11 - I/O - General purpose digital input/output pin.
+        LPC_PINCON->PINSEL0 &= ~(0x3 << 22);
+    }
+#else // SPI_TESTER_SSP1
+    static LPC_TIM_TypeDef* InterruptTimer () { return LPC_TIM2; }
+
+    static const CLKPWR_PCONP INTERRUPT_TIMER_POWER = CLKPWR_PCONP_PCTIM2;
+    static const CLKPWR_PCLKSEL INTERRUPT_TIMER_PCLK = CLKPWR_PCLKSEL_TIMER2;
+    static const TIM_MATCH_CHANNEL INTERRUPT_MATCH_CHANNEL =
+        TIM_MATCH_CHANNEL_0;
+
+    static void MuxInterruptOutput ()
+    {
+        // P0.6 - MAT2.0 - O - Match output for Timer 2, channel 0.
+        LPC_PINCON->PINSEL0 |= 0x3 << 12;
+    }
+
+    static void DemuxInterruptOutput ()
+    {
+        // P0.6 - I/O - General purpose digital input/output pin.
+        LPC_PINCON->PINSEL0 &= ~(0x3 << 12);
+    }
+#endif // SPI_TESTER_SSP1
+};
+
+#if SPI_TESTER_SSP1
+struct Ssp1Traits {
+    static LPC_SSP_TypeDef* Ssp () { return LPC_SSP1; }
+
+    static const CLKPWR_PCONP SSP_POWER = CLKPWR_PCONP_PCSSP1;
+    static const CLKPWR_PCLKSEL SSP_PCLK = CLKPWR_PCLKSEL_SSP1;
+    static const GPDMA_CONN DMA_CONN_RX = GPDMA_CONN_SSP1_RX;
+    static const GPDMA_CONN DMA_CONN_TX = GPDMA_CONN_SSP1_TX;
+    static const DMA_CHANNEL DMA_CHANNEL_RX = DMA_CHANNEL_SPI1_RX;
+    static const DMA_CHANNEL DMA_CHANNEL_TX = DMA_CHANNEL_SPI1_TX;
+    static const IRQn_Type SSP_IRQ = SSP1_IRQn;
+    static const WORK_ITEM SCHEDULER_WORK_ITEM = WORK_ITEM_SPI1;
+
+    //
+    // The buffers of the tester on SSP0 fill AHBSRAM0, so this tester's
+    // share AHBSRAM1 with the I2C tester's large EEPROM
+    //
+    enum : uint32_t {
+        SCK_PIN = 7,
+        CS_PIN = 6,
+        CAPTURE_BUFFER_SIZE = Lldt::Spi::CAPTURE_BUFFER_SIZE / 4,
+    };
+
+    static void MuxSspPins ()
+    {
+        // SSEL1 (P0.6), SCK1 (P0.7), MISO1 (P0.8), MOSI1 (P0.9)
+        uint32_t temp =
+            (LPC_PINCON->PINSEL0 &
+             ~((0x3 << 12) | (0x3 << 14) | (0x3 << 16) | (0x3 << 18)));
+        temp |= (0x2 << 12) | (0x2 << 14) | (0x2 << 16) | (0x2 << 18);
+        LPC_PINCON->PINSEL0 = temp;
+    }
+
+    static LPC_TIM_TypeDef* CaptureTimer () { return LPC_TIM3; }
+
+    static const CLKPWR_PCONP CAPTURE_TIMER_POWER = CLKPWR_PCONP_PCTIM3;
+    static const CLKPWR_PCLKSEL CAPTURE_TIMER_PCLK = CLKPWR_PCLKSEL_TIMER3;
+    static const GPDMA_CONN DMA_CONN_TRACE_LEADING = GPDMA_CONN_MAT3_0;
+    static const GPDMA_CONN DMA_CONN_TRACE_TRAILING = GPDMA_CONN_MAT3_1;
+
+    static void MuxCaptureInput ()
+    {
+        // P0.23 - CAP3.0 - I - Capture input for Timer 3, channel 0.
+        // P0.24 - CAP3.1 - I - Capture input for Timer 3, channel 1.
+        LPC_PINCON->PINSEL1 |= (0x3 << 14) | (0x3 << 16);
+    }
+
+    static LPC_TIM_TypeDef* InterruptTimer () { return LPC_TIM3; }
+
+    static const CLKPWR_PCONP INTERRUPT_TIMER_POWER = CLKPWR_PCONP_PCTIM3;
+    static const CLKPWR_PCLKSEL INTERRUPT_TIMER_PCLK = CLKPWR_PCLKSEL_TIMER3;
+    static const TIM_MATCH_CHANNEL INTERRUPT_MATCH_CHANNEL =
+        TIM_MATCH_CHANNEL_0;
+
+    static void MuxInterruptOutput ()
+    {
+        // P0.10 - MAT3.0 - O - Match output for Timer 3, channel 0.
+        LPC_PINCON->PINSEL0 |= 0x3 << 20;
+    }
+
+    static void DemuxInterruptOutput ()
+    {
+        // P0.10 - I/O - General purpose digital input/output pin.
+        LPC_PINCON->PINSEL0 &= ~(0x3 << 20);
+    }
+};
+#endif // SPI_TESTER_SSP1
+
+template <typename Traits>
 class SpiTester
 {
     enum { MIN_DATA_BIT_LENGTH = 4, MAX_DATA_BIT_LENGTH = 16 };
@@ -17,52 +193,286 @@ public:
 
     void RunStateMachine ( );
 
+    //
+    // Called from the SSP interrupt when a command starts to arrive. Posts
+    // the tester's work item, which runs RunStateMachine.
+    //
+    static void SspInterrupt ( );
+
 private:
 
+    static void RunWorkItem (void* Context);
+
+    //
+    // Interrupt when a command starts to arrive: when the receive FIFO is
+    // half full, or holds data that has not been read for 32 bit periods
+    //
+    static void EnableCommandInterrupt ()
+    {
+        Traits::Ssp()->ICR = SSP_ICR_RT;
+        Traits::Ssp()->IMSC = SSP_IMSC_RX | SSP_IMSC_RT;
+    }
+
     static void SspInit ();
 
+    //
+    // Returns the frame width that SspSetDataMode programs for DataBitLength
+    //
+    static uint32_t EffectiveDataBitLength (uint32_t DataBitLength)
+    {
+        if ((DataBitLength < MIN_DATA_BIT_LENGTH) ||
+            (DataBitLength > MAX_DATA_BIT_LENGTH)) {
+
+            return 8;
+        }
+
+        return DataBitLength;
+    }
+
     static void SspSetDataMode (SpiDataMode Mode, uint32_t DataBitLength);
 
-    static void SspSendImpl (TransferHeader& Data);
+    //
+    // Discards anything left in the transmit FIFO, such as elements a
+    // capture queued that the master did not clock out, by disabling and
+    // re-enabling the SSP. Must be called while chip select is deasserted.
+    //
+    static void FlushTxFifo ()
+    {
+        const uint32_t cr1 = Traits::Ssp()->CR1;
+        Traits::Ssp()->CR1 = cr1 & ~SSP_CR1_SSP_EN;
+        Traits::Ssp()->CR1 = cr1;
+    }
+
+    //
+    // Fills the transmit FIFO from Sequence until it is full. The engines
+    // all prime the FIFO this way, so they do not depend on how many
+    // elements it already holds.
+    //
+    template <typename Sequence>
+    static void PrimeTxFifo (Sequence& Tx, uint32_t DataMask)
+    {
+        while (Traits::Ssp()->SR & SSP_SR_TNF) {
+            Traits::Ssp()->DR = Tx.Next() & DataMask;
+        }
+    }
+
+    static void SetChecksum (TransferHeader& Data);
 
+    static void SspSendImpl (const TransferHeader& Data);
+
+    static void SspSendBytes (const uint8_t* Data, uint32_t Length);
+
+    void FinishSend ();
+
+    //
+    // Sets the length and checksum of a response. Must be called whenever
+    // the contents of the response change.
+    //
     template <typename Ty>
-    static void SspSendWithChecksum (Ty& Data)
+    static TransferHeader* PrepareResponse (Ty& Data)
     {
         static_assert(
             __is_base_of(TransferHeader, Ty),
             "Invalid cast: Ty does not derive from TransferHeader");
+        static_assert(
+            sizeof(Ty) <= BATCH_RESPONSE_BUFFER_SIZE,
+            "Response does not fit in the response buffer");
 
         Data.Header.Length = sizeof(Data);
-        SspSendImpl(Data);
+        SetChecksum(Data);
+        return &Data;
     }
 
     static bool ChipSelectAsserted ()
     {
-        return (LPC_GPIO0->FIOPIN & (1 << 16)) == 0;
+        return (LPC_GPIO0->FIOPIN & (1 << Traits::CS_PIN)) == 0;
     }
 
     static void WaitForCsToDeassert ();
 
+    static uint64_t CaptureDeadline ();
+
+    static bool WaitForChipSelect ();
+
     static void TimerInit ();
 
     static bool ReceiveCommand (CommandBlock& Command);
 
+    static bool ReceiveBytes (uint8_t* Buffer, uint32_t Length);
+
+    TransferHeader* QueryResponse (const CommandBlock& Command);
+
+    static bool LoadPattern (const CommandBlock& Command);
+
+    bool RunModalCommand (const CommandBlock& Command);
+
+    void RunBatch (const CommandBlock& Command);
+
+    void RunBatchModalCommand (const CommandBlock& Command);
+
     static Lldt::Spi::ClockMeasurementStatus WaitForCapture (uint32_t* Capture);
 
-    static Lldt::Spi::TransferInfo CaptureTransfer (const CommandBlock& Command);
+    struct PolledCaptureState {
+        uint32_t RxValue;
+        uint32_t TxValue;
+        uint32_t DataMask;
+        uint32_t Capture;
+        uint32_t ChipSelectAssert;
+        uint32_t Checksum;
+        uint32_t ElementCount;
+        uint32_t MismatchIndex;
+        Lldt::Spi::ClockMeasurementStatus ClockActiveTimeStatus;
+    };
+
+    static void TimeOutCapture (PolledCaptureState& State);
+
+    typedef void (*PolledCaptureLoop) (PolledCaptureState& State);
+
+    template <uint32_t DataBitLength, typename Sequence>
+    static void CapturePolledLoop (PolledCaptureState& State);
+
+    template <typename Sequence>
+    static PolledCaptureLoop SelectPolledCaptureLoop (uint32_t DataBitLength);
+
+    static void RunPolledCaptureLoop (
+        uint32_t DataBitLength,
+        PolledCaptureState& State
+        );
+
+    static void MeasureChipSelectTiming (
+        Lldt::Spi::TransferInfo2& Info,
+        uint32_t TimerStartCycle,
+        uint32_t ChipSelectAssert,
+        uint32_t ChipSelectDeassert,
+        uint32_t FirstEdge
+        );
+
+    static Lldt::Spi::TransferInfo2 CaptureTransfer (const CommandBlock& Command);
+
+    template <typename Ty, typename Sequence>
+    static void CaptureRecordLoop (PolledCaptureState& State);
+
+    static Lldt::Spi::TransferInfo2 CaptureTransferRecord (
+        const CommandBlock& Command
+        );
+
+    static Lldt::Spi::CapturedData GetCapturedData (const CommandBlock& Command);
+
+    static Lldt::Spi::ClockMeasurementStatus WaitForCaptureDma (
+        uint32_t* Capture
+        );
+
+    static Lldt::Spi::TransferInfo2 CaptureTransferDma (
+        const CommandBlock& Command
+        );
+
+    Lldt::Spi::TransferInfo2 CaptureTransferEdgeTrace (
+        const CommandBlock& Command
+        );
 
     static uint32_t dummy;
 
+    //
+    // ElapsedCycles() when chip select was last seen deasserting
+    //
+    static uint32_t chipSelectDeassertCycle;
+
+    //
+    // Set while a response is queued for the master to clock out. The work
+    // item that the SSP interrupt of that transfer posts finishes the send,
+    // and then runs deferredCommand, the command that ended a batch, if
+    // there is one.
+    //
+    static bool sendPending;
+    static uint32_t sendLength;
+    static const CommandBlock* deferredCommand;
+
+    enum : uint32_t {
+        EDGE_TRACE_MAX_CYCLES = Traits::CAPTURE_BUFFER_SIZE / sizeof(uint32_t),
+
+        // LLIs that describe the elements of a Dma capture after the first
+        // GPDMA_MAX_TRANSFER_SIZE. There is at least one, so that the
+        // arrays are not empty.
+        DMA_CAPTURE_LLI_COUNT =
+            (uint32_t(Traits::CAPTURE_BUFFER_SIZE) > GPDMA_MAX_TRANSFER_SIZE) ?
+            ((Traits::CAPTURE_BUFFER_SIZE - 1) / GPDMA_MAX_TRANSFER_SIZE) : 1,
+    };
+
+    //
+    // Buffers used by the Dma, Record and EdgeTrace capture engines, and
+    // the staging buffer of the responses. The GPDMA can only reach AHB
+    // SRAM, so each tester's definitions place them there.
+    //
+    static uint8_t captureRxBuffer[Traits::CAPTURE_BUFFER_SIZE];
+    static uint8_t captureTxBuffer[Traits::CAPTURE_BUFFER_SIZE];
+    static GPDMA_LLI captureRxLli[DMA_CAPTURE_LLI_COUNT];
+    static GPDMA_LLI captureTxLli[DMA_CAPTURE_LLI_COUNT];
+    static uint8_t responseBuffer[BATCH_RESPONSE_BUFFER_SIZE];
+
+    //
+    // Describes the contents of captureRxBuffer for GetCapturedData. The
+    // buffer holds data after a Dma or Record capture, and is empty after
+    // a Polled capture. After an EdgeTrace capture, the timestamps of the
+    // leading edges are in captureRxBuffer and those of the trailing edges
+    // are in captureTxBuffer.
+    //
+    static uint32_t capturedElementCount;
+    static uint32_t capturedElementSize;
+    static uint32_t edgeTraceTrailingCount;
+
+    //
+    // Command blocks received with an ExecuteBatch command
+    //
+    static CommandBlock batchCommands[BATCH_MAX_COMMANDS];
+
+    //
+    // The elements loaded by LoadPattern. A length of 0 selects the
+    // incrementing counter.
+    //
+    static uint16_t patternTable[PATTERN_TABLE_LENGTH];
+    static uint32_t patternLength;
+
+    //
+    // Set by SetCaptureTimeout. A capture gives up if chip select does not
+    // assert within this many milliseconds. 0 waits forever.
+    //
+    static uint32_t captureTimeoutMillis;
+
     PeriodicInterruptInfo RunPeriodicInterrupts (const CommandBlock& Command);
 
+    PeriodicInterruptInfo RunPeriodicInterrupts (
+        uint32_t InterruptFrequency,
+        uint32_t InterruptCount
+        );
+
+    InterruptSweepInfo RunInterruptSweep (const CommandBlock& Command);
+
+    StreamingInfo RunStreamingSession (const CommandBlock& Command);
+
+    CaptureEngineLimits EngineLimits (CaptureMode Mode) const;
+    uint32_t MaxFrequency (CaptureMode Mode, uint32_t DataBitLength) const;
+
+    uint32_t maxPolledElementRate;
+    uint32_t maxDmaFrequency;
     TesterInfo testerInfo;
+    TesterInfo2 testerInfo2;
     TransferInfo transferInfo;
+    TransferInfo2 transferInfo2;
     PeriodicInterruptInfo interruptInfo;
+    InterruptLatencyHistogram latencyHistogram;
+    InterruptSweepInfo sweepInfo;
+    CapturedData capturedData;
+    EdgeTraceInfo edgeTraceInfo;
+    ProfilingInfo profilingInfo;
+    StreamingInfo streamingInfo;
 
-public:
-    static volatile uint32_t remainingInterrupts;
 };
 
+typedef SpiTester<Ssp0Traits> Spi0Tester;
+#if SPI_TESTER_SSP1
+typedef SpiTester<Ssp1Traits> Spi1Tester;
+#endif // SPI_TESTER_SSP1
+
 } // namespace Spi
 } // namespace LLdt
 
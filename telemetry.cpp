@@ -0,0 +1,196 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+#include <stdint.h>
+#include <algorithm>
+#include <lpc17xx.h>
+
+#include "util.h"
+#include "Lpc17xxHardware.h"
+#include "lldtester.h"
+#include "telemetry.h"
+
+#if TELEMETRY_ENABLED
+
+using namespace Lldt;
+
+namespace { // static
+
+enum : uint32_t {
+    //
+    // Records per ring. Must be a power of 2.
+    //
+    TELEMETRY_RING_SIZE = 64,
+};
+
+static_assert(
+    (TELEMETRY_RING_SIZE & (TELEMETRY_RING_SIZE - 1)) == 0,
+    "TELEMETRY_RING_SIZE must be a power of 2");
+
+//
+// head and tail count records written and sent since startup. Only the
+// writer of the ring advances head, and only the drain interrupt advances
+// tail.
+//
+struct TelemetryRing {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dropped;       // records dropped since the last dropped record
+    uint8_t sequence;
+};
+
+AHBSRAM1_SECTION TelemetryRecord
+    telemetryRecords[TELEMETRY_STREAM_COUNT][TELEMETRY_RING_SIZE];
+
+TelemetryRing telemetryRings[TELEMETRY_STREAM_COUNT];
+
+//
+// The ring being sent by the GPDMA, and the number of records in flight.
+// Owned by the drain interrupt.
+//
+uint32_t sendingStream;
+uint32_t sendingCount;
+
+void WriteRecord (
+    uint32_t Stream,
+    uint32_t Index,
+    TelemetryEvent Event,
+    uint32_t Arg0,
+    uint32_t Arg1
+    )
+{
+    TelemetryRing& ring = telemetryRings[Stream];
+    TelemetryRecord& record =
+        telemetryRecords[Stream][Index & (TELEMETRY_RING_SIZE - 1)];
+
+    record.Sync = TELEMETRY_SYNC;
+    record.Event = Event;
+    record.Stream = uint8_t(Stream);
+    record.Sequence = ring.sequence++;
+    record.Timestamp = ElapsedCycles();
+    record.Args[0] = Arg0;
+    record.Args[1] = Arg1;
+}
+
+//
+// Starts sending the oldest contiguous run of records, alternating between
+// the rings so that a busy ring cannot starve the other.
+//
+void TelemetryDrain ()
+{
+    for (uint32_t i = 0; i < TELEMETRY_STREAM_COUNT; ++i) {
+        const uint32_t stream = (sendingStream + 1 + i) % TELEMETRY_STREAM_COUNT;
+        TelemetryRing& ring = telemetryRings[stream];
+        const uint32_t tail = ring.tail;
+        const uint32_t pending = ring.head - tail;
+        if (pending == 0) {
+            continue;
+        }
+
+        const uint32_t index = tail & (TELEMETRY_RING_SIZE - 1);
+        sendingStream = stream;
+        sendingCount = std::min(pending, TELEMETRY_RING_SIZE - index);
+
+        // the UART requests a byte whenever there is space in its FIFO
+        GpdmaProgramChannel(
+            DMA_CHANNEL_TELEMETRY,
+            nullptr,
+            DmaAddress(&telemetryRecords[stream][index]),
+            DmaAddress(&LPC_UART0->THR),
+            sendingCount * sizeof(TelemetryRecord),
+            GPDMA_CTRL_SBSIZE(GPDMA_BSIZE_1) | GPDMA_CTRL_DBSIZE(GPDMA_BSIZE_1) |
+            GPDMA_CTRL_SWIDTH(GPDMA_WIDTH_BYTE) |
+            GPDMA_CTRL_DWIDTH(GPDMA_WIDTH_BYTE) | GPDMA_CTRL_SI | GPDMA_CTRL_I,
+            GPDMA_CFG_DEST_PERIPHERAL(GPDMA_CONN_UART0_TX) |
+            GPDMA_CFG_TRANSFER_TYPE(GPDMA_TRANSFER_TYPE_M2P) |
+            GPDMA_CFG_IE | GPDMA_CFG_ITC);
+        return;
+    }
+}
+
+} // namespace "static"
+
+//
+// The drain runs from the GPDMA interrupt, which is only enabled for the
+// telemetry channel. Writers pend it when the channel is idle.
+//
+extern "C" void DMA_IRQHandler ()
+{
+    const uint32_t mask = 1U << DMA_CHANNEL_TELEMETRY;
+    if ((LPC_GPDMA->DMACIntTCStat | LPC_GPDMA->DMACIntErrStat) & mask) {
+        LPC_GPDMA->DMACIntTCClear = mask;
+        LPC_GPDMA->DMACIntErrClr = mask;
+
+        // records that failed to send are dropped
+        telemetryRings[sendingStream].tail += sendingCount;
+        sendingCount = 0;
+    }
+
+    if (sendingCount == 0) {
+        TelemetryDrain();
+    }
+}
+
+void Lldt::TelemetryInit ()
+{
+    SetPeripheralPowerState(CLKPWR_PCONP_PCUART0, true);
+
+    // TXD0 on P0.2
+    LPC_PINCON->PINSEL0 = (LPC_PINCON->PINSEL0 & ~(0x3 << 4)) | (0x1 << 4);
+
+    const uint32_t divisor =
+        (GetPeripheralClockFrequency(CLKPWR_PCLKSEL_UART0) +
+         (8 * TELEMETRY_BAUD_RATE)) / (16 * TELEMETRY_BAUD_RATE);
+
+    LPC_UART0->LCR = UART_LCR_DLAB_EN | UART_LCR_WLEN8;
+    LPC_UART0->DLL = uint8_t(divisor);
+    LPC_UART0->DLM = uint8_t(divisor >> 8);
+    LPC_UART0->LCR = UART_LCR_WLEN8;
+    LPC_UART0->FCR =
+        UART_FCR_FIFO_EN | UART_FCR_RX_RS | UART_FCR_TX_RS |
+        UART_FCR_DMAMODE_SEL;
+
+    // UART0 TX shares its request line with MAT0.0
+    LPC_SC->DMAREQSEL &= ~DMAREQSEL_TIMER_MATCH(GPDMA_CONN_MAT0_0);
+
+    NVIC_SetPriority(DMA_IRQn, IRQ_PRIORITY_TELEMETRY);
+    NVIC_EnableIRQ(DMA_IRQn);
+
+    TelemetryLog(TELEMETRY_STARTED, SystemCoreClock);
+}
+
+void Lldt::TelemetryLog (TelemetryEvent Event, uint32_t Arg0, uint32_t Arg1)
+{
+    // the interrupts that record events all run at IRQ_PRIORITY_I2C (see
+    // IRQ_PRIORITY), so they do not preempt each other
+    const uint32_t stream = (__get_IPSR() != 0) ?
+        TELEMETRY_STREAM_INTERRUPT : TELEMETRY_STREAM_THREAD;
+    TelemetryRing& ring = telemetryRings[stream];
+
+    uint32_t head = ring.head;
+    const uint32_t space = TELEMETRY_RING_SIZE - (head - ring.tail);
+    const uint32_t needed = (ring.dropped != 0) ? 2 : 1;
+    if (space < needed) {
+        ++ring.dropped;
+        return;
+    }
+
+    if (ring.dropped != 0) {
+        WriteRecord(stream, head, TELEMETRY_RECORDS_DROPPED, ring.dropped, 0);
+        ring.dropped = 0;
+        ++head;
+    }
+
+    WriteRecord(stream, head, Event, Arg0, Arg1);
+    ++head;
+
+    // publish the records once they are complete
+    __DMB();
+    ring.head = head;
+
+    if (!(LPC_GPDMA->DMACEnbldChns & (1 << DMA_CHANNEL_TELEMETRY))) {
+        NVIC_SetPendingIRQ(DMA_IRQn);
+    }
+}
+
+#endif // TELEMETRY_ENABLED
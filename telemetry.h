@@ -0,0 +1,47 @@
+//
+// Copyright (C) Microsoft. All rights reserved.
+//
+// Binary event log. Records are written to a ring buffer in AHB SRAM and
+// sent to UART0 by the GPDMA in the background, so recording an event costs
+// a few dozen cycles and never waits for the UART. Each context has its own
+// ring, so there is a single writer per ring and no locking is needed.
+//
+// The log shares UART0 with printf, so it is compiled out in _DEBUG builds
+// and when TELEMETRY is 0.
+//
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#if TELEMETRY && !defined(_DEBUG)
+#define TELEMETRY_ENABLED 1
+#else
+#define TELEMETRY_ENABLED 0
+#endif
+
+namespace Lldt {
+
+#if TELEMETRY_ENABLED
+
+//
+// Configures UART0 and the drain interrupt, and records TELEMETRY_STARTED.
+// Must be called after GpdmaInit.
+//
+void TelemetryInit ();
+
+//
+// Records an event. May be called from the main loop and from interrupts
+// at IRQ_PRIORITY_I2C. If the ring is full the event is dropped, and a
+// TELEMETRY_RECORDS_DROPPED record is written once there is space.
+//
+void TelemetryLog (TelemetryEvent Event, uint32_t Arg0 = 0, uint32_t Arg1 = 0);
+
+#else // TELEMETRY_ENABLED
+
+inline void TelemetryInit () { }
+inline void TelemetryLog (TelemetryEvent, uint32_t = 0, uint32_t = 0) { }
+
+#endif // TELEMETRY_ENABLED
+
+} // namespace Lldt
+
+#endif // _TELEMETRY_H_
@@ -23,20 +23,33 @@ public:
     uint32_t Update ( uint8_t data )
     {
         return (this->crc = ((this->crc << 8) ^
-            crc16table[((this->crc >> 8) ^ data) & 0xff]) & 0xffff);
+            crc16slice[0][((this->crc >> 8) ^ data) & 0xff]) & 0xffff);
+    }
+
+    //
+    // Update the checksum with the low byte of Data followed by the high byte
+    //
+    static uint32_t Update16 ( uint32_t Crc, uint32_t Data )
+    {
+        return crc16slice[1][((Crc >> 8) ^ Data) & 0xff] ^
+               crc16slice[0][(Crc ^ (Data >> 8)) & 0xff];
     }
 
     uint32_t Update (const uint8_t* Data, unsigned int Length)
     {
-        unsigned int tempCrc = this->crc;
-        for (const uint8_t *data = Data; data != (Data + Length); ++data)
-            tempCrc = (tempCrc << 8) ^ crc16table[((tempCrc >> 8) ^ *data) & 0xff];
-        return (this->crc = (tempCrc & 0xffff));
+        uint32_t tempCrc = this->crc;
+        const uint8_t* data = Data;
+        for (const uint8_t* end = Data + (Length & ~1U); data != end; data += 2)
+            tempCrc = Update16(tempCrc, data[0] | (data[1] << 8));
+        if (Length & 1)
+            tempCrc = ((tempCrc << 8) ^
+                crc16slice[0][((tempCrc >> 8) ^ *data) & 0xff]) & 0xffff;
+        return (this->crc = tempCrc);
     }
 
     void Reset ( ) { this->crc = 0; }
 
-    static const uint16_t crc16table[];
+    static uint16_t crc16slice[2][256];
 
 private:
 
@@ -45,14 +58,89 @@ private:
 
 inline uint32_t crc16_update (uint32_t crc, uint8_t data)
 {
-    return ((crc << 8) ^ Crc16::crc16table[((crc >> 8) ^ data) & 0xff]) & 0xffff;
+    return ((crc << 8) ^ Crc16::crc16slice[0][((crc >> 8) ^ data) & 0xff]) & 0xffff;
 }
 
+//
+// Update crc with the low byte then the high byte of data in one step
+//
+inline uint32_t crc16_update16 (uint32_t crc, uint32_t data)
+{
+    return Crc16::Update16(crc, data);
+}
+
+//
+// Place a variable in one of the 16KB AHB SRAM banks. Unlike the CPU's local
+// SRAM, the AHB SRAM banks are accessible to the GPDMA. The simulated GPDMA
+// of the host build can access any memory.
+//
+#if LLDT_HOST
+#define AHBSRAM0_SECTION alignas(4)
+#define AHBSRAM1_SECTION alignas(4)
+#else // LLDT_HOST
+#define AHBSRAM0_SECTION __attribute__((section("AHBSRAM0"), aligned(4)))
+#define AHBSRAM1_SECTION __attribute__((section("AHBSRAM1"), aligned(4)))
+#endif // LLDT_HOST
+
+//
+// GPDMA channel assignments. Lower numbered channels have higher priority.
+//
+enum DMA_CHANNEL : uint32_t {
+    DMA_CHANNEL_SPI_RX = 0,
+    DMA_CHANNEL_SPI_TX = 1,
+    DMA_CHANNEL_SPI_INTERRUPT_STOP = 2,
+    DMA_CHANNEL_SPI1_RX = 3,
+    DMA_CHANNEL_SPI1_TX = 4,
+    DMA_CHANNEL_TELEMETRY = 5,
+    DMA_CHANNEL_SPI_EDGE_TRACE_LEADING = 6,
+    DMA_CHANNEL_SPI_EDGE_TRACE_TRAILING = 7,
+};
+
+//
+// Interrupt priorities (lower values are higher priority):
+//
+// IRQ_PRIORITY_I2C         I2C1, which runs the I2C slave, and the default
+//                          timer, which runs the SCL hold and timebase
+//                          alarms. These are the only interrupts that
+//                          record telemetry.
+// IRQ_PRIORITY_SCHEDULER   SSP0 and SSP1, which post the SPI testers' work
+//                          items.
+// IRQ_PRIORITY_TELEMETRY   GPDMA, which drains the telemetry log.
+//
+// The SPI testers run their real-time loops in a SpiCriticalSection, which
+// masks IRQ_PRIORITY_SCHEDULER and below, so the I2C slave is always
+// serviced. The masked interrupts only do a few cycles of work, and stall
+// until the loop ends.
+//
+enum IRQ_PRIORITY : uint32_t {
+    IRQ_PRIORITY_I2C = 0,
+    IRQ_PRIORITY_SCHEDULER = 1,
+    IRQ_PRIORITY_TELEMETRY = 2,
+};
+
 struct DisableIrq {
     DisableIrq () { __disable_irq(); }
     ~DisableIrq () { __enable_irq(); }
 };
 
+//
+// Masks interrupts of the given priority and below for the lifetime of the
+// object. Interrupts of higher priority continue to be serviced.
+//
+template <uint32_t Priority>
+struct MaskIrq {
+    MaskIrq () : basepri(__get_BASEPRI())
+    {
+        __set_BASEPRI(Priority << (8 - __NVIC_PRIO_BITS));
+    }
+
+    ~MaskIrq () { __set_BASEPRI(this->basepri); }
+
+    uint32_t basepri;
+};
+
+typedef MaskIrq<IRQ_PRIORITY_SCHEDULER> SpiCriticalSection;
+
 template <typename Fn>
 struct _Finally : public Fn {
     _Finally (Fn&& Func) : Fn(Func) {}
@@ -81,6 +169,13 @@ inline void ActLedOff ()
     LPC_GPIO1->FIOCLR = 1 << 18;
 }
 
+//
+// Blink the activity LED at 1Hz using PWM1.1, which shares P1.18 with the
+// LED, so that blinking takes no CPU time.
+//
+void ActLedBlinkStart ();
+void ActLedBlinkStop ();
+
 // P1.20
 inline void ErrLedInit ()
 {